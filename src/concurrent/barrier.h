@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+
+#include "sys_futex.h"
+
+/*
+ * @brief reusable phase barrier built on futex
+ * @details parties threads call ArriveAndWait(), the last one to arrive starts
+ * the next phase and wakes the others. Waiters spin briefly on the generation
+ * before sleeping, and the last arriver only wakes when somebody sleeps.
+ */
+class Barrier {
+public:
+    explicit Barrier(int parties) : m_parties(parties), m_remaining(parties) {
+        assert(parties > 0);
+    }
+
+    Barrier(const Barrier &) = delete;
+
+    Barrier &operator=(const Barrier &) = delete;
+
+    /// @return true for exactly one thread of each phase, the last to arrive
+    bool ArriveAndWait() {
+        static constexpr int kSpins = 256;
+        const int generation = m_generation.load(std::memory_order_acquire);
+        if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_remaining.store(m_parties, std::memory_order_relaxed);
+            m_generation.fetch_add(1, std::memory_order_seq_cst);
+            if (m_sleepers.load(std::memory_order_seq_cst) > 0) {
+                futex_wake_private(&m_generation, INT_MAX);
+            }
+            return true;
+        }
+        for (int i = 0; i < kSpins; ++i) {
+            if (m_generation.load(std::memory_order_acquire) != generation) {
+                return false;
+            }
+            __builtin_ia32_pause();
+        }
+        while (m_generation.load(std::memory_order_acquire) == generation) {
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            if (m_generation.load(std::memory_order_seq_cst) == generation) {
+                futex_wait_private(&m_generation, generation, nullptr);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return false;
+    }
+
+    int Parties() const { return m_parties; }
+
+private:
+    const int m_parties;
+    std::atomic<int> m_remaining;
+    std::atomic<int> m_generation{0};
+    std::atomic<int> m_sleepers{0};
+};
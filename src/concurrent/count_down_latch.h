@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+
+#include "sys_futex.h"
+
+/*
+ * @brief one-shot latch released when the count reaches zero
+ * @details waiters sleep on the count itself. CountDown() only issues a wake
+ * when the count hits zero and somebody is sleeping.
+ */
+class CountDownLatch {
+public:
+    explicit CountDownLatch(int count) : m_count(count) {
+        assert(count >= 0);
+    }
+
+    CountDownLatch(const CountDownLatch &) = delete;
+
+    CountDownLatch &operator=(const CountDownLatch &) = delete;
+
+    void CountDown(int n = 1) {
+        const int prev = m_count.fetch_sub(n, std::memory_order_acq_rel);
+        assert(prev >= n);
+        if (prev == n && m_sleepers.load(std::memory_order_seq_cst) > 0) {
+            futex_wake_private(&m_count, INT_MAX);
+        }
+    }
+
+    int GetCount() const {
+        return m_count.load(std::memory_order_acquire);
+    }
+
+    void Wait() {
+        WaitUntil(nullptr);
+    }
+
+    /// @return false if the count is still positive after timeout_ms
+    bool TimedWait(int64_t timeout_ms) {
+        if (GetCount() == 0) {
+            return true;
+        }
+        const timespec deadline = futex_deadline_after_ms(timeout_ms);
+        return WaitUntil(&deadline);
+    }
+
+private:
+    bool WaitUntil(const timespec *deadline) {
+        int count;
+        while ((count = m_count.load(std::memory_order_acquire)) > 0) {
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            bool in_time = true;
+            count = m_count.load(std::memory_order_seq_cst);
+            if (count > 0) {
+                in_time = futex_wait_private_until(&m_count, count, deadline);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (!in_time) {
+                return GetCount() == 0;
+            }
+        }
+        return true;
+    }
+
+    std::atomic<int> m_count;
+    std::atomic<int> m_sleepers{0};
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+
+#include "sys_futex.h"
+
+/*
+ * @brief manual reset event built on futex
+ * @details Set() wakes every waiter and the event stays signaled until Reset().
+ * Set() only enters the kernel when somebody is actually sleeping, and Wait()
+ * on a signaled event is a single load.
+ */
+class Event {
+public:
+    explicit Event(bool signaled = false) : m_state(signaled ? kSet : kUnset) {}
+
+    Event(const Event &) = delete;
+
+    Event &operator=(const Event &) = delete;
+
+    void Set() {
+        if (m_state.exchange(kSet, std::memory_order_acq_rel) == kUnsetWithWaiters) {
+            futex_wake_private(&m_state, INT_MAX);
+        }
+    }
+
+    void Reset() {
+        int expected = kSet;
+        m_state.compare_exchange_strong(expected, kUnset, std::memory_order_relaxed);
+    }
+
+    bool IsSet() const {
+        return m_state.load(std::memory_order_acquire) == kSet;
+    }
+
+    void Wait() {
+        WaitUntil(nullptr);
+    }
+
+    /// @return false if the event is still not set after timeout_ms
+    bool TimedWait(int64_t timeout_ms) {
+        if (IsSet()) {
+            return true;
+        }
+        const timespec deadline = futex_deadline_after_ms(timeout_ms);
+        return WaitUntil(&deadline);
+    }
+
+private:
+    bool WaitUntil(const timespec *deadline) {
+        int state = m_state.load(std::memory_order_acquire);
+        while (state != kSet) {
+            if (state == kUnset &&
+                !m_state.compare_exchange_weak(state, kUnsetWithWaiters, std::memory_order_acquire)) {
+                continue;
+            }
+            if (!futex_wait_private_until(&m_state, kUnsetWithWaiters, deadline)) {
+                return IsSet();
+            }
+            state = m_state.load(std::memory_order_acquire);
+        }
+        return true;
+    }
+
+    static constexpr int kUnset = 0;
+    static constexpr int kSet = 1;
+    static constexpr int kUnsetWithWaiters = 2;
+
+    std::atomic<int> m_state;
+};
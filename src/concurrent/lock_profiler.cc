@@ -0,0 +1,168 @@
+#include <algorithm>
+#include <sstream>
+
+#include "lock_profiler.h"
+
+static void UpdateMax(std::atomic<uint64_t> &max, uint64_t value) {
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+static size_t WaitBucket(uint64_t wait_ns) {
+    const size_t log2 = wait_ns == 0 ? 0 : 63 - __builtin_clzll(wait_ns);
+    return std::min(log2, LockProfile::kWaitBuckets - 1);
+}
+
+bool LockProfile::ShouldSample() {
+    const uint32_t interval = LockProfiler::Instance().SampleInterval();
+    if (interval == 0) {
+        return false;
+    }
+    return m_sample_tick.fetch_add(1, std::memory_order_relaxed) % interval == 0;
+}
+
+void LockProfile::RecordContention(bool shared, uint64_t wait_ns, const StackTrace *site) {
+    (shared ? m_shared_contentions : m_contentions).fetch_add(1, std::memory_order_relaxed);
+    m_total_wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    UpdateMax(m_max_wait_ns, wait_ns);
+    m_wait_histogram[WaitBucket(wait_ns)].fetch_add(1, std::memory_order_relaxed);
+    if (site != nullptr) {
+        RecordCallSite(*site);
+    }
+}
+
+void LockProfile::RecordHold(uint64_t hold_ns) {
+    m_total_hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+    UpdateMax(m_max_hold_ns, hold_ns);
+}
+
+void LockProfile::RecordCallSite(const StackTrace &site) {
+    size_t count = 0;
+    const void *const *frames = site.Addresses(&count);
+    // FNV-1a over the return addresses
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; ++i) {
+        hash ^= reinterpret_cast<uintptr_t>(frames[i]);
+        hash *= 1099511628211ULL;
+    }
+    std::lock_guard guard(m_sites_mutex);
+    auto it = m_sites.find(hash);
+    if (it == m_sites.end()) {
+        it = m_sites.emplace(hash, CallSite{site, 0}).first;
+    }
+    ++it->second.count;
+}
+
+void LockProfile::Reset() {
+    m_acquisitions.store(0, std::memory_order_relaxed);
+    m_shared_acquisitions.store(0, std::memory_order_relaxed);
+    m_contentions.store(0, std::memory_order_relaxed);
+    m_shared_contentions.store(0, std::memory_order_relaxed);
+    m_total_wait_ns.store(0, std::memory_order_relaxed);
+    m_max_wait_ns.store(0, std::memory_order_relaxed);
+    m_total_hold_ns.store(0, std::memory_order_relaxed);
+    m_max_hold_ns.store(0, std::memory_order_relaxed);
+    for (auto &bucket: m_wait_histogram) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    std::lock_guard guard(m_sites_mutex);
+    m_sites.clear();
+}
+
+LockProfiler &LockProfiler::Instance() {
+    static LockProfiler profiler;
+    return profiler;
+}
+
+LockProfile *LockProfiler::GetProfile(const std::string &name) {
+    std::lock_guard guard(m_mutex);
+    auto &profile = m_profiles[name];
+    if (!profile) {
+        profile = std::make_unique<LockProfile>(name);
+    }
+    return profile.get();
+}
+
+std::vector<LockProfileSnapshot> LockProfiler::Snapshot() const {
+    std::vector<LockProfileSnapshot> snapshots;
+    std::lock_guard guard(m_mutex);
+    snapshots.reserve(m_profiles.size());
+    for (auto &[name, profile]: m_profiles) {
+        LockProfileSnapshot snapshot;
+        snapshot.name = name;
+        snapshot.acquisitions = profile->m_acquisitions.load(std::memory_order_relaxed);
+        snapshot.shared_acquisitions = profile->m_shared_acquisitions.load(std::memory_order_relaxed);
+        snapshot.contentions = profile->m_contentions.load(std::memory_order_relaxed);
+        snapshot.shared_contentions = profile->m_shared_contentions.load(std::memory_order_relaxed);
+        snapshot.total_wait_ns = profile->m_total_wait_ns.load(std::memory_order_relaxed);
+        snapshot.max_wait_ns = profile->m_max_wait_ns.load(std::memory_order_relaxed);
+        snapshot.total_hold_ns = profile->m_total_hold_ns.load(std::memory_order_relaxed);
+        snapshot.max_hold_ns = profile->m_max_hold_ns.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < LockProfile::kWaitBuckets; ++i) {
+            snapshot.wait_histogram[i] = profile->m_wait_histogram[i].load(std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard sites_guard(profile->m_sites_mutex);
+            for (auto &[hash, site]: profile->m_sites) {
+                snapshot.sites.push_back(site);
+            }
+        }
+        std::sort(snapshot.sites.begin(), snapshot.sites.end(),
+                  [](const auto &lhs, const auto &rhs) { return lhs.count > rhs.count; });
+        snapshots.push_back(std::move(snapshot));
+    }
+    std::sort(snapshots.begin(), snapshots.end(), [](const auto &lhs, const auto &rhs) {
+        return lhs.total_wait_ns > rhs.total_wait_ns;
+    });
+    return snapshots;
+}
+
+std::string LockProfiler::Dump(size_t max_locks, size_t max_sites) const {
+    auto snapshots = Snapshot();
+    if (max_locks != 0 && snapshots.size() > max_locks) {
+        snapshots.resize(max_locks);
+    }
+    std::stringstream ss;
+    for (auto &snapshot: snapshots) {
+        ss << snapshot.name
+           << ": acquisitions=" << snapshot.acquisitions
+           << " shared_acquisitions=" << snapshot.shared_acquisitions
+           << " contentions=" << snapshot.contentions
+           << " shared_contentions=" << snapshot.shared_contentions
+           << " total_wait_us=" << snapshot.total_wait_ns / 1000
+           << " max_wait_us=" << snapshot.max_wait_ns / 1000
+           << " total_hold_us=" << snapshot.total_hold_ns / 1000
+           << " max_hold_us=" << snapshot.max_hold_ns / 1000 << "\n";
+        if (snapshot.contentions + snapshot.shared_contentions != 0) {
+            ss << "  wait histogram:";
+            for (size_t i = 0; i < LockProfile::kWaitBuckets; ++i) {
+                if (snapshot.wait_histogram[i] == 0) {
+                    continue;
+                }
+                if (i + 1 == LockProfile::kWaitBuckets) {
+                    ss << " >=" << (uint64_t{1} << i) << "ns:" << snapshot.wait_histogram[i];
+                } else {
+                    ss << " <" << (uint64_t{2} << i) << "ns:" << snapshot.wait_histogram[i];
+                }
+            }
+            ss << "\n";
+        }
+        for (size_t i = 0; i < snapshot.sites.size() && i < max_sites; ++i) {
+            ss << "  call site sampled " << snapshot.sites[i].count << " times:\n";
+            std::stringstream trace(snapshot.sites[i].trace.ToString());
+            std::string frame;
+            while (std::getline(trace, frame)) {
+                ss << "    " << frame << "\n";
+            }
+        }
+    }
+    return ss.str();
+}
+
+void LockProfiler::Reset() {
+    std::lock_guard guard(m_mutex);
+    for (auto &[name, profile]: m_profiles) {
+        profile->Reset();
+    }
+}
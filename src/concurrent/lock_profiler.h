@@ -0,0 +1,291 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "lock.h"
+#include "utils/stack_trace.h"
+
+/**
+ * @file lock_profiler.h
+ * @brief opt-in contention profiling for Lock and SharedLock implementations
+ * @details wrap a lock in ProfiledLock with a name, then LockProfiler::Instance().Dump()
+ * lists the named locks ordered by total wait time:
+ *
+ *     ProfiledLock<MutexBase> m_lock{"session_table"};
+ */
+
+/*
+ * @brief wait/hold statistics of one named lock, shared by all locks of that name
+ */
+class LockProfile {
+public:
+    /// bucket i counts waits in [2^i, 2^(i+1)) ns, the last bucket everything longer
+    static constexpr size_t kWaitBuckets = 32;
+
+    struct CallSite {
+        StackTrace trace;
+        uint64_t count{0};
+    };
+
+    explicit LockProfile(std::string name) : m_name(std::move(name)) {}
+
+    const std::string &Name() const { return m_name; }
+
+    void RecordAcquire(bool shared) {
+        (shared ? m_shared_acquisitions : m_acquisitions).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /// True for every n-th contended acquisition, see LockProfiler::SetSampleInterval().
+    bool ShouldSample();
+
+    /// @param site call site captured before blocking, nullptr when not sampled
+    void RecordContention(bool shared, uint64_t wait_ns, const StackTrace *site);
+
+    void RecordHold(uint64_t hold_ns);
+
+    void Reset();
+
+private:
+    friend class LockProfiler;
+
+    void RecordCallSite(const StackTrace &site);
+
+    const std::string m_name;
+    std::atomic<uint64_t> m_acquisitions{0};
+    std::atomic<uint64_t> m_shared_acquisitions{0};
+    std::atomic<uint64_t> m_contentions{0};
+    std::atomic<uint64_t> m_shared_contentions{0};
+    std::atomic<uint64_t> m_total_wait_ns{0};
+    std::atomic<uint64_t> m_max_wait_ns{0};
+    std::atomic<uint64_t> m_total_hold_ns{0};
+    std::atomic<uint64_t> m_max_hold_ns{0};
+    std::atomic<uint64_t> m_wait_histogram[kWaitBuckets]{};
+    std::atomic<uint32_t> m_sample_tick{0};
+
+    /// sampled call sites of contended acquisitions, keyed by hash of the trace
+    std::mutex m_sites_mutex;
+    std::map<uint64_t, CallSite> m_sites;
+};
+
+/*
+ * @brief a point-in-time copy of a LockProfile
+ */
+struct LockProfileSnapshot {
+    std::string name;
+    uint64_t acquisitions{0};
+    uint64_t shared_acquisitions{0};
+    uint64_t contentions{0};
+    uint64_t shared_contentions{0};
+    uint64_t total_wait_ns{0};
+    uint64_t max_wait_ns{0};
+    uint64_t total_hold_ns{0};
+    uint64_t max_hold_ns{0};
+    uint64_t wait_histogram[LockProfile::kWaitBuckets]{};
+    /// sampled call sites, most frequent first
+    std::vector<LockProfile::CallSite> sites;
+};
+
+/*
+ * @brief registry of all named lock profiles
+ */
+class LockProfiler {
+public:
+    static LockProfiler &Instance();
+
+    LockProfiler(const LockProfiler &) = delete;
+
+    LockProfiler &operator=(const LockProfiler &) = delete;
+
+    /// Returned profiles live as long as the process.
+    LockProfile *GetProfile(const std::string &name);
+
+    /// Recording can be switched off at runtime, wrapped locks then only pay a relaxed load.
+    void SetEnabled(bool enabled) { m_enabled.store(enabled, std::memory_order_relaxed); }
+
+    bool Enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    /// Capture the call site of every n-th contended acquisition of a lock, 0 disables sampling.
+    void SetSampleInterval(uint32_t n) { m_sample_interval.store(n, std::memory_order_relaxed); }
+
+    uint32_t SampleInterval() const { return m_sample_interval.load(std::memory_order_relaxed); }
+
+    /// Snapshots of all profiles, sorted by total wait time, the hottest first.
+    std::vector<LockProfileSnapshot> Snapshot() const;
+
+    /// Human readable report of at most max_locks locks (0 means all).
+    std::string Dump(size_t max_locks = 0, size_t max_sites = 3) const;
+
+    void Reset();
+
+private:
+    LockProfiler() = default;
+
+    std::atomic<bool> m_enabled{true};
+    std::atomic<uint32_t> m_sample_interval{16};
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::unique_ptr<LockProfile>> m_profiles;
+};
+
+namespace lock_profiler_internal {
+
+inline uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// Exclusive and shared acquisition shared by both ProfiledLock specializations.
+template<typename LockType>
+class ProfiledLockCore {
+public:
+    template<typename ... Args>
+    explicit ProfiledLockCore(const std::string &name, Args &&... args)
+            : m_lock(std::forward<Args>(args)...), m_profile(LockProfiler::Instance().GetProfile(name)) {}
+
+    void lock() noexcept {
+        if (!LockProfiler::Instance().Enabled()) {
+            m_lock.lock();
+            m_hold_start_ns = 0;
+            return;
+        }
+        if (!m_lock.try_lock()) {
+            std::optional<StackTrace> site;
+            if (m_profile->ShouldSample()) {
+                site.emplace();
+            }
+            const uint64_t start = NowNs();
+            m_lock.lock();
+            m_profile->RecordContention(false, NowNs() - start, site ? &*site : nullptr);
+        }
+        m_profile->RecordAcquire(false);
+        m_hold_start_ns = NowNs();
+    }
+
+    bool try_lock() noexcept {
+        if (!m_lock.try_lock()) {
+            return false;
+        }
+        const bool enabled = LockProfiler::Instance().Enabled();
+        if (enabled) {
+            m_profile->RecordAcquire(false);
+        }
+        m_hold_start_ns = enabled ? NowNs() : 0;
+        return true;
+    }
+
+    void unlock() noexcept {
+        if (m_hold_start_ns != 0) {
+            m_profile->RecordHold(NowNs() - m_hold_start_ns);
+        }
+        m_lock.unlock();
+    }
+
+    void lock_shared() noexcept {
+        if (!LockProfiler::Instance().Enabled()) {
+            m_lock.lock_shared();
+            return;
+        }
+        if (!m_lock.try_lock_shared()) {
+            std::optional<StackTrace> site;
+            if (m_profile->ShouldSample()) {
+                site.emplace();
+            }
+            const uint64_t start = NowNs();
+            m_lock.lock_shared();
+            m_profile->RecordContention(true, NowNs() - start, site ? &*site : nullptr);
+        }
+        m_profile->RecordAcquire(true);
+    }
+
+    bool try_lock_shared() noexcept {
+        if (!m_lock.try_lock_shared()) {
+            return false;
+        }
+        if (LockProfiler::Instance().Enabled()) {
+            m_profile->RecordAcquire(true);
+        }
+        return true;
+    }
+
+    void unlock_shared() noexcept {
+        m_lock.unlock_shared();
+    }
+
+    LockType &Underlying() { return m_lock; }
+
+    LockProfile *Profile() const { return m_profile; }
+
+private:
+    LockType m_lock;
+    LockProfile *m_profile;
+    /// written by the exclusive holder only, 0 when the acquisition was not timed
+    uint64_t m_hold_start_ns{0};
+};
+
+}  // namespace lock_profiler_internal
+
+/*
+ * @brief instrumented wrapper of any Lock / SharedLock
+ * @details records wait time, hold time (exclusive mode only), contention counts
+ * and sampled call sites of contended acquisitions into the profile of its name.
+ */
+template<typename LockType,
+        typename Base = std::conditional_t<std::is_base_of_v<SharedLock, LockType>, SharedLock, Lock>>
+class ProfiledLock;
+
+template<typename LockType>
+class ProfiledLock<LockType, Lock> : public Lock {
+    static_assert(std::is_base_of_v<Lock, LockType>, "LockType must implement Lock");
+public:
+    template<typename ... Args>
+    explicit ProfiledLock(const std::string &name, Args &&... args)
+            : m_core(name, std::forward<Args>(args)...) {}
+
+    void lock() noexcept override { m_core.lock(); }
+
+    void unlock() noexcept override { m_core.unlock(); }
+
+    bool try_lock() noexcept override { return m_core.try_lock(); }
+
+    LockType &Underlying() { return m_core.Underlying(); }
+
+    LockProfile *Profile() const { return m_core.Profile(); }
+
+private:
+    lock_profiler_internal::ProfiledLockCore<LockType> m_core;
+};
+
+template<typename LockType>
+class ProfiledLock<LockType, SharedLock> : public SharedLock {
+public:
+    template<typename ... Args>
+    explicit ProfiledLock(const std::string &name, Args &&... args)
+            : m_core(name, std::forward<Args>(args)...) {}
+
+    void lock() noexcept override { m_core.lock(); }
+
+    void unlock() noexcept override { m_core.unlock(); }
+
+    bool try_lock() noexcept override { return m_core.try_lock(); }
+
+    void lock_shared() noexcept override { m_core.lock_shared(); }
+
+    void unlock_shared() noexcept override { m_core.unlock_shared(); }
+
+    bool try_lock_shared() noexcept override { return m_core.try_lock_shared(); }
+
+    LockType &Underlying() { return m_core.Underlying(); }
+
+    LockProfile *Profile() const { return m_core.Profile(); }
+
+private:
+    lock_profiler_internal::ProfiledLockCore<LockType> m_core;
+};
@@ -1,7 +1,12 @@
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <mutex>
 #include <pthread.h>
 #include "mutex.h"
 #include "atomicops.h"
+#include "macro.h"
+#include "spinlock.h"
 #include "sys_futex.h"
 
 // Implement bthread_mutex_t related functions
@@ -51,4 +56,142 @@ void FastPthreadMutex::unlock() noexcept {
     if (prev != BTHREAD_MUTEX_LOCKED) {
         futex_wake_private(whole, 1);
     }
-}
\ No newline at end of file
+}
+
+// Per-thread run state published for AdaptiveMutex spinners. Owners are never
+// freed, only recycled when their thread exits, so a spinner holding a stale
+// pointer reads a valid (if unrelated) flag and merely makes a worse guess.
+struct AdaptiveMutex::Owner {
+    std::atomic<bool> parked{false};
+    Owner *next_free{nullptr};
+};
+
+static SimpleSpinLock s_owner_lock;
+static AdaptiveMutex::Owner *s_free_owners = nullptr;
+static thread_local AdaptiveMutex::Owner *t_owner = nullptr;
+
+namespace {
+struct OwnerReclaimer {
+    ~OwnerReclaimer() {
+        if (t_owner == nullptr) {
+            return;
+        }
+        std::lock_guard guard(s_owner_lock);
+        t_owner->next_free = s_free_owners;
+        s_free_owners = t_owner;
+        t_owner = nullptr;
+    }
+};
+}  // namespace
+
+static AdaptiveMutex::Owner *CurrentOwner() {
+    if (LIKELY(t_owner != nullptr)) {
+        return t_owner;
+    }
+    static thread_local OwnerReclaimer reclaimer;
+    (void) reclaimer;
+    {
+        std::lock_guard guard(s_owner_lock);
+        if (s_free_owners != nullptr) {
+            t_owner = s_free_owners;
+            s_free_owners = s_free_owners->next_free;
+        }
+    }
+    if (t_owner == nullptr) {
+        t_owner = new AdaptiveMutex::Owner;
+    }
+    t_owner->parked.store(false, std::memory_order_relaxed);
+    return t_owner;
+}
+
+static uint64_t MonotonicNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void AdaptiveMutex::lock() noexcept {
+    unsigned expected = 0;
+    if (LIKELY(m_futex.compare_exchange_strong(expected, 1, std::memory_order_acquire))) {
+        m_owner.store(CurrentOwner(), std::memory_order_relaxed);
+        return;
+    }
+    lock_contended();
+}
+
+void AdaptiveMutex::lock_contended() noexcept {
+    static constexpr uint32_t kMaxBackoff = 64;
+    Owner *self = CurrentOwner();
+    if (m_enable_stats) {
+        m_contended_acquires.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t spins = 0;
+    uint32_t backoff = 1;
+    while (spins < m_max_spins) {
+        unsigned state = m_futex.load(std::memory_order_relaxed);
+        if (state == 0 && m_futex.compare_exchange_weak(state, 1, std::memory_order_acquire)) {
+            m_owner.store(self, std::memory_order_relaxed);
+            if (m_enable_stats) {
+                m_spin_acquires.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        // A null owner means the holder has not published itself yet, it is running.
+        Owner *owner = m_owner.load(std::memory_order_relaxed);
+        if (owner != nullptr && owner->parked.load(std::memory_order_relaxed)) {
+            break;
+        }
+        for (uint32_t i = 0; i < backoff; ++i) {
+            cpu_relax();
+        }
+        spins += backoff;
+        backoff = std::min(backoff << 1, kMaxBackoff);
+    }
+
+    self->parked.store(true, std::memory_order_relaxed);
+    const uint64_t start_ns = m_enable_stats ? MonotonicNowNs() : 0;
+    // Taking the lock as 2 may cost one spurious wake, but never loses a sleeper.
+    while (m_futex.exchange(2, std::memory_order_acquire) != 0) {
+        if (m_enable_stats) {
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+        }
+        futex_wait_private(&m_futex, 2, nullptr);
+    }
+    if (m_enable_stats) {
+        m_park_time_ns.fetch_add(MonotonicNowNs() - start_ns, std::memory_order_relaxed);
+    }
+    self->parked.store(false, std::memory_order_relaxed);
+    m_owner.store(self, std::memory_order_relaxed);
+}
+
+bool AdaptiveMutex::try_lock() noexcept {
+    unsigned expected = 0;
+    if (m_futex.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+        m_owner.store(CurrentOwner(), std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void AdaptiveMutex::unlock() noexcept {
+    m_owner.store(nullptr, std::memory_order_relaxed);
+    if (m_futex.exchange(0, std::memory_order_release) == 2) {
+        futex_wake_private(&m_futex, 1);
+    }
+}
+
+AdaptiveMutexStats AdaptiveMutex::GetStats() const {
+    AdaptiveMutexStats stats;
+    stats.contended_acquires = m_contended_acquires.load(std::memory_order_relaxed);
+    stats.spin_acquires = m_spin_acquires.load(std::memory_order_relaxed);
+    stats.parks = m_parks.load(std::memory_order_relaxed);
+    stats.park_time_ns = m_park_time_ns.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void AdaptiveMutex::ResetStats() {
+    m_contended_acquires.store(0, std::memory_order_relaxed);
+    m_spin_acquires.store(0, std::memory_order_relaxed);
+    m_parks.store(0, std::memory_order_relaxed);
+    m_park_time_ns.store(0, std::memory_order_relaxed);
+}
@@ -1,5 +1,9 @@
+#pragma once
+
+#include <atomic>
 #include <cassert>
 #include <cerrno>
+#include <cstdint>
 #include <pthread.h>
 #include <cstring>
 #include <stdexcept>
@@ -75,4 +79,64 @@ public:
     void unlock() noexcept override;
 
     bool try_lock() noexcept override;
-};
\ No newline at end of file
+};
+
+/*
+ * @brief contention statistics of AdaptiveMutex
+ */
+struct AdaptiveMutexStats {
+    /// lock() calls which found the mutex held
+    uint64_t contended_acquires{0};
+    /// contended lock() calls which got the mutex while spinning
+    uint64_t spin_acquires{0};
+    /// times the caller went to sleep on the futex
+    uint64_t parks{0};
+    /// total time spent sleeping on the futex
+    uint64_t park_time_ns{0};
+};
+
+/*
+ * @brief spin-then-park futex mutex
+ * @details A contended lock() spins with exponential pause while the owner is
+ * still running, and only parks on the futex when the spin budget is used up
+ * or the owner itself is asleep in an AdaptiveMutex. "Running" is all userspace
+ * can observe cheaply: an owner preempted by the kernel still looks running.
+ */
+class AdaptiveMutex : public Lock {
+public:
+    /// spin budget counted in pause instructions
+    static constexpr uint32_t kDefaultMaxSpins = 2048;
+
+    explicit AdaptiveMutex(bool enable_stats = false, uint32_t max_spins = kDefaultMaxSpins)
+            : m_futex(0), m_owner(nullptr), m_max_spins(max_spins), m_enable_stats(enable_stats) {}
+
+    ~AdaptiveMutex() override = default;
+
+    void lock() noexcept override;
+
+    void unlock() noexcept override;
+
+    bool try_lock() noexcept override;
+
+    bool StatsEnabled() const { return m_enable_stats; }
+
+    AdaptiveMutexStats GetStats() const;
+
+    void ResetStats();
+
+public:
+    struct Owner;
+
+private:
+    void lock_contended() noexcept;
+
+    std::atomic<unsigned> m_futex;  // 0: unlocked, 1: locked, 2: locked with sleepers
+    std::atomic<Owner *> m_owner;
+    uint32_t m_max_spins;
+    bool m_enable_stats;
+
+    std::atomic<uint64_t> m_contended_acquires{0};
+    std::atomic<uint64_t> m_spin_acquires{0};
+    std::atomic<uint64_t> m_parks{0};
+    std::atomic<uint64_t> m_park_time_ns{0};
+};
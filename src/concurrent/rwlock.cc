@@ -0,0 +1,149 @@
+#include <climits>
+#include <thread>
+
+#include "rwlock.h"
+#include "macro.h"
+#include "sys_futex.h"
+
+static std::atomic<uint32_t> s_next_reader_slot{0};
+
+static uint32_t ReaderSlot() {
+    static thread_local uint32_t t_slot = s_next_reader_slot.fetch_add(1, std::memory_order_relaxed);
+    return t_slot;
+}
+
+DistributedRWLock::DistributedRWLock(Preference preference, size_t shard_num)
+        : m_preference(preference) {
+    if (shard_num == 0) {
+        shard_num = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t rounded = 1;
+    while (rounded < shard_num) {
+        rounded <<= 1;
+    }
+    m_shard_mask = rounded - 1;
+    m_shards.reset(new ReaderShard[rounded]);
+}
+
+DistributedRWLock::ReaderShard &DistributedRWLock::LocalShard() const {
+    return m_shards[ReaderSlot() & m_shard_mask];
+}
+
+int64_t DistributedRWLock::ReaderCount() const {
+    int64_t count = 0;
+    for (size_t i = 0; i <= m_shard_mask; ++i) {
+        count += m_shards[i].readers.load(std::memory_order_seq_cst);
+    }
+    return count;
+}
+
+void DistributedRWLock::WaitReadersDrained() {
+    static constexpr int kSpins = 128;
+    for (int i = 0; i < kSpins; ++i) {
+        if (ReaderCount() == 0) {
+            return;
+        }
+        cpu_relax();
+    }
+    while (true) {
+        const uint32_t seq = m_drain_seq.load(std::memory_order_acquire);
+        if (ReaderCount() == 0) {
+            return;
+        }
+        futex_wait_private(&m_drain_seq, static_cast<int>(seq), nullptr);
+    }
+}
+
+void DistributedRWLock::NotifyWriter() {
+    if (m_state.load(std::memory_order_seq_cst) & kWriterPending) {
+        m_drain_seq.fetch_add(1, std::memory_order_release);
+        futex_wake_private(&m_drain_seq, 1);
+    }
+}
+
+void DistributedRWLock::WaitWriterGone() {
+    uint32_t state = m_state.load(std::memory_order_acquire);
+    while (state & kWriterActive) {
+        if (!(state & kReadersWaiting)) {
+            if (!m_state.compare_exchange_weak(state, state | kReadersWaiting,
+                                               std::memory_order_acq_rel)) {
+                continue;
+            }
+            state |= kReadersWaiting;
+        }
+        futex_wait_private(&m_state, static_cast<int>(state), nullptr);
+        state = m_state.load(std::memory_order_acquire);
+    }
+}
+
+void DistributedRWLock::WakeReaders(uint32_t prev_state) {
+    if (prev_state & kReadersWaiting) {
+        futex_wake_private(&m_state, INT_MAX);
+    }
+}
+
+void DistributedRWLock::lock() noexcept {
+    m_writer_mutex.lock();
+    if (m_preference == kPreferWriter) {
+        m_state.fetch_or(kWriterPending | kWriterActive, std::memory_order_seq_cst);
+        WaitReadersDrained();
+        return;
+    }
+    m_state.fetch_or(kWriterPending, std::memory_order_seq_cst);
+    while (true) {
+        WaitReadersDrained();
+        m_state.fetch_or(kWriterActive, std::memory_order_seq_cst);
+        if (ReaderCount() == 0) {
+            return;
+        }
+        // readers slipped in between the drain and closing the gate, let them run
+        WakeReaders(m_state.fetch_and(~(kWriterActive | kReadersWaiting), std::memory_order_seq_cst));
+    }
+}
+
+bool DistributedRWLock::try_lock() noexcept {
+    if (!m_writer_mutex.try_lock()) {
+        return false;
+    }
+    m_state.fetch_or(kWriterPending | kWriterActive, std::memory_order_seq_cst);
+    if (ReaderCount() == 0) {
+        return true;
+    }
+    WakeReaders(m_state.exchange(0, std::memory_order_seq_cst));
+    m_writer_mutex.unlock();
+    return false;
+}
+
+void DistributedRWLock::unlock() noexcept {
+    WakeReaders(m_state.exchange(0, std::memory_order_seq_cst));
+    m_writer_mutex.unlock();
+}
+
+void DistributedRWLock::lock_shared() noexcept {
+    ReaderShard &shard = LocalShard();
+    while (true) {
+        shard.readers.fetch_add(1, std::memory_order_seq_cst);
+        if (LIKELY(!(m_state.load(std::memory_order_seq_cst) & kWriterActive))) {
+            return;
+        }
+        shard.readers.fetch_sub(1, std::memory_order_seq_cst);
+        NotifyWriter();
+        WaitWriterGone();
+    }
+}
+
+bool DistributedRWLock::try_lock_shared() noexcept {
+    ReaderShard &shard = LocalShard();
+    shard.readers.fetch_add(1, std::memory_order_seq_cst);
+    if (LIKELY(!(m_state.load(std::memory_order_seq_cst) & kWriterActive))) {
+        return true;
+    }
+    shard.readers.fetch_sub(1, std::memory_order_seq_cst);
+    NotifyWriter();
+    return false;
+}
+
+void DistributedRWLock::unlock_shared() noexcept {
+    LocalShard().readers.fetch_sub(1, std::memory_order_seq_cst);
+    NotifyWriter();
+}
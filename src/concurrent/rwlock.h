@@ -6,9 +6,11 @@
 #include <cerrno>
 #include <cstring>
 #include <pthread.h>
+#include <memory>
 #include <system_error>
 
 #include "lock.h"
+#include "mutex.h"
 
 class PosixRWLock : public SharedLock {
 public:
@@ -53,11 +55,7 @@ public:
     }
 
     bool try_lock() noexcept override {
-        int res = pthread_rwlock_trywrlock(&m_rwlock);
-        if (res == EBUSY) {
-            return false;
-        }
-        return true;
+        return pthread_rwlock_trywrlock(&m_rwlock) == 0;
     }
 
     void lock_shared() noexcept override {
@@ -69,9 +67,79 @@ public:
     }
 
     bool try_lock_shared() noexcept override {
-        return pthread_rwlock_tryrdlock(&m_rwlock);
+        return pthread_rwlock_tryrdlock(&m_rwlock) == 0;
     }
 
 private:
     pthread_rwlock_t m_rwlock{};
-};
\ No newline at end of file
+};
+
+/*
+ * @brief reader-writer lock with distributed reader indicators
+ * @details Readers only increment the counter of their own cache-line padded
+ * shard and read the writer state, so read-side cost does not grow with the
+ * number of cores. Writers are serialized by an AdaptiveMutex, announce
+ * themselves in the state word and sleep on a futex until all shards drain.
+ * Readers which meet an active writer step back and sleep on the state word.
+ *
+ * With kPreferWriter an arriving writer blocks new readers at once. With
+ * kPreferReader it waits for a moment without readers before closing the
+ * gate, so a steady stream of readers can starve writers.
+ */
+class DistributedRWLock : public SharedLock {
+public:
+    enum Preference {
+        kPreferReader,
+        kPreferWriter,
+    };
+
+    /// @param shard_num number of reader shards, 0 means one per cpu
+    explicit DistributedRWLock(Preference preference = kPreferWriter, size_t shard_num = 0);
+
+    ~DistributedRWLock() override = default;
+
+    void lock() noexcept override;
+
+    void unlock() noexcept override;
+
+    bool try_lock() noexcept override;
+
+    void lock_shared() noexcept override;
+
+    void unlock_shared() noexcept override;
+
+    bool try_lock_shared() noexcept override;
+
+    size_t ShardNum() const { return m_shard_mask + 1; }
+
+private:
+    struct alignas(64) ReaderShard {
+        std::atomic<int64_t> readers{0};
+    };
+
+    ReaderShard &LocalShard() const;
+
+    int64_t ReaderCount() const;
+
+    void WaitReadersDrained();
+
+    void NotifyWriter();
+
+    void WaitWriterGone();
+
+    void WakeReaders(uint32_t prev_state);
+
+private:
+    static constexpr uint32_t kWriterPending = 1;
+    static constexpr uint32_t kWriterActive = 2;
+    static constexpr uint32_t kReadersWaiting = 4;
+
+    const Preference m_preference;
+    size_t m_shard_mask;
+    std::unique_ptr<ReaderShard[]> m_shards;
+    AdaptiveMutex m_writer_mutex;
+    /// futex word of readers, combination of kWriterPending, kWriterActive and kReadersWaiting
+    alignas(64) std::atomic<uint32_t> m_state{0};
+    /// futex word of the writer, bumped by readers leaving while a writer waits
+    alignas(64) std::atomic<uint32_t> m_drain_seq{0};
+};
@@ -1,26 +1,37 @@
 #pragma  once
 
+#include <atomic>
 #include <cerrno>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <string>
 #include <sys/types.h>
 #include <semaphore.h>
 
+#include "sys_futex.h"
+
+/*
+ * @brief helpers for raw POSIX sem_t, prefer Semaphore below for new code
+ */
 class SemaphoreOps {
 public:
     static void Acquire(sem_t *sem) {
-        sem_wait(sem);
+        while (sem_wait(sem) != 0 && errno == EINTR) {
+        }
     }
 
     static bool TryAcquire(sem_t *sem) {
         return sem_trywait(sem) == 0;
     }
 
-    static bool TimedAcquire(sem_t *sem, int64_t timeout) {
-        struct timespec ts{};
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_nsec += timeout;
-        return sem_timedwait(sem, &ts) == 0;
+    static bool TimedAcquire(sem_t *sem, int64_t timeout) // in ms
+    {
+        const timespec deadline = futex_deadline_after_ms(timeout);
+        int ret;
+        while ((ret = sem_clockwait(sem, CLOCK_MONOTONIC, &deadline)) != 0 && errno == EINTR) {
+        }
+        return ret == 0;
     }
 
     static void Release(sem_t *sem) {
@@ -34,43 +45,86 @@ public:
     }
 };
 
+/*
+ * @brief counting semaphore built on futex
+ * @details Acquire() takes a unit with a CAS when one is available and only
+ * sleeps on the futex when the count is zero. Release() only enters the kernel
+ * when somebody is sleeping, and Release(n) wakes at most n sleepers.
+ * Timeouts are measured on CLOCK_MONOTONIC.
+ */
 class Semaphore {
     Semaphore(const Semaphore &) = delete;
 
     Semaphore &operator=(const Semaphore &) = delete;
 
 public:
-    explicit Semaphore(unsigned int value) {
-        sem_init(&m_sem, false, value);
-    }
+    explicit Semaphore(unsigned int value = 0) : m_value(static_cast<int>(value)) {}
 
-    ~Semaphore() {
-        sem_destroy(&m_sem);
-    }
+    ~Semaphore() = default;
 
     void Acquire() {
-        SemaphoreOps::Acquire(&m_sem);
+        if (TryAcquire()) {
+            return;
+        }
+        AcquireUntil(nullptr);
     }
 
     bool TryAcquire() {
-        return SemaphoreOps::TryAcquire(&m_sem);
+        int value = m_value.load(std::memory_order_relaxed);
+        while (value > 0) {
+            if (m_value.compare_exchange_weak(value, value - 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
     }
 
     bool TimedAcquire(int64_t timeout) // in ms
     {
-        return SemaphoreOps::TimedAcquire(&m_sem, timeout);
+        if (TryAcquire()) {
+            return true;
+        }
+        const timespec deadline = futex_deadline_after_ms(timeout);
+        return AcquireUntil(&deadline);
     }
 
-    void Release() {
-        return SemaphoreOps::Release(&m_sem);
+    void Release(unsigned int n = 1) {
+        m_value.fetch_add(static_cast<int>(n), std::memory_order_seq_cst);
+        if (m_sleepers.load(std::memory_order_seq_cst) > 0) {
+            futex_wake_private(&m_value, static_cast<int>(n));
+        }
     }
 
     // Usually get value is only used for debug propose,
     // be careful your design if you need it.
     unsigned int GetValue() const {
-        return SemaphoreOps::GetValue(&m_sem);
+        return static_cast<unsigned int>(m_value.load(std::memory_order_relaxed));
     }
 
 private:
-    sem_t m_sem;
-};
\ No newline at end of file
+    bool AcquireUntil(const timespec *deadline) {
+        m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+        bool acquired = false;
+        while (true) {
+            int value = m_value.load(std::memory_order_seq_cst);
+            if (value > 0) {
+                if (m_value.compare_exchange_weak(value, value - 1, std::memory_order_acquire,
+                                                  std::memory_order_relaxed)) {
+                    acquired = true;
+                    break;
+                }
+                continue;
+            }
+            if (!futex_wait_private_until(&m_value, 0, deadline)) {
+                acquired = TryAcquire();
+                break;
+            }
+        }
+        m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return acquired;
+    }
+
+    std::atomic<int> m_value;
+    std::atomic<int> m_sleepers{0};
+};
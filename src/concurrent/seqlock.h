@@ -0,0 +1,141 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+#include "spinlock.h"
+
+/**
+ * @file seqlock.h
+ * @brief sequence locks for small, trivially copyable, read-mostly values
+ * @details the writer makes the sequence odd, stores the value and makes it even again;
+ * a reader copies the value between two loads of the sequence and retries when they differ
+ * or are odd. Readers never write shared memory, so they do not bounce the cache line between
+ * cores and cannot starve the writer. The value is kept in relaxed atomic words so a torn read
+ * is a discarded copy instead of a data race.
+ *
+ *     SeqLock<HostStat> host_stat;
+ *     host_stat.Store(stat);           // single writer
+ *     HostStat now = host_stat.Load(); // any number of readers
+ */
+
+/*
+ * @brief single writer sequence lock, concurrent Store()/Update() calls must be serialized
+ * by the caller, see MultiWriterSeqLock otherwise
+ */
+template<typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable_v<T>, "SeqLock requires a trivially copyable type");
+    static_assert(std::is_default_constructible_v<T>, "SeqLock requires a default constructible type");
+
+public:
+    SeqLock() : SeqLock(T{}) {}
+
+    explicit SeqLock(const T &value) {
+        StoreWords(value);
+    }
+
+    SeqLock(const SeqLock &) = delete;
+
+    SeqLock &operator=(const SeqLock &) = delete;
+
+    /// Consistent copy of the value, spins while a write is in progress.
+    T Load() const {
+        T value;
+        uint32_t spins = 0;
+        while (!TryLoad(&value)) {
+            spinlock_internal::SpinWait(spins);
+        }
+        return value;
+    }
+
+    /// One read attempt, false when it overlapped a write and *value must be discarded.
+    bool TryLoad(T *value) const {
+        const uint64_t begin = m_seq.load(std::memory_order_acquire);
+        if (begin & 1) {
+            return false;
+        }
+        LoadWords(value);
+        // keep the word loads above the re-check of the sequence
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_seq.load(std::memory_order_relaxed) == begin;
+    }
+
+    void Store(const T &value) {
+        const uint64_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        // keep the word stores below the odd sequence
+        std::atomic_thread_fence(std::memory_order_release);
+        StoreWords(value);
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /// Read-modify-write by the writer: fn(T&) edits a private copy which is then stored.
+    template<typename Fn>
+    void Update(Fn &&fn) {
+        T value;
+        LoadWords(&value);
+        fn(value);
+        Store(value);
+    }
+
+    /// Even while no write is in progress, grows by 2 per write.
+    uint64_t Sequence() const { return m_seq.load(std::memory_order_acquire); }
+
+private:
+    static constexpr size_t kWords = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    void LoadWords(T *value) const {
+        uint64_t words[kWords];
+        for (size_t i = 0; i < kWords; ++i) {
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        }
+        memcpy(static_cast<void *>(value), words, sizeof(T));
+    }
+
+    void StoreWords(const T &value) {
+        uint64_t words[kWords] = {};
+        memcpy(words, &value, sizeof(T));
+        for (size_t i = 0; i < kWords; ++i) {
+            m_words[i].store(words[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> m_seq{0};
+    std::atomic<uint64_t> m_words[kWords];
+};
+
+/*
+ * @brief sequence lock whose writers are serialized by a spinlock, readers are unchanged
+ */
+template<typename T, typename LockType = AtomicSpinLock>
+class MultiWriterSeqLock {
+public:
+    MultiWriterSeqLock() = default;
+
+    explicit MultiWriterSeqLock(const T &value) : m_seqlock(value) {}
+
+    T Load() const { return m_seqlock.Load(); }
+
+    bool TryLoad(T *value) const { return m_seqlock.TryLoad(value); }
+
+    void Store(const T &value) {
+        std::lock_guard guard(m_writer_lock);
+        m_seqlock.Store(value);
+    }
+
+    template<typename Fn>
+    void Update(Fn &&fn) {
+        std::lock_guard guard(m_writer_lock);
+        m_seqlock.Update(std::forward<Fn>(fn));
+    }
+
+    uint64_t Sequence() const { return m_seqlock.Sequence(); }
+
+private:
+    SeqLock<T> m_seqlock;
+    LockType m_writer_lock;
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+/**
+ * @file sharded_counter.h
+ * @brief statistics that are updated by many threads and read rarely
+ * @details every thread updates its own cache line padded shard with a relaxed,
+ * practically uncontended atomic; reading folds all shards together. A read that
+ * races with updates sees every update that happened before it and any subset of
+ * the concurrent ones, which is what a statistic needs. The shards are freed by the
+ * destructor, so a static reducer that threads may still update during exit is leaked.
+ *
+ *     static auto &s_requests = *new ShardedCounter<int64_t>;
+ *     s_requests.Increment();          // hot path
+ *     LOG(INFO) << s_requests.Value(); // reporting
+ */
+
+namespace sharded_internal {
+
+/// Threads are spread over the shards round robin in the order they first update any reducer.
+inline uint32_t ThreadSlot() {
+    static std::atomic<uint32_t> s_next_slot{0};
+    static thread_local uint32_t t_slot = s_next_slot.fetch_add(1, std::memory_order_relaxed);
+    return t_slot;
+}
+
+template<typename T>
+struct SumOp {
+    static constexpr T Identity() { return T{}; }
+
+    static T Combine(T lhs, T rhs) { return lhs + rhs; }
+
+    static void Apply(std::atomic<T> &slot, T value) {
+        if constexpr (std::is_integral_v<T>) {
+            slot.fetch_add(value, std::memory_order_relaxed);
+        } else {
+            // no fetch_add for floating point atomics before C++20
+            T current = slot.load(std::memory_order_relaxed);
+            while (!slot.compare_exchange_weak(current, current + value, std::memory_order_relaxed)) {
+            }
+        }
+    }
+};
+
+template<typename T>
+struct MaxOp {
+    static constexpr T Identity() { return std::numeric_limits<T>::lowest(); }
+
+    static T Combine(T lhs, T rhs) { return std::max(lhs, rhs); }
+
+    static void Apply(std::atomic<T> &slot, T value) {
+        T current = slot.load(std::memory_order_relaxed);
+        while (value > current && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+template<typename T>
+struct MinOp {
+    static constexpr T Identity() { return std::numeric_limits<T>::max(); }
+
+    static T Combine(T lhs, T rhs) { return std::min(lhs, rhs); }
+
+    static void Apply(std::atomic<T> &slot, T value) {
+        T current = slot.load(std::memory_order_relaxed);
+        while (value < current && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+}  // namespace sharded_internal
+
+/*
+ * @brief a value reduced over per-thread shards with Op (see SumOp, MaxOp, MinOp)
+ */
+template<typename T, typename Op>
+class ShardedReducer {
+    static_assert(std::is_arithmetic_v<T>, "ShardedReducer requires an arithmetic type");
+
+public:
+    /// @param shard_num rounded up to a power of two, 0 means one shard per hardware thread
+    explicit ShardedReducer(size_t shard_num = 0) {
+        if (shard_num == 0) {
+            shard_num = std::max(1u, std::thread::hardware_concurrency());
+        }
+        size_t rounded = 1;
+        while (rounded < shard_num) {
+            rounded <<= 1;
+        }
+        m_shard_mask = rounded - 1;
+        m_shards.reset(new Shard[rounded]);
+    }
+
+    ShardedReducer(const ShardedReducer &) = delete;
+
+    ShardedReducer &operator=(const ShardedReducer &) = delete;
+
+    void Update(T value) {
+        Op::Apply(m_shards[sharded_internal::ThreadSlot() & m_shard_mask].value, value);
+    }
+
+    /// Folds all shards, O(shard number).
+    T Value() const {
+        T result = Op::Identity();
+        for (size_t i = 0; i <= m_shard_mask; ++i) {
+            result = Op::Combine(result, m_shards[i].value.load(std::memory_order_relaxed));
+        }
+        return result;
+    }
+
+    /// Not atomic with respect to concurrent updates, which may survive the reset.
+    void Reset() {
+        for (size_t i = 0; i <= m_shard_mask; ++i) {
+            m_shards[i].value.store(Op::Identity(), std::memory_order_relaxed);
+        }
+    }
+
+    size_t ShardNum() const { return m_shard_mask + 1; }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<T> value{Op::Identity()};
+    };
+
+    size_t m_shard_mask{0};
+    std::unique_ptr<Shard[]> m_shards;
+};
+
+/*
+ * @brief sharded sum, doubles as a gauge when T is signed
+ */
+template<typename T = int64_t>
+class ShardedCounter : public ShardedReducer<T, sharded_internal::SumOp<T>> {
+public:
+    using ShardedReducer<T, sharded_internal::SumOp<T>>::ShardedReducer;
+
+    void Add(T value) { this->Update(value); }
+
+    void Sub(T value) { this->Update(-value); }
+
+    void Increment() { this->Update(1); }
+
+    void Decrement() { this->Update(-1); }
+};
+
+/*
+ * @brief sharded maximum, e.g. a high-water mark
+ */
+template<typename T = int64_t>
+using ShardedMax = ShardedReducer<T, sharded_internal::MaxOp<T>>;
+
+/*
+ * @brief sharded minimum
+ */
+template<typename T = int64_t>
+using ShardedMin = ShardedReducer<T, sharded_internal::MinOp<T>>;
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <sched.h>
 
 #include "lock.h"
 #include "this_thread.h"
@@ -87,4 +89,225 @@ public:
         m_owner = 0;
         pthread_spin_unlock(&m_lock);
     }
-};
\ No newline at end of file
+};
+
+namespace spinlock_internal {
+
+/// Pause while waiting, and give the cpu away now and then so that a fair
+/// lock does not stall when its next owner has been descheduled.
+inline void SpinWait(uint32_t &spins) {
+    static constexpr uint32_t kSpinsBeforeYield = 1024;
+    if (++spins < kSpinsBeforeYield) {
+        __builtin_ia32_pause();
+    } else {
+        spins = 0;
+        sched_yield();
+    }
+}
+
+/// queue node of MCSSpinLock and CLHSpinLock, one cache line each
+struct alignas(64) QNode {
+    std::atomic<QNode *> next{nullptr};
+    std::atomic<bool> locked{false};
+    QNode *free_next{nullptr};
+};
+
+/// per-thread free list of queue nodes, so that lock() never allocates in steady state
+class QNodeCache {
+public:
+    ~QNodeCache() {
+        while (m_head) {
+            QNode *next = m_head->free_next;
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    static QNode *Get() {
+        auto &cache = Instance();
+        QNode *node = cache.m_head;
+        if (node == nullptr) {
+            return new QNode;
+        }
+        cache.m_head = node->free_next;
+        return node;
+    }
+
+    static void Put(QNode *node) {
+        auto &cache = Instance();
+        node->free_next = cache.m_head;
+        cache.m_head = node;
+    }
+
+private:
+    static QNodeCache &Instance() {
+        static thread_local QNodeCache cache;
+        return cache;
+    }
+
+    QNode *m_head{nullptr};
+};
+
+}  // namespace spinlock_internal
+
+/*
+ * @brief FIFO ticket lock
+ * @details waiters are served in arrival order; the ticket dispenser and the
+ * now-serving counter live on separate cache lines so that arriving threads do
+ * not disturb the spinning ones.
+ */
+class TicketSpinLock : public Lock {
+private:
+    alignas(64) std::atomic<uint32_t> m_next{0};
+    alignas(64) std::atomic<uint32_t> m_serving{0};
+
+public:
+    void lock() noexcept override {
+        const uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+        uint32_t spins = 0;
+        uint32_t serving;
+        while ((serving = m_serving.load(std::memory_order_acquire)) != ticket) {
+            // back off in proportion to our distance from the head of the line
+            for (uint32_t i = 1; i < ticket - serving; ++i) {
+                __builtin_ia32_pause();
+            }
+            spinlock_internal::SpinWait(spins);
+        }
+    }
+
+    bool try_lock() noexcept override {
+        uint32_t serving = m_serving.load(std::memory_order_acquire);
+        return m_next.compare_exchange_strong(serving, serving + 1, std::memory_order_acquire,
+                                              std::memory_order_relaxed);
+    }
+
+    void unlock() noexcept override {
+        m_serving.store(m_serving.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+/*
+ * @brief Mellor-Crummey and Scott queue lock
+ * @details each waiter spins on the flag of its own node, so a hand-off touches
+ * exactly one remote cache line no matter how many threads are queued.
+ */
+class MCSSpinLock : public Lock {
+private:
+    using QNode = spinlock_internal::QNode;
+
+    std::atomic<QNode *> m_tail{nullptr};
+    /// node of the current holder, only touched while holding the lock
+    QNode *m_owner_node{nullptr};
+
+public:
+    void lock() noexcept override {
+        QNode *node = spinlock_internal::QNodeCache::Get();
+        node->next.store(nullptr, std::memory_order_relaxed);
+        node->locked.store(true, std::memory_order_relaxed);
+        QNode *pred = m_tail.exchange(node, std::memory_order_acq_rel);
+        if (pred != nullptr) {
+            pred->next.store(node, std::memory_order_release);
+            uint32_t spins = 0;
+            while (node->locked.load(std::memory_order_acquire)) {
+                spinlock_internal::SpinWait(spins);
+            }
+        }
+        m_owner_node = node;
+    }
+
+    bool try_lock() noexcept override {
+        QNode *node = spinlock_internal::QNodeCache::Get();
+        node->next.store(nullptr, std::memory_order_relaxed);
+        QNode *expected = nullptr;
+        if (m_tail.compare_exchange_strong(expected, node, std::memory_order_acq_rel,
+                                           std::memory_order_relaxed)) {
+            m_owner_node = node;
+            return true;
+        }
+        spinlock_internal::QNodeCache::Put(node);
+        return false;
+    }
+
+    void unlock() noexcept override {
+        QNode *node = m_owner_node;
+        QNode *next = node->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            QNode *expected = node;
+            if (m_tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed)) {
+                spinlock_internal::QNodeCache::Put(node);
+                return;
+            }
+            // a successor swapped the tail but has not linked itself yet
+            uint32_t spins = 0;
+            while ((next = node->next.load(std::memory_order_acquire)) == nullptr) {
+                spinlock_internal::SpinWait(spins);
+            }
+        }
+        next->locked.store(false, std::memory_order_release);
+        spinlock_internal::QNodeCache::Put(node);
+    }
+};
+
+/*
+ * @brief Craig, Landin and Hagersten queue lock
+ * @details each waiter spins on its predecessor's node; on unlock the holder
+ * releases its own node to the successor and recycles the predecessor's one.
+ */
+class CLHSpinLock : public Lock {
+private:
+    using QNode = spinlock_internal::QNode;
+
+    std::atomic<QNode *> m_tail;
+    /// nodes of the current holder, only touched while holding the lock
+    QNode *m_owner_node{nullptr};
+    QNode *m_owner_pred{nullptr};
+
+public:
+    CLHSpinLock() : m_tail(new QNode) {}
+
+    ~CLHSpinLock() override {
+        delete m_tail.load(std::memory_order_relaxed);
+    }
+
+    void lock() noexcept override {
+        QNode *node = spinlock_internal::QNodeCache::Get();
+        node->locked.store(true, std::memory_order_relaxed);
+        QNode *pred = m_tail.exchange(node, std::memory_order_acq_rel);
+        uint32_t spins = 0;
+        while (pred->locked.load(std::memory_order_acquire)) {
+            spinlock_internal::SpinWait(spins);
+        }
+        m_owner_node = node;
+        m_owner_pred = pred;
+    }
+
+    bool try_lock() noexcept override {
+        QNode *pred = m_tail.load(std::memory_order_acquire);
+        if (pred->locked.load(std::memory_order_acquire)) {
+            return false;
+        }
+        QNode *node = spinlock_internal::QNodeCache::Get();
+        node->locked.store(true, std::memory_order_relaxed);
+        if (!m_tail.compare_exchange_strong(pred, node, std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+            spinlock_internal::QNodeCache::Put(node);
+            return false;
+        }
+        // Once enqueued we can not back out. If pred was recycled and reused
+        // between the two loads above (ABA) we have to wait for its holder.
+        uint32_t spins = 0;
+        while (pred->locked.load(std::memory_order_acquire)) {
+            spinlock_internal::SpinWait(spins);
+        }
+        m_owner_node = node;
+        m_owner_pred = pred;
+        return true;
+    }
+
+    void unlock() noexcept override {
+        QNode *pred = m_owner_pred;
+        m_owner_node->locked.store(false, std::memory_order_release);
+        spinlock_internal::QNodeCache::Put(pred);
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unistd.h>
+#include <cstdint>
 #include <ctime>
 #include <syscall.h>
 #include <linux/futex.h>
@@ -33,4 +34,53 @@ inline int futex_wake_private(void* addr1, int nwake) {
 inline int futex_requeue_private(void* addr1, int nwake, void* addr2) {
     return syscall(SYS_futex, addr1, (FUTEX_REQUEUE | FUTEX_PRIVATE_FLAG),
                    nwake, NULL, addr2, 0);
-}
\ No newline at end of file
+}
+
+/*
+ * FUTEX_WAIT 的相对超时按 CLOCK_MONOTONIC 计时。带超时的等待可能被提前唤醒（信号、值变化、
+ * 虚假唤醒），所以先把毫秒超时换算成单调时钟上的截止时间，每次重新等待前再计算剩余时间，
+ * 不会因为多次唤醒而把超时累加。
+ */
+inline timespec futex_deadline_after_ms(int64_t timeout_ms) {
+    timespec deadline{};
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+/*
+ * 计算距离 deadline 的剩余时间，已经超时返回 false
+ */
+inline bool futex_remaining_time(const timespec &deadline, timespec *remaining) {
+    timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    remaining->tv_sec = deadline.tv_sec - now.tv_sec;
+    remaining->tv_nsec = deadline.tv_nsec - now.tv_nsec;
+    if (remaining->tv_nsec < 0) {
+        remaining->tv_sec -= 1;
+        remaining->tv_nsec += 1000000000;
+    }
+    return remaining->tv_sec > 0 || (remaining->tv_sec == 0 && remaining->tv_nsec > 0);
+}
+
+/*
+ * 在 addr1 上等待，直到值不再是 expected、被唤醒或者到达 deadline（deadline 为 NULL 时无限等待）。
+ * 返回 false 表示已经超时，其余情况（包括虚假唤醒）返回 true，调用方需要重新检查条件
+ */
+inline bool futex_wait_private_until(void *addr1, int expected, const timespec *deadline) {
+    if (deadline == nullptr) {
+        futex_wait_private(addr1, expected, nullptr);
+        return true;
+    }
+    timespec remaining{};
+    if (!futex_remaining_time(*deadline, &remaining)) {
+        return false;
+    }
+    futex_wait_private(addr1, expected, &remaining);
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+
+#include "sys_futex.h"
+
+/*
+ * @brief go-style wait group
+ * @details Add() the number of outstanding jobs, every job calls Done(), and
+ * Wait() returns once the counter is back to zero. Unlike CountDownLatch it
+ * can be reused after reaching zero. Done() only enters the kernel when the
+ * counter drops to zero while somebody sleeps in Wait().
+ */
+class WaitGroup {
+public:
+    explicit WaitGroup(int count = 0) : m_count(count) {
+        assert(count >= 0);
+    }
+
+    WaitGroup(const WaitGroup &) = delete;
+
+    WaitGroup &operator=(const WaitGroup &) = delete;
+
+    void Add(int delta = 1) {
+        const int prev = m_count.fetch_add(delta, std::memory_order_acq_rel);
+        assert(prev + delta >= 0);
+        if (prev + delta == 0 && m_sleepers.load(std::memory_order_seq_cst) > 0) {
+            futex_wake_private(&m_count, INT_MAX);
+        }
+    }
+
+    void Done() {
+        Add(-1);
+    }
+
+    int GetCount() const {
+        return m_count.load(std::memory_order_acquire);
+    }
+
+    void Wait() {
+        WaitUntil(nullptr);
+    }
+
+    /// @return false if jobs are still outstanding after timeout_ms
+    bool TimedWait(int64_t timeout_ms) {
+        if (GetCount() == 0) {
+            return true;
+        }
+        const timespec deadline = futex_deadline_after_ms(timeout_ms);
+        return WaitUntil(&deadline);
+    }
+
+private:
+    bool WaitUntil(const timespec *deadline) {
+        int count;
+        while ((count = m_count.load(std::memory_order_acquire)) != 0) {
+            m_sleepers.fetch_add(1, std::memory_order_seq_cst);
+            bool in_time = true;
+            count = m_count.load(std::memory_order_seq_cst);
+            if (count != 0) {
+                in_time = futex_wait_private_until(&m_count, count, deadline);
+            }
+            m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+            if (!in_time) {
+                return GetCount() == 0;
+            }
+        }
+        return true;
+    }
+
+    std::atomic<int> m_count;
+    std::atomic<int> m_sleepers{0};
+};
@@ -0,0 +1,43 @@
+#include "coro_event.h"
+
+void CoroEvent::Set() {
+    void *old = m_state.exchange(this, std::memory_order_acq_rel);
+    m_threads.Set();
+    if (old == this) {
+        return;
+    }
+    // the list is last in first, resume in arrival order
+    Awaiter *reversed = nullptr;
+    for (Awaiter *awaiter = static_cast<Awaiter *>(old); awaiter;) {
+        Awaiter *next = awaiter->m_next;
+        awaiter->m_next = reversed;
+        reversed = awaiter;
+        awaiter = next;
+    }
+    while (reversed) {
+        // the awaiter lives in the frame that is about to run, read it first
+        Awaiter *next = reversed->m_next;
+        reversed->m_handle.resume();
+        reversed = next;
+    }
+}
+
+void CoroEvent::Reset() {
+    void *expected = this;
+    m_state.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed);
+    m_threads.Reset();
+}
+
+bool CoroEvent::Awaiter::await_suspend(std::coroutine_handle<> handle) noexcept {
+    m_handle = handle;
+    void *old = m_event.m_state.load(std::memory_order_acquire);
+    do {
+        if (old == &m_event) {
+            // set meanwhile, go on without suspending
+            return false;
+        }
+        m_next = static_cast<Awaiter *>(old);
+    } while (!m_event.m_state.compare_exchange_weak(old, this, std::memory_order_release,
+                                                    std::memory_order_acquire));
+    return true;
+}
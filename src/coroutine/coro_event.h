@@ -0,0 +1,63 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "coro_event.h needs C++20, it is built by the coro_test target (CORES_BUILD_COROUTINES)"
+#endif
+
+#include <atomic>
+#include <coroutine>
+
+#include "concurrent/event.h"
+
+/**
+ * @brief manual reset event that coroutines await and threads wait on
+ * @details awaiting coroutines are pushed on a lock-free list, Set() swaps the list out
+ * and resumes them in the order they arrived, on the thread calling Set(). Threads
+ * block on the futex of an Event, so Set() only enters the kernel when one is asleep.
+ */
+class CoroEvent {
+public:
+    explicit CoroEvent(bool signaled = false)
+            : m_state(signaled ? static_cast<void *>(this) : nullptr), m_threads(signaled) {}
+
+    CoroEvent(const CoroEvent &) = delete;
+
+    CoroEvent &operator=(const CoroEvent &) = delete;
+
+    /**
+     * @brief signal the event, resume the coroutines and wake the threads waiting on it
+     */
+    void Set();
+
+    void Reset();
+
+    bool IsSet() const { return m_state.load(std::memory_order_acquire) == this; }
+
+    /// block the calling thread until the event is set, a coroutine co_awaits instead
+    void Wait() { m_threads.Wait(); }
+
+    class Awaiter {
+    public:
+        explicit Awaiter(CoroEvent &event) : m_event(event) {}
+
+        bool await_ready() const noexcept { return m_event.IsSet(); }
+
+        bool await_suspend(std::coroutine_handle<> handle) noexcept;
+
+        void await_resume() const noexcept {}
+
+    private:
+        friend class CoroEvent;
+
+        CoroEvent &m_event;
+        std::coroutine_handle<> m_handle;
+        Awaiter *m_next{nullptr};
+    };
+
+    Awaiter operator co_await() noexcept { return Awaiter(*this); }
+
+private:
+    /// this when set, otherwise the awaiters last in first, nullptr for none
+    std::atomic<void *> m_state;
+    Event m_threads;
+};
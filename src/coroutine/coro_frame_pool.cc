@@ -0,0 +1,105 @@
+#include <new>
+
+#include "coro_frame_pool.h"
+#include "concurrent/sharded_counter.h"
+
+/// leaked on purpose, thread caches release their frames during exit
+static auto &s_live_frames = *new ShardedCounter<int64_t>;
+static auto &s_cached_frames = *new ShardedCounter<int64_t>;
+
+static constexpr size_t kClassNum = CoroFramePool::kMaxPooledSize / CoroFramePool::kClassSize;
+
+/// frames released after the thread's free lists are gone are deleted
+static thread_local bool t_frame_cache_destroyed = false;
+
+class FrameCache {
+public:
+    FrameCache() = default;
+
+    ~FrameCache() {
+        t_frame_cache_destroyed = true;
+        for (size_t i = 0; i < kClassNum; ++i) {
+            while (Node *node = m_heads[i]) {
+                m_heads[i] = node->next;
+                ::operator delete(node);
+            }
+            s_cached_frames.Sub(static_cast<int64_t>(m_counts[i]));
+        }
+    }
+
+    void *Get(size_t index) {
+        Node *node = m_heads[index];
+        if (node == nullptr) {
+            return nullptr;
+        }
+        m_heads[index] = node->next;
+        --m_counts[index];
+        s_cached_frames.Decrement();
+        return node;
+    }
+
+    bool Put(void *vp, size_t index) {
+        if (m_counts[index] >= CoroFramePool::kMaxCachedPerClass) {
+            return false;
+        }
+        Node *node = static_cast<Node *>(vp);
+        node->next = m_heads[index];
+        m_heads[index] = node;
+        ++m_counts[index];
+        s_cached_frames.Increment();
+        return true;
+    }
+
+private:
+    struct Node {
+        Node *next;
+    };
+
+    Node *m_heads[kClassNum]{};
+    uint32_t m_counts[kClassNum]{};
+};
+
+static FrameCache *GetFrameCache() {
+    if (t_frame_cache_destroyed) {
+        return nullptr;
+    }
+    static thread_local FrameCache t_frame_cache;
+    return &t_frame_cache;
+}
+
+void *CoroFramePool::Alloc(size_t size) {
+    s_live_frames.Increment();
+    if (size == 0 || size > kMaxPooledSize) {
+        return ::operator new(size);
+    }
+    const size_t index = (size - 1) / kClassSize;
+    if (FrameCache *cache = GetFrameCache()) {
+        if (void *vp = cache->Get(index)) {
+            return vp;
+        }
+    }
+    // a whole class, so that any frame of the class can reuse it
+    return ::operator new((index + 1) * kClassSize);
+}
+
+void CoroFramePool::Dealloc(void *vp, size_t size) {
+    if (vp == nullptr) {
+        return;
+    }
+    s_live_frames.Decrement();
+    if (size > 0 && size <= kMaxPooledSize) {
+        if (FrameCache *cache = GetFrameCache()) {
+            if (cache->Put(vp, (size - 1) / kClassSize)) {
+                return;
+            }
+        }
+    }
+    ::operator delete(vp);
+}
+
+CoroFrameStats CoroFramePool::GetStats() {
+    CoroFrameStats stats;
+    stats.live_frames = s_live_frames.Value();
+    stats.cached_frames = s_cached_frames.Value();
+    return stats;
+}
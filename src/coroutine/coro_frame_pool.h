@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief allocator of coroutine frames
+ * @details frames are recycled by size class, 64 bytes apart up to kMaxPooledSize, in a
+ * free list of the thread that releases them, so a coroutine resumed and finished on a
+ * worker hands its frame to the next coroutine started there. Bigger frames, and frames
+ * beyond kMaxCachedPerClass of a class, go straight to operator new / delete.
+ */
+
+struct CoroFrameStats {
+    /// frames allocated and not yet released
+    int64_t live_frames{0};
+    /// released frames waiting in the thread free lists
+    int64_t cached_frames{0};
+};
+
+class CoroFramePool {
+public:
+    static constexpr size_t kClassSize = 64;
+    static constexpr size_t kMaxPooledSize = 4096;
+    static constexpr size_t kMaxCachedPerClass = 1024;
+
+    static void *Alloc(size_t size);
+
+    /**
+     * @brief release a frame returned by Alloc(size), from any thread
+     */
+    static void Dealloc(void *vp, size_t size);
+
+    static CoroFrameStats GetStats();
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "coro_io.h needs C++20, it is built by the coro_test target (CORES_BUILD_COROUTINES)"
+#endif
+
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+
+#include "fiber/fiber_iomanager.h"
+#include "fiber/fiber_scheduler.h"
+
+/**
+ * @file coro_io.h
+ * @brief awaitables that put coroutines on the fiber Scheduler and IOManager
+ * @details a suspended coroutine is resumed by a callback scheduled on the executor, so
+ * it continues inside a worker fiber of that executor. The callback may run on another
+ * worker before await_suspend() even returned, await_suspend() touches nothing after
+ * handing the handle over.
+ */
+
+/**
+ * @brief continue on a worker of scheduler
+ */
+class ScheduleOn {
+public:
+    explicit ScheduleOn(Scheduler &scheduler) : m_scheduler(scheduler) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        m_scheduler.schedule([handle] { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    Scheduler &m_scheduler;
+};
+
+/**
+ * @brief continue on a worker of iom after ms milliseconds, from its timers
+ */
+class SleepFor {
+public:
+    SleepFor(IOManager &iom, uint64_t ms) : m_iom(iom), m_ms(ms) {}
+
+    bool await_ready() const noexcept { return m_ms == 0; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        m_iom.addTimer(m_ms, [handle] { handle.resume(); });
+    }
+
+    void await_resume() const noexcept {}
+
+private:
+    IOManager &m_iom;
+    uint64_t m_ms;
+};
+
+/**
+ * @brief continue on a worker of iom once fd is ready for event, one-shot like addEvent()
+ * @details co_await yields 0, or -1 with errno set when the fd could not be waited for;
+ * IOManager::cancelEvent() resumes the coroutine as well
+ */
+class WaitFd {
+public:
+    WaitFd(IOManager &iom, int fd, IOManager::Event event) : m_iom(iom), m_fd(fd), m_event(event) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        if (m_iom.addEvent(m_fd, m_event, [handle] { handle.resume(); }) != 0) {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        if (m_errno) {
+            errno = m_errno;
+            return -1;
+        }
+        return 0;
+    }
+
+private:
+    IOManager &m_iom;
+    int m_fd;
+    IOManager::Event m_event;
+    int m_errno{0};
+};
+
+inline WaitFd WaitReadable(IOManager &iom, int fd) {
+    return WaitFd(iom, fd, IOManager::READ);
+}
+
+inline WaitFd WaitWritable(IOManager &iom, int fd) {
+    return WaitFd(iom, fd, IOManager::WRITE);
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "coro_task.h needs C++20, it is built by the coro_test target (CORES_BUILD_COROUTINES)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "coro_frame_pool.h"
+#include "concurrent/event.h"
+
+/**
+ * @file coro_task.h
+ * @brief stackless coroutines: Task<T> and SyncWait()
+ * @details a Task is lazy, it starts when it is awaited and resumes its awaiter when it
+ * finishes. Both hand-offs are symmetric transfers, await_suspend returns the handle to
+ * run next, so a chain of tasks that complete synchronously runs in constant stack.
+ * Frames come from CoroFramePool.
+ *
+ *     Task<int> answer() { co_return 42; }
+ *     Task<int> twice() { co_return 2 * co_await answer(); }
+ *     int v = SyncWait(twice());
+ */
+
+template<typename T = void>
+class Task;
+
+namespace coro_internal {
+
+/// frames of every coroutine type of the runtime come from the pool
+struct PromiseAllocBase {
+    static void *operator new(size_t size) { return CoroFramePool::Alloc(size); }
+
+    static void operator delete(void *vp, size_t size) { CoroFramePool::Dealloc(vp, size); }
+};
+
+struct TaskPromiseBase : PromiseAllocBase {
+    /// resumed when the task finishes, the awaiting coroutine
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept {
+            std::coroutine_handle<> next = handle.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template<typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+
+    T take() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template<>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void take() const {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+}  // namespace coro_internal
+
+template<typename T>
+class [[nodiscard]] Task {
+public:
+    using promise_type = coro_internal::TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+
+    Task(Task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool done() const { return !m_handle || m_handle.done(); }
+
+    /**
+     * @brief start the task and suspend until it finished
+     * @return its value, or rethrows its exception
+     * @throw std::logic_error when the task is empty, default constructed or moved from
+     */
+    auto operator co_await() const noexcept {
+        struct Awaiter {
+            handle_type handle;
+
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+                handle.promise().continuation = caller;
+                return handle;
+            }
+
+            T await_resume() {
+                if (!handle) {
+                    throw std::logic_error("co_await on an empty Task");
+                }
+                return handle.promise().take();
+            }
+        };
+        return Awaiter{m_handle};
+    }
+
+private:
+    friend promise_type;
+
+    explicit Task(handle_type handle) : m_handle(handle) {}
+
+private:
+    handle_type m_handle;
+};
+
+namespace coro_internal {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/// the coroutine SyncWait() blocks on, sets the event once the awaited task finished
+struct SyncWaitTask {
+    struct promise_type : PromiseAllocBase {
+        Event *event{nullptr};
+
+        SyncWaitTask get_return_object() noexcept {
+            return SyncWaitTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        auto final_suspend() const noexcept {
+            struct SetEvent {
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+                    // the waiter destroys the frame once woken, this is the last touch
+                    handle.promise().event->Set();
+                }
+
+                void await_resume() const noexcept {}
+            };
+            return SetEvent{};
+        }
+
+        void return_void() const noexcept {}
+
+        /// the awaited exception is caught in the body, nothing else throws
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+}  // namespace coro_internal
+
+/**
+ * @brief run task to completion, blocking the calling thread on a futex while it is
+ * suspended somewhere else
+ * @details not from a coroutine or fiber the task needs to make progress
+ * @return the value of the task, or rethrows its exception
+ */
+template<typename T>
+T SyncWait(Task<T> task) {
+    using Value = std::conditional_t<std::is_void_v<T>, bool, T>;
+    std::optional<Value> value;
+    std::exception_ptr exception;
+    auto body = [&]() -> coro_internal::SyncWaitTask {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await task;
+                value.emplace(true);
+            } else {
+                value.emplace(co_await task);
+            }
+        } catch (...) {
+            exception = std::current_exception();
+        }
+    };
+    Event event;
+    coro_internal::SyncWaitTask wait = body();
+    wait.handle.promise().event = &event;
+    wait.handle.resume();
+    event.Wait();
+    wait.handle.destroy();
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*value);
+    }
+}
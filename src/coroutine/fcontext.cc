@@ -0,0 +1,149 @@
+#include "fcontext.h"
+
+#ifndef FIBER_USE_UCONTEXT
+
+#if defined(__x86_64__)
+
+/*
+ * context-data layout, low to high:
+ *   0x00 mxcsr | 0x04 x87 cw | 0x08 r12 | 0x10 r13 | 0x18 r14 | 0x20 r15 | 0x28 rbx | 0x30 rbp | 0x38 rip
+ */
+asm(R"(
+.text
+.globl jump_fcontext
+.type jump_fcontext,@function
+.align 16
+jump_fcontext:
+    leaq  -0x38(%rsp), %rsp
+    stmxcsr  (%rsp)
+    fnstcw   0x4(%rsp)
+    movq  %r12, 0x8(%rsp)
+    movq  %r13, 0x10(%rsp)
+    movq  %r14, 0x18(%rsp)
+    movq  %r15, 0x20(%rsp)
+    movq  %rbx, 0x28(%rsp)
+    movq  %rbp, 0x30(%rsp)
+
+    /* the suspended context is its stack pointer */
+    movq  %rsp, %rax
+    movq  %rdi, %rsp
+
+    movq  0x38(%rsp), %r8
+    ldmxcsr  (%rsp)
+    fldcw    0x4(%rsp)
+    movq  0x8(%rsp), %r12
+    movq  0x10(%rsp), %r13
+    movq  0x18(%rsp), %r14
+    movq  0x20(%rsp), %r15
+    movq  0x28(%rsp), %rbx
+    movq  0x30(%rsp), %rbp
+    leaq  0x40(%rsp), %rsp
+
+    /* transfer_t {rax, rdx} is both the return value of jump_fcontext() */
+    /* and, in rdi/rsi, the argument of a context function entered first time */
+    movq  %rsi, %rdx
+    movq  %rax, %rdi
+    jmp  *%r8
+.size jump_fcontext,.-jump_fcontext
+
+.globl make_fcontext
+.type make_fcontext,@function
+.align 16
+make_fcontext:
+    movq  %rdi, %rax
+    andq  $-16, %rax
+    leaq  -0x40(%rax), %rax
+
+    /* the trampoline finds fn in rbx */
+    movq  %rdx, 0x28(%rax)
+    stmxcsr  (%rax)
+    fnstcw   0x4(%rax)
+
+    leaq  .Lfcontext_trampoline(%rip), %rcx
+    movq  %rcx, 0x38(%rax)
+    leaq  .Lfcontext_finish(%rip), %rcx
+    movq  %rcx, 0x30(%rax)
+    ret
+
+.Lfcontext_trampoline:
+    /* push finish as the return address of fn, which also aligns the stack like a call */
+    push %rbp
+    jmp *%rbx
+
+.Lfcontext_finish:
+    xorq  %rdi, %rdi
+    call  _exit@PLT
+    hlt
+.size make_fcontext,.-make_fcontext
+)");
+
+#elif defined(__aarch64__)
+
+/*
+ * context-data layout, low to high:
+ *   0x00 d8-d15 | 0x40 x19-x28 | 0x90 fp | 0x98 lr | 0xa0 pc
+ */
+asm(R"(
+.text
+.globl jump_fcontext
+.type jump_fcontext,%function
+.align 4
+jump_fcontext:
+    sub  sp, sp, #0xb0
+
+    stp  d8,  d9,  [sp, #0x00]
+    stp  d10, d11, [sp, #0x10]
+    stp  d12, d13, [sp, #0x20]
+    stp  d14, d15, [sp, #0x30]
+    stp  x19, x20, [sp, #0x40]
+    stp  x21, x22, [sp, #0x50]
+    stp  x23, x24, [sp, #0x60]
+    stp  x25, x26, [sp, #0x70]
+    stp  x27, x28, [sp, #0x80]
+    stp  x29, x30, [sp, #0x90]
+    str  x30, [sp, #0xa0]
+
+    /* the suspended context is its stack pointer */
+    mov  x4, sp
+    mov  sp, x0
+
+    ldp  d8,  d9,  [sp, #0x00]
+    ldp  d10, d11, [sp, #0x10]
+    ldp  d12, d13, [sp, #0x20]
+    ldp  d14, d15, [sp, #0x30]
+    ldp  x19, x20, [sp, #0x40]
+    ldp  x21, x22, [sp, #0x50]
+    ldp  x23, x24, [sp, #0x60]
+    ldp  x25, x26, [sp, #0x70]
+    ldp  x27, x28, [sp, #0x80]
+    ldp  x29, x30, [sp, #0x90]
+
+    /* transfer_t {x0, x1}, data is still in x1 */
+    mov  x0, x4
+    ldr  x4, [sp, #0xa0]
+    add  sp, sp, #0xb0
+    ret  x4
+.size jump_fcontext,.-jump_fcontext
+
+.globl make_fcontext
+.type make_fcontext,%function
+.align 4
+make_fcontext:
+    and  x0, x0, ~0xF
+    sub  x0, x0, #0xb0
+
+    /* enter fn with finish as its return address */
+    str  x2, [x0, #0xa0]
+    adr  x1, .Lfcontext_finish
+    str  x1, [x0, #0x98]
+    ret  x30
+
+.Lfcontext_finish:
+    mov  x0, #0
+    bl  _exit
+.size make_fcontext,.-make_fcontext
+)");
+
+#endif
+
+#endif  // FIBER_USE_UCONTEXT
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @file fcontext.h
+ * @brief minimal user space context switch in assembly, after boost.context's fcontext
+ * @details jump_fcontext() saves only what the ABI requires a callee to preserve (the
+ * callee-saved registers, the SSE control/status word and the x87 control word on x86-64,
+ * x19-x30 and d8-d15 on aarch64) on the current stack and switches stacks. Unlike
+ * swapcontext() it neither saves the full FPU state nor makes an rt_sigprocmask syscall,
+ * so the signal mask is per thread, not per context.
+ *
+ * Fiber and the uthread library use it unless FIBER_USE_UCONTEXT is defined, which is also
+ * the fallback on other architectures.
+ */
+
+#if !defined(FIBER_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define FIBER_USE_UCONTEXT 1
+#endif
+
+#ifndef FIBER_USE_UCONTEXT
+
+/// a suspended context, points into the stack it was suspended on
+typedef void *fcontext_t;
+
+/// what a jump delivers to the resumed side
+struct transfer_t {
+    /// the context that jumped, resuming it continues after its jump_fcontext()
+    fcontext_t fctx;
+    /// the data argument of that jump
+    void *data;
+};
+
+extern "C" {
+
+/**
+ * @brief suspend the current context and resume `to`
+ * @return the transfer of the jump that eventually resumes this context
+ */
+transfer_t jump_fcontext(fcontext_t const to, void *data);
+
+/**
+ * @brief prepare a context on a stack, fn(transfer) runs on the first jump to it
+ * @param sp top (highest address) of the stack
+ * @param size size of the stack, unused but kept for symmetry with boost.context
+ * @note fn must never return, the process exits if it does
+ */
+fcontext_t make_fcontext(void *sp, size_t size, void (*fn)(transfer_t));
+
+}
+
+/**
+ * @brief jump to `to`; `from` is where the current context is stored once it is suspended
+ * @details the resumed side stores the transfer into the slot it receives as data, so a
+ * context is only resumable after the jump has landed. Contexts that finished jump with
+ * nullptr data instead.
+ */
+inline void swap_fcontext(fcontext_t *from, fcontext_t to) {
+    transfer_t t = jump_fcontext(to, from);
+    if (t.data != nullptr) {
+        *static_cast<fcontext_t *>(t.data) = t.fctx;
+    }
+}
+
+#endif  // FIBER_USE_UCONTEXT
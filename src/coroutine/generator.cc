@@ -0,0 +1,98 @@
+#include <cstdlib>
+#include <glog/logging.h>
+
+#include "generator.h"
+#include "fiber/fiber_stack.h"
+
+namespace generator_internal {
+
+static constexpr size_t kDefaultStackSize = 128 * 1024;
+
+StackfulContext::StackfulContext(std::function<void()> body, size_t stack_size)
+        : m_body(std::move(body)), m_stack_size(stack_size ? stack_size : kDefaultStackSize) {}
+
+StackfulContext::~StackfulContext() {
+    if (m_started && !m_finished) {
+        // let the suspended body run its destructors
+        m_unwinding = true;
+        resume();
+    }
+    FiberStackAllocator::Dealloc(m_stack, m_stack_size);
+}
+
+bool StackfulContext::resume() {
+    if (m_finished) {
+        return false;
+    }
+    if (!m_started) {
+        m_started = true;
+        m_stack = FiberStackAllocator::Alloc(m_stack_size);
+        if (m_stack == nullptr) {
+            LOG(FATAL) << "allocate generator stack failed, size: " << m_stack_size;
+        }
+#ifdef FIBER_USE_UCONTEXT
+        getcontext(&m_ctx);
+        m_ctx.uc_stack.ss_sp = m_stack;
+        m_ctx.uc_stack.ss_size = m_stack_size;
+        m_ctx.uc_link = &m_caller;
+        makecontext(&m_ctx, reinterpret_cast<void (*)(void)>(Entry), 1, this);
+        swapcontext(&m_caller, &m_ctx);
+#else
+        m_ctx = make_fcontext(static_cast<char *>(m_stack) + m_stack_size, m_stack_size, Entry);
+        transfer_t transfer = jump_fcontext(m_ctx, this);
+        if (transfer.data != nullptr) {
+            *static_cast<fcontext_t *>(transfer.data) = transfer.fctx;
+        }
+#endif
+    } else {
+#ifdef FIBER_USE_UCONTEXT
+        swapcontext(&m_caller, &m_ctx);
+#else
+        swap_fcontext(&m_caller, m_ctx);
+#endif
+    }
+    if (m_exception) {
+        std::rethrow_exception(std::exchange(m_exception, nullptr));
+    }
+    return !m_finished;
+}
+
+void StackfulContext::suspend() {
+#ifdef FIBER_USE_UCONTEXT
+    swapcontext(&m_ctx, &m_caller);
+#else
+    swap_fcontext(&m_ctx, m_caller);
+#endif
+    if (m_unwinding) {
+        throw GeneratorUnwind();
+    }
+}
+
+void StackfulContext::run() {
+    try {
+        m_body();
+    } catch (const GeneratorUnwind &) {
+    } catch (...) {
+        m_exception = std::current_exception();
+    }
+    // captures of the body go while the stack is still ours
+    m_body = nullptr;
+    m_finished = true;
+}
+
+#ifdef FIBER_USE_UCONTEXT
+void StackfulContext::Entry(StackfulContext *self) {
+    self->run();
+    // returns through uc_link
+}
+#else
+void StackfulContext::Entry(transfer_t transfer) {
+    auto *self = static_cast<StackfulContext *>(transfer.data);
+    self->m_caller = transfer.fctx;
+    self->run();
+    // finished, there is nothing to save
+    jump_fcontext(self->m_caller, nullptr);
+}
+#endif
+
+}  // namespace generator_internal
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "fcontext.h"
+#ifdef FIBER_USE_UCONTEXT
+#include <ucontext.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include "coro_frame_pool.h"
+#define GENERATOR_HAS_COROUTINES 1
+#endif
+
+/**
+ * @file generator.h
+ * @brief lazy sequences of values, pulled one at a time
+ * @details a Generator<T> hands out a pointer to its current value, valid until the
+ * next value is pulled, so nothing is copied or collected on the way. Values come from
+ * a GeneratorSource:
+ *  - a body run on its own stack, which calls yield(value) anywhere down its call
+ *    chain; it is switched to and from with fcontext like the uthreads, on a stack of
+ *    FiberStackAllocator, and works in C++17;
+ *  - a C++20 coroutine that co_yields, when the compiler has them;
+ *  - a plain object implementing next(), like the combinators of pipeline.h.
+ *
+ *     Generator<int> naturals([](Generator<int>::Yield &yield) {
+ *         for (int i = 0;; ++i) yield(i);
+ *     });
+ *     for (int i: std::move(naturals) | Filter(odd) | Take(3)) ...
+ *
+ * A generator dropped before its end unwinds the suspended body: yield() throws
+ * GeneratorUnwind, which the body must not swallow. An exception escaping the body is
+ * rethrown by the next pull.
+ */
+
+template<typename T>
+class GeneratorSource {
+public:
+    virtual ~GeneratorSource() = default;
+
+    /**
+     * @brief advance to the next value
+     * @return the value, owned by the source until the next call; nullptr at the end
+     */
+    virtual T *next() = 0;
+};
+
+/// thrown by yield() into a body whose generator is destroyed before the body ended
+struct GeneratorUnwind {
+};
+
+namespace generator_internal {
+
+/**
+ * @brief the stack and context of a generator body
+ */
+class StackfulContext {
+public:
+    StackfulContext(std::function<void()> body, size_t stack_size);
+
+    ~StackfulContext();
+
+    StackfulContext(const StackfulContext &) = delete;
+
+    StackfulContext &operator=(const StackfulContext &) = delete;
+
+    /**
+     * @brief run the body until it suspends or ends
+     * @return false once the body ended, rethrows what escaped it
+     */
+    bool resume();
+
+    /// from the body: back to the caller of resume(), throws GeneratorUnwind when destroyed
+    void suspend();
+
+private:
+    void run();
+
+#ifdef FIBER_USE_UCONTEXT
+    static void Entry(StackfulContext *self);
+#else
+    static void Entry(transfer_t transfer);
+#endif
+
+private:
+    std::function<void()> m_body;
+    void *m_stack{nullptr};
+    size_t m_stack_size;
+    bool m_started{false};
+    bool m_finished{false};
+    bool m_unwinding{false};
+    std::exception_ptr m_exception;
+#ifdef FIBER_USE_UCONTEXT
+    ucontext_t m_ctx{};
+    ucontext_t m_caller{};
+#else
+    fcontext_t m_ctx{nullptr};
+    fcontext_t m_caller{nullptr};
+#endif
+};
+
+/// values yielded by a body, pointing into its frame while it is suspended
+template<typename T>
+class StackfulSource : public GeneratorSource<T> {
+public:
+    template<typename Body>
+    StackfulSource(Body &&body, size_t stack_size);
+
+    T *next() override {
+        m_current = nullptr;
+        m_copy.reset();
+        if (!m_context.resume()) {
+            return nullptr;
+        }
+        return m_current;
+    }
+
+    void yield(T &value) {
+        m_current = &value;
+        m_context.suspend();
+    }
+
+    void yieldCopy(const T &value) {
+        m_copy.emplace(value);
+        m_current = &*m_copy;
+        m_context.suspend();
+    }
+
+private:
+    T *m_current{nullptr};
+    std::optional<std::remove_const_t<T>> m_copy;
+    StackfulContext m_context;
+};
+
+}  // namespace generator_internal
+
+template<typename T>
+class Generator {
+public:
+    using value_type = T;
+
+    /// what a body calls with each value
+    class Yield {
+    public:
+        void operator()(std::remove_const_t<T> &&value) { m_source->yield(value); }
+
+        void operator()(T &value) { m_source->yield(value); }
+
+        template<typename U = T, typename = std::enable_if_t<!std::is_const_v<U>>>
+        void operator()(const std::remove_const_t<U> &value) { m_source->yieldCopy(value); }
+
+    private:
+        friend class generator_internal::StackfulSource<T>;
+
+        explicit Yield(generator_internal::StackfulSource<T> *source) : m_source(source) {}
+
+        generator_internal::StackfulSource<T> *m_source;
+    };
+
+    Generator() = default;
+
+    explicit Generator(std::unique_ptr<GeneratorSource<T>> source) : m_source(std::move(source)) {}
+
+    /**
+     * @brief run body(yield) on its own stack, lazily, as values are pulled
+     * @param stack_size 0 for the default of 128KB
+     */
+    template<typename Body, typename = std::enable_if_t<std::is_invocable_v<Body &, Yield &>>>
+    explicit Generator(Body body, size_t stack_size = 0)
+            : m_source(std::make_unique<generator_internal::StackfulSource<T>>(std::move(body), stack_size)) {}
+
+    Generator(Generator &&) noexcept = default;
+
+    Generator &operator=(Generator &&) noexcept = default;
+
+    /**
+     * @brief the next value, valid until the next call; nullptr at the end
+     */
+    T *next() { return m_source ? m_source->next() : nullptr; }
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::remove_const_t<T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = T *;
+        using reference = T &;
+
+        iterator() = default;
+
+        explicit iterator(Generator *generator) : m_generator(generator), m_value(generator->next()) {}
+
+        reference operator*() const { return *m_value; }
+
+        pointer operator->() const { return m_value; }
+
+        iterator &operator++() {
+            m_value = m_generator->next();
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(const iterator &other) const { return m_value == other.m_value; }
+
+        bool operator!=(const iterator &other) const { return m_value != other.m_value; }
+
+    private:
+        Generator *m_generator{nullptr};
+        T *m_value{nullptr};
+    };
+
+    /// single pass, begin() pulls the first value
+    iterator begin() { return iterator(this); }
+
+    iterator end() { return iterator(); }
+
+#ifdef GENERATOR_HAS_COROUTINES
+    class promise_type;
+#endif
+
+private:
+    std::unique_ptr<GeneratorSource<T>> m_source;
+};
+
+template<typename T>
+template<typename Body>
+generator_internal::StackfulSource<T>::StackfulSource(Body &&body, size_t stack_size)
+        : m_context([this, body = std::forward<Body>(body)]() mutable {
+                        typename Generator<T>::Yield yield(this);
+                        body(yield);
+                    }, stack_size) {}
+
+#ifdef GENERATOR_HAS_COROUTINES
+
+/// a coroutine returning Generator<T> co_yields its values
+template<typename T>
+class Generator<T>::promise_type {
+public:
+    static void *operator new(size_t size) { return CoroFramePool::Alloc(size); }
+
+    static void operator delete(void *vp, size_t size) { CoroFramePool::Dealloc(vp, size); }
+
+    Generator<T> get_return_object() {
+        return Generator<T>(std::make_unique<CoroSource>(std::coroutine_handle<promise_type>::from_promise(*this)));
+    }
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+
+    std::suspend_always final_suspend() const noexcept { return {}; }
+
+    std::suspend_always yield_value(T &value) noexcept {
+        m_current = &value;
+        return {};
+    }
+
+    std::suspend_always yield_value(std::remove_const_t<T> &&value) noexcept {
+        m_current = &value;
+        return {};
+    }
+
+    template<typename U = T, typename = std::enable_if_t<!std::is_const_v<U>>>
+    std::suspend_always yield_value(const std::remove_const_t<U> &value) {
+        m_copy.emplace(value);
+        m_current = &*m_copy;
+        return {};
+    }
+
+    void return_void() const noexcept {}
+
+    void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+    /// drives the coroutine, the yielded value lives in its frame until the next resume
+    class CoroSource : public GeneratorSource<T> {
+    public:
+        explicit CoroSource(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+        ~CoroSource() override { m_handle.destroy(); }
+
+        T *next() override {
+            promise_type &promise = m_handle.promise();
+            promise.m_current = nullptr;
+            promise.m_copy.reset();
+            if (m_handle.done()) {
+                return nullptr;
+            }
+            m_handle.resume();
+            if (promise.m_exception) {
+                std::rethrow_exception(std::exchange(promise.m_exception, nullptr));
+            }
+            return m_handle.done() ? nullptr : promise.m_current;
+        }
+
+    private:
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+private:
+    T *m_current{nullptr};
+    std::optional<std::remove_const_t<T>> m_copy;
+    std::exception_ptr m_exception;
+};
+
+#endif  // GENERATOR_HAS_COROUTINES
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "generator.h"
+
+/**
+ * @file pipeline.h
+ * @brief streaming stages over Generator<T>
+ * @details each stage is a GeneratorSource pulling from the one before it as its own
+ * values are pulled, on the caller's stack, so a pipeline holds one value per stage and
+ * never materializes a whole stage.
+ *
+ *     auto lines = ReadLines(in) | Filter([](const std::string &l) { return !l.empty(); })
+ *                                | Map([](const std::string &l) { return l.size(); })
+ *                                | Batch(1024);
+ *     for (std::vector<size_t> &batch: lines) ...
+ *
+ * Map and FlatMap move the upstream value into the function, Filter and Take pass the
+ * upstream values through. A function taking a const reference leaves the value, and
+ * the buffers of ReadLines(), to be reused.
+ */
+
+namespace pipeline_internal {
+
+template<typename T, typename It>
+class RangeSource : public GeneratorSource<T> {
+public:
+    RangeSource(It begin, It end) : m_it(begin), m_end(end) {}
+
+    T *next() override {
+        if (m_started && m_it != m_end) {
+            ++m_it;
+        }
+        m_started = true;
+        return m_it == m_end ? nullptr : &*m_it;
+    }
+
+private:
+    It m_it;
+    It m_end;
+    bool m_started{false};
+};
+
+/// a range moved into the generator
+template<typename Range>
+class OwningRangeSource : public GeneratorSource<std::remove_reference_t<decltype(*std::begin(std::declval<Range &>()))>> {
+public:
+    using T = std::remove_reference_t<decltype(*std::begin(std::declval<Range &>()))>;
+
+    explicit OwningRangeSource(Range &&range)
+            : m_range(std::move(range)), m_source(std::begin(m_range), std::end(m_range)) {}
+
+    T *next() override { return m_source.next(); }
+
+private:
+    Range m_range;
+    RangeSource<T, decltype(std::begin(std::declval<Range &>()))> m_source;
+};
+
+class SplitSource : public GeneratorSource<std::string_view> {
+public:
+    SplitSource(std::string_view str, char delim, size_t max) : m_rest(str), m_delim(delim), m_max(max) {
+        m_done = str.empty();
+    }
+
+    std::string_view *next() override {
+        if (m_done) {
+            return nullptr;
+        }
+        const size_t pos = --m_max == 0 ? std::string_view::npos : m_rest.find(m_delim);
+        if (pos == std::string_view::npos) {
+            m_piece = m_rest;
+            m_done = true;
+        } else {
+            m_piece = m_rest.substr(0, pos);
+            m_rest.remove_prefix(pos + 1);
+        }
+        return &m_piece;
+    }
+
+private:
+    std::string_view m_rest;
+    std::string_view m_piece;
+    char m_delim;
+    size_t m_max;
+    bool m_done;
+};
+
+class LineSource : public GeneratorSource<std::string> {
+public:
+    explicit LineSource(std::istream &in) : m_in(in) {}
+
+    std::string *next() override {
+        // the line buffer keeps its capacity unless a later stage moves the line out,
+        // as a Map taking std::string by value does
+        return std::getline(m_in, m_line) ? &m_line : nullptr;
+    }
+
+private:
+    std::istream &m_in;
+    std::string m_line;
+};
+
+template<typename T, typename U, typename F>
+class MapSource : public GeneratorSource<U> {
+public:
+    MapSource(Generator<T> upstream, F fn) : m_upstream(std::move(upstream)), m_fn(std::move(fn)) {}
+
+    U *next() override {
+        T *in = m_upstream.next();
+        if (in == nullptr) {
+            return nullptr;
+        }
+        m_value.reset();
+        m_value.emplace(std::invoke(m_fn, std::move(*in)));
+        return &*m_value;
+    }
+
+private:
+    Generator<T> m_upstream;
+    F m_fn;
+    std::optional<U> m_value;
+};
+
+template<typename T, typename P>
+class FilterSource : public GeneratorSource<T> {
+public:
+    FilterSource(Generator<T> upstream, P pred) : m_upstream(std::move(upstream)), m_pred(std::move(pred)) {}
+
+    T *next() override {
+        while (T *in = m_upstream.next()) {
+            if (std::invoke(m_pred, std::as_const(*in))) {
+                return in;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    Generator<T> m_upstream;
+    P m_pred;
+};
+
+template<typename T>
+class TakeSource : public GeneratorSource<T> {
+public:
+    TakeSource(Generator<T> upstream, size_t n) : m_upstream(std::move(upstream)), m_left(n) {}
+
+    T *next() override {
+        // stop pulling at once, the upstream may be endless
+        if (m_left == 0) {
+            return nullptr;
+        }
+        --m_left;
+        return m_upstream.next();
+    }
+
+private:
+    Generator<T> m_upstream;
+    size_t m_left;
+};
+
+template<typename T>
+class BatchSource : public GeneratorSource<std::vector<std::remove_const_t<T>>> {
+public:
+    using Batch = std::vector<std::remove_const_t<T>>;
+
+    BatchSource(Generator<T> upstream, size_t n) : m_upstream(std::move(upstream)), m_size(n ? n : 1) {}
+
+    Batch *next() override {
+        // a batch moved out by the consumer is left valid but unspecified
+        m_batch.clear();
+        m_batch.reserve(m_size);
+        while (m_batch.size() < m_size) {
+            T *in = m_upstream.next();
+            if (in == nullptr) {
+                break;
+            }
+            m_batch.push_back(std::move(*in));
+        }
+        return m_batch.empty() ? nullptr : &m_batch;
+    }
+
+private:
+    Generator<T> m_upstream;
+    const size_t m_size;
+    Batch m_batch;
+};
+
+template<typename T, typename U, typename F>
+class FlatMapSource : public GeneratorSource<U> {
+public:
+    FlatMapSource(Generator<T> upstream, F fn) : m_upstream(std::move(upstream)), m_fn(std::move(fn)) {}
+
+    U *next() override {
+        while (true) {
+            if (m_inner) {
+                if (U *value = m_inner->next()) {
+                    return value;
+                }
+            }
+            T *in = m_upstream.next();
+            if (in == nullptr) {
+                return nullptr;
+            }
+            m_inner.reset();
+            m_inner.emplace(std::invoke(m_fn, std::move(*in)));
+        }
+    }
+
+private:
+    Generator<T> m_upstream;
+    F m_fn;
+    std::optional<Generator<U>> m_inner;
+};
+
+template<typename F>
+struct MapStage {
+    F fn;
+};
+
+template<typename P>
+struct FilterStage {
+    P pred;
+};
+
+template<typename F>
+struct FlatMapStage {
+    F fn;
+};
+
+struct TakeStage {
+    size_t n;
+};
+
+struct BatchStage {
+    size_t n;
+};
+
+template<typename G>
+struct GeneratorValue;
+
+template<typename U>
+struct GeneratorValue<Generator<U>> {
+    using type = U;
+};
+
+}  // namespace pipeline_internal
+
+/**
+ * @brief the elements of range, which must outlive the generator
+ * @details they are const, the stages after copy instead of moving them out of range
+ */
+template<typename Range>
+auto From(const Range &range) {
+    using T = std::remove_reference_t<decltype(*std::begin(range))>;
+    using It = decltype(std::begin(range));
+    return Generator<T>(std::make_unique<pipeline_internal::RangeSource<T, It>>(std::begin(range), std::end(range)));
+}
+
+/**
+ * @brief the elements of a range moved into the generator
+ */
+template<typename Range, typename = std::enable_if_t<!std::is_lvalue_reference_v<Range>>>
+auto From(Range &&range) {
+    using Source = pipeline_internal::OwningRangeSource<Range>;
+    return Generator<typename Source::T>(std::make_unique<Source>(std::move(range)));
+}
+
+/**
+ * @brief the lines of in without their '\n', read as they are pulled
+ */
+inline Generator<std::string> ReadLines(std::istream &in) {
+    return Generator<std::string>(std::make_unique<pipeline_internal::LineSource>(in));
+}
+
+/**
+ * @brief the pieces of split(str, delim) of str_utils.h, at most max with the rest in the
+ * last one, as views into str found as they are pulled
+ */
+inline Generator<std::string_view> splitLazy(std::string_view str, char delim, size_t max = ~0) {
+    return Generator<std::string_view>(std::make_unique<pipeline_internal::SplitSource>(str, delim, max));
+}
+
+/// fn(value) for every value
+template<typename F>
+pipeline_internal::MapStage<F> Map(F fn) {
+    return {std::move(fn)};
+}
+
+/// the values pred(value) accepts
+template<typename P>
+pipeline_internal::FilterStage<P> Filter(P pred) {
+    return {std::move(pred)};
+}
+
+/// the values of the Generator fn(value) returns, one generator after the other
+template<typename F>
+pipeline_internal::FlatMapStage<F> FlatMap(F fn) {
+    return {std::move(fn)};
+}
+
+/// the first n values, the rest is never produced
+inline pipeline_internal::TakeStage Take(size_t n) {
+    return {n};
+}
+
+/// vectors of n values, the last one may be shorter
+inline pipeline_internal::BatchStage Batch(size_t n) {
+    return {n};
+}
+
+template<typename T, typename F>
+auto operator|(Generator<T> &&upstream, pipeline_internal::MapStage<F> stage) {
+    using U = std::decay_t<std::invoke_result_t<F &, T &&>>;
+    return Generator<U>(std::make_unique<pipeline_internal::MapSource<T, U, F>>(std::move(upstream),
+                                                                                std::move(stage.fn)));
+}
+
+template<typename T, typename P>
+Generator<T> operator|(Generator<T> &&upstream, pipeline_internal::FilterStage<P> stage) {
+    return Generator<T>(std::make_unique<pipeline_internal::FilterSource<T, P>>(std::move(upstream),
+                                                                               std::move(stage.pred)));
+}
+
+template<typename T, typename F>
+auto operator|(Generator<T> &&upstream, pipeline_internal::FlatMapStage<F> stage) {
+    using Inner = std::decay_t<std::invoke_result_t<F &, T &&>>;
+    using U = typename pipeline_internal::GeneratorValue<Inner>::type;
+    return Generator<U>(std::make_unique<pipeline_internal::FlatMapSource<T, U, F>>(std::move(upstream),
+                                                                                    std::move(stage.fn)));
+}
+
+template<typename T>
+Generator<T> operator|(Generator<T> &&upstream, pipeline_internal::TakeStage stage) {
+    return Generator<T>(std::make_unique<pipeline_internal::TakeSource<T>>(std::move(upstream), stage.n));
+}
+
+template<typename T>
+Generator<std::vector<std::remove_const_t<T>>> operator|(Generator<T> &&upstream, pipeline_internal::BatchStage stage) {
+    using Batch = std::vector<std::remove_const_t<T>>;
+    return Generator<Batch>(std::make_unique<pipeline_internal::BatchSource<T>>(std::move(upstream), stage.n));
+}
+
+/**
+ * @brief pull every value into a vector, the end of a pipeline that needs them all
+ */
+template<typename T>
+std::vector<std::remove_const_t<T>> Collect(Generator<T> &&generator) {
+    std::vector<std::remove_const_t<T>> values;
+    while (T *value = generator.next()) {
+        values.push_back(std::move(*value));
+    }
+    return values;
+}
@@ -0,0 +1,227 @@
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+#include <unistd.h>
+
+#include "uthread.h"
+#include "fiber/fiber_stack.h"
+
+/// uthread running on this thread, for the overflow report
+static thread_local uthread_t *t_running_uthread = nullptr;
+
+static struct sigaction s_prev_segv_action;
+static size_t s_page_size = 0;
+
+/// the overflowing uthread cannot run a handler on its own stack
+static constexpr size_t kAltStackSize = 64 * 1024;
+
+static void OverflowHandler(int, siginfo_t *info, void *) {
+    const uthread_t *t = t_running_uthread;
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(info->si_addr);
+    if (t && t->stack) {
+        const uintptr_t low = reinterpret_cast<uintptr_t>(t->stack);
+        if (addr < low && addr >= low - s_page_size) {
+            static const char kMessage[] = "uthread stack overflow, the fault hit the guard page of its stack\n";
+            ssize_t n = write(STDERR_FILENO, kMessage, sizeof(kMessage) - 1);
+            (void) n;
+        }
+    }
+    // the faulting instruction runs again and meets the previous handler or the default action
+    sigaction(SIGSEGV, &s_prev_segv_action, nullptr);
+}
+
+static void InstallOverflowHandler() {
+    s_page_size = FiberStackAllocator::PageSize();
+    struct sigaction action{};
+    action.sa_sigaction = OverflowHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &s_prev_segv_action);
+}
+
+/// an alternate signal stack for the thread, unless it already has one
+class AltSignalStack {
+public:
+    AltSignalStack() {
+        stack_t old{};
+        if (sigaltstack(nullptr, &old) == 0 && !(old.ss_flags & SS_DISABLE)) {
+            return;
+        }
+        m_stack = malloc(kAltStackSize);
+        stack_t ss{};
+        ss.ss_sp = m_stack;
+        ss.ss_size = kAltStackSize;
+        if (sigaltstack(&ss, nullptr) != 0) {
+            free(m_stack);
+            m_stack = nullptr;
+        }
+    }
+
+    ~AltSignalStack() {
+        if (m_stack) {
+            stack_t ss{};
+            ss.ss_flags = SS_DISABLE;
+            sigaltstack(&ss, nullptr);
+            free(m_stack);
+        }
+    }
+
+private:
+    void *m_stack{nullptr};
+};
+
+static void PrepareOverflowReport() {
+    static std::once_flag s_install;
+    std::call_once(s_install, InstallOverflowHandler);
+    static thread_local AltSignalStack t_alt_stack;
+}
+
+/// a finished uthread gives its stack back and its slot to the free list
+static void recycle(schedule_t &schedule, int id) {
+    uthread_t *t = schedule.threads[id].get();
+    FiberStackAllocator::Dealloc(t->stack, t->stack_size);
+    t->stack = nullptr;
+    t->func = nullptr;
+    t->arg = nullptr;
+    // a stale entry in the ready queue stays accounted for by queued
+    t->next_free = schedule.free_head;
+    schedule.free_head = id;
+    --schedule.live;
+}
+
+static void uthread_body(schedule_t *ps) {
+    uthread_t *t = ps->threads[ps->running_thread].get();
+    std::invoke(t->func, t->arg);
+    t->state = ThreadState::FREE;
+}
+
+#ifndef FIBER_USE_UCONTEXT
+/// entered by the first jump of uthread_resume(), which passes the schedule as data
+static void uthread_fcontext_body(transfer_t transfer) {
+    schedule_t *ps = static_cast<schedule_t *>(transfer.data);
+    ps->main = transfer.fctx;
+    uthread_body(ps);
+    // finished, there is nothing to save: the counterpart of uc_link
+    jump_fcontext(ps->main, nullptr);
+}
+#endif
+
+schedule_t::~schedule_t() {
+    // uthreads that never finished are dropped with their frames
+    for (auto &t: threads) {
+        if (t->stack) {
+            FiberStackAllocator::Dealloc(t->stack, t->stack_size);
+        }
+    }
+}
+
+int uthread_create(schedule_t &schedule, Func func, void *arg, size_t stack_size) {
+    if (stack_size == 0) {
+        stack_size = DEFAULT_STACK_SZIE;
+    }
+    void *stack = FiberStackAllocator::Alloc(stack_size);
+    if (stack == nullptr) {
+        return -1;
+    }
+    int id = schedule.free_head;
+    if (id >= 0) {
+        schedule.free_head = schedule.threads[id]->next_free;
+    } else {
+        id = static_cast<int>(schedule.threads.size());
+        schedule.threads.push_back(std::make_unique<uthread_t>());
+    }
+    uthread_t *t = schedule.threads[id].get();
+    t->func = std::move(func);
+    t->arg = arg;
+    t->stack = stack;
+    t->stack_size = stack_size;
+    t->next_free = -1;
+    t->state = ThreadState::RUNNABLE;
+    ++schedule.live;
+
+    if (schedule.running_thread == -1) {
+        uthread_resume(schedule, id);
+    } else if (!t->queued) {
+        t->queued = true;
+        schedule.ready.push_back(id);
+    }
+    return id;
+}
+
+void uthread_yield(schedule_t &schedule) {
+    if (schedule.running_thread == -1) {
+        return;
+    }
+    const int id = schedule.running_thread;
+    uthread_t *t = schedule.threads[id].get();
+    t->state = ThreadState::SUSPEND;
+    if (!t->queued) {
+        t->queued = true;
+        schedule.ready.push_back(id);
+    }
+#ifdef FIBER_USE_UCONTEXT
+    swapcontext(&(t->ctx), &(schedule.main));
+#else
+    swap_fcontext(&(t->ctx), schedule.main);
+#endif
+}
+
+void uthread_resume(schedule_t &schedule, int id) {
+    if (id < 0 || id >= static_cast<int>(schedule.threads.size()) || schedule.running_thread != -1) {
+        return;
+    }
+    uthread_t *t = schedule.threads[id].get();
+    if (t->state != ThreadState::RUNNABLE && t->state != ThreadState::SUSPEND) {
+        return;
+    }
+    PrepareOverflowReport();
+    const bool start = t->state == ThreadState::RUNNABLE;
+    t->state = ThreadState::RUNNING;
+    schedule.running_thread = id;
+    uthread_t *prev_running = t_running_uthread;
+    t_running_uthread = t;
+
+#ifdef FIBER_USE_UCONTEXT
+    if (start) {
+        getcontext(&(t->ctx));
+        t->ctx.uc_stack.ss_sp = t->stack;
+        t->ctx.uc_stack.ss_size = t->stack_size;
+        t->ctx.uc_stack.ss_flags = 0;
+        t->ctx.uc_link = &(schedule.main);
+        makecontext(&(t->ctx), reinterpret_cast<void (*)(void)>(uthread_body), 1, &schedule);
+    }
+    swapcontext(&(schedule.main), &(t->ctx));
+#else
+    if (start) {
+        t->ctx = make_fcontext(static_cast<char *>(t->stack) + t->stack_size, t->stack_size,
+                               uthread_fcontext_body);
+        transfer_t transfer = jump_fcontext(t->ctx, &schedule);
+        if (transfer.data != nullptr) {
+            *static_cast<fcontext_t *>(transfer.data) = transfer.fctx;
+        }
+    } else {
+        swap_fcontext(&(schedule.main), t->ctx);
+    }
+#endif
+
+    t_running_uthread = prev_running;
+    schedule.running_thread = -1;
+    if (t->state == ThreadState::FREE) {
+        recycle(schedule, id);
+    }
+}
+
+void uthread_run_until_finished(schedule_t &schedule) {
+    while (schedule.live > 0 && !schedule.ready.empty()) {
+        const int id = schedule.ready.front();
+        schedule.ready.pop_front();
+        schedule.threads[id]->queued = false;
+        uthread_resume(schedule, id);
+    }
+}
+
+int schedule_finished(const schedule_t &schedule) {
+    return schedule.running_thread == -1 && schedule.live == 0;
+}
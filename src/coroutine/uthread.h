@@ -1,16 +1,29 @@
 #pragma once
 
-#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <cstdio>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <thread>
+#include <vector>
+
+#include "fcontext.h"
+#ifdef FIBER_USE_UCONTEXT
 #include <ucontext.h>
-#include <utility>
+#endif
+
+/**
+ * @file uthread.h
+ * @brief a tiny single-threaded uthread engine, one schedule_t per thread or connection
+ * @details a schedule owns no memory up front. Stacks come from FiberStackAllocator when
+ * a uthread is created and go back to its caches when the uthread finishes, so they are
+ * mapped lazily, recycled, and have a guard page below them: a uthread overflowing its
+ * stack is reported on stderr before the process dies of the SIGSEGV. Finished slots
+ * are kept on a free list and reused in O(1), there is no limit on the number of
+ * uthreads.
+ */
 
 static constexpr size_t DEFAULT_STACK_SZIE = 1024 * 128;
-static constexpr size_t MAX_UTHREAD_SIZE = 1024;
 using Func = std::function<void(void *)>;
 
 enum class ThreadState : uint8_t {
@@ -20,127 +33,70 @@ enum class ThreadState : uint8_t {
     SUSPEND = 3,
 };
 
-struct schedule_t;
+#ifdef FIBER_USE_UCONTEXT
+using uthread_context_t = ucontext_t;
+#else
+using uthread_context_t = fcontext_t;
+#endif
 
 struct uthread_t {
-    ucontext_t ctx;
+    uthread_context_t ctx{};
     Func func;
-    void *arg;
-    ThreadState state;
-    char stack[DEFAULT_STACK_SZIE];
-
-    uthread_t()
-            : ctx{}, func(nullptr), arg(nullptr), state(ThreadState::FREE), stack{} {}
+    void *arg{nullptr};
+    ThreadState state{ThreadState::FREE};
+    /// whether the id is in the ready queue of the schedule
+    bool queued{false};
+    /// lowest usable address of the stack, nullptr while the slot is free
+    void *stack{nullptr};
+    size_t stack_size{0};
+    /// next free slot while FREE, -1 at the end of the list
+    int next_free{-1};
 };
 
 struct schedule_t {
-    ucontext_t main;
-    int running_thread;
-    int max_index;
-    uthread_t *threads;
+    uthread_context_t main{};
+    /// id of the uthread running, -1 in the scheduling context
+    int running_thread{-1};
+    /// uthreads not yet finished
+    size_t live{0};
+    int free_head{-1};
+    /// slots are never moved, ids and contexts stay valid
+    std::vector<std::unique_ptr<uthread_t>> threads;
+    /// ids to resume in order by uthread_run_until_finished()
+    std::deque<int> ready;
 
-    schedule_t()
-            : running_thread{-1},
-              max_index{0},
-              threads{new uthread_t[MAX_UTHREAD_SIZE]} {}
+    schedule_t() = default;
 
-    ~schedule_t() { delete[] threads; }
-};
+    ~schedule_t();
+
+    schedule_t(const schedule_t &) = delete;
 
-static void uthread_body(schedule_t *ps);
+    schedule_t &operator=(const schedule_t &) = delete;
+};
 
 /**
- * @brief create uthreads
- * @param schedule
- * @return
+ * @brief create a uthread running func(arg)
+ * @details called from the scheduling context, the uthread runs at once until it yields
+ * or finishes; called from a uthread, it is only queued to run
+ * @param stack_size 0 for DEFAULT_STACK_SZIE
+ * @return id of the uthread, reused once it finished
  */
-int uthread_create(schedule_t &schedule, Func func, void *args);
+int uthread_create(schedule_t &schedule, Func func, void *arg, size_t stack_size = 0);
 
+/**
+ * @brief suspend the running uthread and go back to the scheduling context
+ * @details the uthread is queued again for uthread_run_until_finished()
+ */
 void uthread_yield(schedule_t &schedule);
 
+/**
+ * @brief run uthread id until it yields or finishes, from the scheduling context
+ */
 void uthread_resume(schedule_t &schedule, int id);
 
-int schedule_finished(const schedule_t &schedule);
-
-void uthread_resume(schedule_t &schedule, int id) {
-    if (id < 0 || id >= schedule.max_index) {
-        return;
-    }
-
-    uthread_t *t = &(schedule.threads[id]);
-
-    if (t->state == ThreadState::SUSPEND) {
-        swapcontext(&(schedule.main), &(t->ctx));
-    }
-}
-
-void uthread_yield(schedule_t &schedule) {
-    if (schedule.running_thread != -1) {
-        uthread_t *t = &(schedule.threads[schedule.running_thread]);
-        t->state = ThreadState::SUSPEND;
-        schedule.running_thread = -1;
-
-        swapcontext(&(t->ctx), &(schedule.main));
-    }
-}
-
-void uthread_body(schedule_t *ps) {
-    int id = ps->running_thread;
-
-    if (id != -1) {
-        uthread_t *t = &(ps->threads[id]);
-
-        std::invoke(t->func, t->arg);
-
-        t->state = ThreadState::FREE;
-
-        ps->running_thread = -1;
-    }
-}
-
-int uthread_create(schedule_t &schedule, Func func, void *arg) {
-    int id = 0;
-
-    for (id = 0; id < schedule.max_index; ++id) {
-        if (schedule.threads[id].state == ThreadState::FREE) {
-            break;
-        }
-    }
-
-    if (id == schedule.max_index) {
-        schedule.max_index++;
-    }
-
-    uthread_t *t = &(schedule.threads[id]);
-
-    t->state = ThreadState::RUNNABLE;
-    t->func = std::move(func);
-    t->arg = arg;
-
-    getcontext(&(t->ctx));
-
-    t->ctx.uc_stack.ss_sp = t->stack;
-    t->ctx.uc_stack.ss_size = DEFAULT_STACK_SZIE;
-    t->ctx.uc_stack.ss_flags = 0;
-    t->ctx.uc_link = &(schedule.main);
-    schedule.running_thread = id;
-
-    makecontext(&(t->ctx), reinterpret_cast<void (*)(void)>(uthread_body), 1, &schedule);
-    swapcontext(&(schedule.main), &(t->ctx));
-
-    return id;
-}
-
-int schedule_finished(const schedule_t &schedule) {
-    if (schedule.running_thread != -1) {
-        return 0;
-    } else {
-        for (int i = 0; i < schedule.max_index; ++i) {
-            if (schedule.threads[i].state != ThreadState::FREE) {
-                return 0;
-            }
-        }
-    }
+/**
+ * @brief resume the ready uthreads round-robin until all of them finished
+ */
+void uthread_run_until_finished(schedule_t &schedule);
 
-    return 1;
-}
\ No newline at end of file
+int schedule_finished(const schedule_t &schedule);
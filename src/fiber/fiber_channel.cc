@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <memory>
+#include <optional>
+
+#include "fiber_channel.h"
+#include "fiber_iomanager.h"
+
+namespace fiber_internal {
+
+void ChannelWaitQueue::push_back(ChannelWaiter *waiter) {
+    waiter->prev = m_tail;
+    waiter->next = nullptr;
+    if (m_tail) {
+        m_tail->next = waiter;
+    } else {
+        m_head = waiter;
+    }
+    m_tail = waiter;
+    waiter->linked = true;
+}
+
+void ChannelWaitQueue::remove(ChannelWaiter *waiter) {
+    if (waiter->prev) {
+        waiter->prev->next = waiter->next;
+    } else {
+        m_head = waiter->next;
+    }
+    if (waiter->next) {
+        waiter->next->prev = waiter->prev;
+    } else {
+        m_tail = waiter->prev;
+    }
+    waiter->prev = waiter->next = nullptr;
+    waiter->linked = false;
+}
+
+ChannelWaiter *ChannelWaitQueue::popClaimed() {
+    while (m_head) {
+        ChannelWaiter *waiter = m_head;
+        remove(waiter);
+        // a select queued on several channels may have completed elsewhere
+        if (waiter->state->claim(waiter->index)) {
+            return waiter;
+        }
+    }
+    return nullptr;
+}
+
+void ChannelBase::close() {
+    ChannelWaiter *woken = nullptr;
+    {
+        std::lock_guard guard(m_lock);
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        // a receiver only waits on an empty buffer, so all of them fail
+        for (ChannelWaitQueue *queue: {&m_receivers, &m_senders}) {
+            while (ChannelWaiter *waiter = queue->popClaimed()) {
+                waiter->ok = false;
+                waiter->next = woken;
+                woken = waiter;
+            }
+        }
+    }
+    while (woken) {
+        ChannelWaiter *next = woken->next;
+        woken->state->waiter.Wake();
+        woken = next;
+    }
+}
+
+bool ChannelBase::closed() {
+    std::lock_guard guard(m_lock);
+    return m_closed;
+}
+
+/// the distinct channels of a select, locked in address order so selects never deadlock
+class SelectLocks {
+public:
+    SelectLocks(const SelectCase *cases, size_t n) : m_channels(m_inline) {
+        if (n > kInlineNum) {
+            m_heap.resize(n);
+            m_channels = m_heap.data();
+        }
+        for (size_t i = 0; i < n; ++i) {
+            m_channels[i] = cases[i].channel;
+        }
+        std::sort(m_channels, m_channels + n);
+        m_count = std::unique(m_channels, m_channels + n) - m_channels;
+    }
+
+    void lock() {
+        for (size_t i = 0; i < m_count; ++i) {
+            m_channels[i]->m_lock.lock();
+        }
+    }
+
+    void unlock() {
+        for (size_t i = m_count; i > 0; --i) {
+            m_channels[i - 1]->m_lock.unlock();
+        }
+    }
+
+private:
+    static constexpr size_t kInlineNum = 4;
+
+    ChannelBase *m_inline[kInlineNum];
+    std::vector<ChannelBase *> m_heap;
+    ChannelBase **m_channels;
+    size_t m_count{0};
+};
+
+static thread_local uint32_t t_select_start = 0;
+
+int Select(SelectCase *cases, size_t n, bool block, int64_t timeout_ms) {
+    if (n == 0) {
+        return -1;
+    }
+    SelectLocks locks(cases, n);
+    locks.lock();
+    // poll from a rotating case, a select always finding the first one ready would starve the others
+    const size_t start = n > 1 ? t_select_start++ % n : 0;
+    for (size_t k = 0; k < n; ++k) {
+        const size_t i = (start + k) % n;
+        SelectCase &c = cases[i];
+        bool ok = false;
+        ChannelWaiter *peer = nullptr;
+        bool done = c.send ? c.channel->trySendLocked(c.elem, &ok, &peer)
+                           : c.channel->tryRecvLocked(c.elem, &ok, &peer);
+        if (done) {
+            locks.unlock();
+            if (peer) {
+                peer->state->waiter.Wake();
+            }
+            if (c.ok) {
+                *c.ok = ok;
+            }
+            return static_cast<int>(i);
+        }
+    }
+    if (!block) {
+        locks.unlock();
+        return -1;
+    }
+
+    // a timer may fire after the select returned, it holds the state weakly
+    std::shared_ptr<SelectState> timed_state;
+    std::optional<SelectState> local_state;
+    SelectState *state;
+    IOManager *iom = nullptr;
+    if (timeout_ms >= 0) {
+        timed_state = std::make_shared<SelectState>();
+        state = timed_state.get();
+        iom = IOManager::GetThis();
+        if (state->waiter.scheduler && !iom) {
+            // no timers without an IOManager, block the worker for the timeout instead
+            state->waiter.fiber.reset();
+            state->waiter.scheduler = nullptr;
+        }
+    } else {
+        state = &local_state.emplace();
+    }
+
+    ChannelWaiter inline_waiters[4];
+    std::vector<ChannelWaiter> heap_waiters;
+    ChannelWaiter *waiters = inline_waiters;
+    if (n > 4) {
+        heap_waiters.resize(n);
+        waiters = heap_waiters.data();
+    }
+    for (size_t i = 0; i < n; ++i) {
+        ChannelWaiter &waiter = waiters[i];
+        waiter.state = state;
+        waiter.elem = cases[i].elem;
+        waiter.index = static_cast<int>(i);
+        ChannelBase *channel = cases[i].channel;
+        (cases[i].send ? channel->m_senders : channel->m_receivers).push_back(&waiter);
+    }
+    locks.unlock();
+
+    if (timeout_ms < 0) {
+        state->waiter.Park("channel");
+    } else if (state->waiter.scheduler) {
+        std::weak_ptr<SelectState> weak_state = timed_state;
+        FiberTimer::ptr timer = iom->addConditionTimer(timeout_ms, [state] {
+            if (state->claim(SelectState::kTimedOut)) {
+                state->waiter.Wake();
+            }
+        }, weak_state);
+        state->waiter.Park("channel");
+        timer->cancel();
+    } else if (!state->waiter.event.TimedWait(timeout_ms) && !state->claim(SelectState::kTimedOut)) {
+        // a peer claimed the select as the wait timed out, let it finish the hand-off
+        state->waiter.event.Wait();
+    }
+
+    const int index = state->done.load(std::memory_order_acquire);
+    // the peer that completed a case unlinked its waiter, the others are still queued
+    if (n > 1 || index == SelectState::kTimedOut) {
+        locks.lock();
+        for (size_t i = 0; i < n; ++i) {
+            if (waiters[i].linked) {
+                ChannelBase *channel = cases[i].channel;
+                (cases[i].send ? channel->m_senders : channel->m_receivers).remove(&waiters[i]);
+            }
+        }
+        locks.unlock();
+    }
+    if (index == SelectState::kTimedOut) {
+        return -1;
+    }
+    if (cases[index].ok) {
+        *cases[index].ok = waiters[index].ok;
+    }
+    return index;
+}
+
+}  // namespace fiber_internal
@@ -0,0 +1,283 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "fiber_mutex.h"
+#include "fiber_nocopyable.h"
+#include "concurrent/spinlock.h"
+
+/**
+ * @brief Go style channels between fibers and threads
+ * @details a blocked sender or receiver parks like the waiters of FiberMutex: a fiber
+ * yields and its worker runs other fibers, a plain thread blocks on an Event. When the
+ * peer is already waiting, the value is moved straight from the sender's frame into
+ * the receiver's, skipping the buffer.
+ *
+ * ChannelSelect waits on several channel operations at once. It locks the channels in
+ * address order, completes the first ready operation, or queues a waiter on every
+ * channel; all of them point to one SelectState, and the peer that wins the CAS on its
+ * done field is the one that completes the select, stale waiters are skipped.
+ */
+
+namespace fiber_internal {
+
+/// one blocking send, recv or select
+struct SelectState {
+    static constexpr int kTimedOut = -2;
+
+    FiberWaiter waiter;
+    /// index of the case that completed, -1 while none did
+    std::atomic<int> done{-1};
+
+    /// claim the state for the case index, false if another case or the timeout won
+    bool claim(int index) {
+        int expected = -1;
+        return done.compare_exchange_strong(expected, index, std::memory_order_acq_rel);
+    }
+};
+
+/// a case of a SelectState queued on a channel, lives on the stack of the selecting side
+struct ChannelWaiter {
+    SelectState *state{nullptr};
+    /// the value to send, or where to put the received one
+    void *elem{nullptr};
+    int index{0};
+    /// false if the channel was closed
+    bool ok{false};
+    bool linked{false};
+    ChannelWaiter *prev{nullptr};
+    ChannelWaiter *next{nullptr};
+};
+
+/// intrusive FIFO of channel waiters, protected by the lock of its channel
+class ChannelWaitQueue {
+public:
+    bool empty() const { return m_head == nullptr; }
+
+    void push_back(ChannelWaiter *waiter);
+
+    void remove(ChannelWaiter *waiter);
+
+    /// the first waiter whose select could be claimed for it, stale ones are dropped
+    ChannelWaiter *popClaimed();
+
+private:
+    ChannelWaiter *m_head{nullptr};
+    ChannelWaiter *m_tail{nullptr};
+};
+
+class ChannelBase;
+class SelectLocks;
+
+/// an operation of a select
+struct SelectCase {
+    ChannelBase *channel;
+    bool send;
+    void *elem;
+    bool *ok;
+};
+
+/**
+ * @brief complete one of the cases, parking until one is ready if block
+ * @param timeout_ms < 0 to wait forever
+ * @return index of the completed case, -1 if none did
+ */
+int Select(SelectCase *cases, size_t n, bool block, int64_t timeout_ms);
+
+/**
+ * @brief the untyped half of a channel: lock, waiters and closing
+ */
+class ChannelBase : public FiberNoncopyable {
+    friend int Select(SelectCase *cases, size_t n, bool block, int64_t timeout_ms);
+    friend class SelectLocks;
+
+public:
+    /**
+     * @brief no more sends: blocked senders fail, receivers drain the buffer and then fail
+     */
+    void close();
+
+    bool closed();
+
+protected:
+    /**
+     * @brief move the value at elem in if that does not block, m_lock is held
+     * @param[out] ok false if the channel is closed
+     * @param[out] peer a waiter to wake once the lock is released
+     * @return whether the operation completed
+     */
+    virtual bool trySendLocked(void *elem, bool *ok, ChannelWaiter **peer) = 0;
+
+    virtual bool tryRecvLocked(void *elem, bool *ok, ChannelWaiter **peer) = 0;
+
+protected:
+    AtomicSpinLock m_lock;
+    bool m_closed{false};
+    ChannelWaitQueue m_senders;
+    ChannelWaitQueue m_receivers;
+};
+
+}  // namespace fiber_internal
+
+/**
+ * @brief typed channel, unbuffered with capacity 0, bounded, or unbounded with kUnbounded
+ * @details send/recv return false once the channel is closed, a value is only moved
+ * out of the caller's hands when an operation succeeds.
+ */
+template<typename T>
+class Channel : public fiber_internal::ChannelBase {
+public:
+    static constexpr size_t kUnbounded = std::numeric_limits<size_t>::max();
+
+    explicit Channel(size_t capacity = 0) : m_capacity(capacity) {}
+
+    bool send(const T &value) {
+        T copy(value);
+        return send(std::move(copy));
+    }
+
+    bool send(T &&value) { return run(true, &value, true); }
+
+    /// false if it would block or the channel is closed
+    bool try_send(T &&value) { return run(true, &value, false); }
+
+    bool try_send(const T &value) {
+        T copy(value);
+        return try_send(std::move(copy));
+    }
+
+    /**
+     * @brief wait for a value
+     * @return false when the channel is closed and drained
+     */
+    bool recv(T &value) { return run(false, &value, true); }
+
+    /// false if it would block or the channel is closed and drained
+    bool try_recv(T &value) { return run(false, &value, false); }
+
+    size_t capacity() const { return m_capacity; }
+
+    /// buffered values
+    size_t size() {
+        std::lock_guard guard(m_lock);
+        return m_buffer.size();
+    }
+
+protected:
+    bool trySendLocked(void *elem, bool *ok, fiber_internal::ChannelWaiter **peer) override {
+        T *value = static_cast<T *>(elem);
+        if (m_closed) {
+            *ok = false;
+            return true;
+        }
+        if (fiber_internal::ChannelWaiter *receiver = m_receivers.popClaimed()) {
+            // a waiting receiver means the buffer is empty, hand the value over
+            *static_cast<T *>(receiver->elem) = std::move(*value);
+            receiver->ok = true;
+            *peer = receiver;
+            *ok = true;
+            return true;
+        }
+        if (m_buffer.size() < m_capacity) {
+            m_buffer.push_back(std::move(*value));
+            *ok = true;
+            return true;
+        }
+        return false;
+    }
+
+    bool tryRecvLocked(void *elem, bool *ok, fiber_internal::ChannelWaiter **peer) override {
+        T *value = static_cast<T *>(elem);
+        if (!m_buffer.empty()) {
+            *value = std::move(m_buffer.front());
+            m_buffer.pop_front();
+            // a sender waits for the slot just freed
+            if (fiber_internal::ChannelWaiter *sender = m_senders.popClaimed()) {
+                m_buffer.push_back(std::move(*static_cast<T *>(sender->elem)));
+                sender->ok = true;
+                *peer = sender;
+            }
+            *ok = true;
+            return true;
+        }
+        if (fiber_internal::ChannelWaiter *sender = m_senders.popClaimed()) {
+            *value = std::move(*static_cast<T *>(sender->elem));
+            sender->ok = true;
+            *peer = sender;
+            *ok = true;
+            return true;
+        }
+        if (m_closed) {
+            *ok = false;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    bool run(bool send, T *value, bool block) {
+        bool ok = false;
+        fiber_internal::SelectCase c{this, send, value, &ok};
+        return fiber_internal::Select(&c, 1, block, -1) == 0 && ok;
+    }
+
+private:
+    const size_t m_capacity;
+    std::deque<T> m_buffer;
+};
+
+/**
+ * @brief wait for the first of several channel operations, like Go's select
+ * @details
+ *     int v;
+ *     std::string s = "hi";
+ *     switch (ChannelSelect().recv(ints, &v).send(strings, &s).wait(100)) {
+ *         case 0: ...  // got v
+ *         case 1: ...  // s was sent
+ *         default: ... // timed out
+ *     }
+ * A send case moves from its value only if it completes. A case on a closed channel
+ * completes with *ok set to false. Ready cases are polled from a rotating start, so
+ * none of them starves.
+ */
+class ChannelSelect : public FiberNoncopyable {
+public:
+    template<typename T>
+    ChannelSelect &recv(Channel<T> &channel, T *value, bool *ok = nullptr) {
+        m_cases.push_back({&channel, false, value, ok});
+        return *this;
+    }
+
+    template<typename T>
+    ChannelSelect &send(Channel<T> &channel, T *value, bool *ok = nullptr) {
+        m_cases.push_back({&channel, true, value, ok});
+        return *this;
+    }
+
+    /**
+     * @brief park until a case completes
+     * @param timeout_ms < 0 to wait forever; a fiber needs an IOManager for the timer,
+     * elsewhere the thread blocks until the timeout
+     * @return index of the case in the order added, -1 on timeout
+     */
+    int wait(int64_t timeout_ms = -1) {
+        return fiber_internal::Select(m_cases.data(), m_cases.size(), true, timeout_ms);
+    }
+
+    /**
+     * @brief complete a ready case if any, like a select with a default case
+     * @return index of the case, -1 if none was ready
+     */
+    int tryWait() {
+        return fiber_internal::Select(m_cases.data(), m_cases.size(), false, -1);
+    }
+
+private:
+    std::vector<fiber_internal::SelectCase> m_cases;
+};
@@ -1,3 +1,19 @@
 #include "fiber_flags.h"
 
 DEFINE_uint64(fiber_stack_size, 128 * 1024, "Stack size for each fiber"); // 128KB
+
+DEFINE_uint32(fiber_scheduler_idle_ms, 10, "Max time an idle scheduler worker parks before it looks for work again");
+
+DEFINE_uint64(fiber_stack_cache_size, 64, "Released fiber stacks each thread keeps for reuse");
+
+DEFINE_uint64(fiber_stack_global_cache_size, 1024, "Released fiber stacks kept for reuse by any thread once the thread caches are full");
+
+DEFINE_bool(fiber_stack_track_usage, false, "Record the stack high-water mark of every released fiber stack");
+
+DEFINE_bool(fiber_hook_enable, false, "Turn blocking socket, pipe and sleep calls of IOManager fibers into fiber yields");
+
+DEFINE_bool(fiber_accounting, false, "Account the run time, switches and blocked time of every fiber, costs a clock read per switch");
+
+DEFINE_bool(fiber_capture_block_stack, false, "Record the stack of a fiber when it parks, shown by Fiber::DumpAll()");
+
+DEFINE_uint32(fiber_preempt_ms, 0, "Ask fibers that run this long without yielding to yield at their next safepoint, 0 to turn preemption off");
@@ -1,3 +1,11 @@
 #include <gflags/gflags.h>
 
-DECLARE_uint64(fiber_stack_size);
\ No newline at end of file
+DECLARE_uint64(fiber_stack_size);
+DECLARE_uint32(fiber_scheduler_idle_ms);
+DECLARE_uint64(fiber_stack_cache_size);
+DECLARE_bool(fiber_stack_track_usage);
+DECLARE_uint64(fiber_stack_global_cache_size);
+DECLARE_bool(fiber_hook_enable);
+DECLARE_bool(fiber_accounting);
+DECLARE_bool(fiber_capture_block_stack);
+DECLARE_uint32(fiber_preempt_ms);
@@ -0,0 +1,284 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "fiber_flags.h"
+#include "fiber_hook.h"
+#include "fiber_iomanager.h"
+
+/// the next definition of name after this library, i.e. the libc one
+#define FIBER_HOOK_ORIGIN(name) \
+    static const auto name##_origin = reinterpret_cast<decltype(&::name)>(dlsym(RTLD_NEXT, #name))
+
+/// fds beyond this are never hooked
+static constexpr int kMaxHookedFd = 65536;
+
+enum FdFlag : uint8_t {
+    /// seen by a hooked call, the other flags are valid
+    kFdChecked = 0x1,
+    /// socket or pipe kept O_NONBLOCK by us whatever the user asks for
+    kFdSysNonBlock = 0x2,
+    /// the user asked for O_NONBLOCK, calls must not block even outside of fibers
+    kFdUserNonBlock = 0x4,
+};
+
+static std::atomic<uint8_t> s_fd_states[kMaxHookedFd];
+
+bool FiberHookActive() {
+    if (!FLAGS_fiber_hook_enable) {
+        return false;
+    }
+    Fiber *main_fiber = Scheduler::GetMainFiber();
+    if (main_fiber == nullptr || IOManager::GetThis() == nullptr) {
+        return false;
+    }
+    return Fiber::GetThis().get() != main_fiber;
+}
+
+/// return the FdFlag of fd, 0 if it is out of range or has not been seen
+static uint8_t FdStateOf(int fd) {
+    if (fd < 0 || fd >= kMaxHookedFd) {
+        return 0;
+    }
+    return s_fd_states[fd].load(std::memory_order_relaxed);
+}
+
+/// return the FdFlag of fd, switching it to O_NONBLOCK first if it is a socket or pipe seen
+/// for the first time
+static uint8_t HookFd(int fd) {
+    if (fd < 0 || fd >= kMaxHookedFd) {
+        return 0;
+    }
+    uint8_t state = s_fd_states[fd].load(std::memory_order_relaxed);
+    if (state != 0) {
+        return state;
+    }
+    state = kFdChecked;
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && (S_ISSOCK(st.st_mode) || S_ISFIFO(st.st_mode))) {
+        FIBER_HOOK_ORIGIN(fcntl);
+        const int flags = fcntl_origin(fd, F_GETFL);
+        if (flags >= 0) {
+            if (flags & O_NONBLOCK) {
+                state |= kFdSysNonBlock | kFdUserNonBlock;
+            } else if (fcntl_origin(fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+                state |= kFdSysNonBlock;
+            }
+        }
+    }
+    s_fd_states[fd].store(state, std::memory_order_relaxed);
+    return state;
+}
+
+/// block the thread until fd is ready for event, for an fd we made non-blocking behind the
+/// back of a caller that is not in a fiber
+static int WaitFd(int fd, IOManager::Event event) {
+    pollfd pfd{};
+    pfd.fd = fd;
+    pfd.events = event == IOManager::READ ? POLLIN : POLLOUT;
+    int rt;
+    do {
+        rt = poll(&pfd, 1, -1);
+    } while (rt < 0 && errno == EINTR);
+    return rt < 0 ? -1 : 0;
+}
+
+/**
+ * @brief retry origin until it does not return EAGAIN, parking the fiber until fd is
+ * ready for event in between
+ * @details outside of fibers a call on an fd we made non-blocking waits in poll(), so that
+ * the fd keeps blocking for its user
+ */
+template<typename Origin, typename... Args>
+static ssize_t DoIO(int fd, IOManager::Event event, Origin origin, Args... args) {
+    const bool active = FiberHookActive();
+    const uint8_t state = active ? HookFd(fd) : FdStateOf(fd);
+    if ((state & kFdUserNonBlock) || !(state & kFdSysNonBlock)) {
+        return origin(fd, args...);
+    }
+    while (true) {
+        ssize_t n;
+        do {
+            n = origin(fd, args...);
+        } while (n < 0 && errno == EINTR);
+        if (n >= 0 || errno != EAGAIN) {
+            return n;
+        }
+        if (!active) {
+            if (WaitFd(fd, event) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        // woken by readiness or by close(), either way the next call tells
+        if (IOManager::GetThis()->addEvent(fd, event) != 0) {
+            return -1;
+        }
+        Fiber::YieldToHold(event == IOManager::READ ? "io read" : "io write");
+    }
+}
+
+static void SleepMs(uint64_t ms) {
+    IOManager *iom = IOManager::GetThis();
+    Fiber::ptr fiber = Fiber::GetThis();
+    iom->addTimer(ms, [iom, fiber] {
+        iom->schedule(fiber);
+    });
+    Fiber::YieldToHold("sleep");
+}
+
+extern "C" {
+
+ssize_t read(int fd, void *buf, size_t count) {
+    FIBER_HOOK_ORIGIN(read);
+    return DoIO(fd, IOManager::READ, read_origin, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    FIBER_HOOK_ORIGIN(write);
+    return DoIO(fd, IOManager::WRITE, write_origin, buf, count);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags) {
+    FIBER_HOOK_ORIGIN(recv);
+    return DoIO(fd, IOManager::READ, recv_origin, buf, len, flags);
+}
+
+ssize_t send(int fd, const void *buf, size_t len, int flags) {
+    FIBER_HOOK_ORIGIN(send);
+    return DoIO(fd, IOManager::WRITE, send_origin, buf, len, flags);
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    FIBER_HOOK_ORIGIN(accept);
+    return static_cast<int>(DoIO(fd, IOManager::READ, accept_origin, addr, addrlen));
+}
+
+int connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+    FIBER_HOOK_ORIGIN(connect);
+    const bool active = FiberHookActive();
+    const uint8_t state = active ? HookFd(fd) : FdStateOf(fd);
+    if ((state & kFdUserNonBlock) || !(state & kFdSysNonBlock)) {
+        return connect_origin(fd, addr, addrlen);
+    }
+    int rt = connect_origin(fd, addr, addrlen);
+    if (rt == 0 || errno != EINPROGRESS) {
+        return rt;
+    }
+    if (!active) {
+        if (WaitFd(fd, IOManager::WRITE) != 0) {
+            return -1;
+        }
+    } else {
+        if (IOManager::GetThis()->addEvent(fd, IOManager::WRITE) != 0) {
+            return -1;
+        }
+        Fiber::YieldToHold("connect");
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0) {
+        return -1;
+    }
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int close(int fd) {
+    FIBER_HOOK_ORIGIN(close);
+    if (fd >= 0 && fd < kMaxHookedFd) {
+        // the fibers waiting for fd may belong to any IOManager, not only to ours
+        if (s_fd_states[fd].exchange(0, std::memory_order_relaxed) & kFdSysNonBlock) {
+            IOManager::CancelAllEverywhere(fd);
+        }
+    }
+    return close_origin(fd);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    FIBER_HOOK_ORIGIN(fcntl);
+    va_list va;
+    va_start(va, cmd);
+    switch (cmd) {
+        case F_GETFL: {
+            va_end(va);
+            const int flags = fcntl_origin(fd, cmd);
+            const uint8_t state = FdStateOf(fd);
+            if (flags < 0 || !(state & kFdSysNonBlock)) {
+                return flags;
+            }
+            return (state & kFdUserNonBlock) ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+        }
+        case F_SETFL: {
+            int flags = va_arg(va, int);
+            va_end(va);
+            const uint8_t state = FdStateOf(fd);
+            if (!(state & kFdSysNonBlock)) {
+                return fcntl_origin(fd, cmd, flags);
+            }
+            const int rt = fcntl_origin(fd, cmd, flags | O_NONBLOCK);
+            if (rt == 0) {
+                const uint8_t user = (flags & O_NONBLOCK) ? kFdUserNonBlock : 0;
+                s_fd_states[fd].store((state & ~kFdUserNonBlock) | user, std::memory_order_relaxed);
+            }
+            return rt;
+        }
+        default: {
+            // every other command takes no argument, an int or a pointer, glibc passes
+            // them on as a pointer alike
+            void *arg = va_arg(va, void *);
+            va_end(va);
+            return fcntl_origin(fd, cmd, arg);
+        }
+    }
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+    FIBER_HOOK_ORIGIN(ioctl);
+    va_list va;
+    va_start(va, request);
+    void *arg = va_arg(va, void *);
+    va_end(va);
+    const uint8_t state = FdStateOf(fd);
+    if (request != FIONBIO || !(state & kFdSysNonBlock)) {
+        return ioctl_origin(fd, request, arg);
+    }
+    const bool user_nonblock = *static_cast<int *>(arg) != 0;
+    int on = 1;
+    const int rt = ioctl_origin(fd, request, &on);
+    if (rt == 0) {
+        const uint8_t user = user_nonblock ? kFdUserNonBlock : 0;
+        s_fd_states[fd].store((state & ~kFdUserNonBlock) | user, std::memory_order_relaxed);
+    }
+    return rt;
+}
+
+unsigned int sleep(unsigned int seconds) {
+    FIBER_HOOK_ORIGIN(sleep);
+    if (!FiberHookActive()) {
+        return sleep_origin(seconds);
+    }
+    SleepMs(static_cast<uint64_t>(seconds) * 1000);
+    return 0;
+}
+
+int usleep(useconds_t usec) {
+    FIBER_HOOK_ORIGIN(usleep);
+    if (!FiberHookActive()) {
+        return usleep_origin(usec);
+    }
+    SleepMs((static_cast<uint64_t>(usec) + 999) / 1000);
+    return 0;
+}
+
+}  // extern "C"
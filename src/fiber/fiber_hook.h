@@ -0,0 +1,18 @@
+#pragma once
+
+/**
+ * @brief blocking calls that park the calling fiber instead of its thread
+ * @details with --fiber_hook_enable, read, write, recv, send, accept and connect on a
+ * socket or pipe, and sleep and usleep, called from a fiber of an IOManager yield until
+ * the fd is ready or the time is up, and the IOManager runs other fibers meanwhile.
+ * The hooked fd is switched to O_NONBLOCK the first time it is used this way, and fcntl
+ * and ioctl(FIONBIO) keep reporting and honoring the mode the user asked for: calls on it
+ * from outside of fibers wait in poll() unless the user made it non-blocking too. An fd the
+ * caller made non-blocking itself or a regular file goes straight to the original
+ * function. close cancels the events still waited for on the fd, in every IOManager.
+ */
+
+/**
+ * @brief return whether hooked calls of the current fiber yield
+ */
+bool FiberHookActive();
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cerrno>
+#include <limits>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <glog/logging.h>
+
+#include "fiber_flags.h"
+#include "fiber_iomanager.h"
+#include "fiber_macros.h"
+
+/// events fetched by one epoll_wait
+static constexpr int kMaxEvents = 256;
+
+static std::shared_mutex s_instances_lock;
+/// leaked on purpose, IOManagers with static storage may unregister during exit
+static auto *s_instances = new std::vector<IOManager *>;
+
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
+        : Scheduler(threads, use_caller, name) {
+    m_epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epfd < 0) {
+        PLOG(FATAL) << "epoll_create1 fail, name=" << name;
+    }
+    m_tickle_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_tickle_fd < 0) {
+        PLOG(FATAL) << "eventfd fail, name=" << name;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    // the only event without an FdContext
+    event.data.ptr = nullptr;
+    if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickle_fd, &event) != 0) {
+        PLOG(FATAL) << "epoll_ctl tickle fd fail, name=" << name;
+    }
+    std::unique_lock wlock(s_instances_lock);
+    s_instances->push_back(this);
+}
+
+IOManager::~IOManager() {
+    {
+        std::unique_lock wlock(s_instances_lock);
+        s_instances->erase(std::find(s_instances->begin(), s_instances->end(), this));
+    }
+    close(m_tickle_fd);
+    close(m_epfd);
+}
+
+IOManager *IOManager::GetThis() {
+    return dynamic_cast<IOManager *>(Scheduler::GetThis());
+}
+
+void IOManager::CancelAllEverywhere(int fd) {
+    std::shared_lock rlock(s_instances_lock);
+    for (IOManager *iom: *s_instances) {
+        iom->cancelAll(fd);
+    }
+}
+
+IOManager::FdContext *IOManager::getFdContext(int fd, bool create) {
+    if (fd < 0) {
+        return nullptr;
+    }
+    {
+        std::shared_lock rlock(m_contexts_lock);
+        if (static_cast<size_t>(fd) < m_contexts.size() && m_contexts[fd]) {
+            return m_contexts[fd].get();
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    std::unique_lock wlock(m_contexts_lock);
+    if (static_cast<size_t>(fd) >= m_contexts.size()) {
+        m_contexts.resize(std::max<size_t>(fd + 1, m_contexts.size() * 3 / 2));
+    }
+    auto &ctx = m_contexts[fd];
+    if (!ctx) {
+        ctx = std::make_unique<FdContext>();
+        ctx->fd = fd;
+    }
+    return ctx.get();
+}
+
+int IOManager::addEvent(int fd, Event event, Callback cb) {
+    FdContext *ctx = getFdContext(fd, true);
+    if (ctx == nullptr) {
+        errno = EBADF;
+        return -1;
+    }
+    std::lock_guard guard(ctx->mutex);
+    if (ctx->events & event) {
+        LOG(ERROR) << "addEvent assert fd=" << fd << " event=" << event << " already waited for";
+        errno = EEXIST;
+        return -1;
+    }
+    epoll_event ep_event{};
+    ep_event.events = EPOLLET | ctx->events | event;
+    ep_event.data.ptr = ctx;
+    const int op = ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epfd, op, fd, &ep_event) != 0) {
+        PLOG(ERROR) << "epoll_ctl fail, fd=" << fd << " op=" << op << " events=" << ep_event.events;
+        return -1;
+    }
+    m_pending_events.fetch_add(1, std::memory_order_relaxed);
+    ctx->events |= event;
+    // the event may fire on another worker right away, it waits for the mutex we hold
+    EventContext &event_ctx = ctx->getContext(event);
+    if (cb) {
+        event_ctx.cb = std::move(cb);
+    } else {
+        FIBER_ASSERT(Scheduler::GetMainFiber() != nullptr);
+        event_ctx.fiber = Fiber::GetThis();
+    }
+    return 0;
+}
+
+bool IOManager::removeEvent(FdContext *ctx, Event event) {
+    const int left = ctx->events & ~event;
+    epoll_event ep_event{};
+    ep_event.events = EPOLLET | left;
+    ep_event.data.ptr = ctx;
+    const int op = left ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    if (epoll_ctl(m_epfd, op, ctx->fd, &ep_event) != 0) {
+        PLOG(ERROR) << "epoll_ctl fail, fd=" << ctx->fd << " op=" << op << " events=" << ep_event.events;
+        return false;
+    }
+    ctx->events = left;
+    return true;
+}
+
+void IOManager::triggerEvent(FdContext *ctx, Event event) {
+    EventContext &event_ctx = ctx->getContext(event);
+    if (event_ctx.cb) {
+        schedule(std::move(event_ctx.cb));
+    } else {
+        schedule(std::move(event_ctx.fiber));
+    }
+    event_ctx.cb = nullptr;
+    event_ctx.fiber.reset();
+    m_pending_events.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool IOManager::delEvent(int fd, Event event) {
+    FdContext *ctx = getFdContext(fd, false);
+    if (ctx == nullptr) {
+        return false;
+    }
+    std::lock_guard guard(ctx->mutex);
+    if (!(ctx->events & event) || !removeEvent(ctx, event)) {
+        return false;
+    }
+    EventContext &event_ctx = ctx->getContext(event);
+    event_ctx.cb = nullptr;
+    event_ctx.fiber.reset();
+    m_pending_events.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool IOManager::cancelEvent(int fd, Event event) {
+    FdContext *ctx = getFdContext(fd, false);
+    if (ctx == nullptr) {
+        return false;
+    }
+    std::lock_guard guard(ctx->mutex);
+    if (!(ctx->events & event) || !removeEvent(ctx, event)) {
+        return false;
+    }
+    triggerEvent(ctx, event);
+    return true;
+}
+
+bool IOManager::cancelAll(int fd) {
+    FdContext *ctx = getFdContext(fd, false);
+    if (ctx == nullptr) {
+        return false;
+    }
+    std::lock_guard guard(ctx->mutex);
+    const int events = ctx->events;
+    if (events == NONE || !removeEvent(ctx, static_cast<Event>(events))) {
+        return false;
+    }
+    if (events & READ) {
+        triggerEvent(ctx, READ);
+    }
+    if (events & WRITE) {
+        triggerEvent(ctx, WRITE);
+    }
+    return true;
+}
+
+uint64_t IOManager::addPoller(Callback cb) {
+    std::unique_lock wlock(m_pollers_lock);
+    const uint64_t id = m_next_poller_id++;
+    m_pollers.emplace(id, std::move(cb));
+    return id;
+}
+
+void IOManager::delPoller(uint64_t id) {
+    std::unique_lock wlock(m_pollers_lock);
+    m_pollers.erase(id);
+}
+
+void IOManager::tickle(int thread) {
+    // a pinned task must reach its worker even if nobody is counted idle yet
+    if (thread < 0 && !hasIdleThreads()) {
+        return;
+    }
+    if (eventfd_write(m_tickle_fd, 1) != 0) {
+        PLOG(ERROR) << "eventfd_write tickle fd fail";
+    }
+}
+
+void IOManager::onTimerInsertedAtFront() {
+    tickle(-1);
+}
+
+bool IOManager::stopping(uint64_t &timeout) {
+    timeout = getNextTimer();
+    return timeout == std::numeric_limits<uint64_t>::max()
+           && m_pending_events.load() == 0
+           && Scheduler::stopping();
+}
+
+bool IOManager::stopping() {
+    uint64_t timeout = 0;
+    return stopping(timeout);
+}
+
+void IOManager::idle() {
+    const int index = GetWorkerIndex();
+    std::unique_ptr<epoll_event[]> events(new epoll_event[kMaxEvents]);
+    std::vector<Callback> cbs;
+    while (true) {
+        uint64_t next_timeout = 0;
+        if (stopping(next_timeout)) {
+            break;
+        }
+        {
+            std::shared_lock rlock(m_pollers_lock);
+            for (auto &[id, poller]: m_pollers) {
+                poller();
+            }
+        }
+        int n = 0;
+        // pairs with the fence in submit(): either we see the task or the submitter sees us idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hasTask(index)) {
+            // a tickle aimed at another worker may wake this one instead, bound the wait
+            const int timeout = static_cast<int>(
+                    std::min<uint64_t>(next_timeout, FLAGS_fiber_scheduler_idle_ms));
+            n = epoll_wait(m_epfd, events.get(), kMaxEvents, timeout);
+            if (n < 0) {
+                if (errno != EINTR) {
+                    PLOG(ERROR) << "epoll_wait fail, epfd=" << m_epfd;
+                }
+                n = 0;
+            }
+        }
+
+        listExpiredCb(cbs);
+        if (!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+        }
+
+        for (int i = 0; i < n; ++i) {
+            epoll_event &event = events[i];
+            if (event.data.ptr == nullptr) {
+                eventfd_t value;
+                eventfd_read(m_tickle_fd, &value);
+                continue;
+            }
+            auto *ctx = static_cast<FdContext *>(event.data.ptr);
+            std::lock_guard guard(ctx->mutex);
+            uint32_t revents = event.events;
+            // an error or hangup wakes every waiter, the retried call reports it
+            if (revents & (EPOLLERR | EPOLLHUP)) {
+                revents |= (EPOLLIN | EPOLLOUT) & ctx->events;
+            }
+            int ready = NONE;
+            if (revents & EPOLLIN) {
+                ready |= READ;
+            }
+            if (revents & EPOLLOUT) {
+                ready |= WRITE;
+            }
+            // cancelled or already handled by another worker
+            ready &= ctx->events;
+            if (ready == NONE || !removeEvent(ctx, static_cast<Event>(ready))) {
+                continue;
+            }
+            if (ready & READ) {
+                triggerEvent(ctx, READ);
+            }
+            if (ready & WRITE) {
+                triggerEvent(ctx, WRITE);
+            }
+        }
+        Fiber::YieldToHold("idle");
+    }
+}
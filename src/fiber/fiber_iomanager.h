@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include "fiber_scheduler.h"
+#include "fiber_timer.h"
+
+/**
+ * @brief Scheduler whose idle workers wait in epoll_wait
+ * @details a fiber waits for an fd with addEvent() and YieldToHold(); when the fd
+ * becomes ready the worker that gets the event schedules the fiber, or the callback
+ * given instead, back. Events are one-shot: they are removed from epoll once they
+ * fired or were cancelled. The epoll timeout follows the earliest timer, so timers
+ * added to the IOManager fire from the same loop.
+ */
+class IOManager : public Scheduler, public FiberTimerManager {
+public:
+    typedef std::shared_ptr<IOManager> ptr;
+    using Callback = Scheduler::Callback;
+
+    enum Event {
+        NONE = 0x0,
+        READ = EPOLLIN,
+        WRITE = EPOLLOUT,
+    };
+
+    explicit IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+
+    ~IOManager() override;
+
+    /**
+     * @brief wait for event on fd, resume the current fiber or run cb when it is ready
+     * @return 0 on success, -1 with errno set by epoll_ctl or EEXIST if event is already waited for
+     */
+    int addEvent(int fd, Event event, Callback cb = nullptr);
+
+    /**
+     * @brief stop waiting for event without waking the waiter
+     */
+    bool delEvent(int fd, Event event);
+
+    /**
+     * @brief stop waiting for event and wake the waiter at once
+     */
+    bool cancelEvent(int fd, Event event);
+
+    /**
+     * @brief cancel every event of fd, e.g. before it is closed
+     */
+    bool cancelAll(int fd);
+
+    /**
+     * @brief events being waited for, not yet fired or cancelled
+     */
+    int64_t getPendingEvents() const { return m_pending_events.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief run cb in every polling round of every worker, right before it waits for
+     * events, e.g. to flush work batched up while the worker was busy
+     * @details cb must not add or delete pollers
+     * @return id for delPoller()
+     */
+    uint64_t addPoller(Callback cb);
+
+    /**
+     * @brief no round runs the poller any more once this returns
+     */
+    void delPoller(uint64_t id);
+
+public:
+    /**
+     * @brief return the IOManager of the current thread, nullptr if it runs none
+     */
+    static IOManager *GetThis();
+
+    /**
+     * @brief cancelAll(fd) on every live IOManager, for an fd closed by a thread that may
+     * run none or another one than its waiters
+     */
+    static void CancelAllEverywhere(int fd);
+
+protected:
+    void tickle(int thread) override;
+
+    bool stopping() override;
+
+    void idle() override;
+
+    void onTimerInsertedAtFront() override;
+
+private:
+    struct EventContext {
+        Fiber::ptr fiber;
+        Callback cb;
+    };
+
+    struct FdContext {
+        int fd{-1};
+        /// events registered in epoll
+        int events{NONE};
+        EventContext read;
+        EventContext write;
+        std::mutex mutex;
+
+        EventContext &getContext(Event event) { return event == READ ? read : write; }
+    };
+
+    FdContext *getFdContext(int fd, bool create);
+
+    /// schedule the waiter of event and forget it, the FdContext mutex is held
+    void triggerEvent(FdContext *ctx, Event event);
+
+    /// remove event from epoll, the FdContext mutex is held
+    bool removeEvent(FdContext *ctx, Event event);
+
+    /// @param[out] timeout ms until the next timer
+    bool stopping(uint64_t &timeout);
+
+private:
+    int m_epfd{-1};
+    /// eventfd in epoll, written by tickle() to interrupt epoll_wait
+    int m_tickle_fd{-1};
+    std::atomic<int64_t> m_pending_events{0};
+    std::shared_mutex m_contexts_lock;
+    /// indexed by fd, never shrinks so a context stays valid while its fd is in epoll
+    std::vector<std::unique_ptr<FdContext>> m_contexts;
+    std::shared_mutex m_pollers_lock;
+    std::map<uint64_t, Callback> m_pollers;
+    uint64_t m_next_poller_id{1};
+};
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <glog/logging.h>
+
+#include "fiber_local.h"
+
+namespace fiber_internal {
+
+thread_local FiberLocalTable *t_fiber_locals = nullptr;
+
+/// deleters may set values again, give up after this many rounds like pthread keys do
+static constexpr int kClearRounds = 4;
+
+namespace {
+
+struct SlotRegistry {
+    std::mutex lock;
+    /// current version of every slot, bumped when it is freed
+    std::vector<uint32_t> versions;
+    std::vector<uint32_t> free_slots;
+};
+
+SlotRegistry &GetSlotRegistry() {
+    // never destroyed, FiberLocals with static storage may outlive it otherwise
+    static SlotRegistry *s_registry = new SlotRegistry;
+    return *s_registry;
+}
+
+}  // namespace
+
+uint32_t AllocFiberLocalSlot(uint32_t *version) {
+    SlotRegistry &registry = GetSlotRegistry();
+    std::lock_guard guard(registry.lock);
+    uint32_t index;
+    if (!registry.free_slots.empty()) {
+        index = registry.free_slots.back();
+        registry.free_slots.pop_back();
+    } else {
+        index = static_cast<uint32_t>(registry.versions.size());
+        registry.versions.push_back(1);
+    }
+    *version = registry.versions[index];
+    return index;
+}
+
+void FreeFiberLocalSlot(uint32_t index) {
+    SlotRegistry &registry = GetSlotRegistry();
+    std::lock_guard guard(registry.lock);
+    // 0 is the version of empty entries
+    if (++registry.versions[index] == 0) {
+        registry.versions[index] = 1;
+    }
+    registry.free_slots.push_back(index);
+}
+
+void FiberLocalTable::set(uint32_t index, uint32_t version, void *value, Deleter deleter) {
+    if (index >= m_size) {
+        if (!value) {
+            return;
+        }
+        uint32_t size = std::max<uint32_t>({index + 1, m_size * 2, 8});
+        auto *entries = new Entry[size];
+        std::copy(m_entries, m_entries + m_size, entries);
+        delete[] m_entries;
+        m_entries = entries;
+        m_size = size;
+    }
+    Entry &entry = m_entries[index];
+    Entry old = entry;
+    entry.value = value;
+    entry.deleter = value ? deleter : nullptr;
+    entry.version = value ? version : 0;
+    // an entry of another version is left over from a destroyed FiberLocal
+    if (old.value && old.value != value) {
+        old.deleter(old.value);
+    }
+}
+
+void *FiberLocalTable::release(uint32_t index, uint32_t version) {
+    void *value = get(index, version);
+    if (value) {
+        m_entries[index] = Entry();
+    }
+    return value;
+}
+
+void FiberLocalTable::clear() {
+    for (int round = 0; m_entries && round < kClearRounds; ++round) {
+        // deleters that set values fill a new array, cleared in the next round
+        Entry *entries = m_entries;
+        uint32_t size = m_size;
+        m_entries = nullptr;
+        m_size = 0;
+        for (uint32_t i = 0; i < size; ++i) {
+            if (entries[i].value) {
+                entries[i].deleter(entries[i].value);
+            }
+        }
+        delete[] entries;
+    }
+    if (m_entries) {
+        LOG(WARNING) << "FiberLocal values are still set after " << kClearRounds << " rounds of deleters, leaking them";
+        delete[] m_entries;
+        m_entries = nullptr;
+        m_size = 0;
+    }
+}
+
+FiberLocalTable *FiberLocalTable::ThreadTable() {
+    static thread_local FiberLocalTable t_table;
+    return &t_table;
+}
+
+}  // namespace fiber_internal
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+#include "fiber_nocopyable.h"
+
+namespace fiber_internal {
+
+/**
+ * @brief the values of the FiberLocals for one fiber, or one thread outside fibers
+ * @details indexed by the slot of the FiberLocal; an entry whose version differs from
+ * the slot's belongs to a destroyed FiberLocal and reads as empty
+ */
+class FiberLocalTable {
+public:
+    typedef void (*Deleter)(void *);
+
+    struct Entry {
+        void *value{nullptr};
+        Deleter deleter{nullptr};
+        uint32_t version{0};
+    };
+
+    FiberLocalTable() = default;
+
+    ~FiberLocalTable() { clear(); }
+
+    FiberLocalTable(const FiberLocalTable &) = delete;
+
+    FiberLocalTable &operator=(const FiberLocalTable &) = delete;
+
+    void *get(uint32_t index, uint32_t version) const {
+        if (index < m_size && m_entries[index].version == version) {
+            return m_entries[index].value;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief replace the value of the slot, the old one is deleted unless it is value
+     */
+    void set(uint32_t index, uint32_t version, void *value, Deleter deleter);
+
+    /**
+     * @brief take the value of the slot out without deleting it
+     */
+    void *release(uint32_t index, uint32_t version);
+
+    /**
+     * @brief delete all values, again for those the deleters set, a few rounds at most
+     */
+    void clear();
+
+    /**
+     * @brief table of the running fiber, or of the thread when no fiber with its own stack runs
+     */
+    static FiberLocalTable *Current();
+
+    /**
+     * @brief the running fiber's table, nullptr outside fibers; maintained by Fiber::SetThis()
+     */
+    static void SetCurrent(FiberLocalTable *table);
+
+private:
+    static FiberLocalTable *ThreadTable();
+
+private:
+    /// allocated on the first set()
+    Entry *m_entries{nullptr};
+    uint32_t m_size{0};
+};
+
+extern thread_local FiberLocalTable *t_fiber_locals;
+
+inline FiberLocalTable *FiberLocalTable::Current() {
+    FiberLocalTable *table = t_fiber_locals;
+    return table ? table : ThreadTable();
+}
+
+inline void FiberLocalTable::SetCurrent(FiberLocalTable *table) {
+    t_fiber_locals = table;
+}
+
+/**
+ * @brief hand out a slot index, reusing freed ones under a new version
+ */
+uint32_t AllocFiberLocalSlot(uint32_t *version);
+
+void FreeFiberLocalSlot(uint32_t index);
+
+}  // namespace fiber_internal
+
+/**
+ * @brief a T per fiber, the thread_local for code that may run on fibers
+ * @details fibers move between threads, so a thread_local read on one may belong to
+ * another fiber after a yield. Each fiber owns a table allocated on its first write,
+ * reading is a thread_local load plus an index into it. The values are deleted when
+ * the fiber terminates; outside fibers, and on the main fiber of a thread, the thread
+ * has a table of its own, cleared when the thread exits.
+ *
+ * e.g.
+ *     static FiberLocal<RequestContext> s_context;
+ *     s_context->trace_id = id;         // created on first use
+ *     if (auto *ctx = s_context.get())  // nullptr if not set
+ */
+template<typename T>
+class FiberLocal : public FiberNoncopyable {
+public:
+    FiberLocal() : m_index(fiber_internal::AllocFiberLocalSlot(&m_version)) {}
+
+    /// values still held by fibers are deleted when those end
+    ~FiberLocal() override { fiber_internal::FreeFiberLocalSlot(m_index); }
+
+    /**
+     * @brief value of the running fiber, nullptr if it has none
+     */
+    T *get() const {
+        return static_cast<T *>(fiber_internal::FiberLocalTable::Current()->get(m_index, m_version));
+    }
+
+    /**
+     * @brief value of the running fiber, default constructed if it has none
+     */
+    T &operator*() const {
+        fiber_internal::FiberLocalTable *table = fiber_internal::FiberLocalTable::Current();
+        T *value = static_cast<T *>(table->get(m_index, m_version));
+        if (!value) {
+            value = new T();
+            table->set(m_index, m_version, value, &Delete);
+        }
+        return *value;
+    }
+
+    T *operator->() const { return &**this; }
+
+    /**
+     * @brief take ownership of value as the running fiber's, deleting the previous one
+     */
+    void reset(T *value = nullptr) {
+        fiber_internal::FiberLocalTable::Current()->set(m_index, m_version, value, &Delete);
+    }
+
+    /**
+     * @brief give up the running fiber's value without deleting it
+     */
+    T *release() {
+        return static_cast<T *>(fiber_internal::FiberLocalTable::Current()->release(m_index, m_version));
+    }
+
+private:
+    static void Delete(void *value) { delete static_cast<T *>(value); }
+
+private:
+    uint32_t m_version{0};
+    const uint32_t m_index;
+};
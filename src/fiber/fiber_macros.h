@@ -13,6 +13,7 @@
 #include <vector>
 #include <string>
 #include <iomanip>
+#include <sstream>
 #include <execinfo.h>
 
 #include <glog/logging.h>
@@ -36,7 +37,7 @@ static std::string fiber_demangle(const char *str) {
     return str;
 }
 
-void FiberBacktrace(std::vector<std::string> &bt, int size, int skip) {
+inline void FiberBacktrace(std::vector<std::string> &bt, int size, int skip) {
     void **array = (void **) malloc((sizeof(void *) * size));
     size_t s = ::backtrace(array, size);
 
@@ -54,7 +55,7 @@ void FiberBacktrace(std::vector<std::string> &bt, int size, int skip) {
     free(array);
 }
 
-std::string FiberBacktraceToString(int size = 64, int skip = 2, const std::string &prefix = "") {
+inline std::string FiberBacktraceToString(int size = 64, int skip = 2, const std::string &prefix = "") {
     std::vector<std::string> bt;
     FiberBacktrace(bt, size, skip);
     std::stringstream ss;
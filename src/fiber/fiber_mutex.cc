@@ -1,24 +1,269 @@
+#include <mutex>
+
 #include "fiber_mutex.h"
+#include "fiber_scheduler.h"
+
+namespace fiber_internal {
+
+FiberWaiter::FiberWaiter() {
+    // only a fiber run by a scheduler can be parked, anything else blocks its thread
+    Fiber *main_fiber = Scheduler::GetMainFiber();
+    if (Scheduler::GetThis() && main_fiber) {
+        Fiber::ptr cur = Fiber::GetThis();
+        if (cur.get() != main_fiber) {
+            fiber = std::move(cur);
+            scheduler = Scheduler::GetThis();
+        }
+    }
+}
+
+void FiberWaiter::Park(const char *reason) {
+    if (scheduler) {
+        // a waker may schedule the fiber before it is switched out, the scheduler
+        // waits for the switch to complete before resuming it elsewhere
+        Fiber::YieldToHold(reason);
+    } else {
+        event.Wait();
+    }
+}
 
-Semaphore::Semaphore(uint32_t count) {
-    if (sem_init(&m_semaphore, 0, count) != 0) {
-        throw std::logic_error("sem init error");
+void FiberWaiter::Wake() {
+    if (scheduler) {
+        // the waiter may hold the last reference to its fiber, pass it on
+        scheduler->schedule(std::move(fiber));
+    } else {
+        event.Set();
     }
 }
 
-Semaphore::~Semaphore() {
-    sem_destroy(&m_semaphore);
+/// wake a chain of waiters linked by next
+static void WakeAll(FiberWaiter *waiter) {
+    while (waiter) {
+        FiberWaiter *next = waiter->next;
+        waiter->Wake();
+        waiter = next;
+    }
+}
+
+}  // namespace fiber_internal
+
+using fiber_internal::FiberWaiter;
+using fiber_internal::WakeAll;
+
+void FiberMutex::lock() noexcept {
+    if (try_lock()) {
+        return;
+    }
+    FiberWaiter waiter;
+    {
+        std::lock_guard guard(m_guard);
+        if (!m_locked) {
+            m_locked = true;
+            return;
+        }
+        m_waiters.push_back(&waiter);
+    }
+    // the lock is handed over by unlock()
+    waiter.Park("FiberMutex");
 }
 
-void Semaphore::wait() {
-    if (sem_wait(&m_semaphore)) {
-        throw std::logic_error("sem wait error");
+bool FiberMutex::try_lock() noexcept {
+    std::lock_guard guard(m_guard);
+    if (m_locked) {
+        return false;
     }
+    m_locked = true;
+    return true;
 }
 
-void Semaphore::notify() {
-    if (sem_post(&m_semaphore)) {
-        throw std::logic_error("sem post error");
+void FiberMutex::unlock() noexcept {
+    FiberWaiter *waiter;
+    {
+        std::lock_guard guard(m_guard);
+        waiter = m_waiters.pop_front();
+        if (waiter == nullptr) {
+            m_locked = false;
+            return;
+        }
+        waiter->next = nullptr;
     }
+    waiter->Wake();
 }
 
+void FiberCondVar::wait(FiberMutex &mutex) {
+    FiberWaiter waiter;
+    {
+        std::lock_guard guard(m_guard);
+        m_waiters.push_back(&waiter);
+    }
+    // queued before the mutex is released, a notify after the unlock is not lost
+    mutex.unlock();
+    waiter.Park("FiberCondVar");
+    mutex.lock();
+}
+
+void FiberCondVar::notify_one() {
+    FiberWaiter *waiter;
+    {
+        std::lock_guard guard(m_guard);
+        waiter = m_waiters.pop_front();
+    }
+    if (waiter) {
+        waiter->Wake();
+    }
+}
+
+void FiberCondVar::notify_all() {
+    FiberWaiter *waiters;
+    {
+        std::lock_guard guard(m_guard);
+        waiters = m_waiters.front();
+        m_waiters = fiber_internal::FiberWaitQueue();
+    }
+    WakeAll(waiters);
+}
+
+void FiberSemaphore::Acquire() {
+    if (TryAcquire()) {
+        return;
+    }
+    FiberWaiter waiter;
+    {
+        std::lock_guard guard(m_guard);
+        if (m_count > 0) {
+            --m_count;
+            return;
+        }
+        m_waiters.push_back(&waiter);
+    }
+    // the permit is handed over by Release()
+    waiter.Park("FiberSemaphore");
+}
+
+bool FiberSemaphore::TryAcquire() {
+    std::lock_guard guard(m_guard);
+    if (m_count == 0) {
+        return false;
+    }
+    --m_count;
+    return true;
+}
+
+void FiberSemaphore::Release(uint64_t n) {
+    FiberWaiter *head = nullptr;
+    {
+        std::lock_guard guard(m_guard);
+        FiberWaiter *tail = nullptr;
+        for (; n > 0 && !m_waiters.empty(); --n) {
+            FiberWaiter *waiter = m_waiters.pop_front();
+            waiter->next = nullptr;
+            if (tail) {
+                tail->next = waiter;
+            } else {
+                head = waiter;
+            }
+            tail = waiter;
+        }
+        m_count += n;
+    }
+    WakeAll(head);
+}
+
+uint64_t FiberSemaphore::GetValue() {
+    std::lock_guard guard(m_guard);
+    return m_count;
+}
+
+void FiberRWLock::lock() noexcept {
+    if (try_lock()) {
+        return;
+    }
+    FiberWaiter waiter;
+    {
+        std::lock_guard guard(m_guard);
+        if (!m_writer && m_readers == 0 && m_waiters.empty()) {
+            m_writer = true;
+            return;
+        }
+        waiter.exclusive = true;
+        m_waiters.push_back(&waiter);
+    }
+    waiter.Park("FiberRWLock");
+}
+
+bool FiberRWLock::try_lock() noexcept {
+    std::lock_guard guard(m_guard);
+    if (m_writer || m_readers != 0 || !m_waiters.empty()) {
+        return false;
+    }
+    m_writer = true;
+    return true;
+}
+
+void FiberRWLock::unlock() noexcept {
+    FiberWaiter *waiters;
+    {
+        std::lock_guard guard(m_guard);
+        m_writer = false;
+        waiters = AdmitWaiters();
+    }
+    WakeAll(waiters);
+}
+
+void FiberRWLock::lock_shared() noexcept {
+    if (try_lock_shared()) {
+        return;
+    }
+    FiberWaiter waiter;
+    {
+        std::lock_guard guard(m_guard);
+        if (!m_writer && m_waiters.empty()) {
+            ++m_readers;
+            return;
+        }
+        waiter.exclusive = false;
+        m_waiters.push_back(&waiter);
+    }
+    waiter.Park("FiberRWLock");
+}
+
+bool FiberRWLock::try_lock_shared() noexcept {
+    std::lock_guard guard(m_guard);
+    if (m_writer || !m_waiters.empty()) {
+        return false;
+    }
+    ++m_readers;
+    return true;
+}
+
+void FiberRWLock::unlock_shared() noexcept {
+    FiberWaiter *waiters = nullptr;
+    {
+        std::lock_guard guard(m_guard);
+        if (--m_readers == 0) {
+            waiters = AdmitWaiters();
+        }
+    }
+    WakeAll(waiters);
+}
+
+FiberWaiter *FiberRWLock::AdmitWaiters() {
+    FiberWaiter *head = m_waiters.front();
+    if (head == nullptr) {
+        return nullptr;
+    }
+    if (head->exclusive) {
+        m_writer = true;
+        m_waiters.pop_front();
+        head->next = nullptr;
+        return head;
+    }
+    // every reader up to the next writer, they stay chained in queue order
+    FiberWaiter *tail = nullptr;
+    while (!m_waiters.empty() && !m_waiters.front()->exclusive) {
+        tail = m_waiters.pop_front();
+        ++m_readers;
+    }
+    tail->next = nullptr;
+    return head;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <thread>
 #include <functional>
 #include <memory>
@@ -6,24 +8,174 @@
 #include <list>
 
 #include <pthread.h>
-#include <semaphore.h>
 
 #include "fiber_nocopyable.h"
+#include "fibers.h"
+#include "concurrent/event.h"
+#include "concurrent/lock.h"
+#include "concurrent/sem.h"
+#include "concurrent/spinlock.h"
+
+class Scheduler;
+
+/**
+ * @brief synchronization primitives that park the waiting fiber instead of its thread
+ * @details a waiter that runs in a fiber of a Scheduler goes on the wait queue of the
+ * primitive and yields with Fiber::YieldToHold(), so its worker keeps running other
+ * fibers; the waker schedules it back. A waiter that is a plain thread blocks on an
+ * Event instead. Release hands the lock or the permit over to the first waiter
+ * directly, so a woken waiter never has to compete for it again.
+ */
+
+namespace fiber_internal {
+
+/// a parked fiber or thread, lives on the stack of the waiter
+struct FiberWaiter {
+    Fiber::ptr fiber;
+    Scheduler *scheduler{nullptr};
+    Event event;
+    /// reader or writer, for FiberRWLock
+    bool exclusive{true};
+    FiberWaiter *next{nullptr};
+
+    FiberWaiter();
+
+    /**
+     * @brief park until Wake(), the wait queue guard must have been released
+     * @param reason shown by Fiber::DumpAll() while a fiber is parked
+     */
+    void Park(const char *reason);
+
+    /// the waiter may be gone once this returns
+    void Wake();
+};
+
+/// intrusive FIFO of waiters, protected by the guard of its primitive
+class FiberWaitQueue {
+public:
+    bool empty() const { return m_head == nullptr; }
+
+    FiberWaiter *front() const { return m_head; }
+
+    void push_back(FiberWaiter *waiter) {
+        waiter->next = nullptr;
+        if (m_tail) {
+            m_tail->next = waiter;
+        } else {
+            m_head = waiter;
+        }
+        m_tail = waiter;
+    }
+
+    FiberWaiter *pop_front() {
+        FiberWaiter *waiter = m_head;
+        if (waiter) {
+            m_head = waiter->next;
+            if (m_head == nullptr) {
+                m_tail = nullptr;
+            }
+        }
+        return waiter;
+    }
 
-class Semaphore : public FiberNoncopyable {
 private:
-    sem_t m_semaphore;
+    FiberWaiter *m_head{nullptr};
+    FiberWaiter *m_tail{nullptr};
+};
+
+}  // namespace fiber_internal
 
+/*
+ * @brief mutex that parks fibers, FIFO with direct hand-off
+ */
+class FiberMutex : public Lock {
 public:
-    explicit Semaphore(uint32_t count = 0);
+    void lock() noexcept override;
 
-    ~Semaphore();
+    bool try_lock() noexcept override;
 
-    void wait();
+    void unlock() noexcept override;
 
-    void notify();
+private:
+    AtomicSpinLock m_guard;
+    bool m_locked{false};
+    fiber_internal::FiberWaitQueue m_waiters;
 };
 
+/*
+ * @brief condition variable to be used with FiberMutex
+ */
+class FiberCondVar : public FiberNoncopyable {
+public:
+    /**
+     * @pre mutex is locked by the caller
+     * @post mutex is locked by the caller
+     */
+    void wait(FiberMutex &mutex);
+
+    template<typename Predicate>
+    void wait(FiberMutex &mutex, Predicate pred) {
+        while (!pred()) {
+            wait(mutex);
+        }
+    }
+
+    void notify_one();
+
+    void notify_all();
+
+private:
+    AtomicSpinLock m_guard;
+    fiber_internal::FiberWaitQueue m_waiters;
+};
+
+/*
+ * @brief counting semaphore that parks fibers, permits are handed to waiters in FIFO order
+ */
 class FiberSemaphore : public FiberNoncopyable {
+public:
+    explicit FiberSemaphore(uint64_t count = 0) : m_count(count) {}
+
+    void Acquire();
+
+    bool TryAcquire();
+
+    void Release(uint64_t n = 1);
+
+    uint64_t GetValue();
+
+private:
+    AtomicSpinLock m_guard;
+    uint64_t m_count;
+    fiber_internal::FiberWaitQueue m_waiters;
+};
 
-};
\ No newline at end of file
+/*
+ * @brief readers-writer lock that parks fibers
+ * @details FIFO: a reader arriving behind a waiting writer waits too, so writers do
+ * not starve; releasing the lock admits either the first writer or every reader at the
+ * head of the queue.
+ */
+class FiberRWLock : public SharedLock {
+public:
+    void lock() noexcept override;
+
+    bool try_lock() noexcept override;
+
+    void unlock() noexcept override;
+
+    void lock_shared() noexcept override;
+
+    bool try_lock_shared() noexcept override;
+
+    void unlock_shared() noexcept override;
+
+private:
+    /// admit the waiters at the head of the queue, the guard is held; returns them chained by next
+    fiber_internal::FiberWaiter *AdmitWaiters();
+
+    AtomicSpinLock m_guard;
+    bool m_writer{false};
+    uint64_t m_readers{0};
+    fiber_internal::FiberWaitQueue m_waiters;
+};
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <glog/logging.h>
+
+#include "fiber_flags.h"
+#include "fiber_preempt.h"
+#include "fiber_scheduler.h"
+#include "concurrent/this_thread.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/// rarely used by anything else, and ignored by default should one arrive late
+static constexpr int kPreemptSignal = SIGURG;
+
+/// the handler we replaced, for the signals that are not our ticks
+static struct sigaction s_old_action;
+
+static std::atomic<uint64_t> s_overruns{0};
+static std::atomic<uint64_t> s_yields{0};
+static std::atomic<uint64_t> s_forced{0};
+
+namespace fiber_internal {
+
+thread_local volatile sig_atomic_t t_preempt_requested = 0;
+
+/// bumped by the worker at every slice, compared by the signal handler across ticks
+static thread_local std::atomic<uint32_t> t_preempt_slice{0};
+static thread_local uint32_t t_preempt_seen_slice = 0;
+/// depth of FiberPreemptScope of the running fiber
+static thread_local volatile sig_atomic_t t_preempt_scope_depth = 0;
+/// the current thread is a worker with a PreemptTimer
+static thread_local volatile sig_atomic_t t_preempt_armed = 0;
+
+void PreemptNewSlice() {
+    t_preempt_requested = 0;
+    t_preempt_slice.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool PreemptYield() {
+    t_preempt_requested = 0;
+    Fiber *main_fiber = Scheduler::GetMainFiber();
+    if (main_fiber == nullptr || Fiber::GetThis().get() == main_fiber) {
+        return false;
+    }
+    s_yields.fetch_add(1, std::memory_order_relaxed);
+    Fiber::YieldToReady();
+    return true;
+}
+
+/**
+ * the fiber may resume on another worker: thread-locals, errno included, are reached
+ * again from a separate function, the compiler would reuse the old thread's addresses
+ */
+static __attribute__((noinline)) void ResumeInScope(sig_atomic_t depth, int saved_errno) {
+    asm volatile("" : : : "memory");
+    t_preempt_scope_depth = depth;
+    errno = saved_errno;
+}
+
+/// a SIGURG for out-of-band data, or sent to a thread that is no worker
+static void ChainOldHandler(int sig, siginfo_t *info, void *context) {
+    if (s_old_action.sa_flags & SA_SIGINFO) {
+        s_old_action.sa_sigaction(sig, info, context);
+    } else if (s_old_action.sa_handler != SIG_DFL && s_old_action.sa_handler != SIG_IGN) {
+        s_old_action.sa_handler(sig);
+    }
+}
+
+static void PreemptSignalHandler(int sig, siginfo_t *info, void *context) {
+    if (!t_preempt_armed || info->si_code != SI_TIMER) {
+        ChainOldHandler(sig, info, context);
+        return;
+    }
+    const int saved_errno = errno;
+    const uint32_t slice = t_preempt_slice.load(std::memory_order_relaxed);
+    if (slice != t_preempt_seen_slice) {
+        t_preempt_seen_slice = slice;
+        return;
+    }
+    if (!t_preempt_requested) {
+        t_preempt_requested = 1;
+        s_overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    const sig_atomic_t depth = t_preempt_scope_depth;
+    if (depth > 0) {
+        s_forced.fetch_add(1, std::memory_order_relaxed);
+        // the region may be entered again by another fiber of this worker meanwhile
+        t_preempt_scope_depth = 0;
+        Fiber::YieldToReady();
+        ResumeInScope(depth, saved_errno);
+        return;
+    }
+    errno = saved_errno;
+}
+
+static void InstallPreemptHandler() {
+    struct sigaction action{};
+    action.sa_sigaction = PreemptSignalHandler;
+    // SA_NODEFER: a fiber switched out inside the handler must not leave the signal
+    // blocked for the worker, the mask is only restored when the handler returns
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(kPreemptSignal, &action, &s_old_action)) {
+        PLOG(FATAL) << "sigaction for fiber preemption fail";
+    }
+}
+
+PreemptTimer::PreemptTimer() {
+    const uint32_t preempt_ms = FLAGS_fiber_preempt_ms;
+    if (preempt_ms == 0) {
+        return;
+    }
+    static std::once_flag s_install;
+    std::call_once(s_install, InstallPreemptHandler);
+
+    struct sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = kPreemptSignal;
+    event.sigev_notify_thread_id = ThisThread::GetId();
+    // the cpu time of the worker, it does not advance while the worker sleeps
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &m_timer)) {
+        PLOG(FATAL) << "timer_create for fiber preemption fail";
+    }
+    const uint64_t tick_us = std::max<uint64_t>(preempt_ms * 1000 / 2, 1000);
+    struct itimerspec spec{};
+    spec.it_interval.tv_sec = static_cast<time_t>(tick_us / 1000000);
+    spec.it_interval.tv_nsec = static_cast<long>(tick_us % 1000000 * 1000);
+    spec.it_value = spec.it_interval;
+    if (timer_settime(m_timer, 0, &spec, nullptr)) {
+        PLOG(FATAL) << "timer_settime for fiber preemption fail";
+    }
+    m_armed = true;
+    t_preempt_armed = 1;
+}
+
+PreemptTimer::~PreemptTimer() {
+    if (m_armed) {
+        t_preempt_armed = 0;
+        timer_delete(m_timer);
+    }
+}
+
+}  // namespace fiber_internal
+
+FiberPreemptScope::FiberPreemptScope() {
+    fiber_internal::t_preempt_scope_depth = fiber_internal::t_preempt_scope_depth + 1;
+}
+
+FiberPreemptScope::~FiberPreemptScope() {
+    fiber_internal::t_preempt_scope_depth = fiber_internal::t_preempt_scope_depth - 1;
+}
+
+FiberPreemptStats FiberGetPreemptStats() {
+    return {s_overruns.load(std::memory_order_relaxed), s_yields.load(std::memory_order_relaxed),
+            s_forced.load(std::memory_order_relaxed)};
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <csignal>
+#include <ctime>
+#include <cstdint>
+
+#include "fiber_nocopyable.h"
+
+/**
+ * @brief opt-in preemption of fibers that hold their worker for too long
+ * @details with --fiber_preempt_ms > 0 every scheduler worker arms a timer on its own
+ * cpu-time clock (timer_create with SIGEV_THREAD_ID), so idle or blocked workers get no
+ * signals. The timer ticks every fiber_preempt_ms / 2; when a tick sees the same slice
+ * as the one before, the fiber has overrun and is asked to yield, which it does at its
+ * next FiberYieldIfNeeded() safepoint. Inside a FiberPreemptScope the signal handler
+ * switches the fiber out by itself.
+ *
+ * The signal is SIGURG, installed with SA_RESTART; calls that are never restarted, like
+ * epoll_wait or nanosleep, may still fail with EINTR on a worker. A SIGURG that is not a
+ * tick of a worker's timer goes to the handler installed before.
+ */
+
+namespace fiber_internal {
+
+/// set by the signal handler, cleared when the worker starts the next slice
+extern thread_local volatile sig_atomic_t t_preempt_requested;
+
+/// the current worker starts running a task
+void PreemptNewSlice();
+
+/// the slow path of FiberYieldIfNeeded()
+bool PreemptYield();
+
+/**
+ * @brief arms the preemption timer of the current worker while it lives
+ * @details does nothing when fiber_preempt_ms is 0
+ */
+class PreemptTimer : public FiberNoncopyable {
+public:
+    PreemptTimer();
+
+    ~PreemptTimer() override;
+
+private:
+    timer_t m_timer{};
+    bool m_armed{false};
+};
+
+}  // namespace fiber_internal
+
+/**
+ * @brief a safepoint: yield if the current fiber has overrun its slice
+ * @details costs a thread-local load when there is nothing to do, cheap enough for the
+ * inner loop of a computation
+ * @return whether the fiber yielded
+ */
+inline bool FiberYieldIfNeeded() {
+    if (__builtin_expect(fiber_internal::t_preempt_requested == 0, 1)) {
+        return false;
+    }
+    return fiber_internal::PreemptYield();
+}
+
+/**
+ * @brief a region where the fiber may be switched out at any instruction
+ * @details the code inside must only compute: no locks, no allocation, nothing that is
+ * not async-signal-safe, and no yielding. Once switched out the fiber may resume on
+ * another worker, so the region must not keep thread-local addresses either.
+ */
+class FiberPreemptScope : public FiberNoncopyable {
+public:
+    FiberPreemptScope();
+
+    ~FiberPreemptScope() override;
+};
+
+struct FiberPreemptStats {
+    /// slices that ran past fiber_preempt_ms
+    uint64_t overruns;
+    /// yields at FiberYieldIfNeeded() safepoints
+    uint64_t yields;
+    /// fibers switched out by the signal inside a FiberPreemptScope
+    uint64_t forced;
+};
+
+/**
+ * @brief preemption counters since the process started
+ */
+FiberPreemptStats FiberGetPreemptStats();
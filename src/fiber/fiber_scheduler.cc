@@ -0,0 +1,328 @@
+#include <functional>
+#include <glog/logging.h>
+
+#include "concurrent/spinlock.h"
+#include "fiber_flags.h"
+#include "fiber_macros.h"
+#include "fiber_preempt.h"
+#include "fiber_scheduler.h"
+
+/// capacity of the lock-free local run queue of every worker, overflow goes to the inbox
+static constexpr size_t kLocalQueueCapacity = 4096;
+
+/// scheduler of the current thread
+static thread_local Scheduler *t_scheduler = nullptr;
+/// fiber of the current thread that runs the scheduling loop
+static thread_local Fiber *t_scheduler_fiber = nullptr;
+/// worker index of the current thread in t_scheduler
+static thread_local int t_worker_index = -1;
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
+        : m_name(name), m_use_caller(use_caller) {
+    FIBER_ASSERT(threads > 0);
+    for (size_t i = 0; i < threads; ++i) {
+        auto worker = std::make_unique<Worker>();
+        worker->local.init(kLocalQueueCapacity);
+        m_workers.push_back(std::move(worker));
+    }
+    if (use_caller) {
+        FIBER_ASSERT(GetThis() == nullptr);
+        Fiber::GetThis();
+        setThis();
+        t_worker_index = 0;
+        m_root_fiber.reset(new Fiber(std::bind(&Scheduler::run, this, 0), 0, true));
+        m_root_fiber->setSystemName("root");
+    }
+}
+
+Scheduler::~Scheduler() {
+    FIBER_ASSERT(m_stopping);
+    for (auto &worker: m_workers) {
+        Task *task = nullptr;
+        while (worker->local.pop(&task)) {
+            delete task;
+        }
+        for (Task *t: worker->inbox) {
+            delete t;
+        }
+        for (Task *t: worker->pinned) {
+            delete t;
+        }
+    }
+    if (GetThis() == this) {
+        t_scheduler = nullptr;
+        t_worker_index = -1;
+    }
+}
+
+Scheduler *Scheduler::GetThis() {
+    return t_scheduler;
+}
+
+Fiber *Scheduler::GetMainFiber() {
+    return t_scheduler_fiber;
+}
+
+int Scheduler::GetWorkerIndex() {
+    return t_worker_index;
+}
+
+void Scheduler::setThis() {
+    t_scheduler = this;
+}
+
+void Scheduler::start() {
+    if (!m_stopping.exchange(false)) {
+        return;
+    }
+    for (size_t i = m_use_caller ? 1 : 0; i < m_workers.size(); ++i) {
+        m_workers[i]->thread = std::make_shared<FiberThread>(std::bind(&Scheduler::run, this, i),
+                                                             m_name + "_" + std::to_string(i));
+    }
+}
+
+void Scheduler::stop() {
+    if (m_use_caller) {
+        FIBER_ASSERT(GetThis() == this);
+    } else {
+        FIBER_ASSERT(GetThis() != this);
+    }
+    m_stopping.store(true);
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        tickle(static_cast<int>(i));
+    }
+    if (m_root_fiber && !stopping()) {
+        m_root_fiber->call();
+        t_scheduler_fiber = nullptr;
+    }
+    for (auto &worker: m_workers) {
+        if (worker->thread) {
+            worker->thread->join();
+            worker->thread.reset();
+        }
+    }
+}
+
+void Scheduler::schedule(Fiber::ptr fiber, int thread) {
+    submit(new Task{std::move(fiber), nullptr, thread});
+}
+
+void Scheduler::schedule(Callback cb, int thread) {
+    submit(new Task{nullptr, std::move(cb), thread});
+}
+
+void Scheduler::switchTo(int thread) {
+    FIBER_ASSERT(GetMainFiber() != nullptr);
+    if (GetThis() == this && (thread == -1 || thread == t_worker_index)) {
+        return;
+    }
+    schedule(Fiber::GetThis(), thread);
+    Fiber::YieldToHold("switchTo");
+}
+
+void Scheduler::submit(Task *task) {
+    m_pending_tasks.fetch_add(1, std::memory_order_relaxed);
+    const size_t n = m_workers.size();
+    if (task->thread < 0 && GetThis() == this && t_worker_index >= 0
+        && m_workers[t_worker_index]->local.push(task)) {
+        // pairs with the fence in idle(): either we see the idle worker or it sees the task
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (hasIdleThreads()) {
+            tickle(-1);
+        }
+        return;
+    }
+    size_t target;
+    if (task->thread >= 0) {
+        target = task->thread % n;
+    } else {
+        // the caller thread only runs tasks inside stop(), do not queue for it
+        const size_t first = (m_use_caller && n > 1) ? 1 : 0;
+        target = first + m_next_worker.fetch_add(1, std::memory_order_relaxed) % (n - first);
+    }
+    Worker &worker = *m_workers[target];
+    const bool pinned = task->thread >= 0;
+    {
+        std::lock_guard guard(worker.inbox_mutex);
+        if (pinned) {
+            worker.pinned.push_back(task);
+            worker.pinned_size.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            worker.inbox.push_back(task);
+            worker.inbox_size.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // a pinned task needs its own worker, anybody may steal the others
+    tickle(pinned ? static_cast<int>(target) : -1);
+}
+
+Scheduler::Task *Scheduler::nextTask(int index) {
+    Worker &self = *m_workers[index];
+    Task *task = nullptr;
+    if (self.pinned_size.load(std::memory_order_relaxed) + self.inbox_size.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard guard(self.inbox_mutex);
+        if (!self.pinned.empty()) {
+            task = self.pinned.front();
+            self.pinned.pop_front();
+            self.pinned_size.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+        if (!self.inbox.empty()) {
+            task = self.inbox.front();
+            self.inbox.pop_front();
+            self.inbox_size.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+    if (self.local.pop(&task)) {
+        return task;
+    }
+    const size_t n = m_workers.size();
+    for (size_t i = 1; i < n; ++i) {
+        Worker &victim = *m_workers[(index + i) % n];
+        if (victim.local.steal(&task)) {
+            return task;
+        }
+        if (victim.inbox_size.load(std::memory_order_relaxed) > 0) {
+            std::unique_lock lock(victim.inbox_mutex, std::try_to_lock);
+            if (lock && !victim.inbox.empty()) {
+                task = victim.inbox.front();
+                victim.inbox.pop_front();
+                victim.inbox_size.fetch_sub(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::hasTask(int index) {
+    Worker &self = *m_workers[index];
+    if (self.pinned_size.load(std::memory_order_relaxed) > 0) {
+        return true;
+    }
+    for (auto &worker: m_workers) {
+        if (worker->inbox_size.load(std::memory_order_relaxed) > 0 || worker->local.volatile_size() > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::wake(int index) {
+    Worker &worker = *m_workers[index];
+    if (worker.idle.load(std::memory_order_relaxed) && worker.idle.exchange(false)) {
+        worker.parker.Release();
+        return true;
+    }
+    return false;
+}
+
+void Scheduler::tickle(int thread) {
+    if (thread >= 0) {
+        wake(thread);
+        return;
+    }
+    if (!hasIdleThreads()) {
+        return;
+    }
+    const size_t n = m_workers.size();
+    const size_t start = m_next_worker.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+        if (wake(static_cast<int>((start + i) % n))) {
+            return;
+        }
+    }
+}
+
+bool Scheduler::stopping() {
+    return m_stopping.load() && m_pending_tasks.load() == 0 && m_active_threads.load() == 0;
+}
+
+void Scheduler::idle() {
+    Worker &worker = *m_workers[t_worker_index];
+    while (!stopping()) {
+        worker.idle.store(true);
+        // pairs with the fence in submit() and the store of m_stopping in stop()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hasTask(t_worker_index) && !stopping()) {
+            worker.parker.TimedAcquire(FLAGS_fiber_scheduler_idle_ms);
+        }
+        // a tickle that raced with the timeout leaves a permit behind, which only
+        // makes the next park return at once
+        worker.idle.store(false);
+        Fiber::YieldToHold("idle");
+    }
+}
+
+void Scheduler::run(int index) {
+    setThis();
+    t_worker_index = index;
+    if (m_use_caller && index == 0) {
+        t_scheduler_fiber = m_root_fiber.get();
+    } else {
+        t_scheduler_fiber = Fiber::GetThis().get();
+    }
+
+    Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
+    idle_fiber->setSystemName("idle");
+    fiber_internal::PreemptTimer preempt_timer;
+    /// fiber reused for callback tasks as long as they run to completion
+    Fiber::ptr cb_fiber;
+    while (true) {
+        Task *task = nextTask(index);
+        if (task == nullptr) {
+            if (idle_fiber->getState() == Fiber::TERM) {
+                break;
+            }
+            m_idle_threads.fetch_add(1);
+            // the idle loop must not inherit the slice, nor the overrun, of the last task
+            fiber_internal::PreemptNewSlice();
+            idle_fiber->swapIn();
+            m_idle_threads.fetch_sub(1);
+            continue;
+        }
+
+        m_active_threads.fetch_add(1);
+        m_pending_tasks.fetch_sub(1);
+        Fiber::ptr fiber;
+        bool is_cb = false;
+        if (task->fiber) {
+            fiber = std::move(task->fiber);
+        } else {
+            if (cb_fiber) {
+                cb_fiber->reset(std::move(task->cb));
+            } else {
+                cb_fiber.reset(new Fiber(std::move(task->cb)));
+            }
+            fiber = cb_fiber;
+            is_cb = true;
+        }
+        delete task;
+
+        // a fiber rescheduled by another thread right after it yielded may still be
+        // switching out there, its context is incomplete until the flag is cleared
+        uint32_t spins = 0;
+        while (fiber->m_running.exchange(true, std::memory_order_acquire)) {
+            spinlock_internal::SpinWait(spins);
+        }
+        Fiber::State state = fiber->getState();
+        if (state != Fiber::TERM && state != Fiber::EXCEPT) {
+            fiber_internal::PreemptNewSlice();
+            fiber->swapIn();
+            state = fiber->getState();
+        }
+        fiber->m_running.store(false, std::memory_order_release);
+
+        if (state == Fiber::READY) {
+            schedule(fiber);
+        }
+        if (is_cb && state != Fiber::TERM && state != Fiber::EXCEPT) {
+            // the fiber is owned by whoever resumes it now
+            cb_fiber.reset();
+        }
+        m_active_threads.fetch_sub(1);
+    }
+    t_scheduler_fiber = nullptr;
+}
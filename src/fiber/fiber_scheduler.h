@@ -2,18 +2,170 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
 #include <iostream>
 #include "fibers.h"
 #include "fiber_thread.h"
+#include "concurrent/sem.h"
+#include "concurrent/work_stealing_queue.h"
 
 /**
  * @brief Fiber Scheduler
  * @details N:M Fiber:Thread Model
+ * every worker thread owns a lock-free local run queue (WorkStealingQueue) that only it
+ * pushes to and pops from, and a locked inbox for tasks scheduled from other threads.
+ * A worker runs its inbox and local queue first, then steals from the other workers,
+ * and parks in idle() when there is nothing to run.
+ *
+ * With use_caller the thread that constructs the scheduler is worker 0; it runs the
+ * scheduling loop in a root fiber only inside stop().
  */
+class Scheduler : public FiberNoncopyable {
+public:
+    typedef std::shared_ptr<Scheduler> ptr;
+    typedef std::function<void()> Callback;
+
+    /**
+     * @param threads number of workers, the caller thread included when use_caller
+     * @param use_caller whether the constructing thread becomes worker 0
+     * @param name worker threads are named name_<index>
+     */
+    explicit Scheduler(size_t threads = 1, bool use_caller = true, const std::string &name = "Scheduler");
+
+    ~Scheduler() override;
+
+    const std::string &getName() const { return m_name; }
+
+    size_t getThreadCount() const { return m_workers.size(); }
+
+    /**
+     * @brief start the worker threads
+     */
+    void start();
+
+    /**
+     * @brief run until every scheduled task has finished, then join the workers
+     * @pre called by the caller thread when use_caller
+     */
+    void stop();
+
+    /**
+     * @brief schedule a fiber to run
+     * @param thread worker index the fiber must run on, -1 for any worker;
+     * pinned tasks are never stolen
+     */
+    void schedule(Fiber::ptr fiber, int thread = -1);
+
+    /**
+     * @brief schedule a callback to run in a fiber of the worker
+     */
+    void schedule(Callback cb, int thread = -1);
+
+    template<class InputIterator>
+    void schedule(InputIterator begin, InputIterator end) {
+        for (; begin != end; ++begin) {
+            schedule(*begin);
+        }
+    }
+
+    /**
+     * @brief move the current fiber to another worker of this scheduler
+     * @param thread worker index, -1 for any worker
+     */
+    void switchTo(int thread = -1);
+
+    /**
+     * @brief tasks scheduled but not yet picked up by a worker
+     */
+    int64_t getPendingTasks() const { return m_pending_tasks.load(std::memory_order_relaxed); }
 
-class Scheduler {
 public:
-    typedef std::shared_ptr<Fiber> ptr;
+    /**
+     * @brief return the scheduler of the current thread
+     */
+    static Scheduler *GetThis();
+
+    /**
+     * @brief return the scheduling fiber of the current thread, nullptr outside a scheduler
+     */
+    static Fiber *GetMainFiber();
+
+    /**
+     * @brief return the worker index of the current thread, -1 outside a scheduler
+     */
+    static int GetWorkerIndex();
+
+protected:
+    /**
+     * @brief wake up a worker that waits for tasks
+     * @param thread worker index, -1 for any idle worker
+     */
+    virtual void tickle(int thread);
+
+    /**
+     * @brief return whether the scheduler may stop
+     */
+    virtual bool stopping();
+
+    /**
+     * @brief run in the idle fiber of a worker when there is nothing to run
+     */
+    virtual void idle();
+
+    void setThis();
+
+    bool hasIdleThreads() const { return m_idle_threads.load(std::memory_order_relaxed) > 0; }
+
+    /**
+     * @brief return whether worker index may find a task to run
+     */
+    bool hasTask(int index);
+
+private:
+    struct Task {
+        Fiber::ptr fiber;
+        Callback cb;
+        int thread;
+    };
+
+    struct Worker {
+        /// pushed and popped by the owner only, stolen by the others
+        WorkStealingQueue<Task *> local;
+        std::mutex inbox_mutex;
+        /// tasks scheduled from other threads, may be stolen
+        std::deque<Task *> inbox;
+        /// tasks scheduled for this worker only
+        std::deque<Task *> pinned;
+        /// sizes of inbox and pinned, checked without the lock
+        std::atomic<size_t> inbox_size{0};
+        std::atomic<size_t> pinned_size{0};
+        /// true while parked in idle(), tickle() clears it and releases parker
+        std::atomic<bool> idle{false};
+        Semaphore parker;
+        FiberThread::ptr thread;
+    };
+
+    void run(int index);
+
+    void submit(Task *task);
+
+    Task *nextTask(int index);
 
+    /// wake up worker index if it is parked
+    bool wake(int index);
 
-};
\ No newline at end of file
+private:
+    std::string m_name;
+    bool m_use_caller;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    /// runs run(0) in the caller thread when use_caller
+    Fiber::ptr m_root_fiber;
+    std::atomic<size_t> m_next_worker{0};
+    std::atomic<int64_t> m_pending_tasks{0};
+    std::atomic<int64_t> m_active_threads{0};
+    std::atomic<int64_t> m_idle_threads{0};
+    std::atomic<bool> m_stopping{true};
+};
@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <glog/logging.h>
+
+#include "concurrent/sharded_counter.h"
+#include "fiber_flags.h"
+#include "fiber_stack.h"
+
+/// leaked on purpose, thread caches release their stacks during exit
+static auto &s_mapped_stacks = *new ShardedCounter<int64_t>;
+static auto &s_cached_stacks = *new ShardedCounter<int64_t>;
+static auto &s_max_used_bytes = *new ShardedMax<int64_t>;
+
+static size_t RoundUpToPage(size_t size) {
+    const size_t page = FiberStackAllocator::PageSize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+static void *MapStack(size_t size) {
+    const size_t page = FiberStackAllocator::PageSize();
+    void *base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        PLOG(ERROR) << "mmap fiber stack failed, size: " << size;
+        return nullptr;
+    }
+    if (mprotect(base, page, PROT_NONE) != 0) {
+        PLOG(ERROR) << "mprotect fiber stack guard page failed";
+        munmap(base, size + page);
+        return nullptr;
+    }
+    s_mapped_stacks.Increment();
+    return static_cast<char *>(base) + page;
+}
+
+static void UnmapStack(void *vp, size_t size) {
+    const size_t page = FiberStackAllocator::PageSize();
+    if (munmap(static_cast<char *>(vp) - page, size + page) != 0) {
+        PLOG(ERROR) << "munmap fiber stack failed";
+    }
+    s_mapped_stacks.Decrement();
+}
+
+/// give the touched pages of a stack back to the system, the mapping stays
+static void ReleaseStackPages(void *vp, size_t size) {
+    if (madvise(vp, size, MADV_DONTNEED) != 0) {
+        PLOG(ERROR) << "madvise fiber stack failed";
+    }
+}
+
+/// stacks overflowing the thread caches, shared by all threads so that stacks freed
+/// by one thread are reused by another that creates fibers
+class GlobalStackPool {
+public:
+    void *Get(size_t size) {
+        std::lock_guard guard(m_mutex);
+        auto it = m_stacks.find(size);
+        if (it == m_stacks.end() || it->second.empty()) {
+            return nullptr;
+        }
+        void *vp = it->second.back();
+        it->second.pop_back();
+        --m_count;
+        s_cached_stacks.Decrement();
+        return vp;
+    }
+
+    bool Put(void *vp, size_t size) {
+        std::lock_guard guard(m_mutex);
+        if (m_count >= FLAGS_fiber_stack_global_cache_size) {
+            return false;
+        }
+        m_stacks[size].push_back(vp);
+        ++m_count;
+        s_cached_stacks.Increment();
+        return true;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<size_t, std::vector<void *>> m_stacks;
+    uint64_t m_count{0};
+};
+
+/// leaked on purpose, thread caches may spill into it during exit
+static GlobalStackPool *s_global_pool = new GlobalStackPool;
+
+/// stacks released by thread_local destructors after t_stack_cache is gone are unmapped
+static thread_local bool t_stack_cache_destroyed = false;
+
+/// recycled stacks of the current thread by rounded size
+class StackCache {
+public:
+    StackCache() = default;
+
+    ~StackCache() {
+        t_stack_cache_destroyed = true;
+        for (auto &[size, stacks]: m_stacks) {
+            for (void *vp: stacks) {
+                UnmapStack(vp, size);
+            }
+            s_cached_stacks.Sub(static_cast<int64_t>(stacks.size()));
+        }
+    }
+
+    void *Get(size_t size) {
+        auto it = m_stacks.find(size);
+        if (it == m_stacks.end() || it->second.empty()) {
+            return nullptr;
+        }
+        void *vp = it->second.back();
+        it->second.pop_back();
+        --m_count;
+        s_cached_stacks.Decrement();
+        return vp;
+    }
+
+    bool Put(void *vp, size_t size) {
+        if (m_count >= FLAGS_fiber_stack_cache_size) {
+            return false;
+        }
+        m_stacks[size].push_back(vp);
+        ++m_count;
+        s_cached_stacks.Increment();
+        return true;
+    }
+
+private:
+    std::unordered_map<size_t, std::vector<void *>> m_stacks;
+    uint64_t m_count{0};
+};
+
+static StackCache *GetStackCache() {
+    if (t_stack_cache_destroyed) {
+        return nullptr;
+    }
+    static thread_local StackCache t_stack_cache;
+    return &t_stack_cache;
+}
+
+size_t FiberStackAllocator::PageSize() {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+void *FiberStackAllocator::Alloc(size_t size) {
+    size = RoundUpToPage(size);
+    if (StackCache *cache = GetStackCache()) {
+        if (void *vp = cache->Get(size)) {
+            return vp;
+        }
+    }
+    if (void *vp = s_global_pool->Get(size)) {
+        return vp;
+    }
+    return MapStack(size);
+}
+
+void FiberStackAllocator::Dealloc(void *vp, size_t size) {
+    if (vp == nullptr) {
+        return;
+    }
+    size = RoundUpToPage(size);
+    if (FLAGS_fiber_stack_track_usage) {
+        s_max_used_bytes.Update(static_cast<int64_t>(UsedBytes(vp, size)));
+    }
+    if (StackCache *cache = GetStackCache()) {
+        if (cache->Put(vp, size)) {
+            return;
+        }
+    }
+    // a stack parked in the global pool may wait long for a thread to pick it up, it
+    // must not hold on to the pages the deepest fiber it ran touched
+    ReleaseStackPages(vp, size);
+    if (s_global_pool->Put(vp, size)) {
+        return;
+    }
+    UnmapStack(vp, size);
+}
+
+size_t FiberStackAllocator::UsedBytes(void *vp, size_t size) {
+    size = RoundUpToPage(size);
+    const size_t page = PageSize();
+    const size_t pages = size / page;
+    std::vector<unsigned char> resident(pages);
+    if (mincore(vp, size, resident.data()) != 0) {
+        PLOG(ERROR) << "mincore fiber stack failed";
+        return 0;
+    }
+    // the stack grows down, the lowest resident page marks the deepest use
+    for (size_t i = 0; i < pages; ++i) {
+        if (resident[i] & 1) {
+            return (pages - i) * page;
+        }
+    }
+    return 0;
+}
+
+FiberStackStats FiberStackAllocator::GetStats() {
+    FiberStackStats stats;
+    stats.mapped_stacks = s_mapped_stacks.Value();
+    stats.cached_stacks = s_cached_stacks.Value();
+    stats.max_used_bytes = std::max<int64_t>(s_max_used_bytes.Value(), 0);
+    return stats;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief fiber stacks mapped with mmap
+ * @details every stack is a private anonymous mapping with a PROT_NONE guard page below
+ * it, so an overflow faults at once instead of corrupting the neighbouring memory. The
+ * mapping is MAP_NORESERVE and never touched by the allocator: the kernel commits pages
+ * only when the fiber first uses them, so RSS follows the depth fibers really reach, not
+ * fiber_stack_size. Released stacks are kept in a per-thread cache, up to
+ * fiber_stack_cache_size of them, then in a global pool shared by all threads, up to
+ * fiber_stack_global_cache_size, before they are unmapped. Stacks entering the global
+ * pool give their pages back first, a cached stack costs no RSS there.
+ */
+
+struct FiberStackStats {
+    /// stacks currently mapped, in use or cached
+    int64_t mapped_stacks{0};
+    /// mapped stacks waiting in the thread caches and the global pool
+    int64_t cached_stacks{0};
+    /// deepest stack usage seen when stacks were released, 0 unless fiber_stack_track_usage
+    int64_t max_used_bytes{0};
+};
+
+class FiberStackAllocator {
+public:
+    /**
+     * @brief return the lowest usable address of a stack of at least size bytes,
+     * nullptr when the address space is exhausted
+     */
+    static void *Alloc(size_t size);
+
+    /**
+     * @brief release a stack returned by Alloc(size)
+     */
+    static void Dealloc(void *vp, size_t size);
+
+    /**
+     * @brief high-water mark of a stack: the bytes between its top and the lowest page
+     * that is resident, i.e. ever touched since the stack was mapped
+     */
+    static size_t UsedBytes(void *vp, size_t size);
+
+    static FiberStackStats GetStats();
+
+    static size_t PageSize();
+};
@@ -8,7 +8,7 @@
 #include "fiber_thread.h"
 
 static thread_local FiberThread *t_thread = nullptr;
-static thread_local std::string_view t_thread_name = "UNKNOWN";
+static thread_local std::string t_thread_name = "UNKNOWN";
 
 FiberThread *FiberThread::GetThis() {
     return t_thread;
@@ -34,7 +34,7 @@ FiberThread::FiberThread(Callback cb, const std::string &name) : m_cb(std::move(
     if (rt) {
         LOG(FATAL) << "pthread_create thread fail, rt=" << rt << " name=" << name;
     }
-    m_semaphore.wait();
+    m_semaphore.Acquire();
 }
 
 FiberThread::~FiberThread() noexcept {
@@ -58,11 +58,11 @@ void *FiberThread::run(void *arg) {
     t_thread = thread;
     t_thread_name = thread->m_name;
     thread->m_id = syscall(SYS_gettid);
-    pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).data());
+    pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
 
     std::function<void()> cb;
     cb.swap(t_thread->m_cb);
-    t_thread->m_semaphore.notify();
+    t_thread->m_semaphore.Release();
     std::invoke(cb);
     return nullptr;
 }
\ No newline at end of file
@@ -11,7 +11,7 @@
 
 #include "fiber_singleton.h"
 #include "fiber_nocopyable.h"
-#include "fiber_mutex.h"
+#include "concurrent/sem.h"
 
 class FiberThread : public FiberNoncopyable {
 public:
@@ -41,6 +41,6 @@ private:
     pid_t m_id{-1};
     pthread_t m_thread{0};
     Callback m_cb;
-    std::string_view m_name;
+    std::string m_name;
     Semaphore m_semaphore;
 };
\ No newline at end of file
@@ -1,154 +1,370 @@
-#include <numeric>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <thread>
 
 #include "fiber_timer.h"
+#include "utils/memory_pool_lite.h"
 
-bool FiberTimer::Comparator::operator()(const FiberTimer::ptr &lhs, const FiberTimer::ptr &rhs) const {
-    if (!lhs && !rhs) {
-        return false;
+namespace fiber_internal {
+
+static constexpr int kLevelBits = 6;
+static constexpr uint64_t kSlotNum = 1ull << kLevelBits;
+static constexpr int kLevelNum = 6;
+/// timers further away park in the top level and cascade again when it comes round
+static constexpr uint64_t kMaxDuration = 1ull << (kLevelBits * kLevelNum);
+static constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+/// doubly linked through FiberTimer::m_prev/m_next
+struct TimerList {
+    FiberTimer *head{nullptr};
+
+    bool empty() const { return head == nullptr; }
+
+    void push(FiberTimer *timer) {
+        timer->m_prev = nullptr;
+        timer->m_next = head;
+        if (head) {
+            head->m_prev = timer;
+        }
+        head = timer;
     }
-    if (!lhs) {
-        return true;
+
+    void remove(FiberTimer *timer) {
+        if (timer->m_prev) {
+            timer->m_prev->m_next = timer->m_next;
+        } else {
+            head = timer->m_next;
+        }
+        if (timer->m_next) {
+            timer->m_next->m_prev = timer->m_prev;
+        }
+        timer->m_prev = timer->m_next = nullptr;
     }
-    if (!rhs) {
-        return false;
+
+    FiberTimer *take() {
+        FiberTimer *list = head;
+        head = nullptr;
+        return list;
     }
-    if (lhs->m_next < rhs->m_next) {
-        return true;
+};
+
+struct alignas(64) TimerWheel {
+    static constexpr uint8_t kNotLinked = 0xff;
+    static constexpr uint8_t kExpired = 0xfe;
+
+    struct Expiration {
+        int level;
+        uint64_t slot;
+        uint64_t deadline;
+    };
+
+    std::mutex lock;
+    /// ms the wheel has been advanced to, deadlines up to it have expired
+    uint64_t elapsed{FiberGetCurrentTimeMs()};
+    /// bit i of level k is set if slots[k][i] is not empty
+    uint64_t occupied[kLevelNum] = {0};
+    TimerList slots[kLevelNum][kSlotNum];
+    /// timers added with a deadline not after elapsed, they fire in the next advance
+    TimerList expired;
+    /// no timer needs processing before it, read without the lock
+    std::atomic<uint64_t> next_deadline{kNever};
+
+    /**
+     * @brief the level is given by the highest bit where deadline and elapsed differ,
+     * so the timer is due when its slot in that level comes round
+     */
+    static int LevelFor(uint64_t elapsed, uint64_t deadline) {
+        uint64_t masked = (elapsed ^ deadline) | (kSlotNum - 1);
+        masked = std::min(masked, kMaxDuration - 1);
+        return (63 - __builtin_clzll(masked)) / kLevelBits;
     }
-    if (lhs->m_next > rhs->m_next) {
+
+    void insert(FiberTimer *timer) {
+        if (timer->m_deadline <= elapsed) {
+            timer->m_level = kExpired;
+            expired.push(timer);
+            return;
+        }
+        int level = LevelFor(elapsed, timer->m_deadline);
+        uint64_t slot = (timer->m_deadline >> (level * kLevelBits)) & (kSlotNum - 1);
+        timer->m_level = static_cast<uint8_t>(level);
+        timer->m_slot = static_cast<uint8_t>(slot);
+        slots[level][slot].push(timer);
+        occupied[level] |= 1ull << slot;
+    }
+
+    void remove(FiberTimer *timer) {
+        if (timer->m_level == kExpired) {
+            expired.remove(timer);
+        } else {
+            TimerList &list = slots[timer->m_level][timer->m_slot];
+            list.remove(timer);
+            if (list.empty()) {
+                occupied[timer->m_level] &= ~(1ull << timer->m_slot);
+            }
+        }
+        timer->m_level = kNotLinked;
+    }
+
+    /**
+     * @brief the earliest occupied slot; levels are checked bottom up, as the lower
+     * levels cover the time before the next slot of the upper ones
+     */
+    bool nextExpiration(Expiration &exp) const {
+        for (int level = 0; level < kLevelNum; ++level) {
+            if (!occupied[level]) {
+                continue;
+            }
+            const uint64_t slot_range = 1ull << (level * kLevelBits);
+            const uint64_t level_range = slot_range << kLevelBits;
+            // rotate so that bit 0 is the slot elapsed is in
+            uint64_t now_slot = elapsed / slot_range;
+            uint64_t shift = now_slot & (kSlotNum - 1);
+            uint64_t rotated = shift ? (occupied[level] >> shift) | (occupied[level] << (kSlotNum - shift))
+                                     : occupied[level];
+            if (level == kLevelNum - 1 && rotated != 1) {
+                // the current top slot only holds timers a whole rotation away
+                rotated &= ~1ull;
+            }
+            uint64_t slot = (__builtin_ctzll(rotated) + now_slot) & (kSlotNum - 1);
+            uint64_t level_start = elapsed & ~(level_range - 1);
+            uint64_t deadline = level_start + slot * slot_range;
+            if (deadline <= elapsed) {
+                // only the top level wraps round
+                deadline += level_range;
+            }
+            exp = {level, slot, deadline};
+            return true;
+        }
         return false;
     }
-    return lhs.get() < rhs.get();
-}
 
+    void lowerNextDeadline(uint64_t deadline) {
+        if (deadline < next_deadline.load(std::memory_order_relaxed)) {
+            next_deadline.store(deadline, std::memory_order_release);
+        }
+    }
+
+    void updateNextDeadline() {
+        Expiration exp;
+        uint64_t next = kNever;
+        if (!expired.empty()) {
+            next = elapsed;
+        } else if (nextExpiration(exp)) {
+            next = exp.deadline;
+        }
+        next_deadline.store(next, std::memory_order_release);
+    }
+
+    /**
+     * @brief move the wheel to now, collecting the callbacks of the expired timers
+     * @param released one-shot timers that fired, to be dropped without the lock
+     * @return the number of one-shot timers that fired
+     */
+    int64_t advance(uint64_t now, std::vector<FiberTimer::Callback> &cbs, std::vector<FiberTimer::ptr> &released) {
+        FiberTimer *fired = expired.take();
+        FiberTimer *fired_tail = nullptr;
+        for (FiberTimer *timer = fired; timer; timer = timer->m_next) {
+            fired_tail = timer;
+        }
+
+        Expiration exp;
+        while (nextExpiration(exp) && exp.deadline <= now) {
+            FiberTimer *timer = slots[exp.level][exp.slot].take();
+            occupied[exp.level] &= ~(1ull << exp.slot);
+            elapsed = exp.deadline;
+            while (timer) {
+                FiberTimer *next = timer->m_next;
+                if (timer->m_deadline <= elapsed) {
+                    timer->m_prev = fired_tail;
+                    timer->m_next = nullptr;
+                    (fired_tail ? fired_tail->m_next : fired) = timer;
+                    fired_tail = timer;
+                } else {
+                    // cascade down to a finer level
+                    insert(timer);
+                }
+                timer = next;
+            }
+        }
+        elapsed = std::max(elapsed, now);
+
+        int64_t done = 0;
+        while (fired) {
+            FiberTimer *timer = fired;
+            fired = timer->m_next;
+            timer->m_prev = timer->m_next = nullptr;
+            timer->m_level = kNotLinked;
+            if (timer->m_recurring) {
+                cbs.push_back(timer->m_cb);
+                // inserted after elapsed caught up, a 0ms timer fires once per round
+                timer->m_deadline = now + timer->m_ms;
+                insert(timer);
+            } else {
+                cbs.push_back(std::move(timer->m_cb));
+                timer->m_cb = nullptr;
+                released.push_back(std::move(timer->m_self));
+                ++done;
+            }
+        }
+        updateNextDeadline();
+        return done;
+    }
+};
 
-FiberTimer::FiberTimer(uint64_t ms, FiberTimer::Callback cb, bool recurring, FiberTimerManager *manager)
+}  // namespace fiber_internal
+
+using fiber_internal::TimerWheel;
+
+FiberTimer::FiberTimer(Key, uint64_t ms, FiberTimer::Callback cb, bool recurring,
+                       FiberTimerManager *manager, TimerWheel *wheel)
         : m_recurring(recurring),
           m_ms(ms),
-          m_next(FiberGetCurrentTimeMs() + m_ms),
+          m_deadline(FiberGetCurrentTimeMs() + m_ms),
           m_cb(std::move(cb)),
-          m_manager(manager) {
-
-}
-
-FiberTimer::FiberTimer(uint64_t next) : m_next(next) {
+          m_manager(manager),
+          m_wheel(wheel),
+          m_level(TimerWheel::kNotLinked) {
 
 }
 
 bool FiberTimer::cancel() {
-    std::unique_lock wlock(m_manager->m_rw_lock);
-    if (m_cb) {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if (it != m_manager->m_timers.end()) {
-            m_manager->m_timers.erase(it);
-        }
-        return true;
+    ptr self;
+    std::unique_lock lock(m_wheel->lock);
+    if (!m_cb) {
+        return false;
+    }
+    m_cb = nullptr;
+    if (m_level != TimerWheel::kNotLinked) {
+        m_wheel->remove(this);
+        m_manager->m_timer_count.Decrement();
+        // the wheel's next_deadline may now be early, which only costs a spurious wakeup
+        self = std::move(m_self);
     }
-    return false;
+    lock.unlock();
+    return true;
 }
 
 bool FiberTimer::refresh() {
-    std::unique_lock wlock(m_manager->m_rw_lock);
-    if (!m_cb) {
-        return false;
-    }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
+    std::unique_lock lock(m_wheel->lock);
+    if (!m_cb || m_level == TimerWheel::kNotLinked) {
         return false;
     }
-    m_manager->m_timers.erase(it);
-    m_next = FiberGetCurrentTimeMs() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_wheel->remove(this);
+    m_deadline = FiberGetCurrentTimeMs() + m_ms;
+    m_wheel->insert(this);
+    // a later deadline never moves the wheel's next_deadline
     return true;
 }
 
-
 bool FiberTimer::reset(uint64_t ms, bool from_now) {
-    if (ms == m_ms && !from_now) {
-        return true;
-    }
-    std::unique_lock wlock(m_manager->m_rw_lock);
-    if (!m_cb) {
+    std::unique_lock lock(m_wheel->lock);
+    if (!m_cb || m_level == TimerWheel::kNotLinked) {
         return false;
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if (it == m_manager->m_timers.end()) {
-        return false;
+    if (ms == m_ms && !from_now) {
+        return true;
     }
-    m_manager->m_timers.erase(it);
+    m_wheel->remove(this);
     uint64_t start = 0;
     if (from_now) {
         start = FiberGetCurrentTimeMs();
     } else {
-        start = m_next - m_ms;
+        start = m_deadline - m_ms;
     }
     m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), wlock);
+    m_deadline = start + m_ms;
+    m_wheel->insert(this);
+    uint64_t deadline = m_deadline;
+    m_wheel->lowerNextDeadline(deadline);
+    lock.unlock();
+    m_manager->checkInsertedAtFront(deadline);
     return true;
 }
 
-FiberTimerManager::FiberTimerManager() : m_last_execute_time(FiberGetCurrentTimeMs()) {
-
+FiberTimerManager::FiberTimerManager() : m_next_deadline(fiber_internal::kNever) {
+    size_t wheel_num = 1;
+    while (wheel_num < std::max(1u, std::thread::hardware_concurrency())) {
+        wheel_num <<= 1;
+    }
+    m_wheel_mask = wheel_num - 1;
+    m_wheels.reset(new TimerWheel[wheel_num]);
 }
 
 FiberTimerManager::~FiberTimerManager() {
-
+    // break the self references of the timers still scheduled
+    std::vector<FiberTimer::ptr> released;
+    for (size_t i = 0; i <= m_wheel_mask; ++i) {
+        TimerWheel &wheel = m_wheels[i];
+        std::lock_guard lock(wheel.lock);
+        auto drain = [&released](fiber_internal::TimerList &list) {
+            while (!list.empty()) {
+                FiberTimer *timer = list.head;
+                list.remove(timer);
+                timer->m_level = TimerWheel::kNotLinked;
+                timer->m_cb = nullptr;
+                released.push_back(std::move(timer->m_self));
+            }
+        };
+        drain(wheel.expired);
+        for (auto &level: wheel.slots) {
+            for (auto &slot: level) {
+                drain(slot);
+            }
+        }
+    }
 }
 
 uint64_t FiberTimerManager::getNextTimer() {
-    std::shared_lock rlock(m_rw_lock);
-    m_tickled = false;
-    if (m_timers.empty()) {
+    m_tickled.store(false, std::memory_order_relaxed);
+    uint64_t next = minNextDeadline();
+    // publish, then look again: an addTimer() either sees the published deadline and
+    // tickles, or its timer is seen here
+    while (true) {
+        m_next_deadline.store(next, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t again = minNextDeadline();
+        if (again >= next) {
+            break;
+        }
+        next = again;
+    }
+    if (next == fiber_internal::kNever) {
         return std::numeric_limits<uint64_t>::max();
     }
-
-    const FiberTimer::ptr &next = *m_timers.begin();
     uint64_t now_ms = FiberGetCurrentTimeMs();
-    if (now_ms >= next->m_next) {
-        return 0;
-    } else {
-        return next->m_next - now_ms;
+    return now_ms >= next ? 0 : next - now_ms;
+}
+
+uint64_t FiberTimerManager::minNextDeadline() const {
+    uint64_t next = fiber_internal::kNever;
+    for (size_t i = 0; i <= m_wheel_mask; ++i) {
+        next = std::min(next, m_wheels[i].next_deadline.load(std::memory_order_acquire));
     }
+    return next;
 }
 
 bool FiberTimerManager::hasTimer() {
-    std::shared_lock rlock(m_rw_lock);
-    return !m_timers.empty();
+    return m_timer_count.Value() > 0;
 }
 
 void FiberTimerManager::listExpiredCb(std::vector<Callback> &cbs) {
     uint64_t now_ms = FiberGetCurrentTimeMs();
-    std::vector<FiberTimer::ptr> expired;
-
-    std::unique_lock wlock(m_rw_lock);
-    if (m_timers.empty()) {
-        return;
-    }
-    bool rollover = detectClockRollover(now_ms);
-    if (!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
-    }
-
-    FiberTimer::ptr now_timer(new FiberTimer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while (it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(),
-                   std::make_move_iterator(m_timers.begin()),
-                   std::make_move_iterator(it));
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
-
-    for (auto &timer: expired) {
-        cbs.push_back(timer->m_cb);
-        if (timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
+    std::vector<FiberTimer::ptr> released;
+    for (size_t i = 0; i <= m_wheel_mask; ++i) {
+        TimerWheel &wheel = m_wheels[i];
+        if (wheel.next_deadline.load(std::memory_order_acquire) > now_ms) {
+            continue;
+        }
+        // another worker is expiring this wheel
+        std::unique_lock lock(wheel.lock, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            continue;
+        }
+        int64_t done = wheel.advance(now_ms, cbs, released);
+        if (done) {
+            m_timer_count.Add(-done);
         }
     }
 }
@@ -160,24 +376,27 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
     }
 }
 
-template<typename LockType>
-void FiberTimerManager::addTimer(FiberTimer::ptr timer, LockType &lock) {
-    auto it = m_timers.insert(std::move(timer)).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if (at_front) {
-        m_tickled = true;
-    }
-    lock.unlock();
-
-    if (at_front) {
+void FiberTimerManager::checkInsertedAtFront(uint64_t deadline) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (deadline < m_next_deadline.load(std::memory_order_relaxed) &&
+        !m_tickled.exchange(true, std::memory_order_relaxed)) {
         onTimerInsertedAtFront();
     }
 }
 
 FiberTimer::ptr FiberTimerManager::addTimer(uint64_t ms, FiberTimerManager::Callback cb, bool recurring) {
-    FiberTimer::ptr timer(new FiberTimer(ms, cb, recurring, this));
-    std::unique_lock rlock(m_rw_lock);
-    addTimer(timer, rlock);
+    TimerWheel *wheel = &m_wheels[sharded_internal::ThreadSlot() & m_wheel_mask];
+    // the timer and its control block in one slot of the thread's free list
+    auto timer = std::allocate_shared<FiberTimer>(MemoryPoolLiteConcurrentAllocator<FiberTimer>(), FiberTimer::Key(),
+                                                  ms, std::move(cb), recurring, this, wheel);
+    m_timer_count.Increment();
+    std::unique_lock lock(wheel->lock);
+    timer->m_self = timer;
+    wheel->insert(timer.get());
+    uint64_t deadline = timer->m_deadline;
+    wheel->lowerNextDeadline(deadline);
+    lock.unlock();
+    checkInsertedAtFront(deadline);
     return timer;
 }
 
@@ -186,13 +405,3 @@ FiberTimerManager::addConditionTimer(uint64_t ms, FiberTimerManager::Callback cb
                                      bool recurring) {
     return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
-
-bool FiberTimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if (now_ms < m_last_execute_time &&
-        now_ms < (m_last_execute_time - 60 * 60 * 1000)) {
-        rollover = true;
-    }
-    m_last_execute_time = now_ms;
-    return rollover;
-}
\ No newline at end of file
@@ -1,59 +1,86 @@
+#pragma once
+
+#include <atomic>
 #include <memory>
 #include <utility>
 #include <vector>
-#include <set>
 #include <functional>
-#include <unordered_set>
-#include <unordered_map>
-#include <shared_mutex>
-#include <mutex>
 #include <chrono>
 
+#include "concurrent/sharded_counter.h"
+
 class FiberTimerManager;
 
+namespace fiber_internal {
+struct TimerList;
+struct TimerWheel;
+}  // namespace fiber_internal
+
+/// milliseconds on the monotonic clock, immune to wall clock changes
 static inline uint64_t FiberGetCurrentTimeMs() {
-    auto now = std::chrono::system_clock::now();
+    auto now = std::chrono::steady_clock::now();
     auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
     return now_ms.time_since_epoch().count();
 }
 
 class FiberTimer : public std::enable_shared_from_this<FiberTimer> {
     friend class FiberTimerManager;
+    friend struct fiber_internal::TimerList;
+    friend struct fiber_internal::TimerWheel;
 
 public:
     typedef std::shared_ptr<FiberTimer> ptr;
     typedef std::function<void()> Callback;
 
+    /// only FiberTimerManager can make one
+    class Key {
+        friend class FiberTimerManager;
+
+        Key() {}
+    };
+
+    FiberTimer(Key, uint64_t ms, Callback cb, bool recurring,
+               FiberTimerManager *manager, fiber_internal::TimerWheel *wheel);
+
     bool cancel();
 
     bool refresh();
 
     bool reset(uint64_t ms, bool from_now);
 
-private:
-    explicit FiberTimer(uint64_t ms, Callback cb,
-                        bool recurring, FiberTimerManager *manager);
-
-    explicit FiberTimer(uint64_t next);
-
 private:
     /// is always running
     bool m_recurring{false};
     /// time cycle
     uint64_t m_ms{0};
     /// execute time
-    uint64_t m_next{0};
+    uint64_t m_deadline{0};
     /// callback
     Callback m_cb{nullptr};
     /// timer manager
     FiberTimerManager *m_manager{nullptr};
 
 private:
-    struct Comparator {
-        bool operator()(const FiberTimer::ptr &lhs, const FiberTimer::ptr &rhs) const;
-    };
+    /// wheel of the thread that added the timer, guards the fields below
+    fiber_internal::TimerWheel *m_wheel{nullptr};
+    /// intrusive links of the wheel slot or the expired list
+    FiberTimer *m_prev{nullptr};
+    FiberTimer *m_next{nullptr};
+    /// slot position in the wheel, or one of the TimerWheel::kNotLinked/kExpired markers
+    uint8_t m_level;
+    uint8_t m_slot{0};
+    /// keeps the timer alive while it is scheduled, the caller may drop its handle
+    ptr m_self;
 };
 
+/**
+ * @brief timers in hierarchical timing wheels
+ * @details every thread adds timers to its own wheel, so threads rarely share a lock.
+ * A wheel has 6 levels of 64 slots, a slot of level k spans 64^k ms; a timer sits in
+ * an intrusive list of the slot its deadline falls into, so add, cancel and refresh are
+ * O(1), and it moves down a level whenever its slot comes due until it expires from
+ * level 0. listExpiredCb() collects the expired timers of all wheels in one pass.
+ */
 class FiberTimerManager {
     friend class FiberTimer;
 
@@ -68,6 +95,10 @@ public:
 
     FiberTimer::ptr addConditionTimer(uint64_t ms, Callback cb, std::weak_ptr<void> weak_cond, bool recurring = false);
 
+    /**
+     * @brief ms until the next timer may expire, 0 if some already did, max if there is none
+     * @details may be early for timers more than 64ms away, never late
+     */
     uint64_t getNextTimer();
 
     void listExpiredCb(std::vector<Callback> &cbs);
@@ -80,25 +111,23 @@ protected:
      */
     virtual void onTimerInsertedAtFront() = 0;
 
-    /**
-     * @brief add timer to manager
-     */
-    template<typename LockType>
-    void addTimer(FiberTimer::ptr val, LockType &lock);
-
 private:
+    /// earliest next_deadline of the wheels
+    uint64_t minNextDeadline() const;
+
     /**
-     * @brief check the machine timer has been lay down
+     * @brief tell the owner if deadline is earlier than what getNextTimer() reported
      */
-    bool detectClockRollover(uint64_t now_ms);
+    void checkInsertedAtFront(uint64_t deadline);
 
 private:
-    /// Shared Mutex
-    std::shared_mutex m_rw_lock;
-    /// timer collections
-    std::set<FiberTimer::ptr, FiberTimer::Comparator> m_timers;
-    /// trigger onTimerInsertedAtFront
-    bool m_tickled = false;
-    /// last execute time
-    uint64_t m_last_execute_time = 0;
-};
\ No newline at end of file
+    /// one wheel per thread slot
+    std::unique_ptr<fiber_internal::TimerWheel[]> m_wheels;
+    size_t m_wheel_mask{0};
+    /// scheduled timers
+    ShardedCounter<int64_t> m_timer_count;
+    /// earliest deadline the last getNextTimer() saw
+    std::atomic<uint64_t> m_next_deadline;
+    /// onTimerInsertedAtFront() already ran since the last getNextTimer()
+    std::atomic<bool> m_tickled{false};
+};
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <glog/logging.h>
+
+#include "concurrent/spinlock.h"
+#include "fiber_iomanager.h"
+#include "fiber_macros.h"
+#include "fiber_mutex.h"
+#include "fiber_uring.h"
+
+static int SysUringSetup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int SysUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int SysUringRegister(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+bool IOUring::Supported() {
+    static const bool supported = [] {
+        io_uring_params params{};
+        const int fd = SysUringSetup(2, &params);
+        if (fd < 0) {
+            return false;
+        }
+        close(fd);
+        return true;
+    }();
+    return supported;
+}
+
+IOUring::IOUring(const Options &options) : m_sqpoll(options.sqpoll) {
+    io_uring_params params{};
+    if (options.sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = options.sqpoll_idle_ms;
+    }
+    m_fd = SysUringSetup(options.entries, &params);
+    if (m_fd < 0) {
+        PLOG(ERROR) << "io_uring_setup fail, entries=" << options.entries;
+        return;
+    }
+    m_sq_entries = params.sq_entries;
+    m_cq_entries = params.cq_entries;
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        LOG(WARNING) << "io_uring drops completions on overflow, keep at most "
+                     << params.cq_entries << " operations in flight";
+    }
+
+    m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+    }
+    m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED) {
+        PLOG(ERROR) << "mmap io_uring sq ring fail";
+        m_sq_ring = nullptr;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    if (single_mmap) {
+        m_cq_ring = m_sq_ring;
+    } else {
+        m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED) {
+            PLOG(ERROR) << "mmap io_uring cq ring fail";
+            m_cq_ring = nullptr;
+            munmap(m_sq_ring, m_sq_ring_size);
+            m_sq_ring = nullptr;
+            close(m_fd);
+            m_fd = -1;
+            return;
+        }
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        PLOG(ERROR) << "mmap io_uring sqes fail";
+        if (m_cq_ring != m_sq_ring) {
+            munmap(m_cq_ring, m_cq_ring_size);
+        }
+        munmap(m_sq_ring, m_sq_ring_size);
+        m_sq_ring = m_cq_ring = nullptr;
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto *sq = static_cast<char *>(m_sq_ring);
+    m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    m_sq_flags = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+    m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    m_sqe_tail = *m_sq_tail;
+    // sqe i always sits in slot i, the indirection array never changes
+    for (unsigned i = 0; i < m_sq_entries; ++i) {
+        m_sq_array[i] = i;
+    }
+
+    auto *cq = static_cast<char *>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IOUring::~IOUring() {
+    if (m_fd < 0) {
+        return;
+    }
+    munmap(m_sqes, m_sqes_size);
+    if (m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_ring_size);
+    }
+    munmap(m_sq_ring, m_sq_ring_size);
+    close(m_fd);
+}
+
+io_uring_sqe *IOUring::getSqe() {
+    if (sqSpace() == 0) {
+        return nullptr;
+    }
+    io_uring_sqe *sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+    ++m_sqe_tail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IOUring::submit(unsigned wait_nr) {
+    // publish the sqes, the kernel reads them once it sees the new tail
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    const unsigned to_submit = m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (m_sqpoll) {
+        // the poll thread picks the sqes up by itself unless it went to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (__atomic_load_n(m_sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        } else if (wait_nr == 0) {
+            return static_cast<int>(to_submit);
+        }
+    } else if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+    const int rt = SysUringEnter(m_fd, to_submit, wait_nr, flags);
+    return rt < 0 ? -errno : rt;
+}
+
+int IOUring::wait(unsigned wait_nr) {
+    const int rt = SysUringEnter(m_fd, 0, wait_nr, IORING_ENTER_GETEVENTS);
+    return rt < 0 ? -errno : 0;
+}
+
+int IOUring::flushOverflow() {
+    const int rt = SysUringEnter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    return rt < 0 ? -errno : 0;
+}
+
+int IOUring::registerBuffers(const iovec *iovs, unsigned nr) {
+    return SysUringRegister(m_fd, IORING_REGISTER_BUFFERS, iovs, nr) < 0 ? -errno : 0;
+}
+
+int IOUring::unregisterBuffers() {
+    return SysUringRegister(m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) < 0 ? -errno : 0;
+}
+
+int IOUring::registerFiles(const int *fds, unsigned nr) {
+    return SysUringRegister(m_fd, IORING_REGISTER_FILES, fds, nr) < 0 ? -errno : 0;
+}
+
+int IOUring::unregisterFiles() {
+    return SysUringRegister(m_fd, IORING_UNREGISTER_FILES, nullptr, 0) < 0 ? -errno : 0;
+}
+
+int IOUring::registerEventFd(int efd) {
+    return SysUringRegister(m_fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0 ? -errno : 0;
+}
+
+/// user_data of the nop that stops the reaper thread
+static constexpr uint64_t kStopReaper = 0;
+
+struct UringEngine::Request {
+    /// execute(): the parked caller, its result slot and the operations it still waits for
+    fiber_internal::FiberWaiter *waiter{nullptr};
+    int *result{nullptr};
+    std::atomic<int> *remaining{nullptr};
+    /// submit()
+    Callback done;
+};
+
+UringEngine::UringEngine(IOManager *iom, const IOUring::Options &options)
+        : m_ring(options), m_iom(iom) {
+    if (!m_ring.valid()) {
+        return;
+    }
+    if (m_iom == nullptr) {
+        m_reaper = std::make_shared<FiberThread>(std::bind(&UringEngine::reaperLoop, this), "uring_reaper");
+        return;
+    }
+    m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_event_fd < 0) {
+        PLOG(FATAL) << "eventfd fail";
+    }
+    const int rt = m_ring.registerEventFd(m_event_fd);
+    if (rt < 0) {
+        LOG(FATAL) << "io_uring register eventfd fail: " << strerror(-rt);
+    }
+    m_poller_id = m_iom->addPoller(std::bind(&UringEngine::poll, this));
+}
+
+UringEngine::~UringEngine() {
+    if (!m_ring.valid()) {
+        return;
+    }
+    FIBER_ASSERT(m_inflight.load() == 0);
+    if (m_reaper) {
+        {
+            std::lock_guard guard(m_lock);
+            io_uring_sqe *sqe = m_ring.getSqe();
+            while (sqe == nullptr) {
+                m_ring.submit();
+                sqe = m_ring.getSqe();
+            }
+            UringPrepNop(sqe);
+            sqe->user_data = kStopReaper;
+            m_ring.submit();
+        }
+        m_reaper->join();
+        return;
+    }
+    m_iom->delPoller(m_poller_id);
+    // once the event fired, onCompletions() is queued or running and clears m_armed last
+    std::unique_lock lock(m_lock);
+    while (m_armed && !m_iom->delEvent(m_event_fd, IOManager::READ)) {
+        lock.unlock();
+        if (Scheduler::GetMainFiber() != nullptr) {
+            // it may be queued on this very worker
+            Fiber::YieldToReady();
+        } else {
+            sched_yield();
+        }
+        lock.lock();
+    }
+    lock.unlock();
+    close(m_event_fd);
+}
+
+void UringEngine::enqueue(Request *requests, const Prep *preps, size_t n, bool link) {
+    std::lock_guard guard(m_lock);
+    FIBER_ASSERT(n <= m_ring.sqEntries());
+    // a chain must go to the kernel in one piece
+    uint32_t spins = 0;
+    while (m_ring.sqSpace() < n) {
+        submitLocked();
+        spinlock_internal::SpinWait(spins);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        io_uring_sqe *sqe = m_ring.getSqe();
+        preps[i](sqe);
+        if (link && i + 1 < n) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        sqe->user_data = reinterpret_cast<uint64_t>(&requests[i]);
+    }
+    m_inflight.fetch_add(static_cast<int64_t>(n), std::memory_order_relaxed);
+    if (m_iom == nullptr) {
+        submitLocked();
+        return;
+    }
+    arm();
+    // workers of the IOManager leave the sqes to the next polling round
+    const bool in_worker = Scheduler::GetMainFiber() != nullptr && IOManager::GetThis() == m_iom;
+    if (!in_worker || m_ring.sqPending() >= m_ring.sqEntries() / 4) {
+        submitLocked();
+    }
+}
+
+void UringEngine::submitLocked() {
+    int rt;
+    do {
+        rt = m_ring.submit();
+    } while (rt == -EINTR);
+    // EAGAIN and EBUSY leave the sqes queued for the next round
+    if (rt < 0 && rt != -EAGAIN && rt != -EBUSY) {
+        LOG(ERROR) << "io_uring_enter fail: " << strerror(-rt);
+    }
+}
+
+bool UringEngine::reapCompletions(bool wait) {
+    std::unique_lock lock(m_reap_lock, std::defer_lock);
+    if (wait) {
+        lock.lock();
+    } else if (!lock.try_lock()) {
+        return false;
+    }
+    bool stop = false;
+    m_ring.reap([this, &stop](const io_uring_cqe &cqe) {
+        if (cqe.user_data == kStopReaper) {
+            stop = true;
+            return;
+        }
+        auto *request = reinterpret_cast<Request *>(cqe.user_data);
+        m_inflight.fetch_sub(1, std::memory_order_relaxed);
+        if (request->waiter) {
+            *request->result = cqe.res;
+            fiber_internal::FiberWaiter *waiter = request->waiter;
+            // the requests live on the stack of the waiter
+            if (request->remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                waiter->Wake();
+            }
+        } else {
+            request->done(cqe.res);
+            delete request;
+        }
+    });
+    return stop;
+}
+
+void UringEngine::arm() {
+    if (m_armed) {
+        return;
+    }
+    if (m_iom->addEvent(m_event_fd, IOManager::READ, std::bind(&UringEngine::onCompletions, this)) == 0) {
+        m_armed = true;
+    }
+}
+
+void UringEngine::poll() {
+    {
+        std::lock_guard guard(m_lock);
+        if (m_ring.sqPending() > 0) {
+            submitLocked();
+        }
+    }
+    if (m_inflight.load(std::memory_order_relaxed) > 0) {
+        reapCompletions(false);
+    }
+}
+
+void UringEngine::onCompletions() {
+    eventfd_t value;
+    eventfd_read(m_event_fd, &value);
+    // completions posted after the drain are reaped here or signal the eventfd again
+    reapCompletions(true);
+    std::lock_guard guard(m_lock);
+    // the event is one-shot, keep it only while there is something to wait for
+    m_armed = false;
+    if (m_inflight.load(std::memory_order_relaxed) > 0) {
+        arm();
+    }
+}
+
+void UringEngine::reaperLoop() {
+    while (true) {
+        const int rt = m_ring.wait(1);
+        if (rt < 0 && rt != -EINTR) {
+            LOG(ERROR) << "io_uring_enter wait fail: " << strerror(-rt);
+        }
+        if (reapCompletions(true)) {
+            break;
+        }
+    }
+}
+
+int UringEngine::execute(const Prep &prep) {
+    fiber_internal::FiberWaiter waiter;
+    int result = 0;
+    std::atomic<int> remaining{1};
+    Request request;
+    request.waiter = &waiter;
+    request.result = &result;
+    request.remaining = &remaining;
+    enqueue(&request, &prep, 1, false);
+    waiter.Park("io_uring");
+    return result;
+}
+
+std::vector<int> UringEngine::executeLinked(const std::vector<Prep> &preps) {
+    std::vector<int> results(preps.size());
+    if (preps.empty()) {
+        return results;
+    }
+    fiber_internal::FiberWaiter waiter;
+    std::atomic<int> remaining{static_cast<int>(preps.size())};
+    std::vector<Request> requests(preps.size());
+    for (size_t i = 0; i < preps.size(); ++i) {
+        requests[i].waiter = &waiter;
+        requests[i].result = &results[i];
+        requests[i].remaining = &remaining;
+    }
+    enqueue(requests.data(), preps.data(), preps.size(), true);
+    waiter.Park("io_uring");
+    return results;
+}
+
+void UringEngine::submit(const Prep &prep, Callback done) {
+    auto *request = new Request;
+    request->done = std::move(done);
+    enqueue(request, &prep, 1, false);
+}
+
+int UringEngine::read(int fd, void *buf, uint32_t len, uint64_t offset) {
+    return execute([=](io_uring_sqe *sqe) { UringPrepRead(sqe, fd, buf, len, offset); });
+}
+
+int UringEngine::write(int fd, const void *buf, uint32_t len, uint64_t offset) {
+    return execute([=](io_uring_sqe *sqe) { UringPrepWrite(sqe, fd, buf, len, offset); });
+}
+
+int UringEngine::recv(int fd, void *buf, uint32_t len, int flags) {
+    return execute([=](io_uring_sqe *sqe) { UringPrepRecv(sqe, fd, buf, len, flags); });
+}
+
+int UringEngine::send(int fd, const void *buf, uint32_t len, int flags) {
+    return execute([=](io_uring_sqe *sqe) { UringPrepSend(sqe, fd, buf, len, flags); });
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "fiber_nocopyable.h"
+#include "fiber_thread.h"
+
+class IOManager;
+
+/**
+ * @brief io_uring driven through the raw syscalls, liburing is not needed
+ * @details single producer, single consumer: getSqe()/submit() and reap() must each be
+ * called by one thread at a time, UringEngine below does the locking.
+ */
+class IOUring : public FiberNoncopyable {
+public:
+    struct Options {
+        /// submission queue size, rounded up to a power of 2 by the kernel
+        uint32_t entries{256};
+        /// let a kernel thread poll the submission queue, submit() then rarely enters the kernel
+        bool sqpoll{false};
+        /// idle time before the SQPOLL thread sleeps
+        uint32_t sqpoll_idle_ms{100};
+    };
+
+    /**
+     * @brief return whether the kernel supports io_uring, it may be missing or disabled
+     */
+    static bool Supported();
+
+    explicit IOUring(const Options &options);
+
+    ~IOUring();
+
+    /// false if io_uring_setup failed, errno tells why
+    bool valid() const { return m_fd >= 0; }
+
+    int fd() const { return m_fd; }
+
+    uint32_t sqEntries() const { return m_sq_entries; }
+
+    uint32_t cqEntries() const { return m_cq_entries; }
+
+    /**
+     * @brief return a zeroed sqe to fill, nullptr when the submission queue is full
+     */
+    io_uring_sqe *getSqe();
+
+    /**
+     * @brief hand the sqes got so far to the kernel and wait for wait_nr completions
+     * @return the number of sqes submitted, or -errno
+     */
+    int submit(unsigned wait_nr = 0);
+
+    /**
+     * @brief wait until wait_nr completions are posted, submits nothing so it may run
+     * concurrently with getSqe()/submit()
+     * @return 0 or -errno
+     */
+    int wait(unsigned wait_nr);
+
+    /**
+     * @brief sqes that getSqe() can still hand out
+     */
+    unsigned sqSpace() const {
+        return m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE));
+    }
+
+    /**
+     * @brief sqes got but not yet submitted
+     */
+    unsigned sqPending() const { return m_sqe_tail - *m_sq_tail; }
+
+    /**
+     * @brief call fn(const io_uring_cqe &) for every completion posted so far
+     * @details completions that found the completion queue full are kept by the kernel
+     * and flushed into the ring as it drains, so more operations than cqEntries() may be
+     * in flight
+     * @return the number of completions
+     */
+    template<typename Fn>
+    unsigned reap(Fn &&fn) {
+        unsigned n = 0;
+        while (true) {
+            unsigned head = *m_cq_head;
+            const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head, ++n) {
+                fn(m_cqes[head & m_cq_mask]);
+            }
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            if (!(__atomic_load_n(m_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) ||
+                flushOverflow() != 0) {
+                return n;
+            }
+        }
+    }
+
+    /// fixed buffers for IORING_OP_READ_FIXED/WRITE_FIXED, @return 0 or -errno
+    int registerBuffers(const iovec *iovs, unsigned nr);
+
+    int unregisterBuffers();
+
+    /// fixed files, used with IOSQE_FIXED_FILE and the index as fd, @return 0 or -errno
+    int registerFiles(const int *fds, unsigned nr);
+
+    int unregisterFiles();
+
+    /// eventfd signaled on every completion, @return 0 or -errno
+    int registerEventFd(int efd);
+
+private:
+    /// move the completions kept by the kernel into the drained ring, @return 0 or -errno
+    int flushOverflow();
+
+private:
+    int m_fd{-1};
+    bool m_sqpoll{false};
+    uint32_t m_sq_entries{0};
+    uint32_t m_cq_entries{0};
+
+    void *m_sq_ring{nullptr};
+    size_t m_sq_ring_size{0};
+    void *m_cq_ring{nullptr};
+    size_t m_cq_ring_size{0};
+    io_uring_sqe *m_sqes{nullptr};
+    size_t m_sqes_size{0};
+
+    unsigned *m_sq_head{nullptr};
+    unsigned *m_sq_tail{nullptr};
+    unsigned *m_sq_flags{nullptr};
+    unsigned *m_sq_array{nullptr};
+    unsigned m_sq_mask{0};
+    /// sqes handed out by getSqe(), published to the kernel by submit()
+    unsigned m_sqe_tail{0};
+
+    unsigned *m_cq_head{nullptr};
+    unsigned *m_cq_tail{nullptr};
+    unsigned m_cq_mask{0};
+    io_uring_cqe *m_cqes{nullptr};
+};
+
+static inline void UringPrepRw(io_uring_sqe *sqe, uint8_t op, int fd,
+                               const void *addr, uint32_t len, uint64_t offset) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uint64_t>(addr);
+    sqe->len = len;
+}
+
+static inline void UringPrepNop(io_uring_sqe *sqe) {
+    UringPrepRw(sqe, IORING_OP_NOP, -1, nullptr, 0, 0);
+}
+
+static inline void UringPrepRead(io_uring_sqe *sqe, int fd, void *buf, uint32_t len, uint64_t offset) {
+    UringPrepRw(sqe, IORING_OP_READ, fd, buf, len, offset);
+}
+
+static inline void UringPrepWrite(io_uring_sqe *sqe, int fd, const void *buf, uint32_t len, uint64_t offset) {
+    UringPrepRw(sqe, IORING_OP_WRITE, fd, buf, len, offset);
+}
+
+/// buf must lie in the registered buffer buf_index
+static inline void UringPrepReadFixed(io_uring_sqe *sqe, int fd, void *buf, uint32_t len,
+                                      uint64_t offset, uint16_t buf_index) {
+    UringPrepRw(sqe, IORING_OP_READ_FIXED, fd, buf, len, offset);
+    sqe->buf_index = buf_index;
+}
+
+static inline void UringPrepWriteFixed(io_uring_sqe *sqe, int fd, const void *buf, uint32_t len,
+                                       uint64_t offset, uint16_t buf_index) {
+    UringPrepRw(sqe, IORING_OP_WRITE_FIXED, fd, buf, len, offset);
+    sqe->buf_index = buf_index;
+}
+
+static inline void UringPrepRecv(io_uring_sqe *sqe, int fd, void *buf, uint32_t len, int flags) {
+    UringPrepRw(sqe, IORING_OP_RECV, fd, buf, len, 0);
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+}
+
+static inline void UringPrepSend(io_uring_sqe *sqe, int fd, const void *buf, uint32_t len, int flags) {
+    UringPrepRw(sqe, IORING_OP_SEND, fd, buf, len, 0);
+    sqe->msg_flags = static_cast<uint32_t>(flags);
+}
+
+/// fd of the prepared sqe is an index into the registered files
+static inline void UringUseFixedFile(io_uring_sqe *sqe) {
+    sqe->flags |= IOSQE_FIXED_FILE;
+}
+
+/**
+ * @brief I/O through an IOUring for fibers and plain threads
+ * @details a fiber issuing an operation is parked until its completion, a thread blocks
+ * on an event. With an IOManager, the sqes its fibers queue are batched per polling
+ * round: they are handed to the kernel in one io_uring_enter when a worker runs out of
+ * tasks, or once a quarter of the ring is pending; completions are reaped in the same
+ * round, or when the eventfd registered with the ring wakes up an idle worker.
+ * Operations from outside the IOManager are submitted at once. Without an IOManager, a
+ * reaper thread waits for the completions.
+ *
+ * Results follow the io_uring convention: bytes transferred, or -errno.
+ */
+class UringEngine : public FiberNoncopyable {
+public:
+    typedef std::function<void(io_uring_sqe *)> Prep;
+    typedef std::function<void(int)> Callback;
+
+    explicit UringEngine(IOManager *iom = nullptr, const IOUring::Options &options = IOUring::Options());
+
+    ~UringEngine();
+
+    bool valid() const { return m_ring.valid(); }
+
+    /// register buffers and files here, before the first operation
+    IOUring &ring() { return m_ring; }
+
+    /**
+     * @brief run the operation filled in by prep and wait for it
+     */
+    int execute(const Prep &prep);
+
+    /**
+     * @brief run the operations as one IOSQE_IO_LINK chain, each starts when the previous
+     * one succeeded, and wait for all of them
+     * @return the result of every operation, -ECANCELED for the ones after a failure
+     */
+    std::vector<int> executeLinked(const std::vector<Prep> &preps);
+
+    /**
+     * @brief start the operation, done(result) runs on the reaping thread, e.g. to fulfil a promise
+     */
+    void submit(const Prep &prep, Callback done);
+
+    int read(int fd, void *buf, uint32_t len, uint64_t offset);
+
+    int write(int fd, const void *buf, uint32_t len, uint64_t offset);
+
+    int recv(int fd, void *buf, uint32_t len, int flags = 0);
+
+    int send(int fd, const void *buf, uint32_t len, int flags = 0);
+
+    /**
+     * @brief operations submitted and not completed yet
+     */
+    int64_t getInflight() const { return m_inflight.load(std::memory_order_relaxed); }
+
+private:
+    struct Request;
+
+    /// queue the sqes of n requests, linked into a chain if link
+    void enqueue(Request *requests, const Prep *preps, size_t n, bool link);
+
+    /// hand the queued sqes to the kernel, m_lock is held
+    void submitLocked();
+
+    /**
+     * @brief process the completions posted so far
+     * @param wait false to skip when another thread is reaping
+     * @return whether the stop sentinel was seen
+     */
+    bool reapCompletions(bool wait);
+
+    /// make the IOManager reap when the eventfd fires, m_lock is held
+    void arm();
+
+    /// polling round of the IOManager
+    void poll();
+
+    void onCompletions();
+
+    void reaperLoop();
+
+private:
+    IOUring m_ring;
+    IOManager *m_iom;
+    uint64_t m_poller_id{0};
+    int m_event_fd{-1};
+    /// guards the submission queue and m_armed
+    std::mutex m_lock;
+    /// the completion queue has a single consumer
+    std::mutex m_reap_lock;
+    bool m_armed{false};
+    std::atomic<int64_t> m_inflight{0};
+    FiberThread::ptr m_reaper;
+};
@@ -0,0 +1,60 @@
+#include <algorithm>
+#include <vector>
+#include <glog/logging.h>
+
+#include "fiber_flags.h"
+#include "fiber_watchdog.h"
+
+FiberWatchdog::FiberWatchdog(uint64_t threshold_ms, FiberWatchdog::Callback cb)
+        : m_threshold_ms(std::max<uint64_t>(threshold_ms, 1)), m_cb(std::move(cb)) {
+    if (!FLAGS_fiber_accounting) {
+        LOG(WARNING) << "FiberWatchdog needs --fiber_accounting, no fiber will be reported";
+    }
+    m_thread = std::make_shared<FiberThread>(std::bind(&FiberWatchdog::run, this), "fiber_watchdog");
+}
+
+FiberWatchdog::~FiberWatchdog() {
+    m_stop.Set();
+    m_thread->join();
+}
+
+void FiberWatchdog::run() {
+    // a slice is seen between threshold_ms and 1.5 * threshold_ms after it started
+    while (!m_stop.TimedWait(std::max<uint64_t>(m_threshold_ms / 2, 1))) {
+        check();
+    }
+}
+
+void FiberWatchdog::check() {
+    // may measure the tick rate for a while, not under the registry locks
+    const double ns_per_tick = fiber_internal::NsPerTick();
+    const uint64_t now = fiber_internal::ReadCpuTicks();
+    const uint64_t threshold_ns = m_threshold_ms * 1000000;
+    std::vector<Fiber::Info> infos;
+    // a running fiber has no parked stack
+    std::vector<void *> frames;
+    Fiber::ForEach([&](Fiber &fiber) {
+        if (!fiber.m_stack || fiber.m_system_name) {
+            return;
+        }
+        const uint64_t start = fiber.m_slice_start_ticks.load(std::memory_order_relaxed);
+        if (!start || now < start || fiber_internal::CpuTicksToNs(now - start, ns_per_tick) < threshold_ns) {
+            return;
+        }
+        if (fiber.m_reported_slice_ticks.exchange(start, std::memory_order_relaxed) == start) {
+            return;
+        }
+        infos.emplace_back();
+        fiber.fillInfo(infos.back(), now, ns_per_tick, frames);
+    });
+    // report without the registry locks, fibers may come and go meanwhile
+    for (const Fiber::Info &info: infos) {
+        m_reported.fetch_add(1, std::memory_order_relaxed);
+        if (m_cb) {
+            m_cb(info);
+        } else {
+            LOG(WARNING) << "fiber " << info.id << " has run for " << info.running_us / 1000
+                         << "ms without yielding, thread " << info.tid;
+        }
+    }
+}
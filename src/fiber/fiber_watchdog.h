@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+#include "fiber_nocopyable.h"
+#include "fiber_thread.h"
+#include "fibers.h"
+#include "concurrent/event.h"
+
+/**
+ * @brief reports fibers that hold their worker for too long without yielding
+ * @details a thread scans the fiber registry every threshold_ms / 2 and reports each
+ * fiber whose slice on a cpu has lasted threshold_ms, once per slice. Main fibers of
+ * threads and the scheduler's own fibers are left out. Needs FLAGS_fiber_accounting.
+ */
+class FiberWatchdog : public FiberNoncopyable {
+public:
+    typedef std::function<void(const Fiber::Info &)> Callback;
+
+    /**
+     * @param cb called on the watchdog thread, by default logs a warning
+     */
+    explicit FiberWatchdog(uint64_t threshold_ms, Callback cb = nullptr);
+
+    ~FiberWatchdog() override;
+
+    uint64_t getReported() const { return m_reported.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+
+    /// one pass over the registry
+    void check();
+
+private:
+    const uint64_t m_threshold_ms;
+    Callback m_cb;
+    std::atomic<uint64_t> m_reported{0};
+    Event m_stop;
+    FiberThread::ptr m_thread;
+};
@@ -1,34 +1,127 @@
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <numeric>
-#include <ucontext.h>
+#include <sstream>
+#include <execinfo.h>
 #include <glog/logging.h>
 
+#include "concurrent/sharded_counter.h"
+#include "concurrent/this_thread.h"
 #include "fiber_macros.h"
 #include "fiber_flags.h"
 #include "fibers.h"
+#include "fiber_scheduler.h"
+#include "fiber_stack.h"
 
 static std::atomic<uint64_t> s_fiber_id{0};
-static std::atomic<uint64_t> s_fiber_count{0};
+/// live fibers, updated on every fiber creation and destruction; leaked on purpose, thread
+/// fibers are destroyed at thread exit, which may come after the static destructors ran
+static auto &s_fiber_count = *new ShardedCounter<int64_t>;
 
 /// current running fiber
 static thread_local Fiber *t_fiber = nullptr;
 /// main fiber, used to switch to main context
 static thread_local Fiber::ptr t_threadFiber = nullptr;
 
-/// TODO(JackyFan): use better memory pool
-class MallocStackAllocator {
-public:
-    static void *Alloc(size_t size) {
-        return malloc(size);
+using StackAllocator = FiberStackAllocator;
+
+namespace fiber_internal {
+
+static uint64_t SteadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct TickAnchor {
+    uint64_t ticks;
+    uint64_t ns;
+};
+
+static const TickAnchor &GetTickAnchor() {
+    static const TickAnchor anchor{ReadCpuTicks(), SteadyNs()};
+    return anchor;
+}
+
+/// anchored at load, by the time anyone converts ticks the rate can be measured over a while
+[[maybe_unused]] static const TickAnchor &s_tick_anchor = GetTickAnchor();
+
+double NsPerTick() {
+#if defined(__x86_64__) || defined(__i386__)
+    // an invariant TSC runs at a fixed rate, measure it against steady_clock since the anchor
+    static std::atomic<double> s_ns_per_tick{0};
+    double ns_per_tick = s_ns_per_tick.load(std::memory_order_relaxed);
+    if (ns_per_tick == 0) {
+        const TickAnchor &anchor = GetTickAnchor();
+        uint64_t now_ticks, now_ns;
+        // at least 1ms, so the error of the two reads stays well below 0.01%
+        do {
+            now_ticks = ReadCpuTicks();
+            now_ns = SteadyNs();
+        } while (now_ns - anchor.ns < 1000000);
+        ns_per_tick = static_cast<double>(now_ns - anchor.ns) / static_cast<double>(now_ticks - anchor.ticks);
+        // fixed once measured over a second
+        if (now_ns - anchor.ns >= 1000000000) {
+            s_ns_per_tick.store(ns_per_tick, std::memory_order_relaxed);
+        }
+    }
+    return ns_per_tick;
+#else
+    return 1;
+#endif
+}
+
+/// live fibers, sharded by address so creating fibers on many threads does not contend
+struct FiberRegistryShard {
+    std::mutex lock;
+    Fiber *head{nullptr};
+
+    void add(Fiber *fiber) {
+        std::lock_guard guard(lock);
+        fiber->m_registry = this;
+        fiber->m_registry_next = head;
+        if (head) {
+            head->m_registry_prev = fiber;
+        }
+        head = fiber;
     }
 
-    static void Dealloc(void *vp, size_t size) {
-        return free(vp);
+    void remove(Fiber *fiber) {
+        std::lock_guard guard(lock);
+        if (fiber->m_registry_prev) {
+            fiber->m_registry_prev->m_registry_next = fiber->m_registry_next;
+        } else {
+            head = fiber->m_registry_next;
+        }
+        if (fiber->m_registry_next) {
+            fiber->m_registry_next->m_registry_prev = fiber->m_registry_prev;
+        }
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+}  // namespace fiber_internal
+
+using fiber_internal::FiberRegistryShard;
+
+static constexpr size_t kRegistryShardNum = 16;
+
+static FiberRegistryShard *GetRegistry() {
+    // never destroyed, fibers of threads still running at exit may outlive it otherwise
+    static auto *s_registry = new FiberRegistryShard[kRegistryShardNum];
+    return s_registry;
+}
+
+static void RegisterFiber(Fiber *fiber) {
+    GetRegistry()[(reinterpret_cast<uintptr_t>(fiber) >> 6) % kRegistryShardNum].add(fiber);
+}
+
+/// the fiber swapIn()/swapOut() switch against: the scheduling fiber when this thread
+/// runs a Scheduler, otherwise the main fiber of the thread
+static Fiber *GetSchedulingFiber() {
+    Fiber *fiber = Scheduler::GetMainFiber();
+    return fiber ? fiber : t_threadFiber.get();
+}
 
 uint64_t Fiber::GetFiberId() {
     if (t_fiber) {
@@ -38,45 +131,45 @@ uint64_t Fiber::GetFiberId() {
 }
 
 Fiber::Fiber() {
-    m_state = EXEC;
+    setState(EXEC);
+    m_create_ticks = fiber_internal::ReadCpuTicks();
+    // the thread itself, on a cpu since it started
+    m_slice_start_ticks.store(m_create_ticks, std::memory_order_relaxed);
+    m_tid.store(ThisThread::GetId(), std::memory_order_relaxed);
+    RegisterFiber(this);
     SetThis(this);
+#ifdef FIBER_USE_UCONTEXT
     if (getcontext(&m_ctx)) {
         FIBER_ASSERT_MSG(false, "getcontext");
     }
-    s_fiber_count.fetch_and(1, std::memory_order_relaxed);
+#endif
+    s_fiber_count.Increment();
     LOG(INFO) << "Fiber::Fiber main";
 }
 
 Fiber::Fiber(Fiber::Callback cb, size_t stack_size, bool use_caller) :
         m_id(++s_fiber_id), m_cb(std::move(cb)) {
-    s_fiber_count.fetch_add(1, std::memory_order_relaxed);
-    m_stacksize = FLAGS_fiber_stack_size;
+    s_fiber_count.Increment();
+    m_create_ticks = fiber_internal::ReadCpuTicks();
+    RegisterFiber(this);
+    m_stacksize = stack_size ? stack_size : FLAGS_fiber_stack_size;
     m_stack = StackAllocator::Alloc(m_stacksize);
     if (m_stack == nullptr) {
         FIBER_ASSERT_MSG(false, "Allocate memory failed, id: " << m_id);
     }
-    if (getcontext(&m_ctx)) {
-        FIBER_ASSERT_MSG(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    if (!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
-    }
+    initContext(use_caller);
     LOG(INFO) << "Succeed to init Fiber, id: " << m_id;
 }
 
 Fiber::~Fiber() {
-    s_fiber_count.fetch_sub(1, std::memory_order_relaxed);
+    s_fiber_count.Decrement();
+    m_registry->remove(this);
     if (m_stack) {
-        FIBER_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
+        FIBER_ASSERT(getState() == TERM || getState() == EXCEPT || getState() == INIT);
         StackAllocator::Dealloc(m_stack, m_stacksize);
     } else {
-        FIBER_ASSERT(m_cb != nullptr);
-        FIBER_ASSERT(m_state == EXEC);
+        FIBER_ASSERT(m_cb == nullptr);
+        FIBER_ASSERT(getState() == EXEC);
         Fiber *cur = t_fiber;
         if (cur == this) {
             SetThis(nullptr);
@@ -87,44 +180,242 @@ Fiber::~Fiber() {
 
 void Fiber::reset(Fiber::Callback cb) {
     FIBER_ASSERT(m_stack != nullptr);
-    FIBER_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
+    FIBER_ASSERT(getState() == TERM || getState() == INIT || getState() == EXCEPT);
     m_cb = std::move(cb);
+    initContext(false);
+    setState(INIT);
+}
+
+#ifndef FIBER_USE_UCONTEXT
+/// first entry of a fiber, the jump that started it carries the slot of the suspended side
+static void FContextMainFunc(transfer_t t) {
+    *static_cast<fcontext_t *>(t.data) = t.fctx;
+    Fiber::MainFunc();
+}
+
+static void FContextCallerMainFunc(transfer_t t) {
+    *static_cast<fcontext_t *>(t.data) = t.fctx;
+    Fiber::CallerMainFunc();
+}
+#endif
+
+void Fiber::initContext(bool use_caller) {
+#ifdef FIBER_USE_UCONTEXT
     if (getcontext(&m_ctx)) {
         FIBER_ASSERT_MSG(false, "getcontext");
     }
     m_ctx.uc_link = nullptr;
     m_ctx.uc_stack.ss_sp = m_stack;
     m_ctx.uc_stack.ss_size = m_stacksize;
+    makecontext(&m_ctx, use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc, 0);
+#else
+    m_ctx = make_fcontext(static_cast<char *>(m_stack) + m_stacksize, m_stacksize,
+                          use_caller ? &FContextCallerMainFunc : &FContextMainFunc);
+#endif
+}
+
+void Fiber::SwitchContext(Fiber *from, Fiber *to) {
+    if (FLAGS_fiber_accounting) {
+        const uint64_t now = fiber_internal::ReadCpuTicks();
+        from->accountOut(now);
+        to->accountIn(now);
+    }
+    to->m_block_reason.store(nullptr, std::memory_order_relaxed);
+#ifdef FIBER_USE_UCONTEXT
+    if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+        FIBER_ASSERT_MSG(false, "swapcontext")
+    }
+#else
+    swap_fcontext(&from->m_ctx, to->m_ctx);
+#endif
+}
+
+void Fiber::accountOut(uint64_t now) {
+    const uint64_t start = m_slice_start_ticks.load(std::memory_order_relaxed);
+    if (start) {
+        m_run_ticks.store(m_run_ticks.load(std::memory_order_relaxed) + now - start, std::memory_order_relaxed);
+        m_slice_start_ticks.store(0, std::memory_order_relaxed);
+    }
+    if (getState() == HOLD) {
+        m_block_start_ticks.store(now, std::memory_order_relaxed);
+    }
+}
+
+void Fiber::accountIn(uint64_t now) {
+    // only the running thread writes these, no read-modify-write needed
+    m_switches.store(m_switches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_slice_start_ticks.store(now, std::memory_order_relaxed);
+    m_tid.store(ThisThread::GetId(), std::memory_order_relaxed);
+    const uint64_t block_start = m_block_start_ticks.load(std::memory_order_relaxed);
+    if (block_start) {
+        m_blocked_ticks.store(m_blocked_ticks.load(std::memory_order_relaxed) + now - block_start,
+                              std::memory_order_relaxed);
+        m_block_start_ticks.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Fiber::captureBlockStack() {
+    constexpr int kMaxFrames = 32;
+    void *frames[kMaxFrames];
+    int n = ::backtrace(frames, kMaxFrames);
+    // skip this function and YieldToHold()
+    constexpr int kSkip = 2;
+    std::lock_guard guard(m_registry->lock);
+    if (!m_block_stack) {
+        m_block_stack = std::make_unique<std::vector<void *>>();
+    }
+    m_block_stack->assign(frames + std::min(n, kSkip), frames + n);
+}
+
+void Fiber::fillInfo(Fiber::Info &info, uint64_t now, double ns_per_tick, std::vector<void *> &frames) const {
+    auto CpuTicksToNs = [ns_per_tick](uint64_t ticks) { return fiber_internal::CpuTicksToNs(ticks, ns_per_tick); };
+    info.id = m_id;
+    info.state = getState();
+    info.system_name = m_system_name;
+    info.main = m_stack == nullptr;
+    info.age_ms = CpuTicksToNs(now - m_create_ticks) / 1000000;
+    info.run_us = CpuTicksToNs(m_run_ticks.load(std::memory_order_relaxed)) / 1000;
+    info.switches = m_switches.load(std::memory_order_relaxed);
+    const uint64_t block_start = m_block_start_ticks.load(std::memory_order_relaxed);
+    info.blocked_us = CpuTicksToNs(m_blocked_ticks.load(std::memory_order_relaxed) +
+                                   (block_start && now > block_start ? now - block_start : 0)) / 1000;
+    info.block_reason = m_block_reason.load(std::memory_order_relaxed);
+    const uint64_t slice_start = m_slice_start_ticks.load(std::memory_order_relaxed);
+    info.running_us = slice_start && now > slice_start ? CpuTicksToNs(now - slice_start) / 1000 : 0;
+    info.tid = m_tid.load(std::memory_order_relaxed);
+    frames.clear();
+    if (m_block_stack && info.state == HOLD) {
+        frames = *m_block_stack;
+    }
+}
+
+void Fiber::SymbolizeStack(const std::vector<void *> &frames, std::vector<std::string> &stack) {
+    stack.clear();
+    if (frames.empty()) {
+        return;
+    }
+    char **symbols = backtrace_symbols(frames.data(), static_cast<int>(frames.size()));
+    if (symbols) {
+        for (size_t i = 0; i < frames.size(); ++i) {
+            stack.push_back(fiber_demangle(symbols[i]));
+        }
+        free(symbols);
+    }
+}
+
+Fiber::Info Fiber::getInfo() const {
+    Info info;
+    std::vector<void *> frames;
+    // may measure the tick rate for a while, not under the lock
+    const double ns_per_tick = fiber_internal::NsPerTick();
+    {
+        std::lock_guard guard(m_registry->lock);
+        fillInfo(info, fiber_internal::ReadCpuTicks(), ns_per_tick, frames);
+    }
+    SymbolizeStack(frames, info.stack);
+    return info;
+}
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+void Fiber::ForEach(const std::function<void(Fiber &)> &fn) {
+    for (size_t i = 0; i < kRegistryShardNum; ++i) {
+        FiberRegistryShard &shard = GetRegistry()[i];
+        std::lock_guard guard(shard.lock);
+        for (Fiber *fiber = shard.head; fiber; fiber = fiber->m_registry_next) {
+            fn(*fiber);
+        }
+    }
+}
+
+void Fiber::ListAll(std::vector<Fiber::Info> &infos) {
+    const double ns_per_tick = fiber_internal::NsPerTick();
+    const uint64_t now = fiber_internal::ReadCpuTicks();
+    const size_t first = infos.size();
+    std::vector<std::vector<void *>> frames;
+    ForEach([&](Fiber &fiber) {
+        infos.emplace_back();
+        frames.emplace_back();
+        fiber.fillInfo(infos.back(), now, ns_per_tick, frames.back());
+    });
+    // backtrace_symbols() reads the symbol tables, keep it out of the shard locks
+    for (size_t i = 0; i < frames.size(); ++i) {
+        SymbolizeStack(frames[i], infos[first + i].stack);
+    }
+}
+
+std::string Fiber::DumpAll() {
+    std::vector<Info> infos;
+    ListAll(infos);
+    std::stringstream ss;
+    ss << infos.size() << " fibers" << std::endl;
+    for (const Info &info: infos) {
+        ss << "fiber " << info.id;
+        if (info.main) {
+            ss << " (main)";
+        } else if (info.system_name) {
+            ss << " (" << info.system_name << ")";
+        }
+        ss << " " << StateName(info.state) << " tid=" << info.tid << " age=" << info.age_ms << "ms"
+           << " run=" << info.run_us << "us switches=" << info.switches << " blocked=" << info.blocked_us << "us";
+        if (info.block_reason) {
+            ss << " on " << info.block_reason;
+        }
+        if (info.running_us) {
+            ss << " running for " << info.running_us << "us";
+        }
+        ss << std::endl;
+        for (const std::string &frame: info.stack) {
+            ss << "    " << frame << std::endl;
+        }
+    }
+    return ss.str();
+}
+
+const char *Fiber::StateName(Fiber::State state) {
+    switch (state) {
+        case INIT:
+            return "INIT";
+        case HOLD:
+            return "HOLD";
+        case EXEC:
+            return "EXEC";
+        case TERM:
+            return "TERM";
+        case READY:
+            return "READY";
+        case EXCEPT:
+            return "EXCEPT";
+    }
+    return "UNKNOWN";
 }
 
 void Fiber::call() {
     SetThis(this);
-    m_state = EXEC;
-    if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        FIBER_ASSERT_MSG(false, "swapcontext")
-    }
+    setState(EXEC);
+    SwitchContext(t_threadFiber.get(), this);
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        FIBER_ASSERT_MSG(false, "swapcontext")
-    }
+    SwitchContext(this, t_threadFiber.get());
 }
 
 void Fiber::swapIn() {
-    //TODO(JackyFan): switch by schedule
+    FIBER_ASSERT(getState() != EXEC);
+    SetThis(this);
+    setState(EXEC);
+    SwitchContext(GetSchedulingFiber(), this);
 }
 
 void Fiber::swapOut() {
-    //TODO(JackyFan): switch by schedule
+    Fiber *main_fiber = GetSchedulingFiber();
+    SetThis(main_fiber);
+    SwitchContext(this, main_fiber);
 }
 
 void Fiber::SetThis(Fiber *f) {
     t_fiber = f;
+    // the main fiber of a thread shares the thread's FiberLocals
+    fiber_internal::FiberLocalTable::SetCurrent(f && f->m_stack ? &f->m_locals : nullptr);
 }
 
 Fiber::ptr Fiber::GetThis() {
@@ -138,27 +429,31 @@ Fiber::ptr Fiber::GetThis() {
 
 void Fiber::YieldToReady() {
     auto cur = GetThis();
-    FIBER_ASSERT(cur->m_state == EXEC);
-    cur->m_state = READY;
+    FIBER_ASSERT(cur->getState() == EXEC);
+    cur->setState(READY);
     cur->swapOut();
 }
 
-void Fiber::YieldToHold() {
+void Fiber::YieldToHold(const char *reason) {
     auto cur = GetThis();
-    FIBER_ASSERT(cur->m_state == EXEC);
-    cur->m_state = HOLD;
+    FIBER_ASSERT(cur->getState() == EXEC);
+    cur->m_block_reason.store(reason, std::memory_order_relaxed);
+    if (FLAGS_fiber_capture_block_stack && cur->m_stack) {
+        cur->captureBlockStack();
+    }
+    cur->setState(HOLD);
     cur->swapOut();
 }
 
 void Fiber::YieldToTerm()  {
     auto cur = GetThis();
-    FIBER_ASSERT(cur->m_state != TERM && cur->m_state != EXCEPT);
-    cur->m_state = TERM;
+    FIBER_ASSERT(cur->getState() != TERM && cur->getState() != EXCEPT);
+    cur->setState(TERM);
     cur->swapOut();
 }
 
 uint64_t Fiber::TotalFibers() {
-    return s_fiber_count.load(std::memory_order_relaxed);
+    return s_fiber_count.Value();
 }
 
 void Fiber::MainFunc() {
@@ -167,16 +462,17 @@ void Fiber::MainFunc() {
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
-        cur->m_state = TERM;
+        cur->setState(TERM);
     } catch (std::exception &ex) {
-        cur->m_state = EXCEPT;
+        cur->setState(EXCEPT);
         LOG(ERROR) << "Failed to exec fiber, Except: " << ex.what() << " fiber id: " << cur->getId() << " \nbacktrace: "
                    << FiberBacktraceToString();
     } catch (...) {
-        cur->m_state = EXCEPT;
+        cur->setState(EXCEPT);
         LOG(ERROR) << "Failed to exec fiber, Except. " << " fiber id: " << cur->getId() << " \nbacktrace: "
                    << FiberBacktraceToString();
     }
+    cur->m_locals.clear();
     auto *raw_ptr = cur.get();
     cur.reset();
     raw_ptr->swapOut();
@@ -189,18 +485,19 @@ void Fiber::CallerMainFunc() {
     try {
         cur->m_cb();
         cur->m_cb = nullptr;
-        cur->m_state = TERM;
+        cur->setState(TERM);
     } catch (std::exception &ex) {
-        cur->m_state = EXCEPT;
+        cur->setState(EXCEPT);
         LOG(ERROR) << "Failed to exec fiber, Except: " << ex.what() << " fiber id: " << cur->getId() << " \nbacktrace: "
                    << FiberBacktraceToString();
     } catch (...) {
-        cur->m_state = EXCEPT;
+        cur->setState(EXCEPT);
         LOG(ERROR) << "Failed to exec fiber, Except. " << " fiber id: " << cur->getId() << " \nbacktrace: "
                    << FiberBacktraceToString();
     }
+    cur->m_locals.clear();
     auto *raw_ptr = cur.get();
     cur.reset();
-    raw_ptr->swapOut();
+    raw_ptr->back();
     FIBER_ASSERT_MSG(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()))
 }
\ No newline at end of file
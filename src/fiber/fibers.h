@@ -1,14 +1,56 @@
 
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include <string>
+#include <vector>
+#include <sys/types.h>
 #include <glog/logging.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "coroutine/fcontext.h"
+#include "fiber_local.h"
+#ifdef FIBER_USE_UCONTEXT
+#include <ucontext.h>
+#endif
 
 class Scheduler;
+class FiberWatchdog;
+
+namespace fiber_internal {
+struct FiberRegistryShard;
+
+/// clock of the fiber accounting, read on every switch: the TSC where there is one
+inline uint64_t ReadCpuTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief nanoseconds per ReadCpuTicks() tick
+ * @details measured against steady_clock, for up to 1ms per call during the first second
+ * of the process, so call it before taking locks
+ */
+double NsPerTick();
+
+/// convert a span of ReadCpuTicks() to nanoseconds
+inline uint64_t CpuTicksToNs(uint64_t ticks, double ns_per_tick) {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * ns_per_tick);
+}
+
+}  // namespace fiber_internal
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
     friend class Scheduler;
+    friend class FiberWatchdog;
+    friend struct fiber_internal::FiberRegistryShard;
 
 public:
     typedef std::shared_ptr<Fiber> ptr;
@@ -25,6 +67,33 @@ public:
         EXCEPT,
     };
 
+    /**
+     * @brief snapshot of a fiber for dumps, times are only counted with FLAGS_fiber_accounting
+     */
+    struct Info {
+        uint64_t id{0};
+        State state{INIT};
+        /// set for the fibers of a scheduler itself, see setSystemName()
+        const char *system_name{nullptr};
+        /// the main fiber of a thread, running on the thread's own stack
+        bool main{false};
+        uint64_t age_ms{0};
+        /// time on a cpu, not counting the slice in progress
+        uint64_t run_us{0};
+        /// times it was switched in
+        uint64_t switches{0};
+        /// time spent in HOLD, i.e. parked until somebody wakes it
+        uint64_t blocked_us{0};
+        /// why it is parked now, nullptr if it is not
+        const char *block_reason{nullptr};
+        /// length of the slice in progress, 0 if it is not on a cpu
+        uint64_t running_us{0};
+        /// thread that ran it last
+        pid_t tid{0};
+        /// where it parked, with FLAGS_fiber_capture_block_stack
+        std::vector<std::string> stack;
+    };
+
 private:
     Fiber();
 
@@ -41,14 +110,14 @@ public:
     void reset(Callback cb);
 
     /**
-     * @brief switch the fiber state to running
+     * @brief switch the fiber state to running, from the scheduling fiber of this thread
      * @pre getState() != EXEC
      * @post getState() = EXEC
      */
     void swapIn();
 
     /**
-     * @brief switch fiber to background
+     * @brief switch fiber to background, back to the scheduling fiber of this thread
      */
     void swapOut();
 
@@ -73,7 +142,18 @@ public:
     /**
      * @brief return fiber state
      */
-    State getState() const { return m_state;}
+    State getState() const { return m_state.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief mark a fiber a scheduler runs for itself, e.g. its idle fiber: it is
+     * listed under name and never reported as long running
+     */
+    void setSystemName(const char *name) { m_system_name = name; }
+
+    /**
+     * @brief snapshot of the accounting, safe to call from any thread
+     */
+    Info getInfo() const;
 
 public:
     /**
@@ -95,9 +175,10 @@ public:
 
     /**
      * @brief switch the fiber to background and set state to hold
+     * @param reason why the fiber parks, shown by dumps until it is switched in again
      * @post getState() = HOLD
      */
-    static void YieldToHold();
+    static void YieldToHold(const char *reason = nullptr);
 
     /**
      * @brief switch the fiber to background and set state to hold
@@ -127,18 +208,92 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     * @brief snapshot of every live fiber, main fibers of threads included
+     */
+    static void ListAll(std::vector<Info> &infos);
+
+    /**
+     * @brief ListAll() as text, a line per fiber followed by its parked stack if captured
+     */
+    static std::string DumpAll();
+
+    static const char *StateName(State state);
+
+private:
+    /**
+     * @brief prepare the context of a fiber with a stack to enter MainFunc / CallerMainFunc
+     */
+    void initContext(bool use_caller);
+
+    /**
+     * @brief suspend from and resume to, from must be the running fiber
+     */
+    static void SwitchContext(Fiber *from, Fiber *to);
+
+    /// the fiber leaves / enters a cpu at now, in ReadCpuTicks()
+    void accountOut(uint64_t now);
+
+    void accountIn(uint64_t now);
+
+    /// record where the running fiber parks
+    void captureBlockStack();
+
+    /// the registry shard lock is held, the parked stack is left in frames for SymbolizeStack()
+    void fillInfo(Info &info, uint64_t now, double ns_per_tick, std::vector<void *> &frames) const;
+
+    /// out of the registry locks, backtrace_symbols() is slow
+    static void SymbolizeStack(const std::vector<void *> &frames, std::vector<std::string> &stack);
+
+    void setState(State state) { m_state.store(state, std::memory_order_relaxed); }
+
+    /// call fn for every live fiber, under the lock of its registry shard
+    static void ForEach(const std::function<void(Fiber &)> &fn);
+
 private:
     /// fiber id
     uint64_t m_id = 0;
     /// fiber stack
     uint32_t m_stacksize = 0;
-    /// fiber state
-    State m_state = INIT;
+    /// fiber state, also read by the threads listing the fibers
+    std::atomic<State> m_state{INIT};
     /// fiber context
+#ifdef FIBER_USE_UCONTEXT
     ucontext_t m_ctx;
+#else
+    fcontext_t m_ctx = nullptr;
+#endif
     /// fiber stack pointer
     void *m_stack = nullptr;
     /// fiber callback
     Callback m_cb;
+    /// set by the scheduler while the fiber is on a cpu, its context is only
+    /// complete, and so resumable elsewhere, once this is cleared after swapOut()
+    std::atomic<bool> m_running{false};
+    /// FiberLocal values, cleared when the fiber terminates
+    fiber_internal::FiberLocalTable m_locals;
+
+private:
+    /// accounting in ReadCpuTicks(), written by the thread running the fiber and read by dumps
+    uint64_t m_create_ticks{0};
+    std::atomic<uint64_t> m_run_ticks{0};
+    std::atomic<uint64_t> m_switches{0};
+    std::atomic<uint64_t> m_blocked_ticks{0};
+    /// start of the slice on a cpu in progress, 0 if off cpu
+    std::atomic<uint64_t> m_slice_start_ticks{0};
+    /// start of the park in progress, 0 if not parked
+    std::atomic<uint64_t> m_block_start_ticks{0};
+    std::atomic<const char *> m_block_reason{nullptr};
+    std::atomic<pid_t> m_tid{0};
+    const char *m_system_name{nullptr};
+    /// slice FiberWatchdog reported last, so a slice is reported once
+    std::atomic<uint64_t> m_reported_slice_ticks{0};
+    /// frames of the last park with FLAGS_fiber_capture_block_stack, guarded by the registry shard
+    std::unique_ptr<std::vector<void *>> m_block_stack;
+
+    /// links in the registry of live fibers
+    fiber_internal::FiberRegistryShard *m_registry{nullptr};
+    Fiber *m_registry_prev{nullptr};
+    Fiber *m_registry_next{nullptr};
 
 };
\ No newline at end of file
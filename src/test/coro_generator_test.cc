@@ -0,0 +1,89 @@
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "coroutine/coro_frame_pool.h"
+#include "coroutine/generator.h"
+#include "coroutine/pipeline.h"
+
+static Generator<int> Range(int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+        co_yield i;
+    }
+}
+
+static Generator<int> Naturals(bool *destroyed) {
+    struct Guard {
+        bool *destroyed;
+
+        ~Guard() { *destroyed = true; }
+    } guard{destroyed};
+    for (int i = 0;; ++i) {
+        co_yield i;
+    }
+}
+
+static Generator<int> ThrowsAfter(int n) {
+    for (int i = 0; i < n; ++i) {
+        co_yield i;
+    }
+    throw std::runtime_error("generator failed");
+}
+
+TEST(CoroGeneratorTest, YieldSequence) {
+    std::vector<int> values;
+    for (int i: Range(0, 5)) {
+        values.push_back(i);
+    }
+    ASSERT_EQ(values, std::vector<int>({0, 1, 2, 3, 4}));
+    ASSERT_TRUE(Collect(Range(3, 3)).empty());
+
+    // an lvalue is yielded in place, a const one is copied
+    const std::string word = "abc";
+    auto words = [&word]() -> Generator<std::string> {
+        std::string local = "xyz";
+        co_yield local;
+        co_yield word;
+        co_yield std::string("tmp");
+    };
+    ASSERT_EQ(Collect(words()), std::vector<std::string>({"xyz", "abc", "tmp"}));
+}
+
+TEST(CoroGeneratorTest, EarlyDestruction) {
+    const int64_t live = CoroFramePool::GetStats().live_frames;
+    bool destroyed = false;
+    {
+        Generator<int> naturals = Naturals(&destroyed);
+        ASSERT_EQ(*naturals.next(), 0);
+        ASSERT_EQ(*naturals.next(), 1);
+        ASSERT_EQ(CoroFramePool::GetStats().live_frames, live + 1);
+        ASSERT_FALSE(destroyed);
+    }
+    // the suspended frame ran its destructors and went back to the pool
+    ASSERT_TRUE(destroyed);
+    ASSERT_EQ(CoroFramePool::GetStats().live_frames, live);
+}
+
+TEST(CoroGeneratorTest, ExceptionPropagates) {
+    Generator<int> gen = ThrowsAfter(2);
+    ASSERT_EQ(*gen.next(), 0);
+    ASSERT_EQ(*gen.next(), 1);
+    ASSERT_THROW(gen.next(), std::runtime_error);
+    // the body is done after the exception
+    ASSERT_EQ(gen.next(), nullptr);
+}
+
+TEST(CoroGeneratorTest, PipelineStages) {
+    bool destroyed = false;
+    auto squares = Collect(Naturals(&destroyed)
+                           | Filter([](int i) { return i % 2 == 1; })
+                           | Map([](int i) { return i * i; })
+                           | Take(4));
+    ASSERT_EQ(squares, std::vector<int>({1, 9, 25, 49}));
+    // Take stopped pulling, the endless body was unwound with the pipeline
+    ASSERT_TRUE(destroyed);
+
+    auto batches = Collect(Range(0, 5) | Batch(2));
+    ASSERT_EQ(batches, std::vector<std::vector<int>>({{0, 1}, {2, 3}, {4}}));
+}
@@ -0,0 +1,147 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "coroutine/coro_event.h"
+#include "coroutine/coro_io.h"
+#include "coroutine/coro_task.h"
+
+static Task<int> Answer() {
+    co_return 42;
+}
+
+static Task<int> Twice() {
+    co_return 2 * co_await Answer();
+}
+
+static Task<> Throws() {
+    throw std::runtime_error("task failed");
+    co_return;
+}
+
+TEST(CoroTaskTest, ValuesAndExceptions) {
+    ASSERT_EQ(SyncWait(Twice()), 84);
+    ASSERT_THROW(SyncWait(Throws()), std::runtime_error);
+    auto catches = []() -> Task<bool> {
+        try {
+            co_await Throws();
+        } catch (const std::runtime_error &) {
+            co_return true;
+        }
+        co_return false;
+    };
+    ASSERT_TRUE(SyncWait(catches()));
+    auto awaits_empty = []() -> Task<int> {
+        Task<int> empty;
+        co_return co_await empty;
+    };
+    ASSERT_THROW(SyncWait(awaits_empty()), std::logic_error);
+}
+
+TEST(CoroTaskTest, SymmetricTransfer) {
+    // a million tasks completing synchronously one after another, in constant stack
+    constexpr int task_nums = 1000000;
+    auto sum = []() -> Task<int64_t> {
+        int64_t total = 0;
+        for (int i = 0; i < task_nums; ++i) {
+            total += co_await Answer();
+        }
+        co_return total;
+    };
+    ASSERT_EQ(SyncWait(sum()), int64_t(42) * task_nums);
+}
+
+TEST(CoroTaskTest, FramePool) {
+    const CoroFrameStats before = CoroFramePool::GetStats();
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_EQ(SyncWait(Twice()), 84);
+    }
+    const CoroFrameStats after = CoroFramePool::GetStats();
+    ASSERT_EQ(after.live_frames, before.live_frames);
+    // the frames went back to the free lists, not to the heap
+    ASSERT_GT(after.cached_frames, 0);
+}
+
+TEST(CoroTaskTest, Event) {
+    constexpr int thread_nums = 4;
+    CoroEvent event;
+    std::atomic<int> resumed{0};
+    auto waiter = [&]() -> Task<int> {
+        co_await event;
+        resumed.fetch_add(1);
+        co_return 1;
+    };
+    std::vector<std::thread> threads;
+    std::atomic<int> sum{0};
+    for (int i = 0; i < thread_nums; ++i) {
+        threads.emplace_back([&] {
+            sum.fetch_add(SyncWait(waiter()));
+        });
+    }
+    // a plain thread blocks on the futex
+    threads.emplace_back([&] {
+        event.Wait();
+        sum.fetch_add(1);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(resumed.load(), 0);
+    event.Set();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(resumed.load(), thread_nums);
+    ASSERT_EQ(sum.load(), thread_nums + 1);
+    // set: no suspension at all
+    ASSERT_EQ(SyncWait(waiter()), 1);
+    event.Reset();
+    ASSERT_FALSE(event.IsSet());
+}
+
+TEST(CoroTaskTest, ScheduleOnAndSleep) {
+    IOManager iom(2, false, "coro");
+    iom.start();
+    auto task = [&]() -> Task<int64_t> {
+        co_await ScheduleOn(iom);
+        EXPECT_EQ(Scheduler::GetThis(), &iom);
+        auto start = std::chrono::steady_clock::now();
+        co_await SleepFor(iom, 30);
+        EXPECT_EQ(Scheduler::GetThis(), &iom);
+        co_return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    };
+    ASSERT_GE(SyncWait(task()), 29);
+    iom.stop();
+}
+
+TEST(CoroTaskTest, WaitReadable) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    IOManager iom(1, false, "coro_io");
+    iom.start();
+    auto reader = [&]() -> Task<char> {
+        co_await ScheduleOn(iom);
+        EXPECT_EQ(co_await WaitReadable(iom, fds[0]), 0);
+        char c = 0;
+        EXPECT_EQ(read(fds[0], &c, 1), 1);
+        co_return c;
+    };
+    std::thread writer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        ASSERT_EQ(write(fds[1], "x", 1), 1);
+    });
+    ASSERT_EQ(SyncWait(reader()), 'x');
+    writer.join();
+    // an fd epoll refuses
+    auto bad = [&]() -> Task<int> {
+        co_await ScheduleOn(iom);
+        co_return co_await WaitReadable(iom, -1);
+    };
+    ASSERT_EQ(SyncWait(bad()), -1);
+    iom.stop();
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,126 @@
+#include <chrono>
+#include <cfenv>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <ucontext.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include "coroutine/fcontext.h"
+#include "fiber/fibers.h"
+
+static constexpr size_t kStackSize = 64 * 1024;
+static constexpr int kSwitches = 1000000;
+
+#ifndef FIBER_USE_UCONTEXT
+
+struct PingPong {
+    fcontext_t main{nullptr};
+    fcontext_t ctx{nullptr};
+    int64_t sum{0};
+};
+
+static void PingPongBody(transfer_t t) {
+    auto *pp = static_cast<PingPong *>(t.data);
+    pp->main = t.fctx;
+    for (int64_t i = 1;; ++i) {
+        pp->sum += i;
+        swap_fcontext(&pp->ctx, pp->main);
+    }
+}
+
+TEST(FContextTest, PingPong) {
+    std::unique_ptr<char[]> stack(new char[kStackSize]);
+    PingPong pp;
+    pp.ctx = make_fcontext(stack.get() + kStackSize, kStackSize, PingPongBody);
+    transfer_t t = jump_fcontext(pp.ctx, &pp);
+    pp.ctx = t.fctx;
+    for (int i = 1; i < 100; ++i) {
+        swap_fcontext(&pp.main, pp.ctx);
+    }
+    ASSERT_EQ(pp.sum, 100 * 101 / 2);
+}
+
+static void RoundingBody(transfer_t t) {
+    // the rounding mode belongs to the context and is restored on every switch
+    fesetround(FE_UPWARD);
+    volatile double x = 1.5;
+    auto *result = static_cast<double *>(t.data);
+    *result = std::nearbyint(x + 0.1);
+    jump_fcontext(t.fctx, nullptr);
+}
+
+TEST(FContextTest, FloatingPointControlWord) {
+    std::unique_ptr<char[]> stack(new char[kStackSize]);
+    ASSERT_EQ(fegetround(), FE_TONEAREST);
+    double result = 0;
+    fcontext_t ctx = make_fcontext(stack.get() + kStackSize, kStackSize, RoundingBody);
+    jump_fcontext(ctx, &result);
+    ASSERT_EQ(result, 2.0);
+    ASSERT_EQ(fegetround(), FE_TONEAREST);
+}
+
+static void BenchmarkBody(transfer_t t) {
+    fcontext_t *main = static_cast<fcontext_t *>(t.data);
+    *main = t.fctx;
+    fcontext_t self = nullptr;
+    while (true) {
+        swap_fcontext(&self, *main);
+    }
+}
+
+#endif  // FIBER_USE_UCONTEXT
+
+static ucontext_t s_uc_main, s_uc_ctx;
+
+static void UContextBody() {
+    while (true) {
+        swapcontext(&s_uc_ctx, &s_uc_main);
+    }
+}
+
+TEST(FContextTest, DISABLED_Benchmark) {
+    std::unique_ptr<char[]> stack(new char[kStackSize]);
+    auto ns_per_switch = [](std::chrono::steady_clock::time_point start) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        return static_cast<double>(ns) / (2.0 * kSwitches);
+    };
+
+    getcontext(&s_uc_ctx);
+    s_uc_ctx.uc_stack.ss_sp = stack.get();
+    s_uc_ctx.uc_stack.ss_size = kStackSize;
+    s_uc_ctx.uc_link = nullptr;
+    makecontext(&s_uc_ctx, UContextBody, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSwitches; ++i) {
+        swapcontext(&s_uc_main, &s_uc_ctx);
+    }
+    std::cout << "swapcontext: " << ns_per_switch(start) << " ns/switch" << std::endl;
+
+#ifndef FIBER_USE_UCONTEXT
+    fcontext_t main = nullptr;
+    fcontext_t ctx = make_fcontext(stack.get() + kStackSize, kStackSize, BenchmarkBody);
+    ctx = jump_fcontext(ctx, &main).fctx;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSwitches; ++i) {
+        swap_fcontext(&main, ctx);
+    }
+    std::cout << "jump_fcontext: " << ns_per_switch(start) << " ns/switch" << std::endl;
+#endif
+
+    Fiber::GetThis();
+    Fiber::ptr fiber = std::make_shared<Fiber>([] {
+        Fiber *self = Fiber::GetThis().get();
+        for (int i = 0; i < kSwitches; ++i) {
+            self->back();
+        }
+    }, kStackSize);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kSwitches; ++i) {
+        fiber->call();
+    }
+    std::cout << "Fiber::call/back: " << ns_per_switch(start) << " ns/switch" << std::endl;
+    fiber->call();
+    ASSERT_EQ(fiber->getState(), Fiber::TERM);
+}
@@ -0,0 +1,258 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_channel.h"
+#include "fiber/fiber_iomanager.h"
+#include "fiber/fiber_scheduler.h"
+
+static int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(ChannelTest, UnbufferedPingPong) {
+    constexpr int round_nums = 1000;
+    Channel<int> ping, pong;
+    int last = -1;
+    // a single worker: a send or recv that blocked the thread would deadlock
+    Scheduler scheduler(1, false, "pingpong");
+    scheduler.start();
+    scheduler.schedule([&] {
+        for (int i = 0; i < round_nums; ++i) {
+            ASSERT_TRUE(ping.send(i));
+            ASSERT_TRUE(pong.recv(last));
+            ASSERT_EQ(last, i + 1);
+        }
+        ping.close();
+    });
+    scheduler.schedule([&] {
+        int value;
+        while (ping.recv(value)) {
+            ASSERT_TRUE(pong.send(value + 1));
+        }
+    });
+    scheduler.stop();
+    ASSERT_EQ(last, round_nums);
+}
+
+TEST(ChannelTest, Buffered) {
+    Channel<std::string> channel(2);
+    ASSERT_TRUE(channel.try_send("a"));
+    ASSERT_TRUE(channel.try_send("b"));
+    std::string value = "c";
+    ASSERT_FALSE(channel.try_send(std::move(value)));
+    // a failed send leaves the value alone
+    ASSERT_EQ(value, "c");
+    ASSERT_EQ(channel.size(), 2u);
+    ASSERT_TRUE(channel.try_recv(value));
+    ASSERT_EQ(value, "a");
+    ASSERT_TRUE(channel.recv(value));
+    ASSERT_EQ(value, "b");
+    ASSERT_FALSE(channel.try_recv(value));
+
+    Channel<int> unbuffered;
+    ASSERT_FALSE(unbuffered.try_send(1));
+}
+
+TEST(ChannelTest, Unbounded) {
+    constexpr int value_nums = 100000;
+    Channel<std::unique_ptr<int>> channel(Channel<std::unique_ptr<int>>::kUnbounded);
+    for (int i = 0; i < value_nums; ++i) {
+        ASSERT_TRUE(channel.try_send(std::make_unique<int>(i)));
+    }
+    ASSERT_EQ(channel.size(), static_cast<size_t>(value_nums));
+    std::unique_ptr<int> value;
+    for (int i = 0; i < value_nums; ++i) {
+        ASSERT_TRUE(channel.recv(value));
+        ASSERT_EQ(*value, i);
+    }
+}
+
+TEST(ChannelTest, Close) {
+    Channel<int> channel(1);
+    ASSERT_TRUE(channel.send(1));
+    std::atomic<int> failed{0};
+    Scheduler scheduler(1, false, "close");
+    scheduler.start();
+    // blocked on a full buffer
+    scheduler.schedule([&] {
+        if (!channel.send(2)) {
+            failed.fetch_add(1);
+        }
+    });
+    std::thread closer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        channel.close();
+    });
+    // the scheduler does not wait for parked fibers
+    closer.join();
+    scheduler.stop();
+    ASSERT_EQ(failed.load(), 1);
+    ASSERT_TRUE(channel.closed());
+    ASSERT_FALSE(channel.send(3));
+    // the buffer still drains
+    int value = 0;
+    ASSERT_TRUE(channel.recv(value));
+    ASSERT_EQ(value, 1);
+    ASSERT_FALSE(channel.recv(value));
+}
+
+TEST(ChannelTest, FibersAndThreads) {
+    constexpr int producer_nums = 4, consumer_nums = 4, value_nums = 5000;
+    for (size_t capacity: {size_t(0), size_t(16)}) {
+        Channel<int64_t> channel(capacity);
+        std::atomic<int64_t> sum{0};
+        std::atomic<int> producers_left{producer_nums};
+        std::atomic<int> consumers_left{consumer_nums};
+        Scheduler scheduler(2, false, "mpmc");
+        scheduler.start();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < producer_nums; ++i) {
+            auto produce = [&] {
+                for (int j = 1; j <= value_nums; ++j) {
+                    ASSERT_TRUE(channel.send(j));
+                }
+                if (producers_left.fetch_sub(1) == 1) {
+                    channel.close();
+                }
+            };
+            // half of each side are threads, half fibers
+            if (i % 2) {
+                threads.emplace_back(produce);
+            } else {
+                scheduler.schedule(produce);
+            }
+        }
+        for (int i = 0; i < consumer_nums; ++i) {
+            auto consume = [&] {
+                int64_t value;
+                while (channel.recv(value)) {
+                    sum.fetch_add(value);
+                }
+                consumers_left.fetch_sub(1);
+            };
+            if (i % 2) {
+                threads.emplace_back(consume);
+            } else {
+                scheduler.schedule(consume);
+            }
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        // the scheduler does not wait for parked fibers, close() may still be waking them
+        while (consumers_left.load() > 0) {
+            std::this_thread::yield();
+        }
+        scheduler.stop();
+        ASSERT_EQ(sum.load(), int64_t(producer_nums) * value_nums * (value_nums + 1) / 2);
+    }
+}
+
+TEST(ChannelTest, Select) {
+    Channel<int> ints;
+    Channel<std::string> strings(1);
+    int got_int = 0;
+    std::string to_send = "hello";
+    // nothing ready
+    ASSERT_EQ(ChannelSelect().recv(ints, &got_int).tryWait(), -1);
+    // the buffer has room
+    ASSERT_EQ(ChannelSelect().recv(ints, &got_int).send(strings, &to_send).tryWait(), 1);
+    ASSERT_TRUE(to_send.empty());
+
+    std::string got_string;
+    int index = -1;
+    Scheduler scheduler(1, false, "select");
+    scheduler.start();
+    scheduler.schedule([&] {
+        // the string is ready at once, then the int is sent by the other fiber
+        ASSERT_EQ(ChannelSelect().recv(ints, &got_int).recv(strings, &got_string).wait(), 1);
+        index = ChannelSelect().recv(ints, &got_int).recv(strings, &got_string).wait();
+    });
+    scheduler.schedule([&] {
+        ASSERT_TRUE(ints.send(42));
+    });
+    scheduler.stop();
+    ASSERT_EQ(got_string, "hello");
+    ASSERT_EQ(index, 0);
+    ASSERT_EQ(got_int, 42);
+
+    // a closed channel completes its case with ok false
+    strings.close();
+    bool ok = true;
+    ASSERT_EQ(ChannelSelect().recv(ints, &got_int).recv(strings, &got_string, &ok).wait(), 1);
+    ASSERT_FALSE(ok);
+}
+
+TEST(ChannelTest, SelectOnlyOneCaseWins) {
+    constexpr int round_nums = 2000;
+    Channel<int> a, b;
+    std::atomic<int> received{0};
+    Scheduler scheduler(2, false, "select_one");
+    scheduler.start();
+    scheduler.schedule([&] {
+        int value;
+        for (int i = 0; i < round_nums; ++i) {
+            if (ChannelSelect().recv(a, &value).recv(b, &value).wait() >= 0) {
+                received.fetch_add(1);
+            }
+        }
+    });
+    std::thread sender_a([&] {
+        for (int i = 0; i < round_nums / 2; ++i) {
+            ASSERT_TRUE(a.send(i));
+        }
+    });
+    std::thread sender_b([&] {
+        for (int i = 0; i < round_nums / 2; ++i) {
+            ASSERT_TRUE(b.send(i));
+        }
+    });
+    sender_a.join();
+    sender_b.join();
+    scheduler.stop();
+    // every send was matched by exactly one select
+    ASSERT_EQ(received.load(), round_nums);
+}
+
+TEST(ChannelTest, SelectTimeout) {
+    Channel<int> channel;
+    int value = 0;
+    // a plain thread
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_EQ(ChannelSelect().recv(channel, &value).wait(30), -1);
+    ASSERT_GE(ElapsedMs(start), 29);
+
+    // fibers on an IOManager park on a timer, the worker keeps running
+    std::atomic<int> timed_out{0};
+    std::atomic<int> received{0};
+    IOManager iom(1, false, "select_timeout");
+    iom.start();
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i) {
+        iom.schedule([&] {
+            int got = 0;
+            int index = ChannelSelect().recv(channel, &got).wait(50);
+            if (index < 0) {
+                timed_out.fetch_add(1);
+            } else if (got == 7) {
+                received.fetch_add(1);
+            }
+        });
+    }
+    iom.schedule([&] {
+        // after the others have queued
+        Fiber::YieldToReady();
+        ASSERT_TRUE(channel.send(7));
+    });
+    iom.stop();
+    ASSERT_EQ(received.load(), 1);
+    ASSERT_EQ(timed_out.load(), 9);
+    // one worker, the timeouts overlap
+    ASSERT_LT(ElapsedMs(start), 500);
+}
@@ -0,0 +1,286 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_flags.h"
+#include "fiber/fiber_hook.h"
+#include "fiber/fiber_iomanager.h"
+
+static int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(IOManagerTest, EventCallback) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+    std::atomic<int> fired{0};
+    IOManager iom(2, false, "event_cb");
+    iom.start();
+    ASSERT_EQ(iom.addEvent(fds[0], IOManager::READ, [&] { fired.fetch_add(1); }), 0);
+    ASSERT_EQ(iom.addEvent(fds[1], IOManager::WRITE, [&] { fired.fetch_add(10); }), 0);
+    // the same event twice is an error
+    ASSERT_NE(iom.addEvent(fds[0], IOManager::READ, [] {}), 0);
+    ASSERT_EQ(write(fds[1], "x", 1), 1);
+    iom.stop();
+    ASSERT_EQ(fired.load(), 11);
+    ASSERT_EQ(iom.getPendingEvents(), 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IOManagerTest, CancelEvent) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+    std::atomic<int> fired{0};
+    IOManager iom(1, false, "cancel");
+    iom.start();
+    ASSERT_EQ(iom.addEvent(fds[0], IOManager::READ, [&] { fired.fetch_add(1); }), 0);
+    ASSERT_TRUE(iom.delEvent(fds[0], IOManager::READ));
+    ASSERT_FALSE(iom.delEvent(fds[0], IOManager::READ));
+    // cancelled events run their waiter at once
+    ASSERT_EQ(iom.addEvent(fds[0], IOManager::READ, [&] { fired.fetch_add(1); }), 0);
+    ASSERT_TRUE(iom.cancelAll(fds[0]));
+    iom.stop();
+    ASSERT_EQ(fired.load(), 1);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IOManagerTest, ResumeFiber) {
+    int fds[2];
+    ASSERT_EQ(pipe2(fds, O_NONBLOCK), 0);
+    char buf[8] = {0};
+    ssize_t n = -1;
+    IOManager iom(2, false, "resume");
+    iom.start();
+    iom.schedule([&] {
+        ASSERT_EQ(read(fds[0], buf, sizeof(buf)), -1);
+        ASSERT_EQ(IOManager::GetThis()->addEvent(fds[0], IOManager::READ), 0);
+        IOManager::GetThis()->schedule([&] {
+            ASSERT_EQ(write(fds[1], "hello", 5), 5);
+        });
+        Fiber::YieldToHold();
+        n = read(fds[0], buf, sizeof(buf));
+    });
+    iom.stop();
+    ASSERT_EQ(n, 5);
+    ASSERT_STREQ(buf, "hello");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(IOManagerTest, Timer) {
+    std::atomic<int> ticks{0};
+    std::atomic<int64_t> once_ms{-1};
+    IOManager iom(1, false, "timer");
+    iom.start();
+    auto start = std::chrono::steady_clock::now();
+    iom.addTimer(50, [&] { once_ms = ElapsedMs(start); });
+    FiberTimer::ptr recurring;
+    recurring = iom.addTimer(10, [&] {
+        if (ticks.fetch_add(1) + 1 == 5) {
+            recurring->cancel();
+        }
+    }, true);
+    // stop() waits for the timers
+    iom.stop();
+    ASSERT_EQ(ticks.load(), 5);
+    // timers have millisecond resolution
+    ASSERT_GE(once_ms.load(), 49);
+    ASSERT_LT(once_ms.load(), 1000);
+}
+
+class FiberHookTest : public ::testing::Test {
+public:
+    void SetUp() override { FLAGS_fiber_hook_enable = true; }
+
+    void TearDown() override { FLAGS_fiber_hook_enable = false; }
+};
+
+TEST_F(FiberHookTest, SleepYields) {
+    constexpr int fiber_nums = 20;
+    std::atomic<int> done{0};
+    IOManager iom(1, false, "sleep");
+    iom.start();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < fiber_nums; ++i) {
+        iom.schedule([&] {
+            ASSERT_TRUE(FiberHookActive());
+            usleep(100 * 1000);
+            done.fetch_add(1);
+        });
+    }
+    iom.stop();
+    ASSERT_EQ(done.load(), fiber_nums);
+    // one worker, the sleeps overlap
+    ASSERT_LT(ElapsedMs(start), 100 * fiber_nums / 2);
+    ASSERT_FALSE(FiberHookActive());
+}
+
+TEST_F(FiberHookTest, BlockingPipe) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::string received;
+    // a single worker: a read that blocked the thread would never see the write
+    IOManager iom(1, false, "pipe");
+    iom.start();
+    iom.schedule([&] {
+        char buf[64];
+        ssize_t n;
+        while ((n = read(fds[0], buf, sizeof(buf))) > 0) {
+            received.append(buf, n);
+        }
+        close(fds[0]);
+    });
+    iom.schedule([&] {
+        for (int i = 0; i < 3; ++i) {
+            usleep(5 * 1000);
+            ASSERT_EQ(write(fds[1], "abc", 3), 3);
+        }
+        close(fds[1]);
+    });
+    iom.stop();
+    ASSERT_EQ(received, "abcabcabc");
+}
+
+TEST_F(FiberHookTest, LoopbackEcho) {
+    constexpr int client_nums = 10;
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(listen_fd, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    ASSERT_EQ(bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, client_nums), 0);
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len), 0);
+
+    std::atomic<int> echoed{0};
+    IOManager iom(2, false, "echo");
+    iom.start();
+    iom.schedule([&] {
+        for (int i = 0; i < client_nums; ++i) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            ASSERT_GE(fd, 0);
+            IOManager::GetThis()->schedule([fd] {
+                char buf[64];
+                ssize_t n;
+                while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+                    ASSERT_EQ(send(fd, buf, n, 0), n);
+                }
+                close(fd);
+            });
+        }
+        close(listen_fd);
+    });
+    for (int i = 0; i < client_nums; ++i) {
+        iom.schedule([&, i] {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+            const std::string msg = "ping " + std::to_string(i);
+            ASSERT_EQ(send(fd, msg.data(), msg.size(), 0), static_cast<ssize_t>(msg.size()));
+            char buf[64];
+            size_t got = 0;
+            while (got < msg.size()) {
+                ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+                ASSERT_GT(n, 0);
+                got += n;
+            }
+            ASSERT_EQ(std::string(buf, got), msg);
+            close(fd);
+            echoed.fetch_add(1);
+        });
+    }
+    iom.stop();
+    ASSERT_EQ(echoed.load(), client_nums);
+}
+
+TEST_F(FiberHookTest, BlockingOutsideFiber) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    IOManager iom(1, false, "outside");
+    iom.start();
+    iom.schedule([&] {
+        ASSERT_EQ(write(fds[1], "a", 1), 1);
+        char c;
+        ASSERT_EQ(read(fds[0], &c, 1), 1);
+    });
+    iom.stop();
+    // switched to O_NONBLOCK by the fiber above, still blocking for everyone else
+    ASSERT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+    std::thread writer([&] {
+        usleep(20 * 1000);
+        ASSERT_EQ(write(fds[1], "b", 1), 1);
+    });
+    char c = 0;
+    ASSERT_EQ(read(fds[0], &c, 1), 1);
+    ASSERT_EQ(c, 'b');
+    writer.join();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_F(FiberHookTest, UserNonBlock) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    IOManager iom(1, false, "nonblock");
+    iom.start();
+    iom.schedule([&] {
+        char c;
+        ASSERT_EQ(write(fds[1], "a", 1), 1);
+        ASSERT_EQ(read(fds[0], &c, 1), 1);
+        ASSERT_EQ(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK), 0);
+        ASSERT_NE(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+        ASSERT_EQ(read(fds[0], &c, 1), -1);
+        ASSERT_EQ(errno, EAGAIN);
+        int off = 0;
+        ASSERT_EQ(ioctl(fds[0], FIONBIO, &off), 0);
+        ASSERT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+    });
+    iom.stop();
+    // the fd itself stays non-blocking for the hooks
+    FLAGS_fiber_hook_enable = false;
+    std::thread writer([&] {
+        usleep(20 * 1000);
+        ASSERT_EQ(write(fds[1], "b", 1), 1);
+    });
+    char c = 0;
+    ASSERT_EQ(read(fds[0], &c, 1), 1);
+    ASSERT_EQ(c, 'b');
+    writer.join();
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST_F(FiberHookTest, CloseFromOtherThread) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::atomic<bool> waiting{false};
+    IOManager iom(1, false, "close");
+    iom.start();
+    iom.schedule([&] {
+        char c;
+        waiting = true;
+        ASSERT_EQ(read(fds[0], &c, 1), -1);
+        ASSERT_EQ(errno, EBADF);
+    });
+    while (!waiting || iom.getPendingEvents() == 0) {
+        usleep(1000);
+    }
+    // a thread that runs no IOManager
+    close(fds[0]);
+    iom.stop();
+    ASSERT_EQ(iom.getPendingEvents(), 0);
+    close(fds[1]);
+}
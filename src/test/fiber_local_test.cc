@@ -0,0 +1,129 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_local.h"
+#include "fiber/fiber_scheduler.h"
+
+struct Tracked {
+    static std::atomic<int> s_live;
+
+    Tracked() { s_live.fetch_add(1); }
+
+    ~Tracked() { s_live.fetch_sub(1); }
+
+    int value{0};
+};
+
+std::atomic<int> Tracked::s_live{0};
+
+TEST(FiberLocalTest, ThreadFallback) {
+    FiberLocal<int> local;
+    ASSERT_EQ(local.get(), nullptr);
+    *local = 1;
+    ASSERT_EQ(*local.get(), 1);
+    std::thread other([&] {
+        ASSERT_EQ(local.get(), nullptr);
+        *local = 2;
+        ASSERT_EQ(*local, 2);
+    });
+    other.join();
+    ASSERT_EQ(*local, 1);
+    local.reset();
+    ASSERT_EQ(local.get(), nullptr);
+}
+
+TEST(FiberLocalTest, PerFiberAcrossYields) {
+    constexpr int fiber_nums = 50, yield_nums = 20;
+    FiberLocal<int> local;
+    FiberLocal<std::string> name;
+    std::atomic<int> mismatches{0};
+    std::atomic<int> done{0};
+    // several workers, fibers move between threads when they yield
+    Scheduler scheduler(4, false, "local");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule([&, i] {
+            if (local.get() || name.get()) {
+                mismatches.fetch_add(1);
+            }
+            *local = i;
+            *name = std::to_string(i);
+            for (int j = 0; j < yield_nums; ++j) {
+                Fiber::YieldToReady();
+                if (*local != i || *name != std::to_string(i)) {
+                    mismatches.fetch_add(1);
+                }
+            }
+            done.fetch_add(1);
+        });
+    }
+    scheduler.stop();
+    ASSERT_EQ(done.load(), fiber_nums);
+    ASSERT_EQ(mismatches.load(), 0);
+}
+
+TEST(FiberLocalTest, DeletedAtTermination) {
+    constexpr int fiber_nums = 100;
+    FiberLocal<Tracked> local;
+    std::atomic<int> peak{0};
+    Scheduler scheduler(2, false, "local_del");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule([&] {
+            local->value = 1;
+            int live = Tracked::s_live.load();
+            if (live > peak.load()) {
+                peak = live;
+            }
+            Fiber::YieldToReady();
+        });
+    }
+    // also when the fiber ends with an exception
+    scheduler.schedule([&] {
+        local->value = 2;
+        throw std::runtime_error("fiber local");
+    });
+    scheduler.stop();
+    ASSERT_GT(peak.load(), 0);
+    ASSERT_EQ(Tracked::s_live.load(), 0);
+}
+
+TEST(FiberLocalTest, DeleterSetsValue) {
+    FiberLocal<Tracked> first;
+    FiberLocal<Tracked> second;
+    struct Resurrect {
+        FiberLocal<Tracked> *local;
+
+        ~Resurrect() { (*local)->value = 1; }
+    };
+    FiberLocal<Resurrect> resurrect;
+    Scheduler scheduler(1, false, "local_re");
+    scheduler.start();
+    scheduler.schedule([&] {
+        resurrect->local = &second;
+        first->value = 1;
+    });
+    scheduler.stop();
+    ASSERT_EQ(Tracked::s_live.load(), 0);
+}
+
+TEST(FiberLocalTest, ReleaseAndStaleSlot) {
+    auto *local = new FiberLocal<Tracked>;
+    (*local)->value = 7;
+    Tracked *value = local->release();
+    ASSERT_EQ(local->get(), nullptr);
+    ASSERT_EQ(value->value, 7);
+    local->reset(value);
+    ASSERT_EQ(local->get(), value);
+    delete local;
+    ASSERT_EQ(Tracked::s_live.load(), 1);
+    // the slot is reused, the value left by the destroyed FiberLocal is not visible
+    FiberLocal<int> reused;
+    ASSERT_EQ(reused.get(), nullptr);
+    *reused = 3;
+    ASSERT_EQ(Tracked::s_live.load(), 0);
+    ASSERT_EQ(*reused, 3);
+}
@@ -0,0 +1,217 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_mutex.h"
+#include "fiber/fiber_scheduler.h"
+
+TEST(FiberMutexTest, ParksFiberNotThread) {
+    // a single worker: if Acquire() blocked the thread, Release() would never run
+    FiberSemaphore sem;
+    std::atomic<int> order{0};
+    int acquired_at = 0;
+    Scheduler scheduler(1, false, "park");
+    scheduler.start();
+    scheduler.schedule([&] {
+        sem.Acquire();
+        acquired_at = ++order;
+    });
+    scheduler.schedule([&] {
+        ++order;
+        sem.Release();
+    });
+    scheduler.stop();
+    ASSERT_EQ(acquired_at, 2);
+    ASSERT_EQ(sem.GetValue(), 0u);
+}
+
+TEST(FiberMutexTest, Mutex) {
+    constexpr int fiber_nums = 200, loop_nums = 100;
+    FiberMutex mutex;
+    int64_t counter = 0;
+    Scheduler scheduler(4, false, "mutex");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule([&] {
+            for (int j = 0; j < loop_nums; ++j) {
+                std::lock_guard guard(mutex);
+                int64_t value = counter;
+                // give up the worker while holding the lock
+                if (j % 10 == 0) {
+                    Fiber::YieldToReady();
+                }
+                counter = value + 1;
+            }
+        });
+    }
+    scheduler.stop();
+    ASSERT_EQ(counter, fiber_nums * loop_nums);
+    ASSERT_TRUE(mutex.try_lock());
+    ASSERT_FALSE(mutex.try_lock());
+    mutex.unlock();
+}
+
+TEST(FiberMutexTest, ThreadsAndFibers) {
+    constexpr int loop_nums = 2000;
+    FiberMutex mutex;
+    int64_t counter = 0;
+    auto body = [&] {
+        for (int j = 0; j < loop_nums; ++j) {
+            std::lock_guard guard(mutex);
+            ++counter;
+        }
+    };
+    Scheduler scheduler(2, false, "mixed");
+    scheduler.start();
+    for (int i = 0; i < 8; ++i) {
+        scheduler.schedule(body);
+    }
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back(body);
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    scheduler.stop();
+    ASSERT_EQ(counter, 12 * loop_nums);
+}
+
+TEST(FiberMutexTest, CondVar) {
+    constexpr int producer_nums = 4, consumer_nums = 4, item_nums = 1000;
+    FiberMutex mutex;
+    FiberCondVar not_empty;
+    std::deque<int> queue;
+    int64_t sum = 0;
+    int consumed = 0;
+    Scheduler scheduler(3, false, "condvar");
+    scheduler.start();
+    for (int i = 0; i < consumer_nums; ++i) {
+        scheduler.schedule([&] {
+            while (true) {
+                std::lock_guard guard(mutex);
+                not_empty.wait(mutex, [&] { return !queue.empty(); });
+                int item = queue.front();
+                queue.pop_front();
+                // -1 tells the consumer to quit
+                if (item < 0) {
+                    break;
+                }
+                sum += item;
+                ++consumed;
+            }
+        });
+    }
+    for (int i = 0; i < producer_nums; ++i) {
+        scheduler.schedule([&] {
+            for (int j = 1; j <= item_nums; ++j) {
+                {
+                    std::lock_guard guard(mutex);
+                    queue.push_back(j);
+                }
+                not_empty.notify_one();
+            }
+        });
+    }
+    scheduler.schedule([&] {
+        // wait until everything is consumed, then stop the consumers at once
+        while (true) {
+            {
+                std::lock_guard guard(mutex);
+                if (consumed == producer_nums * item_nums) {
+                    for (int i = 0; i < consumer_nums; ++i) {
+                        queue.push_back(-1);
+                    }
+                    break;
+                }
+            }
+            Fiber::YieldToReady();
+        }
+        not_empty.notify_all();
+    });
+    scheduler.stop();
+    ASSERT_EQ(sum, int64_t(producer_nums) * item_nums * (item_nums + 1) / 2);
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(FiberMutexTest, Semaphore) {
+    constexpr int fiber_nums = 100, permits = 3;
+    FiberSemaphore sem(permits);
+    std::atomic<int> inside{0};
+    std::atomic<int> max_inside{0};
+    Scheduler scheduler(4, false, "semaphore");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule([&] {
+            sem.Acquire();
+            int now = inside.fetch_add(1) + 1;
+            int max = max_inside.load();
+            while (now > max && !max_inside.compare_exchange_weak(max, now)) {
+            }
+            Fiber::YieldToReady();
+            inside.fetch_sub(1);
+            sem.Release();
+        });
+    }
+    scheduler.stop();
+    ASSERT_LE(max_inside.load(), permits);
+    ASSERT_EQ(sem.GetValue(), uint64_t(permits));
+    ASSERT_TRUE(sem.TryAcquire());
+    sem.Release(2);
+    ASSERT_EQ(sem.GetValue(), uint64_t(permits + 1));
+}
+
+TEST(FiberMutexTest, RWLock) {
+    constexpr int reader_nums = 50, writer_nums = 10, loop_nums = 50;
+    FiberRWLock rwlock;
+    // both halves are always equal when observed under the lock
+    int64_t a = 0, b = 0;
+    std::atomic<int> readers_inside{0};
+    std::atomic<bool> overlapped{false};
+    std::atomic<bool> torn{false};
+    Scheduler scheduler(4, false, "rwlock");
+    scheduler.start();
+    for (int i = 0; i < writer_nums; ++i) {
+        scheduler.schedule([&] {
+            for (int j = 0; j < loop_nums; ++j) {
+                std::lock_guard guard(rwlock);
+                if (readers_inside.load() != 0) {
+                    overlapped = true;
+                }
+                ++a;
+                Fiber::YieldToReady();
+                ++b;
+            }
+        });
+    }
+    for (int i = 0; i < reader_nums; ++i) {
+        scheduler.schedule([&] {
+            for (int j = 0; j < loop_nums; ++j) {
+                std::shared_lock guard(rwlock);
+                readers_inside.fetch_add(1);
+                if (a != b) {
+                    torn = true;
+                }
+                Fiber::YieldToReady();
+                readers_inside.fetch_sub(1);
+            }
+        });
+    }
+    scheduler.stop();
+    ASSERT_FALSE(overlapped.load());
+    ASSERT_FALSE(torn.load());
+    ASSERT_EQ(a, writer_nums * loop_nums);
+    ASSERT_EQ(b, a);
+    ASSERT_TRUE(rwlock.try_lock_shared());
+    ASSERT_TRUE(rwlock.try_lock_shared());
+    ASSERT_FALSE(rwlock.try_lock());
+    rwlock.unlock_shared();
+    rwlock.unlock_shared();
+    ASSERT_TRUE(rwlock.try_lock());
+    ASSERT_FALSE(rwlock.try_lock_shared());
+    rwlock.unlock();
+}
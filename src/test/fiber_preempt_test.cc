@@ -0,0 +1,96 @@
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_flags.h"
+#include "fiber/fiber_preempt.h"
+#include "fiber/fiber_scheduler.h"
+
+static int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(FiberPreemptTest, OffByDefault) {
+    ASSERT_EQ(FLAGS_fiber_preempt_ms, 0u);
+    Scheduler scheduler(1, false, "no_preempt");
+    scheduler.start();
+    bool yielded = true;
+    scheduler.schedule([&] {
+        auto start = std::chrono::steady_clock::now();
+        yielded = false;
+        while (ElapsedMs(start) < 30) {
+            yielded |= FiberYieldIfNeeded();
+        }
+    });
+    scheduler.stop();
+    ASSERT_FALSE(yielded);
+}
+
+TEST(FiberPreemptTest, YieldAtSafepoints) {
+    FLAGS_fiber_preempt_ms = 10;
+    const FiberPreemptStats before = FiberGetPreemptStats();
+    std::atomic<int64_t> other_ran_ms{-1};
+    // a single worker, the second fiber only runs if the first one yields
+    Scheduler scheduler(1, false, "preempt");
+    scheduler.start();
+    auto start = std::chrono::steady_clock::now();
+    scheduler.schedule([&] {
+        while (ElapsedMs(start) < 300) {
+            FiberYieldIfNeeded();
+        }
+    });
+    scheduler.schedule([&] {
+        other_ran_ms = ElapsedMs(start);
+    });
+    scheduler.stop();
+    FLAGS_fiber_preempt_ms = 0;
+    const FiberPreemptStats after = FiberGetPreemptStats();
+    ASSERT_GE(other_ran_ms.load(), 0);
+    ASSERT_LT(other_ran_ms.load(), 150);
+    ASSERT_GT(after.overruns, before.overruns);
+    ASSERT_GT(after.yields, before.yields);
+    ASSERT_EQ(after.forced, before.forced);
+}
+
+TEST(FiberPreemptTest, ForcedInScope) {
+    FLAGS_fiber_preempt_ms = 10;
+    const FiberPreemptStats before = FiberGetPreemptStats();
+    std::atomic<bool> other_ran{false};
+    bool timed_out = false;
+    Scheduler scheduler(1, false, "preempt_forced");
+    scheduler.start();
+    scheduler.schedule([&] {
+        auto start = std::chrono::steady_clock::now();
+        FiberPreemptScope scope;
+        // no safepoint: only the signal lets the other fiber run
+        while (!other_ran.load(std::memory_order_relaxed)) {
+            if (ElapsedMs(start) > 2000) {
+                timed_out = true;
+                break;
+            }
+        }
+    });
+    scheduler.schedule([&] {
+        other_ran = true;
+    });
+    scheduler.stop();
+    FLAGS_fiber_preempt_ms = 0;
+    ASSERT_FALSE(timed_out);
+    ASSERT_GT(FiberGetPreemptStats().forced, before.forced);
+}
+
+TEST(FiberPreemptTest, StraySignal) {
+    FLAGS_fiber_preempt_ms = 10;
+    Scheduler scheduler(1, false, "preempt_stray");
+    scheduler.start();
+    scheduler.schedule([] {});
+    scheduler.stop();
+    FLAGS_fiber_preempt_ms = 0;
+    // the handler stays installed, a SIGURG to a thread without a timer is no tick
+    const FiberPreemptStats before = FiberGetPreemptStats();
+    raise(SIGURG);
+    raise(SIGURG);
+    ASSERT_EQ(fiber_internal::t_preempt_requested, 0);
+    ASSERT_EQ(FiberGetPreemptStats().overruns, before.overruns);
+}
@@ -0,0 +1,153 @@
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <mutex>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_scheduler.h"
+
+TEST(FiberSchedulerTest, ScheduleCallbacks) {
+    constexpr int task_nums = 10000;
+    std::atomic<int> counter{0};
+    Scheduler scheduler(4, false, "callbacks");
+    scheduler.start();
+    for (int i = 0; i < task_nums; ++i) {
+        scheduler.schedule([&counter] {
+            counter.fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    scheduler.stop();
+    ASSERT_EQ(counter.load(), task_nums);
+    ASSERT_EQ(scheduler.getPendingTasks(), 0);
+}
+
+TEST(FiberSchedulerTest, UseCaller) {
+    constexpr int task_nums = 1000;
+    std::atomic<int> counter{0};
+    std::atomic<int> on_caller{0};
+    {
+        Scheduler scheduler(2, true, "use_caller");
+        ASSERT_EQ(Scheduler::GetThis(), &scheduler);
+        scheduler.start();
+        for (int i = 0; i < task_nums; ++i) {
+            scheduler.schedule([&] {
+                counter.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        // runs on the caller thread, inside stop()
+        scheduler.schedule([&] {
+            on_caller.store(Scheduler::GetWorkerIndex());
+            counter.fetch_add(1, std::memory_order_relaxed);
+        }, 0);
+        scheduler.stop();
+    }
+    ASSERT_EQ(counter.load(), task_nums + 1);
+    ASSERT_EQ(on_caller.load(), 0);
+    ASSERT_EQ(Scheduler::GetThis(), nullptr);
+}
+
+TEST(FiberSchedulerTest, YieldToReady) {
+    constexpr int fiber_nums = 100, yield_nums = 100;
+    std::atomic<int> counter{0};
+    Scheduler scheduler(3, false, "yield");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule(std::make_shared<Fiber>([&counter] {
+            for (int j = 0; j < yield_nums; ++j) {
+                counter.fetch_add(1, std::memory_order_relaxed);
+                Fiber::YieldToReady();
+            }
+        }, 32 * 1024));
+    }
+    scheduler.stop();
+    ASSERT_EQ(counter.load(), fiber_nums * yield_nums);
+}
+
+TEST(FiberSchedulerTest, ThreadHint) {
+    constexpr int task_nums = 200;
+    std::atomic<int> misplaced{0};
+    Scheduler scheduler(4, false, "hint");
+    scheduler.start();
+    for (int i = 0; i < task_nums; ++i) {
+        const int thread = i % 4;
+        scheduler.schedule([&misplaced, thread] {
+            if (Scheduler::GetWorkerIndex() != thread) {
+                misplaced.fetch_add(1);
+            }
+        }, thread);
+    }
+    scheduler.stop();
+    ASSERT_EQ(misplaced.load(), 0);
+}
+
+TEST(FiberSchedulerTest, HoldAndResume) {
+    constexpr int fiber_nums = 1000;
+    std::atomic<int> resumed{0};
+    std::mutex mutex;
+    std::vector<Fiber::ptr> held;
+    Scheduler scheduler(4, false, "hold");
+    scheduler.start();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule([&] {
+            {
+                std::lock_guard guard(mutex);
+                held.push_back(Fiber::GetThis());
+            }
+            // another worker may resume us while we are still switching out
+            Fiber::YieldToHold();
+            resumed.fetch_add(1);
+        });
+        scheduler.schedule([&] {
+            Fiber::ptr fiber;
+            while (!fiber) {
+                {
+                    std::lock_guard guard(mutex);
+                    if (!held.empty()) {
+                        fiber = held.back();
+                        held.pop_back();
+                    }
+                }
+                if (!fiber) {
+                    Fiber::YieldToReady();
+                }
+            }
+            Scheduler::GetThis()->schedule(fiber);
+        });
+    }
+    scheduler.stop();
+    ASSERT_EQ(resumed.load(), fiber_nums);
+}
+
+TEST(FiberSchedulerTest, SwitchTo) {
+    std::atomic<int> before{-1}, after{-1};
+    Scheduler scheduler(2, false, "switch");
+    scheduler.start();
+    scheduler.schedule([&] {
+        before.store(Scheduler::GetWorkerIndex());
+        Scheduler::GetThis()->switchTo(1 - Scheduler::GetWorkerIndex());
+        after.store(Scheduler::GetWorkerIndex());
+    });
+    scheduler.stop();
+    ASSERT_GE(before.load(), 0);
+    ASSERT_EQ(after.load(), 1 - before.load());
+}
+
+TEST(FiberSchedulerTest, ManyFibers) {
+    constexpr int fiber_nums = 100000;
+    std::atomic<int> counter{0};
+    Scheduler scheduler(4, false, "many");
+    scheduler.start();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < fiber_nums; ++i) {
+        scheduler.schedule(std::make_shared<Fiber>([&counter] {
+            Fiber::YieldToReady();
+            counter.fetch_add(1, std::memory_order_relaxed);
+        }, 16 * 1024));
+    }
+    scheduler.stop();
+    auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    ASSERT_EQ(counter.load(), fiber_nums);
+    LOG(INFO) << fiber_nums << " fibers on 4 threads cost " << cost << " ms";
+}
@@ -0,0 +1,104 @@
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_flags.h"
+#include "fiber/fiber_stack.h"
+#include "fiber/fibers.h"
+
+static constexpr size_t kStackSize = 128 * 1024;
+/// a size no other test uses, so that no recycled, already touched stack is handed out
+static constexpr size_t kUntouchedSize = 136 * 1024;
+/// a size that never reaches the global pool
+static constexpr size_t kRecycleSize = 200 * 1024;
+
+TEST(FiberStackTest, RecycleInThreadCache) {
+    const auto cached = FiberStackAllocator::GetStats().cached_stacks;
+    // a fresh thread, so that the cache starts empty
+    std::thread([] {
+        void *stack = FiberStackAllocator::Alloc(kRecycleSize);
+        ASSERT_NE(stack, nullptr);
+        memset(stack, 0x5a, kRecycleSize);
+        const auto mapped = FiberStackAllocator::GetStats().mapped_stacks;
+        FiberStackAllocator::Dealloc(stack, kRecycleSize);
+        ASSERT_GE(FiberStackAllocator::GetStats().cached_stacks, 1);
+        ASSERT_EQ(FiberStackAllocator::Alloc(kRecycleSize), stack);
+        ASSERT_EQ(FiberStackAllocator::GetStats().mapped_stacks, mapped);
+        FiberStackAllocator::Dealloc(stack, kRecycleSize);
+    }).join();
+    // the cache of the exited thread has been unmapped
+    ASSERT_EQ(FiberStackAllocator::GetStats().cached_stacks, cached);
+}
+
+TEST(FiberStackTest, UsedBytes) {
+    std::thread([] {
+        void *stack = FiberStackAllocator::Alloc(kUntouchedSize);
+        ASSERT_EQ(FiberStackAllocator::UsedBytes(stack, kUntouchedSize), 0u);
+        // touch the top 20KB, as a fiber would
+        memset(static_cast<char *>(stack) + kUntouchedSize - 20 * 1024, 1, 20 * 1024);
+        const size_t used = FiberStackAllocator::UsedBytes(stack, kUntouchedSize);
+        ASSERT_GE(used, 20u * 1024);
+        ASSERT_LE(used, 20u * 1024 + FiberStackAllocator::PageSize());
+
+        FLAGS_fiber_stack_track_usage = true;
+        FiberStackAllocator::Dealloc(stack, kUntouchedSize);
+        FLAGS_fiber_stack_track_usage = false;
+        ASSERT_GE(FiberStackAllocator::GetStats().max_used_bytes, 20 * 1024);
+    }).join();
+}
+
+TEST(FiberStackTest, GlobalPoolReleasesPages) {
+    const uint64_t cache_size = FLAGS_fiber_stack_cache_size;
+    FLAGS_fiber_stack_cache_size = 0;
+    std::thread([] {
+        void *stack = FiberStackAllocator::Alloc(kStackSize);
+        ASSERT_NE(stack, nullptr);
+        memset(stack, 1, kStackSize);
+        ASSERT_EQ(FiberStackAllocator::UsedBytes(stack, kStackSize), kStackSize);
+        // the thread cache is full, the stack goes to the global pool
+        FiberStackAllocator::Dealloc(stack, kStackSize);
+        ASSERT_EQ(FiberStackAllocator::UsedBytes(stack, kStackSize), 0u);
+        ASSERT_EQ(FiberStackAllocator::Alloc(kStackSize), stack);
+        FiberStackAllocator::Dealloc(stack, kStackSize);
+    }).join();
+    FLAGS_fiber_stack_cache_size = cache_size;
+}
+
+TEST(FiberStackTest, LazyCommit) {
+    constexpr int stack_nums = 10000;
+    std::thread([] {
+        std::vector<void *> stacks;
+        for (int i = 0; i < stack_nums; ++i) {
+            stacks.push_back(FiberStackAllocator::Alloc(kUntouchedSize));
+            ASSERT_NE(stacks.back(), nullptr);
+        }
+        // 1.3GB of address space, nothing committed yet
+        for (void *stack: stacks) {
+            ASSERT_EQ(FiberStackAllocator::UsedBytes(stack, kUntouchedSize), 0u);
+        }
+        for (void *stack: stacks) {
+            FiberStackAllocator::Dealloc(stack, kUntouchedSize);
+        }
+    }).join();
+}
+
+TEST(FiberStackTest, GuardPage) {
+    void *stack = FiberStackAllocator::Alloc(kStackSize);
+    volatile char *below = static_cast<char *>(stack) - 1;
+    ASSERT_DEATH(*below = 1, "");
+    FiberStackAllocator::Dealloc(stack, kStackSize);
+}
+
+TEST(FiberStackTest, FiberUsesPooledStack) {
+    Fiber::GetThis();
+    int value = 0;
+    Fiber::ptr fiber = std::make_shared<Fiber>([&value] {
+        char buffer[16 * 1024];
+        memset(buffer, 1, sizeof(buffer));
+        value = buffer[100];
+    });
+    fiber->call();
+    ASSERT_EQ(fiber->getState(), Fiber::TERM);
+    ASSERT_EQ(value, 1);
+}
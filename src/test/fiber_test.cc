@@ -28,7 +28,7 @@ void test_fiber() {
     LOG(INFO) << "Main end 2";
 }
 
-TEST(FiberTest, DISABLED_Test1) {
+TEST(FiberTest, Test1) {
     FiberThread::SetName("main");
     std::vector<FiberThread::ptr> threads;
     for (int i = 0; i < 1; ++i) {
@@ -1,19 +1,202 @@
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
 #include <gtest/gtest.h>
 #include <glog/logging.h>
 
 #include "fiber/fiber_thread.h"
 #include "fiber/fiber_timer.h"
 
+class TestTimerManager : public FiberTimerManager {
+public:
+    /// run the expired callbacks until no timer is left or timeout_ms passed
+    void runUntilIdle(uint64_t timeout_ms = 5000) {
+        uint64_t end = FiberGetCurrentTimeMs() + timeout_ms;
+        while (hasTimer() && FiberGetCurrentTimeMs() < end) {
+            uint64_t next = getNextTimer();
+            if (next > 0) {
+                usleep(std::min<uint64_t>(next, 10) * 1000);
+            }
+            std::vector<Callback> cbs;
+            listExpiredCb(cbs);
+            for (auto &cb: cbs) {
+                cb();
+            }
+        }
+    }
+
+    std::atomic<int> tickles{0};
+
+protected:
+    void onTimerInsertedAtFront() override { tickles.fetch_add(1); }
+};
+
 class FiberTimerTest : public ::testing::Test {
 public:
     void SetUp() override {}
 
     void TearDown() override {}
+
+protected:
+    TestTimerManager m_manager;
 };
 
-TEST_F(FiberTimerTest, TimerTest){
+TEST_F(FiberTimerTest, TimerTest) {
+    std::vector<int> order;
+    uint64_t start = FiberGetCurrentTimeMs();
+    std::vector<uint64_t> fired_at(3);
+    for (int ms: {30, 10, 20}) {
+        m_manager.addTimer(ms, [&, ms] {
+            order.push_back(ms);
+            fired_at[ms / 10 - 1] = FiberGetCurrentTimeMs() - start;
+        });
+    }
+    ASSERT_TRUE(m_manager.hasTimer());
+    m_manager.runUntilIdle();
+    ASSERT_EQ(order, std::vector<int>({10, 20, 30}));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_GE(fired_at[i], static_cast<uint64_t>(10 * (i + 1)));
+    }
+    ASSERT_FALSE(m_manager.hasTimer());
+    ASSERT_EQ(m_manager.getNextTimer(), std::numeric_limits<uint64_t>::max());
+}
+
+TEST_F(FiberTimerTest, Cancel) {
+    int fired = 0;
+    auto timer = m_manager.addTimer(5, [&] { ++fired; });
+    auto other = m_manager.addTimer(5, [&] { ++fired; });
+    ASSERT_TRUE(timer->cancel());
+    ASSERT_FALSE(timer->cancel());
+    ASSERT_FALSE(timer->refresh());
+    // not re-armed, even with the period it already has
+    ASSERT_FALSE(timer->reset(5, false));
+    m_manager.runUntilIdle();
+    ASSERT_EQ(fired, 1);
+    // a fired one-shot timer can not be cancelled any more
+    ASSERT_FALSE(other->cancel());
+    ASSERT_FALSE(m_manager.hasTimer());
+}
+
+TEST_F(FiberTimerTest, RefreshAndReset) {
+    uint64_t start = FiberGetCurrentTimeMs();
+    uint64_t fired_at = 0;
+    auto timer = m_manager.addTimer(1000, [&] { fired_at = FiberGetCurrentTimeMs() - start; });
+    ASSERT_TRUE(timer->reset(20, true));
+    ASSERT_GT(m_manager.getNextTimer(), 0u);
+    ASSERT_LE(m_manager.getNextTimer(), 20u);
+    usleep(10 * 1000);
+    // pushed back to 20ms from now
+    ASSERT_TRUE(timer->refresh());
+    m_manager.runUntilIdle();
+    ASSERT_GE(fired_at, 30u);
+    ASSERT_LT(fired_at, 1000u);
+    ASSERT_FALSE(timer->reset(5, true));
+}
 
+TEST_F(FiberTimerTest, Recurring) {
+    int ticks = 0;
+    FiberTimer::ptr timer;
+    timer = m_manager.addTimer(2, [&] {
+        if (++ticks == 5) {
+            timer->cancel();
+        }
+    }, true);
+    m_manager.runUntilIdle();
+    ASSERT_EQ(ticks, 5);
+    ASSERT_FALSE(m_manager.hasTimer());
 }
 
+TEST_F(FiberTimerTest, ConditionTimer) {
+    int fired = 0;
+    auto cond = std::make_shared<int>(0);
+    m_manager.addConditionTimer(1, [&] { ++fired; }, cond);
+    m_manager.addConditionTimer(1, [&] { ++fired; }, std::make_shared<int>(0));
+    m_manager.runUntilIdle();
+    ASSERT_EQ(fired, 1);
+}
+
+TEST_F(FiberTimerTest, CascadeFromUpperLevels) {
+    // 64ms and more start in level 1, 4096ms and more in level 2
+    uint64_t start = FiberGetCurrentTimeMs();
+    std::vector<uint64_t> fired_at;
+    for (int ms: {150, 70, 3}) {
+        m_manager.addTimer(ms, [&] { fired_at.push_back(FiberGetCurrentTimeMs() - start); });
+    }
+    auto far = m_manager.addTimer(100000, [] {});
+    m_manager.addTimer(static_cast<uint64_t>(1) << 40, [] {});
+    while (fired_at.size() < 3 && FiberGetCurrentTimeMs() - start < 5000) {
+        // never later than the earliest timer
+        ASSERT_LE(m_manager.getNextTimer(), 150u);
+        usleep(1000);
+        std::vector<FiberTimerManager::Callback> cbs;
+        m_manager.listExpiredCb(cbs);
+        for (auto &cb: cbs) {
+            cb();
+        }
+    }
+    ASSERT_EQ(fired_at.size(), 3u);
+    ASSERT_GE(fired_at[0], 3u);
+    ASSERT_GE(fired_at[1], 70u);
+    ASSERT_GE(fired_at[2], 150u);
+    ASSERT_LT(fired_at[2], 1000u);
+    ASSERT_GT(m_manager.getNextTimer(), 0u);
+    ASSERT_LE(m_manager.getNextTimer(), 100000u);
+    ASSERT_TRUE(far->cancel());
+    ASSERT_TRUE(m_manager.hasTimer());
+}
+
+TEST_F(FiberTimerTest, InsertedAtFront) {
+    ASSERT_EQ(m_manager.getNextTimer(), std::numeric_limits<uint64_t>::max());
+    m_manager.addTimer(100, [] {});
+    ASSERT_EQ(m_manager.tickles.load(), 1);
+    // told once until the owner looks again
+    m_manager.addTimer(50, [] {});
+    ASSERT_EQ(m_manager.tickles.load(), 1);
+    ASSERT_LE(m_manager.getNextTimer(), 50u);
+    m_manager.addTimer(200, [] {});
+    ASSERT_EQ(m_manager.tickles.load(), 1);
+    m_manager.addTimer(10, [] {});
+    ASSERT_EQ(m_manager.tickles.load(), 2);
+}
+
+TEST_F(FiberTimerTest, ManyTimersFromThreads) {
+    constexpr int thread_nums = 4;
+    constexpr int timer_nums = 5000;
+    std::atomic<int> fired{0};
+    std::atomic<int> early{0};
+    std::atomic<int> cancelled{0};
+    std::vector<FiberThread::ptr> threads;
+    for (int i = 0; i < thread_nums; ++i) {
+        threads.emplace_back(new FiberThread([&, i] {
+            std::mt19937 rng(i);
+            std::vector<FiberTimer::ptr> timers;
+            for (int j = 0; j < timer_nums; ++j) {
+                uint64_t ms = rng() % 100;
+                uint64_t deadline = FiberGetCurrentTimeMs() + ms;
+                timers.push_back(m_manager.addTimer(ms, [&, deadline] {
+                    if (FiberGetCurrentTimeMs() < deadline) {
+                        early.fetch_add(1);
+                    }
+                    fired.fetch_add(1);
+                }));
+            }
+            for (size_t j = 0; j < timers.size(); j += 2) {
+                if (timers[j]->cancel()) {
+                    cancelled.fetch_add(1);
+                }
+            }
+        }, "timer_" + std::to_string(i)));
+    }
+    for (auto &thread: threads) {
+        thread->join();
+    }
+    m_manager.runUntilIdle();
+    ASSERT_EQ(fired.load() + cancelled.load(), thread_nums * timer_nums);
+    ASSERT_GE(cancelled.load(), 1);
+    ASSERT_EQ(early.load(), 0);
+    ASSERT_FALSE(m_manager.hasTimer());
+}
@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_flags.h"
+#include "fiber/fiber_iomanager.h"
+#include "fiber/fiber_uring.h"
+
+static constexpr uint32_t kBlockSize = 4096;
+static constexpr int kBlocks = 256;
+
+class UringTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        if (!IOUring::Supported()) {
+            GTEST_SKIP() << "io_uring is not available";
+        }
+        char path[] = "/tmp/uring_test_XXXXXX";
+        m_fd = mkstemp(path);
+        ASSERT_GE(m_fd, 0);
+        unlink(path);
+        // block i is filled with the byte i
+        std::vector<char> block(kBlockSize);
+        for (int i = 0; i < kBlocks; ++i) {
+            memset(block.data(), i, kBlockSize);
+            ASSERT_EQ(pwrite(m_fd, block.data(), kBlockSize, uint64_t(i) * kBlockSize), ssize_t(kBlockSize));
+        }
+    }
+
+    void TearDown() override {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+protected:
+    int m_fd{-1};
+};
+
+TEST_F(UringTest, ReadWriteFromThread) {
+    UringEngine engine;
+    ASSERT_TRUE(engine.valid());
+    std::vector<char> buf(kBlockSize);
+    ASSERT_EQ(engine.read(m_fd, buf.data(), kBlockSize, 7 * kBlockSize), int(kBlockSize));
+    ASSERT_EQ(buf[0], 7);
+    ASSERT_EQ(buf[kBlockSize - 1], 7);
+
+    memset(buf.data(), 'x', kBlockSize);
+    ASSERT_EQ(engine.write(m_fd, buf.data(), kBlockSize, 3 * kBlockSize), int(kBlockSize));
+    char c = 0;
+    ASSERT_EQ(pread(m_fd, &c, 1, 3 * kBlockSize + 100), 1);
+    ASSERT_EQ(c, 'x');
+
+    // errors come back as -errno
+    ASSERT_EQ(engine.read(-1, buf.data(), kBlockSize, 0), -EBADF);
+    ASSERT_EQ(engine.getInflight(), 0);
+}
+
+TEST_F(UringTest, LinkedOps) {
+    UringEngine engine;
+    std::string out(kBlockSize, 'L');
+    std::vector<char> in(kBlockSize);
+    auto results = engine.executeLinked({
+        [&](io_uring_sqe *sqe) { UringPrepWrite(sqe, m_fd, out.data(), kBlockSize, 0); },
+        [&](io_uring_sqe *sqe) { UringPrepRw(sqe, IORING_OP_FSYNC, m_fd, nullptr, 0, 0); },
+        [&](io_uring_sqe *sqe) { UringPrepRead(sqe, m_fd, in.data(), kBlockSize, 0); },
+    });
+    ASSERT_EQ(results, std::vector<int>({int(kBlockSize), 0, int(kBlockSize)}));
+    ASSERT_EQ(std::string(in.data(), kBlockSize), out);
+
+    // a failure cancels the rest of the chain
+    results = engine.executeLinked({
+        [&](io_uring_sqe *sqe) { UringPrepRead(sqe, -1, in.data(), kBlockSize, 0); },
+        [&](io_uring_sqe *sqe) { UringPrepRead(sqe, m_fd, in.data(), kBlockSize, 0); },
+    });
+    ASSERT_EQ(results, std::vector<int>({-EBADF, -ECANCELED}));
+}
+
+TEST_F(UringTest, RegisteredBuffersAndFiles) {
+    UringEngine engine;
+    std::vector<char> buf(2 * kBlockSize);
+    iovec iov{buf.data(), buf.size()};
+    ASSERT_EQ(engine.ring().registerBuffers(&iov, 1), 0);
+    ASSERT_EQ(engine.ring().registerFiles(&m_fd, 1), 0);
+    const int n = engine.execute([&](io_uring_sqe *sqe) {
+        UringPrepReadFixed(sqe, 0, buf.data() + kBlockSize, kBlockSize, 9 * kBlockSize, 0);
+        UringUseFixedFile(sqe);
+    });
+    ASSERT_EQ(n, int(kBlockSize));
+    ASSERT_EQ(buf[kBlockSize], 9);
+    ASSERT_EQ(engine.ring().unregisterFiles(), 0);
+    ASSERT_EQ(engine.ring().unregisterBuffers(), 0);
+}
+
+TEST_F(UringTest, AsyncSubmit) {
+    UringEngine engine;
+    std::vector<char> buf(kBlockSize);
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    engine.submit([&](io_uring_sqe *sqe) { UringPrepRead(sqe, m_fd, buf.data(), kBlockSize, 5 * kBlockSize); },
+                  [&promise](int res) { promise.set_value(res); });
+    ASSERT_EQ(future.get(), int(kBlockSize));
+    ASSERT_EQ(buf[0], 5);
+}
+
+TEST_F(UringTest, CompletionOverflow) {
+    IOUring::Options options;
+    options.entries = 4;
+    IOUring ring(options);
+    ASSERT_TRUE(ring.valid());
+    // four times the completion queue, nothing reaped in between
+    const unsigned total = ring.cqEntries() * 4;
+    for (unsigned i = 0; i < total; ++i) {
+        io_uring_sqe *sqe = ring.getSqe();
+        if (sqe == nullptr) {
+            ASSERT_GT(ring.submit(), 0);
+            sqe = ring.getSqe();
+        }
+        UringPrepNop(sqe);
+        sqe->user_data = i;
+    }
+    ASSERT_GT(ring.submit(), 0);
+    std::vector<bool> seen(total);
+    unsigned reaped = ring.reap([&](const io_uring_cqe &cqe) {
+        ASSERT_LT(cqe.user_data, total);
+        seen[cqe.user_data] = true;
+    });
+    ASSERT_EQ(reaped, total);
+    ASSERT_EQ(std::count(seen.begin(), seen.end(), true), total);
+}
+
+TEST_F(UringTest, SqPoll) {
+    IOUring::Options options;
+    options.sqpoll = true;
+    UringEngine engine(nullptr, options);
+    if (!engine.valid()) {
+        GTEST_SKIP() << "SQPOLL is not permitted";
+    }
+    std::vector<char> buf(kBlockSize);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(engine.read(m_fd, buf.data(), kBlockSize, uint64_t(i) * kBlockSize), int(kBlockSize));
+        ASSERT_EQ(buf[0], i);
+    }
+}
+
+TEST_F(UringTest, FibersOnIOManager) {
+    constexpr int fiber_nums = 32;
+    std::atomic<int> verified{0};
+    IOManager iom(2, false, "uring");
+    {
+        UringEngine engine(&iom);
+        iom.start();
+        for (int f = 0; f < fiber_nums; ++f) {
+            iom.schedule([&, f] {
+                std::vector<char> buf(kBlockSize);
+                for (int i = f; i < kBlocks; i += fiber_nums) {
+                    if (engine.read(m_fd, buf.data(), kBlockSize, uint64_t(i) * kBlockSize) == int(kBlockSize)
+                        && buf[0] == char(i) && buf[kBlockSize - 1] == char(i)) {
+                        verified.fetch_add(1);
+                    }
+                }
+            });
+        }
+        // a thread may use the same engine, its operation is submitted at once
+        std::vector<char> buf(kBlockSize);
+        ASSERT_EQ(engine.read(m_fd, buf.data(), kBlockSize, 11 * kBlockSize), int(kBlockSize));
+        ASSERT_EQ(buf[0], 11);
+        iom.stop();
+        ASSERT_EQ(engine.getInflight(), 0);
+    }
+    ASSERT_EQ(verified.load(), kBlocks);
+}
+
+TEST_F(UringTest, DestroyWithCompletionQueued) {
+    IOManager iom(1, false, "uring_destroy");
+    iom.start();
+    std::atomic<int> verified{0};
+    iom.schedule([&] {
+        std::vector<char> buf(kBlockSize);
+        for (int i = 0; i < kBlocks; ++i) {
+            // the eventfd may fire after the read returned, its callback is queued behind this fiber
+            UringEngine engine(&iom);
+            if (engine.read(m_fd, buf.data(), kBlockSize, uint64_t(i) * kBlockSize) == int(kBlockSize)
+                && buf[0] == char(i)) {
+                verified.fetch_add(1);
+            }
+        }
+    });
+    iom.stop();
+    ASSERT_EQ(verified.load(), kBlocks);
+}
+
+static double NsPerOp(std::chrono::steady_clock::time_point start, int ops) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / ops;
+}
+
+/// connected loopback TCP pairs, made with blocking calls
+static void MakeLoopbackPairs(int n, std::vector<std::pair<int, int>> &pairs) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, n), 0);
+    socklen_t len = sizeof(addr);
+    ASSERT_EQ(getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &len), 0);
+    for (int i = 0; i < n; ++i) {
+        int client = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_EQ(connect(client, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+        int server = accept(listen_fd, nullptr, nullptr);
+        ASSERT_GE(server, 0);
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pairs.emplace_back(client, server);
+    }
+    close(listen_fd);
+}
+
+/// ping-pong of small messages, recv_fn and send_fn do one call each
+template<typename RecvFn, typename SendFn>
+static void PingPong(int fd, bool client, int rounds, RecvFn recv_fn, SendFn send_fn) {
+    char buf[64] = {0};
+    for (int i = 0; i < rounds; ++i) {
+        if (client) {
+            send_fn(fd, buf, sizeof(buf));
+        }
+        size_t got = 0;
+        while (got < sizeof(buf)) {
+            int n = recv_fn(fd, buf + got, sizeof(buf) - got);
+            if (n <= 0) {
+                return;
+            }
+            got += n;
+        }
+        if (!client) {
+            send_fn(fd, buf, sizeof(buf));
+        }
+    }
+}
+
+TEST_F(UringTest, DISABLED_Benchmark) {
+    constexpr int read_nums = 20000;
+    std::vector<char> buf(kBlockSize);
+
+    // the file is in the page cache, this is the per-call overhead
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < read_nums; ++i) {
+        pread(m_fd, buf.data(), kBlockSize, uint64_t(i % kBlocks) * kBlockSize);
+    }
+    std::cout << "file pread: " << NsPerOp(start, read_nums) << " ns/read" << std::endl;
+
+    {
+        constexpr int fiber_nums = 32;
+        IOManager iom(1, false, "uring_bench");
+        UringEngine engine(&iom);
+        iom.start();
+        start = std::chrono::steady_clock::now();
+        for (int f = 0; f < fiber_nums; ++f) {
+            iom.schedule([&, f] {
+                std::vector<char> fiber_buf(kBlockSize);
+                for (int i = f; i < read_nums; i += fiber_nums) {
+                    engine.read(m_fd, fiber_buf.data(), kBlockSize, uint64_t(i % kBlocks) * kBlockSize);
+                }
+            });
+        }
+        iom.stop();
+        std::cout << "file io_uring, " << fiber_nums << " fibers: "
+                  << NsPerOp(start, read_nums) << " ns/read" << std::endl;
+    }
+    // epoll does not apply: regular files are always ready
+
+    constexpr int pair_nums = 8, rounds = 500;
+    auto sys_recv = [](int fd, char *p, size_t n) { return int(::recv(fd, p, n, 0)); };
+    auto sys_send = [](int fd, const char *p, size_t n) { return int(::send(fd, p, n, 0)); };
+    {
+        std::vector<std::pair<int, int>> pairs;
+        MakeLoopbackPairs(pair_nums, pairs);
+        std::vector<std::thread> threads;
+        start = std::chrono::steady_clock::now();
+        for (auto &[client, server]: pairs) {
+            threads.emplace_back([&, fd = client] { PingPong(fd, true, rounds, sys_recv, sys_send); });
+            threads.emplace_back([&, fd = server] { PingPong(fd, false, rounds, sys_recv, sys_send); });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        std::cout << "socket blocking threads: " << NsPerOp(start, pair_nums * rounds) << " ns/round trip"
+                  << std::endl;
+        for (auto &[client, server]: pairs) {
+            close(client);
+            close(server);
+        }
+    }
+    {
+        std::vector<std::pair<int, int>> pairs;
+        MakeLoopbackPairs(pair_nums, pairs);
+        FLAGS_fiber_hook_enable = true;
+        IOManager iom(1, false, "epoll_bench");
+        iom.start();
+        start = std::chrono::steady_clock::now();
+        for (auto &[client, server]: pairs) {
+            iom.schedule([&, fd = client] { PingPong(fd, true, rounds, sys_recv, sys_send); });
+            iom.schedule([&, fd = server] { PingPong(fd, false, rounds, sys_recv, sys_send); });
+        }
+        iom.stop();
+        FLAGS_fiber_hook_enable = false;
+        std::cout << "socket epoll fibers: " << NsPerOp(start, pair_nums * rounds) << " ns/round trip"
+                  << std::endl;
+        for (auto &[client, server]: pairs) {
+            close(client);
+            close(server);
+        }
+    }
+    {
+        std::vector<std::pair<int, int>> pairs;
+        MakeLoopbackPairs(pair_nums, pairs);
+        IOManager iom(1, false, "uring_sock_bench");
+        UringEngine engine(&iom);
+        auto uring_recv = [&](int fd, char *p, size_t n) { return engine.recv(fd, p, n); };
+        auto uring_send = [&](int fd, const char *p, size_t n) { return engine.send(fd, p, n); };
+        iom.start();
+        start = std::chrono::steady_clock::now();
+        for (auto &[client, server]: pairs) {
+            iom.schedule([&, fd = client] { PingPong(fd, true, rounds, uring_recv, uring_send); });
+            iom.schedule([&, fd = server] { PingPong(fd, false, rounds, uring_recv, uring_send); });
+        }
+        iom.stop();
+        std::cout << "socket io_uring fibers: " << NsPerOp(start, pair_nums * rounds) << " ns/round trip"
+                  << std::endl;
+        for (auto &[client, server]: pairs) {
+            close(client);
+            close(server);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "fiber/fiber_flags.h"
+#include "fiber/fiber_mutex.h"
+#include "fiber/fiber_scheduler.h"
+#include "fiber/fiber_watchdog.h"
+
+static void BusyFor(int ms) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (std::chrono::steady_clock::now() < end) {
+    }
+}
+
+class FiberInfoTest : public ::testing::Test {
+public:
+    void SetUp() override { FLAGS_fiber_accounting = true; }
+
+    void TearDown() override { FLAGS_fiber_accounting = false; }
+};
+
+TEST_F(FiberInfoTest, Accounting) {
+    std::thread thread([] {
+        Fiber::GetThis();
+        Fiber::ptr fiber(new Fiber([] {
+            BusyFor(20);
+            Fiber::YieldToHold("test");
+            BusyFor(10);
+        }));
+        fiber->swapIn();
+        Fiber::Info info = fiber->getInfo();
+        ASSERT_EQ(info.state, Fiber::HOLD);
+        ASSERT_STREQ(info.block_reason, "test");
+        ASSERT_EQ(info.switches, 1u);
+        ASSERT_GE(info.run_us, 20000u);
+        ASSERT_EQ(info.running_us, 0u);
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        // the park in progress counts
+        ASSERT_GE(fiber->getInfo().blocked_us, 30000u);
+        fiber->swapIn();
+        info = fiber->getInfo();
+        ASSERT_EQ(info.state, Fiber::TERM);
+        ASSERT_EQ(info.block_reason, nullptr);
+        ASSERT_EQ(info.switches, 2u);
+        ASSERT_GE(info.run_us, 30000u);
+        ASSERT_GE(info.blocked_us, 30000u);
+    });
+    thread.join();
+}
+
+TEST_F(FiberInfoTest, DumpAll) {
+    FLAGS_fiber_capture_block_stack = true;
+    FiberMutex mutex;
+    std::atomic<bool> parked{false};
+    std::string dump;
+    mutex.lock();
+    Scheduler scheduler(1, false, "dump");
+    scheduler.start();
+    uint64_t fiber_id = 0;
+    scheduler.schedule([&] {
+        fiber_id = Fiber::GetFiberId();
+        parked = true;
+        std::lock_guard guard(mutex);
+    });
+    while (!parked) {
+        std::this_thread::yield();
+    }
+    // let it reach the park
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::vector<Fiber::Info> infos;
+    Fiber::ListAll(infos);
+    dump = Fiber::DumpAll();
+    mutex.unlock();
+    scheduler.stop();
+    FLAGS_fiber_capture_block_stack = false;
+
+    auto it = std::find_if(infos.begin(), infos.end(), [&](const Fiber::Info &info) {
+        return info.id == fiber_id;
+    });
+    ASSERT_NE(it, infos.end());
+    ASSERT_EQ(it->state, Fiber::HOLD);
+    ASSERT_STREQ(it->block_reason, "FiberMutex");
+    ASSERT_FALSE(it->stack.empty());
+    ASSERT_NE(dump.find("fiber " + std::to_string(fiber_id) + " HOLD"), std::string::npos) << dump;
+    ASSERT_NE(dump.find("on FiberMutex"), std::string::npos) << dump;
+    ASSERT_NE(dump.find("(idle)"), std::string::npos) << dump;
+}
+
+TEST_F(FiberInfoTest, WatchdogReportsLongSlices) {
+    std::mutex lock;
+    std::vector<uint64_t> reported;
+    FiberWatchdog watchdog(20, [&](const Fiber::Info &info) {
+        std::lock_guard guard(lock);
+        reported.push_back(info.id);
+        ASSERT_GE(info.running_us, 20000u);
+    });
+    uint64_t busy_id = 0;
+    Scheduler scheduler(1, false, "watchdog");
+    scheduler.start();
+    scheduler.schedule([&] {
+        busy_id = Fiber::GetFiberId();
+        BusyFor(100);
+    });
+    // yields well within the threshold
+    scheduler.schedule([&] {
+        for (int i = 0; i < 20; ++i) {
+            BusyFor(2);
+            Fiber::YieldToReady();
+        }
+    });
+    scheduler.stop();
+    std::lock_guard guard(lock);
+    // once per slice, however many scans saw it
+    ASSERT_EQ(reported, std::vector<uint64_t>({busy_id}));
+    ASSERT_EQ(watchdog.getReported(), 1u);
+}
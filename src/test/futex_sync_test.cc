@@ -0,0 +1,177 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include "concurrent/barrier.h"
+#include "concurrent/count_down_latch.h"
+#include "concurrent/event.h"
+#include "concurrent/wait_group.h"
+
+using namespace std::chrono_literals;
+
+static int64_t ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(EventTest, SetAndReset) {
+    Event event;
+    ASSERT_FALSE(event.IsSet());
+    ASSERT_FALSE(event.TimedWait(0));
+    event.Set();
+    ASSERT_TRUE(event.IsSet());
+    event.Wait();
+    ASSERT_TRUE(event.TimedWait(0));
+    event.Reset();
+    ASSERT_FALSE(event.IsSet());
+
+    Event signaled(true);
+    ASSERT_TRUE(signaled.IsSet());
+}
+
+TEST(EventTest, TimedWaitTimeout) {
+    Event event;
+    const auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(event.TimedWait(50));
+    ASSERT_GE(ElapsedMs(start), 50);
+}
+
+TEST(EventTest, WakeAllWaiters) {
+    Event event;
+    std::atomic<int> woken{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&] {
+            event.Wait();
+            woken.fetch_add(1);
+        });
+    }
+    std::this_thread::sleep_for(10ms);
+    ASSERT_EQ(woken.load(), 0);
+    event.Set();
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(woken.load(), 8);
+}
+
+TEST(EventTest, TimedWaitWoken) {
+    Event event;
+    std::thread setter([&] {
+        std::this_thread::sleep_for(10ms);
+        event.Set();
+    });
+    ASSERT_TRUE(event.TimedWait(10000));
+    setter.join();
+}
+
+TEST(CountDownLatchTest, Basic) {
+    CountDownLatch latch(3);
+    ASSERT_EQ(latch.GetCount(), 3);
+    ASSERT_FALSE(latch.TimedWait(10));
+    latch.CountDown();
+    latch.CountDown(2);
+    ASSERT_EQ(latch.GetCount(), 0);
+    latch.Wait();
+    ASSERT_TRUE(latch.TimedWait(0));
+}
+
+TEST(CountDownLatchTest, MultiThread) {
+    constexpr int kThreads = 8;
+    CountDownLatch latch(kThreads);
+    std::atomic<int> finished{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&] {
+            finished.fetch_add(1);
+            latch.CountDown();
+        });
+    }
+    std::vector<std::thread> waiters;
+    for (int i = 0; i < 4; ++i) {
+        waiters.emplace_back([&] {
+            latch.Wait();
+            ASSERT_EQ(finished.load(), kThreads);
+        });
+    }
+    latch.Wait();
+    ASSERT_EQ(finished.load(), kThreads);
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    for (auto &&thread: waiters) {
+        thread.join();
+    }
+}
+
+TEST(BarrierTest, Phases) {
+    constexpr int kThreads = 6, kPhases = 200;
+    Barrier barrier(kThreads);
+    std::atomic<int> arrived{0};
+    std::atomic<int> serial{0};
+    std::atomic<bool> broken{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&] {
+            for (int phase = 0; phase < kPhases; ++phase) {
+                arrived.fetch_add(1);
+                if (barrier.ArriveAndWait()) {
+                    serial.fetch_add(1);
+                }
+                // nobody may start the next phase before everybody finished this one
+                if (arrived.load() < (phase + 1) * kThreads) {
+                    broken = true;
+                }
+                barrier.ArriveAndWait();
+            }
+        });
+    }
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    ASSERT_FALSE(broken.load());
+    ASSERT_EQ(serial.load(), kPhases);
+}
+
+TEST(BarrierTest, SingleParty) {
+    Barrier barrier(1);
+    ASSERT_TRUE(barrier.ArriveAndWait());
+    ASSERT_TRUE(barrier.ArriveAndWait());
+}
+
+TEST(WaitGroupTest, Basic) {
+    WaitGroup wg;
+    wg.Wait();
+    wg.Add(2);
+    ASSERT_FALSE(wg.TimedWait(10));
+    wg.Done();
+    wg.Done();
+    ASSERT_TRUE(wg.TimedWait(0));
+    // reusable after reaching zero
+    wg.Add();
+    ASSERT_EQ(wg.GetCount(), 1);
+    wg.Done();
+    wg.Wait();
+}
+
+TEST(WaitGroupTest, MultiThread) {
+    constexpr int kJobs = 32;
+    WaitGroup wg;
+    std::atomic<int> done{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kJobs; ++i) {
+        wg.Add();
+        threads.emplace_back([&, i] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(i % 3));
+            done.fetch_add(1);
+            wg.Done();
+        });
+    }
+    ASSERT_TRUE(wg.TimedWait(10000));
+    ASSERT_EQ(done.load(), kJobs);
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <glog/logging.h>
+#include "coroutine/generator.h"
+#include "coroutine/pipeline.h"
+#include "utils/str_utils.h"
+
+static Generator<int> Naturals() {
+    return Generator<int>([](Generator<int>::Yield &yield) {
+        for (int i = 0;; ++i) {
+            yield(i);
+        }
+    });
+}
+
+TEST(GeneratorTest, Stackful) {
+    std::vector<int> values;
+    // yield from anywhere down the body's call chain
+    std::function<void(Generator<int>::Yield &, int)> walk = [&](Generator<int>::Yield &yield, int depth) {
+        if (depth == 0) {
+            return;
+        }
+        walk(yield, depth - 1);
+        yield(depth);
+    };
+    Generator<int> generator([&](Generator<int>::Yield &yield) { walk(yield, 5); });
+    for (int v: generator) {
+        values.push_back(v);
+    }
+    ASSERT_EQ(values, std::vector<int>({1, 2, 3, 4, 5}));
+    ASSERT_EQ(generator.next(), nullptr);
+}
+
+TEST(GeneratorTest, UnwindAndExceptions) {
+    auto alive = std::make_shared<int>(0);
+    {
+        Generator<int> generator([alive](Generator<int>::Yield &yield) {
+            auto held = alive;
+            for (int i = 0;; ++i) {
+                yield(i);
+            }
+        });
+        ASSERT_EQ(*generator.next(), 0);
+        ASSERT_EQ(alive.use_count(), 3);
+    }
+    // the suspended body ran its destructors and the body itself is gone
+    ASSERT_EQ(alive.use_count(), 1);
+
+    Generator<int> failing([](Generator<int>::Yield &yield) {
+        yield(1);
+        throw std::runtime_error("source failed");
+    });
+    ASSERT_EQ(*failing.next(), 1);
+    ASSERT_THROW(failing.next(), std::runtime_error);
+    ASSERT_EQ(failing.next(), nullptr);
+}
+
+TEST(GeneratorTest, Pipeline) {
+    auto odd_squares = Naturals()
+                       | Filter([](int v) { return v % 2 == 1; })
+                       | Map([](int v) { return v * v; })
+                       | Take(4);
+    ASSERT_EQ(Collect(std::move(odd_squares)), std::vector<int>({1, 9, 25, 49}));
+
+    std::vector<std::string> words = {"a", "bb", "ccc", "dddd", "eeeee"};
+    auto batches = Collect(From(words) | Map([](std::string w) { return w.size(); }) | Batch(2));
+    ASSERT_EQ(batches.size(), 3u);
+    ASSERT_EQ(batches[0], std::vector<size_t>({1, 2}));
+    ASSERT_EQ(batches[2], std::vector<size_t>({5}));
+
+    auto repeated = From(words) | Take(3) | FlatMap([](std::string w) {
+        return Generator<char>([w](Generator<char>::Yield &yield) {
+            for (char c: w) {
+                yield(c);
+            }
+        });
+    });
+    ASSERT_EQ(Collect(std::move(repeated)), std::vector<char>({'a', 'b', 'b', 'c', 'c', 'c'}));
+    // the stages copied out of words, a moved-in range is moved out of
+    ASSERT_EQ(words[4], "eeeee");
+    auto owned = Collect(From(std::move(words)) | Map([](std::string w) { return w + "!"; }));
+    ASSERT_EQ(owned[4], "eeeee!");
+}
+
+TEST(GeneratorTest, SplitLazy) {
+    std::vector<std::string_view> pieces = Collect(splitLazy("a,b,,c", ','));
+    ASSERT_EQ(pieces, std::vector<std::string_view>({"a", "b", "", "c"}));
+    ASSERT_EQ(Collect(splitLazy("a,b,c", ',', 2)), std::vector<std::string_view>({"a", "b,c"}));
+    ASSERT_TRUE(Collect(splitLazy("", ',')).empty());
+    // the same pieces as split()
+    const std::string csv = "x,,y,z,";
+    std::vector<std::string> eager = split(csv, ',');
+    std::vector<std::string> lazy;
+    for (std::string_view piece: splitLazy(csv, ',')) {
+        lazy.emplace_back(piece);
+    }
+    ASSERT_EQ(lazy, eager);
+}
+
+static long MaxRssKb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+TEST(GeneratorTest, DISABLED_LinesBenchmark) {
+    // GENERATOR_BENCH_MB=4096 for a multi-GB run
+    const char *env = getenv("GENERATOR_BENCH_MB");
+    const size_t file_mb = env ? strtoul(env, nullptr, 10) : 64;
+    char path[] = "/tmp/generator_bench_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    {
+        std::ofstream out(path);
+        const std::string line = "field0,field1,field2,12345,field4,field5,field6,field7\n";
+        for (size_t written = 0; written < file_mb << 20; written += line.size()) {
+            out << line;
+        }
+    }
+    const long rss_before = MaxRssKb();
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(path);
+    size_t rows = 0;
+    int64_t sum = 0;
+    auto pipeline = ReadLines(in)
+                    | Map([](const std::string &line) {
+                          std::string_view field;
+                          for (std::string_view piece: splitLazy(line, ',', 5)) {
+                              field = piece;
+                              if (field.size() == 5 && field[0] == '1') {
+                                  break;
+                              }
+                          }
+                          return std::atoll(std::string(field).c_str());
+                      })
+                    | Batch(1024);
+    for (std::vector<long long> &batch: pipeline) {
+        rows += batch.size();
+        for (long long v: batch) {
+            sum += v;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    unlink(path);
+    ASSERT_GT(rows, 0u);
+    ASSERT_EQ(sum, static_cast<int64_t>(rows) * 12345);
+    // one line and one batch at a time, whatever the size of the file
+    const long rss_growth_kb = MaxRssKb() - rss_before;
+    ASSERT_LT(rss_growth_kb, 16 * 1024);
+    LOG(INFO) << file_mb << "MB, " << rows << " lines in " << seconds << "s, "
+              << file_mb / seconds << "MB/s, max rss growth " << rss_growth_kb << "KB";
+}
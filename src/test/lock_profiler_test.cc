@@ -0,0 +1,155 @@
+#include <atomic>
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include "concurrent/lock_profiler.h"
+#include "concurrent/mutex.h"
+#include "concurrent/rwlock.h"
+#include "concurrent/spinlock.h"
+
+class LockProfilerTest : public ::testing::Test {
+public:
+    void SetUp() override {
+        LockProfiler::Instance().SetEnabled(true);
+        LockProfiler::Instance().SetSampleInterval(1);
+        LockProfiler::Instance().Reset();
+    }
+
+    void TearDown() override {
+        LockProfiler::Instance().SetSampleInterval(16);
+    }
+
+    static LockProfileSnapshot Find(const std::string &name) {
+        for (auto &snapshot: LockProfiler::Instance().Snapshot()) {
+            if (snapshot.name == name) {
+                return snapshot;
+            }
+        }
+        return {};
+    }
+};
+
+TEST_F(LockProfilerTest, Uncontended) {
+    ProfiledLock<MutexBase> lock("profiler_test.uncontended");
+    for (int i = 0; i < 10; ++i) {
+        std::lock_guard guard(lock);
+    }
+    ASSERT_TRUE(lock.try_lock());
+    ASSERT_FALSE(lock.try_lock());
+    lock.unlock();
+
+    auto snapshot = Find("profiler_test.uncontended");
+    ASSERT_EQ(snapshot.acquisitions, 11u);
+    ASSERT_EQ(snapshot.contentions, 0u);
+    ASSERT_EQ(snapshot.total_wait_ns, 0u);
+    ASSERT_TRUE(snapshot.sites.empty());
+}
+
+TEST_F(LockProfilerTest, ContendedWaitAndHold) {
+    ProfiledLock<AdaptiveMutex> lock("profiler_test.contended");
+    lock.lock();
+    std::thread waiter([&lock] {
+        std::lock_guard guard(lock);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.unlock();
+    waiter.join();
+
+    auto snapshot = Find("profiler_test.contended");
+    ASSERT_EQ(snapshot.acquisitions, 2u);
+    ASSERT_EQ(snapshot.contentions, 1u);
+    ASSERT_GE(snapshot.total_wait_ns, 10u * 1000 * 1000);
+    ASSERT_EQ(snapshot.max_wait_ns, snapshot.total_wait_ns);
+    ASSERT_GE(snapshot.max_hold_ns, 10u * 1000 * 1000);
+    ASSERT_EQ(snapshot.sites.size(), 1u);
+    ASSERT_EQ(snapshot.sites[0].count, 1u);
+
+    uint64_t histogram_total = 0;
+    for (auto count: snapshot.wait_histogram) {
+        histogram_total += count;
+    }
+    ASSERT_EQ(histogram_total, 1u);
+}
+
+TEST_F(LockProfilerTest, SharedLock) {
+    ProfiledLock<DistributedRWLock> lock("profiler_test.shared");
+    static_assert(std::is_base_of_v<SharedLock, decltype(lock)>);
+    {
+        std::shared_lock guard(lock);
+        ASSERT_TRUE(lock.try_lock_shared());
+        lock.unlock_shared();
+        ASSERT_FALSE(lock.try_lock());
+    }
+    lock.lock();
+    std::thread reader([&lock] {
+        std::shared_lock guard(lock);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    lock.unlock();
+    reader.join();
+
+    auto snapshot = Find("profiler_test.shared");
+    ASSERT_EQ(snapshot.shared_acquisitions, 3u);
+    ASSERT_EQ(snapshot.acquisitions, 1u);
+    ASSERT_EQ(snapshot.shared_contentions, 1u);
+}
+
+TEST_F(LockProfilerTest, DumpSortedByWait) {
+    ProfiledLock<SimpleSpinLock> cold("profiler_test.cold");
+    ProfiledLock<MutexBase> hot("profiler_test.hot");
+    {
+        std::lock_guard guard(cold);
+    }
+    hot.lock();
+    std::thread waiter([&hot] {
+        std::lock_guard guard(hot);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    hot.unlock();
+    waiter.join();
+
+    auto snapshots = LockProfiler::Instance().Snapshot();
+    ASSERT_FALSE(snapshots.empty());
+    ASSERT_EQ(snapshots.front().name, "profiler_test.hot");
+    for (size_t i = 1; i < snapshots.size(); ++i) {
+        ASSERT_GE(snapshots[i - 1].total_wait_ns, snapshots[i].total_wait_ns);
+    }
+    auto dump = LockProfiler::Instance().Dump(1);
+    ASSERT_NE(dump.find("profiler_test.hot"), std::string::npos);
+    ASSERT_EQ(dump.find("profiler_test.cold"), std::string::npos);
+    ASSERT_NE(dump.find("call site"), std::string::npos);
+    LOG(INFO) << "\n" << dump;
+}
+
+TEST_F(LockProfilerTest, Disabled) {
+    ProfiledLock<MutexBase> lock("profiler_test.disabled");
+    LockProfiler::Instance().SetEnabled(false);
+    {
+        std::lock_guard guard(lock);
+    }
+    LockProfiler::Instance().SetEnabled(true);
+    ASSERT_EQ(Find("profiler_test.disabled").acquisitions, 0u);
+}
+
+TEST_F(LockProfilerTest, MultiThread) {
+    constexpr int COUNT = 20000;
+    int counter = 0;
+    ProfiledLock<MutexBase> lock("profiler_test.multi_thread");
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&lock, &counter, COUNT] {
+            for (int j = 0; j < COUNT; ++j) {
+                std::lock_guard guard(lock);
+                counter++;
+            }
+        });
+    }
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(counter, 4 * COUNT);
+    ASSERT_EQ(Find("profiler_test.multi_thread").acquisitions, 4u * COUNT);
+}
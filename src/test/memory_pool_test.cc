@@ -1,6 +1,16 @@
+#include <chrono>
+#include <cstring>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include "utils/memory_pool_lite.h"
+#include "utils/memory_pool_cached.h"
 #include "utils/memory_utils.h"
 
 TEST(SimpleAllocatorTest, BasicTest) {
@@ -11,4 +21,382 @@ TEST(SimpleAllocatorTest, BasicTest) {
     for (int i = 0; i < 1000; ++i) {
         EXPECT_EQ(v[i], i);
     }
-}
\ No newline at end of file
+}
+
+template<template<typename> class Alloc>
+static void CheckContainers() {
+    std::list<int, Alloc<int>> list;
+    std::map<int, std::string, std::less<>, Alloc<std::pair<const int, std::string>>> map;
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<>, Alloc<std::pair<const int, int>>> hash;
+    std::vector<int, Alloc<int>> vector;
+    for (int i = 0; i < 10000; ++i) {
+        list.push_back(i);
+        map.emplace(i, std::to_string(i));
+        hash.emplace(i, i);
+        vector.push_back(i);
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        map.erase(i);
+        hash.erase(i);
+    }
+    list.remove_if([](int i) { return i % 2 == 0; });
+    ASSERT_EQ(list.size(), 5000);
+    ASSERT_EQ(map.size(), 5000);
+    ASSERT_EQ(hash.size(), 5000);
+    for (int i = 1; i < 10000; i += 2) {
+        ASSERT_EQ(map.at(i), std::to_string(i));
+        ASSERT_EQ(hash.at(i), i);
+        ASSERT_EQ(vector[i], i);
+    }
+    // the nodes move with their allocator
+    auto moved = std::move(map);
+    moved.emplace(0, "0");
+    ASSERT_EQ(moved.size(), 5001);
+    // splicing needs equal allocators, copies and rebinds compare equal
+    decltype(list) other(list.get_allocator());
+    other.push_back(-1);
+    list.splice(list.begin(), other);
+    list.sort();
+    ASSERT_EQ(list.front(), -1);
+    other.swap(list);
+    ASSERT_EQ(other.size(), 5001);
+}
+
+template<typename T>
+using PoolAllocator = MemoryPoolLiteAllocator<T>;
+
+template<typename T>
+using ConcurrentPoolAllocator = MemoryPoolLiteConcurrentAllocator<T>;
+
+TEST(MemoryPoolLiteAllocatorTest, Containers) {
+    CheckContainers<PoolAllocator>();
+    CheckContainers<ConcurrentPoolAllocator>();
+    static_assert(std::is_same_v<std::allocator_traits<MemoryPoolLiteAllocator<int>>::rebind_alloc<double>,
+            MemoryPoolLiteAllocator<double>>);
+}
+
+TEST(MemoryPoolLiteAllocatorTest, ConcurrentCrossThread) {
+    using List = std::list<std::string, MemoryPoolLiteConcurrentAllocator<std::string>>;
+    constexpr int kThreads = 4;
+    constexpr int kNodes = 20000;
+    std::vector<List> lists(kThreads);
+    std::vector<std::thread> threads;
+    // the threads exit with all their nodes alive, the heaps outlive them
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&lists, t] {
+            for (int i = 0; i < kNodes; ++i) {
+                lists[t].push_back(std::to_string(i));
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    threads.clear();
+    // every thread frees and refills the nodes of another one
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&lists, t] {
+            List &list = lists[(t + 1) % kThreads];
+            int i = 0;
+            for (const std::string &value: list) {
+                ASSERT_EQ(value, std::to_string(i++));
+            }
+            for (int round = 0; round < 3; ++round) {
+                list.clear();
+                for (int j = 0; j < kNodes; ++j) {
+                    list.push_back(std::to_string(j));
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    // the main thread frees the nodes of exited threads, the last free deletes their heaps
+    for (auto &list: lists) {
+        ASSERT_EQ(list.size(), kNodes);
+        list.splice(list.end(), lists[0]);
+    }
+    lists.clear();
+}
+
+TEST(MemoryPoolLiteAllocatorTest, DISABLED_Benchmark) {
+    constexpr int kElements = 100000;
+    constexpr int kRounds = 5;
+    auto run = [](const char *name, auto make) {
+        auto container = make();
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < kRounds; ++round) {
+            for (int i = 0; i < kElements; ++i) {
+                container.emplace(container.end(), typename decltype(container)::value_type{});
+            }
+            container.clear();
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        LOG(INFO) << name << ": " << static_cast<double>(ns.count()) / (kRounds * kElements) << " ns/element";
+    };
+    auto run_map = [](const char *name, auto make) {
+        auto container = make();
+        std::mt19937 rng(1);
+        std::vector<int> keys(kElements);
+        std::generate(keys.begin(), keys.end(), rng);
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < kRounds; ++round) {
+            for (int key: keys) {
+                container.emplace(key, key);
+            }
+            for (int key: keys) {
+                container.erase(key);
+            }
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        LOG(INFO) << name << ": " << static_cast<double>(ns.count()) / (kRounds * kElements) << " ns/element";
+    };
+    using Pair = std::pair<const int, int>;
+    run("list std::allocator", [] { return std::list<int>(); });
+    run("list MemoryPoolLiteAllocator", [] { return std::list<int, MemoryPoolLiteAllocator<int>>(); });
+    run("list MemoryPoolLiteConcurrentAllocator",
+        [] { return std::list<int, MemoryPoolLiteConcurrentAllocator<int>>(); });
+    run_map("map std::allocator", [] { return std::map<int, int>(); });
+    run_map("map MemoryPoolLiteAllocator",
+            [] { return std::map<int, int, std::less<>, MemoryPoolLiteAllocator<Pair>>(); });
+    run_map("map MemoryPoolLiteConcurrentAllocator",
+            [] { return std::map<int, int, std::less<>, MemoryPoolLiteConcurrentAllocator<Pair>>(); });
+    run_map("unordered_map std::allocator", [] { return std::unordered_map<int, int>(); });
+    run_map("unordered_map MemoryPoolLiteAllocator", [] {
+        return std::unordered_map<int, int, std::hash<int>, std::equal_to<>, MemoryPoolLiteAllocator<Pair>>();
+    });
+    run_map("unordered_map MemoryPoolLiteConcurrentAllocator", [] {
+        return std::unordered_map<int, int, std::hash<int>, std::equal_to<>, MemoryPoolLiteConcurrentAllocator<Pair>>();
+    });
+}
+
+TEST(MemoryPoolLiteTest, Alignment) {
+    MemoryPoolLiteImpl arena(4096, 64 * 1024);
+    for (size_t size = 1; size < 10000; size = size * 3 + 1) {
+        char *ptr = arena.New(size);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignof(std::max_align_t), 0);
+        memset(ptr, 1, size);
+        for (size_t align: {1, 8, 64, 4096}) {
+            void *vp = arena.Allocate(size, align);
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(vp) % align, 0);
+            memset(vp, 2, size);
+        }
+    }
+    // bigger than any block
+    char *big = static_cast<char *>(arena.Allocate(1024 * 1024, 64));
+    memset(big, 3, 1024 * 1024);
+    ASSERT_GE(arena.PoolUsage(), 1024 * 1024);
+}
+
+struct Tracked {
+    Tracked(std::vector<int> &log, int id) : log(log), id(id) {}
+
+    ~Tracked() { log.push_back(id); }
+
+    std::vector<int> &log;
+    int id;
+};
+
+TEST(MemoryPoolLiteTest, MarkRewindAndDestructors) {
+    std::vector<int> log;
+    {
+        MemoryPoolLiteImpl arena(256);
+        arena.Create<Tracked>(log, 1);
+        auto marker = arena.Mark();
+        char *ptr = arena.New(100);
+        arena.Create<Tracked>(log, 2);
+        arena.Create<Tracked>(log, 3);
+        arena.Rewind(marker);
+        ASSERT_EQ(log, std::vector<int>({3, 2}));
+        // the memory after the marker is reused
+        ASSERT_EQ(arena.New(100), ptr);
+
+        {
+            MemoryPoolLiteImpl::Scope scope(arena);
+            arena.Create<Tracked>(log, 4);
+            // spills into new blocks, rewound too
+            for (int i = 0; i < 100; ++i) {
+                arena.New(100);
+            }
+        }
+        ASSERT_EQ(log, std::vector<int>({3, 2, 4}));
+        int *plain = arena.Create<int>(5);
+        ASSERT_EQ(*plain, 5);
+        arena.Create<Tracked>(log, 6);
+    }
+    ASSERT_EQ(log, std::vector<int>({3, 2, 4, 6, 1}));
+}
+
+TEST(MemoryPoolLiteTest, ResetReusesBlocks) {
+    MemoryPoolLiteImpl arena(1024, 64 * 1024);
+    auto request = [&arena] {
+        std::vector<std::string *> fields;
+        for (int i = 0; i < 200; ++i) {
+            fields.push_back(arena.Create<std::string>(100, 'x'));
+            arena.Allocate(i * 8, 8);
+        }
+        arena.Reset();
+    };
+    request();
+    // grown geometrically, not a block per allocation
+    const size_t usage = arena.PoolUsage();
+    ASSERT_LT(usage, 8 * 200 * 200);
+    for (int i = 0; i < 100; ++i) {
+        request();
+    }
+    ASSERT_EQ(arena.PoolUsage(), usage);
+}
+
+TEST(MemoryPoolLiteTest, HugePages) {
+    for (auto mode: {MemoryPoolLiteImpl::HugePages::kAdvise, MemoryPoolLiteImpl::HugePages::kHugeTlb}) {
+        // without reserved huge pages kHugeTlb falls back to kAdvise
+        MemoryPoolLiteImpl arena(64 * 1024, 8 * 1024 * 1024, mode);
+        char *ptr = arena.New(100);
+        ASSERT_EQ(arena.PoolUsage(), sizeof(arena) + 2 * 1024 * 1024);
+        memset(ptr, 1, 100);
+        char *big = arena.New(3 * 1024 * 1024);
+        memset(big, 1, 3 * 1024 * 1024);
+        ASSERT_EQ(arena.PoolUsage(), sizeof(arena) + 6 * 1024 * 1024);
+    }
+}
+
+TEST(MemoryPoolCachedTest, SizesAndAlignment) {
+    MemoryPoolCachedImpl pool;
+    std::vector<std::pair<char *, size_t>> objects;
+    for (size_t size = 0; size <= 3 * MemoryPoolCachedImpl::kMaxSmallSize; size += size < 1024 ? 1 : 997) {
+        char *ptr = pool.New(size);
+        ASSERT_NE(ptr, nullptr);
+        if (size >= 16) {
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % 16, 0) << size;
+        }
+        memset(ptr, static_cast<int>(size & 0xff), size);
+        objects.emplace_back(ptr, size);
+    }
+    // no object overlapped another
+    for (auto &[ptr, size]: objects) {
+        for (size_t i = 0; i < size; ++i) {
+            ASSERT_EQ(static_cast<unsigned char>(ptr[i]), size & 0xff);
+        }
+        pool.Dispose(ptr);
+    }
+    pool.Dispose(nullptr);
+    ASSERT_EQ(pool.GetStats().in_use_bytes, 0);
+}
+
+TEST(MemoryPoolCachedTest, ReuseAndStats) {
+    MemoryPoolCachedImpl pool;
+    // the page map root is reserved, not counted
+    ASSERT_LT(pool.PoolUsage(), 64 * 1024);
+    std::vector<char *> objects;
+    for (int i = 0; i < 10000; ++i) {
+        objects.push_back(pool.New(100));
+    }
+    MemoryPoolStats stats = pool.GetStats();
+    ASSERT_GE(stats.in_use_bytes, 100 * 10000);
+    ASSERT_GE(pool.PoolUsage(), stats.in_use_bytes);
+    for (char *ptr: objects) {
+        pool.Dispose(ptr);
+    }
+    stats = pool.GetStats();
+    ASSERT_EQ(stats.in_use_bytes, 0);
+    ASSERT_GT(stats.thread_cache_bytes + stats.central_cache_bytes, 0);
+
+    // freed objects come back, the pool does not grow
+    const size_t usage = pool.PoolUsage();
+    for (int round = 0; round < 10; ++round) {
+        for (char *&ptr: objects) {
+            ptr = pool.New(100);
+        }
+        for (char *ptr: objects) {
+            pool.Dispose(ptr);
+        }
+    }
+    ASSERT_EQ(pool.PoolUsage(), usage);
+}
+
+TEST(MemoryPoolCachedTest, LargeAndRelease) {
+    MemoryPoolCachedImpl pool;
+    constexpr size_t kSize = 8 * 1024 * 1024;
+    char *ptr = pool.New(kSize);
+    ASSERT_NE(ptr, nullptr);
+    memset(ptr, 1, kSize);
+    ASSERT_GE(pool.GetStats().in_use_bytes, kSize);
+    pool.Dispose(ptr);
+    MemoryPoolStats stats = pool.GetStats();
+    ASSERT_EQ(stats.in_use_bytes, 0);
+    ASSERT_GE(stats.page_heap_free_bytes, kSize);
+
+    pool.ReleaseFreeMemory();
+    stats = pool.GetStats();
+    ASSERT_GE(stats.released_bytes, kSize);
+    ASSERT_LE(pool.PoolUsage(), stats.system_bytes - kSize + stats.metadata_bytes);
+
+    // released pages are mapped again on use
+    ptr = pool.New(kSize);
+    memset(ptr, 2, kSize);
+    ASSERT_EQ(ptr[kSize - 1], 2);
+    pool.Dispose(ptr);
+
+    // sizes no mapping can hold fail instead of wrapping around when rounded to pages
+    ASSERT_EQ(pool.New(SIZE_MAX), nullptr);
+    ASSERT_EQ(pool.New(SIZE_MAX - 4096), nullptr);
+    ASSERT_EQ(pool.GetStats().in_use_bytes, 0);
+}
+
+TEST(MemoryPoolCachedTest, CrossThreadDispose) {
+    MemoryPoolCachedImpl pool;
+    constexpr int kThreads = 4;
+    constexpr int kObjects = 20000;
+    std::vector<std::vector<char *>> objects(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&pool, &objects, t] {
+            for (int i = 0; i < kObjects; ++i) {
+                char *ptr = pool.New(8 + (i % 64) * 8);
+                *reinterpret_cast<int *>(ptr) = i;
+                objects[t].push_back(ptr);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    // the caches of exited threads went back to the central lists
+    ASSERT_EQ(pool.GetStats().thread_cache_bytes, 0);
+
+    threads.clear();
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&pool, &objects, t] {
+            // every thread frees the objects another one allocated
+            auto &mine = objects[(t + 1) % kThreads];
+            for (int i = 0; i < kObjects; ++i) {
+                ASSERT_EQ(*reinterpret_cast<int *>(mine[i]), i);
+                pool.Dispose(mine[i]);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    MemoryPoolStats stats = pool.GetStats();
+    ASSERT_EQ(stats.in_use_bytes, 0);
+    ASSERT_EQ(stats.thread_cache_bytes, 0);
+}
+
+TEST(MemoryPoolCachedTest, PoolDestroyedBeforeThread) {
+    std::thread thread([] {
+        for (int round = 0; round < 3; ++round) {
+            // the cache of the destroyed pool is dropped, not given back at exit
+            MemoryPoolCachedImpl pool;
+            std::vector<char *> objects;
+            for (int i = 0; i < 1000; ++i) {
+                objects.push_back(pool.New(48));
+            }
+            for (char *ptr: objects) {
+                pool.Dispose(ptr);
+            }
+        }
+    });
+    thread.join();
+}
@@ -62,4 +62,73 @@ TEST(MutextTest, FastPthreadMutexTest){
     }
 
     ASSERT_EQ(counter, COUNT * 10);
-}
\ No newline at end of file
+}
+
+TEST(MutextTest, AdaptiveMutexBasic) {
+    AdaptiveMutex mutex;
+    mutex.lock();
+    ASSERT_FALSE(mutex.try_lock());
+    mutex.unlock();
+    ASSERT_TRUE(mutex.try_lock());
+    mutex.unlock();
+    {
+        BaseScopedLocker<AdaptiveMutex> locker(mutex);
+        ASSERT_FALSE(mutex.try_lock());
+    }
+    ASSERT_TRUE(mutex.try_lock());
+    mutex.unlock();
+}
+
+TEST(MutextTest, AdaptiveMutexMultiThreadTest) {
+    constexpr int COUNT = 100000;
+    int counter = 0;
+    AdaptiveMutex lock(true);
+    auto threadFunc = [&lock, &counter, COUNT] {
+        for (int i = 0; i < COUNT; ++i) {
+            std::lock_guard guard(lock);
+            counter++;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 10; ++i) {
+        threads.emplace_back(threadFunc);
+    }
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(counter, COUNT * 10);
+    auto stats = lock.GetStats();
+    ASSERT_LE(stats.spin_acquires, stats.contended_acquires);
+}
+
+TEST(MutextTest, AdaptiveMutexStats) {
+    AdaptiveMutex lock(true, 0);
+    lock.lock();
+    std::thread waiter([&lock] {
+        std::lock_guard guard(lock);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.unlock();
+    waiter.join();
+
+    auto stats = lock.GetStats();
+    ASSERT_EQ(stats.contended_acquires, 1u);
+    ASSERT_EQ(stats.spin_acquires, 0u);
+    ASSERT_GE(stats.parks, 1u);
+    ASSERT_GT(stats.park_time_ns, 0u);
+
+    lock.ResetStats();
+    ASSERT_EQ(lock.GetStats().contended_acquires, 0u);
+
+    AdaptiveMutex quiet;
+    quiet.lock();
+    std::thread other([&quiet] {
+        std::lock_guard guard(quiet);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    quiet.unlock();
+    other.join();
+    ASSERT_EQ(quiet.GetStats().contended_acquires, 0u);
+}
@@ -1,5 +1,6 @@
 #include <atomic>
 #include <thread>
+#include <vector>
 #include <shared_mutex>
 #include <mutex>
 #include <glog/logging.h>
@@ -12,3 +13,88 @@ TEST(RWLockTest, BasicTest1) {
     { PosixRWLock lock3(PosixRWLock::Kind::kKindPreferWriter); }
 }
 
+TEST(RWLockTest, PosixTryLock) {
+    PosixRWLock lock;
+    ASSERT_TRUE(lock.try_lock_shared());
+    ASSERT_TRUE(lock.try_lock_shared());
+    ASSERT_FALSE(lock.try_lock());
+    lock.unlock_shared();
+    lock.unlock_shared();
+    ASSERT_TRUE(lock.try_lock());
+    ASSERT_FALSE(lock.try_lock_shared());
+    lock.unlock();
+}
+
+TEST(RWLockTest, DistributedTryLock) {
+    for (auto preference: {DistributedRWLock::kPreferReader, DistributedRWLock::kPreferWriter}) {
+        DistributedRWLock lock(preference);
+        ASSERT_TRUE(lock.try_lock_shared());
+        ASSERT_TRUE(lock.try_lock_shared());
+        ASSERT_FALSE(lock.try_lock());
+        lock.unlock_shared();
+        lock.unlock_shared();
+        ASSERT_TRUE(lock.try_lock());
+        ASSERT_FALSE(lock.try_lock_shared());
+        ASSERT_FALSE(lock.try_lock());
+        lock.unlock();
+        {
+            std::shared_lock guard(lock);
+            ASSERT_FALSE(lock.try_lock());
+        }
+        {
+            std::unique_lock guard(lock);
+            ASSERT_FALSE(lock.try_lock_shared());
+        }
+    }
+}
+
+TEST(RWLockTest, DistributedShardNum) {
+    DistributedRWLock lock(DistributedRWLock::kPreferWriter, 5);
+    ASSERT_EQ(lock.ShardNum(), 8u);
+    DistributedRWLock lock2;
+    ASSERT_GE(lock2.ShardNum(), 1u);
+}
+
+void RWLockMultiThreadTest(SharedLock &lock) {
+    constexpr int kReaders = 6, kWriters = 2, kLoops = 20000;
+    // writers keep both halves equal, readers must never see them differ
+    int64_t first = 0, second = 0;
+    std::atomic<bool> torn{false};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kWriters; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < kLoops; ++j) {
+                std::unique_lock guard(lock);
+                ++first;
+                ++second;
+            }
+        });
+    }
+    for (int i = 0; i < kReaders; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < kLoops; ++j) {
+                std::shared_lock guard(lock);
+                if (first != second) {
+                    torn = true;
+                }
+            }
+        });
+    }
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    ASSERT_FALSE(torn.load());
+    ASSERT_EQ(first, kWriters * kLoops);
+    ASSERT_EQ(second, kWriters * kLoops);
+}
+
+TEST(RWLockTest, MultiThreadTest) {
+    PosixRWLock posix_lock;
+    RWLockMultiThreadTest(posix_lock);
+
+    DistributedRWLock reader_preferred(DistributedRWLock::kPreferReader);
+    RWLockMultiThreadTest(reader_preferred);
+
+    DistributedRWLock writer_preferred(DistributedRWLock::kPreferWriter);
+    RWLockMultiThreadTest(writer_preferred);
+}
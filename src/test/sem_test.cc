@@ -1,5 +1,7 @@
 #include <atomic>
+#include <chrono>
 #include <thread>
+#include <vector>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include "concurrent/sem.h"
@@ -41,7 +43,7 @@ TEST_F(SemaphoreOpsTest, TimedAcquire) {
     SemaphoreOps::Acquire(&semaphore);
 
     // Attempt to acquire the semaphore with a timeout, which should fail.
-    ASSERT_FALSE(SemaphoreOps::TimedAcquire(&semaphore, 500)); // 500 microsecond timeout
+    ASSERT_FALSE(SemaphoreOps::TimedAcquire(&semaphore, 500)); // 500 millisecond timeout
 
     // Release the semaphore, which would allow us to acquire it again.
     SemaphoreOps::Release(&semaphore);
@@ -62,4 +64,69 @@ TEST(SemaphoreTest, TimedAcquire){
     Semaphore sem(1);
     sem.Acquire();
     ASSERT_FALSE(sem.TimedAcquire(50));
-}
\ No newline at end of file
+}
+
+TEST(SemaphoreTest, TimedAcquireWaitsForTimeout){
+    Semaphore sem(0);
+    const auto start = std::chrono::steady_clock::now();
+    // more than a second, the old implementation added it to tv_nsec without normalizing
+    ASSERT_FALSE(sem.TimedAcquire(1100));
+    const auto cost = std::chrono::steady_clock::now() - start;
+    ASSERT_GE(cost, std::chrono::milliseconds(1100));
+    ASSERT_LT(cost, std::chrono::milliseconds(3000));
+}
+
+TEST(SemaphoreTest, ReleaseMany){
+    Semaphore sem;
+    ASSERT_FALSE(sem.TryAcquire());
+    sem.Release(3);
+    ASSERT_EQ(sem.GetValue(), 3u);
+    ASSERT_TRUE(sem.TryAcquire());
+    ASSERT_TRUE(sem.TryAcquire());
+    ASSERT_TRUE(sem.TimedAcquire(0));
+    ASSERT_FALSE(sem.TryAcquire());
+}
+
+TEST(SemaphoreTest, ReleaseWakesWaiters){
+    constexpr int kWaiters = 4;
+    Semaphore sem(0);
+    std::atomic<int> acquired{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kWaiters; ++i) {
+        threads.emplace_back([&] {
+            sem.Acquire();
+            acquired.fetch_add(1);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    sem.Release(2);
+    while (acquired.load() < 2) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(acquired.load(), 2);
+    sem.Release(2);
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(acquired.load(), kWaiters);
+    ASSERT_EQ(sem.GetValue(), 0u);
+}
+
+TEST(SemaphoreTest, ProducerConsumer){
+    constexpr int kItems = 100000;
+    Semaphore items(0);
+    std::atomic<int64_t> consumed{0};
+    std::thread consumer([&] {
+        for (int i = 0; i < kItems; ++i) {
+            items.Acquire();
+            consumed.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    for (int i = 0; i < kItems; ++i) {
+        items.Release();
+    }
+    consumer.join();
+    ASSERT_EQ(consumed.load(), kItems);
+    ASSERT_EQ(items.GetValue(), 0u);
+}
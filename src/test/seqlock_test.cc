@@ -0,0 +1,110 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include "concurrent/seqlock.h"
+
+namespace {
+
+/// every field equals the same counter, a torn copy would mix two counters
+struct Snapshot {
+    int64_t a;
+    int64_t b;
+    int32_t c;
+    char tag;
+};
+
+bool Consistent(const Snapshot &s) {
+    return s.a == s.b && s.a == s.c && s.tag == static_cast<char>('a' + s.a % 26);
+}
+
+Snapshot MakeSnapshot(int64_t n) {
+    return Snapshot{n, n, static_cast<int32_t>(n), static_cast<char>('a' + n % 26)};
+}
+
+}  // namespace
+
+TEST(SeqLockTest, StoreAndLoad) {
+    SeqLock<Snapshot> seqlock(MakeSnapshot(3));
+    ASSERT_EQ(seqlock.Load().a, 3);
+    ASSERT_EQ(seqlock.Sequence(), 0u);
+
+    seqlock.Store(MakeSnapshot(7));
+    Snapshot snapshot{};
+    ASSERT_TRUE(seqlock.TryLoad(&snapshot));
+    ASSERT_TRUE(Consistent(snapshot));
+    ASSERT_EQ(snapshot.a, 7);
+    ASSERT_EQ(seqlock.Sequence(), 2u);
+
+    seqlock.Update([](Snapshot &s) { s = MakeSnapshot(s.a + 1); });
+    ASSERT_EQ(seqlock.Load().a, 8);
+    ASSERT_EQ(seqlock.Sequence(), 4u);
+
+    SeqLock<int> small;
+    ASSERT_EQ(small.Load(), 0);
+    small.Store(-5);
+    ASSERT_EQ(small.Load(), -5);
+}
+
+TEST(SeqLockTest, ReadersNeverSeeTornValue) {
+    constexpr int64_t kWrites = 200000;
+    SeqLock<Snapshot> seqlock(MakeSnapshot(0));
+    std::atomic<bool> done{false};
+    std::atomic<int64_t> torn{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&] {
+            int64_t last = 0;
+            while (!done.load(std::memory_order_acquire)) {
+                Snapshot snapshot = seqlock.Load();
+                if (!Consistent(snapshot) || snapshot.a < last) {
+                    torn.fetch_add(1);
+                }
+                last = snapshot.a;
+            }
+        });
+    }
+    for (int64_t i = 1; i <= kWrites; ++i) {
+        seqlock.Store(MakeSnapshot(i));
+    }
+    done.store(true, std::memory_order_release);
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    ASSERT_EQ(torn.load(), 0);
+    ASSERT_EQ(seqlock.Load().a, kWrites);
+}
+
+TEST(SeqLockTest, MultiWriter) {
+    constexpr int kWriters = 4;
+    constexpr int64_t kUpdates = 20000;
+    MultiWriterSeqLock<Snapshot> seqlock(MakeSnapshot(0));
+    std::atomic<bool> done{false};
+    std::atomic<int64_t> torn{0};
+
+    std::thread reader([&] {
+        while (!done.load(std::memory_order_acquire)) {
+            if (!Consistent(seqlock.Load())) {
+                torn.fetch_add(1);
+            }
+        }
+    });
+    std::vector<std::thread> writers;
+    for (int i = 0; i < kWriters; ++i) {
+        writers.emplace_back([&] {
+            for (int64_t j = 0; j < kUpdates; ++j) {
+                seqlock.Update([](Snapshot &s) { s = MakeSnapshot(s.a + 1); });
+            }
+        });
+    }
+    for (auto &writer: writers) {
+        writer.join();
+    }
+    done.store(true, std::memory_order_release);
+    reader.join();
+    ASSERT_EQ(torn.load(), 0);
+    ASSERT_EQ(seqlock.Load().a, kWriters * kUpdates);
+    ASSERT_EQ(seqlock.Sequence(), 2u * kWriters * kUpdates);
+}
@@ -0,0 +1,62 @@
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <vector>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include "concurrent/sharded_counter.h"
+
+TEST(ShardedCounterTest, Basic) {
+    ShardedCounter<int64_t> counter(3);
+    ASSERT_EQ(counter.ShardNum(), 4u);
+    ASSERT_EQ(counter.Value(), 0);
+    counter.Increment();
+    counter.Add(10);
+    counter.Sub(4);
+    counter.Decrement();
+    ASSERT_EQ(counter.Value(), 6);
+    counter.Reset();
+    ASSERT_EQ(counter.Value(), 0);
+
+    ShardedCounter<double> seconds(1);
+    seconds.Add(0.5);
+    seconds.Add(1.25);
+    ASSERT_DOUBLE_EQ(seconds.Value(), 1.75);
+}
+
+TEST(ShardedCounterTest, MaxAndMin) {
+    ShardedMax<int64_t> max;
+    ShardedMin<int64_t> min;
+    ASSERT_EQ(max.Value(), std::numeric_limits<int64_t>::lowest());
+    ASSERT_EQ(min.Value(), std::numeric_limits<int64_t>::max());
+    for (int64_t value: {5, -3, 42, 7}) {
+        max.Update(value);
+        min.Update(value);
+    }
+    ASSERT_EQ(max.Value(), 42);
+    ASSERT_EQ(min.Value(), -3);
+}
+
+TEST(ShardedCounterTest, MultiThread) {
+    constexpr int kThreads = 8;
+    constexpr int64_t kUpdates = 100000;
+    ShardedCounter<int64_t> counter;
+    ShardedMax<int64_t> max;
+    ShardedMin<int64_t> min;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kThreads; ++i) {
+        threads.emplace_back([&, i] {
+            for (int64_t j = 0; j < kUpdates; ++j) {
+                counter.Increment();
+                max.Update(i * kUpdates + j);
+                min.Update(i * kUpdates + j);
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(counter.Value(), kThreads * kUpdates);
+    ASSERT_EQ(max.Value(), kThreads * kUpdates - 1);
+    ASSERT_EQ(min.Value(), 0);
+}
@@ -1,5 +1,10 @@
 #include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
 #include <thread>
+#include <vector>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include "concurrent/spinlock.h"
@@ -16,6 +21,18 @@ TEST(SpinLockTest, SingleThread) {
     PosixSpinLock posix_spinlock;
     ASSERT_NO_THROW(posix_spinlock.lock());
     ASSERT_NO_THROW(posix_spinlock.unlock());
+
+    TicketSpinLock ticket_spinlock;
+    ASSERT_NO_THROW(ticket_spinlock.lock());
+    ASSERT_NO_THROW(ticket_spinlock.unlock());
+
+    MCSSpinLock mcs_spinlock;
+    ASSERT_NO_THROW(mcs_spinlock.lock());
+    ASSERT_NO_THROW(mcs_spinlock.unlock());
+
+    CLHSpinLock clh_spinlock;
+    ASSERT_NO_THROW(clh_spinlock.lock());
+    ASSERT_NO_THROW(clh_spinlock.unlock());
 }
 
 TEST(SpinLockTest, TryLock) {
@@ -32,6 +49,45 @@ TEST(SpinLockTest, TryLock) {
     atomic_spinlock.unlock();
     ASSERT_TRUE(atomic_spinlock.try_lock());
     atomic_spinlock.unlock();
+
+    TicketSpinLock ticket_spinlock;
+    ASSERT_TRUE(ticket_spinlock.try_lock());
+    ASSERT_FALSE(ticket_spinlock.try_lock());
+    ticket_spinlock.unlock();
+    ASSERT_TRUE(ticket_spinlock.try_lock());
+    ticket_spinlock.unlock();
+
+    MCSSpinLock mcs_spinlock;
+    ASSERT_TRUE(mcs_spinlock.try_lock());
+    ASSERT_FALSE(mcs_spinlock.try_lock());
+    mcs_spinlock.unlock();
+    ASSERT_TRUE(mcs_spinlock.try_lock());
+    mcs_spinlock.unlock();
+
+    CLHSpinLock clh_spinlock;
+    ASSERT_TRUE(clh_spinlock.try_lock());
+    ASSERT_FALSE(clh_spinlock.try_lock());
+    clh_spinlock.unlock();
+    ASSERT_TRUE(clh_spinlock.try_lock());
+    clh_spinlock.unlock();
+}
+
+TEST(SpinLockTest, NestedQueueLocks) {
+    MCSSpinLock mcs1, mcs2;
+    CLHSpinLock clh1, clh2;
+    mcs1.lock();
+    clh1.lock();
+    mcs2.lock();
+    clh2.lock();
+    // release out of acquisition order
+    mcs1.unlock();
+    clh1.unlock();
+    mcs2.unlock();
+    clh2.unlock();
+    ASSERT_TRUE(mcs1.try_lock());
+    ASSERT_TRUE(clh1.try_lock());
+    mcs1.unlock();
+    clh1.unlock();
 }
 
 void STDLockSpinLock(Lock &lock) {
@@ -52,10 +108,18 @@ TEST(SpinLockTest, STDLockTest) {
 
     PosixSpinLock posix_spinlock;
     STDLockSpinLock(posix_spinlock);
+
+    TicketSpinLock ticket_spinlock;
+    STDLockSpinLock(ticket_spinlock);
+
+    MCSSpinLock mcs_spinlock;
+    STDLockSpinLock(mcs_spinlock);
+
+    CLHSpinLock clh_spinlock;
+    STDLockSpinLock(clh_spinlock);
 }
 
-void SpinLockMultiThreadTest(Lock &lock) {
-    constexpr int COUNT = 100000;
+void SpinLockMultiThreadTest(Lock &lock, int COUNT = 100000) {
     int counter = 0;
 
     auto threadFunc = [&lock, &counter, COUNT] {
@@ -85,4 +149,107 @@ TEST(SpinLockTest, MultipleThreads) {
 
     PosixSpinLock posix_spinlock;
     SpinLockMultiThreadTest(posix_spinlock);
-}
\ No newline at end of file
+}
+
+TEST(SpinLockTest, FairLocksMultipleThreads) {
+    // every hand-off of a fair lock needs the next waiter on a cpu, keep it short
+    // so that the test stays fast on machines with fewer cores than threads
+    constexpr int COUNT = 10000;
+    TicketSpinLock ticket_spinlock;
+    SpinLockMultiThreadTest(ticket_spinlock, COUNT);
+
+    MCSSpinLock mcs_spinlock;
+    SpinLockMultiThreadTest(mcs_spinlock, COUNT);
+
+    CLHSpinLock clh_spinlock;
+    SpinLockMultiThreadTest(clh_spinlock, COUNT);
+}
+
+struct SpinLockBenchResult {
+    double ops_per_us{0};
+    double handoff_ns{0};
+    double fairness{0};  // min / max acquisitions per thread, 1.0 is perfectly fair
+};
+
+SpinLockBenchResult SpinLockBenchmark(Lock &lock, size_t thread_num) {
+    using Clock = std::chrono::steady_clock;
+    constexpr auto kDuration = std::chrono::milliseconds(50);
+
+    std::atomic<bool> start{false}, stop{false};
+    std::vector<uint64_t> acquisitions(thread_num, 0);
+    // protected by lock
+    size_t last_owner = thread_num;
+    Clock::time_point last_release;
+    uint64_t handoffs = 0;
+    Clock::duration handoff_time{0};
+
+    auto threadFunc = [&](size_t index) {
+        while (!start.load(std::memory_order_acquire)) {
+        }
+        uint64_t local = 0;
+        while (!stop.load(std::memory_order_relaxed)) {
+            lock.lock();
+            if (last_owner != index && last_owner != thread_num) {
+                ++handoffs;
+                handoff_time += Clock::now() - last_release;
+            }
+            last_owner = index;
+            ++local;
+            last_release = Clock::now();
+            lock.unlock();
+        }
+        acquisitions[index] = local;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_num; ++i) {
+        threads.emplace_back(threadFunc, i);
+    }
+    const auto begin = Clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(kDuration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto &&thread: threads) {
+        thread.join();
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin);
+
+    SpinLockBenchResult result;
+    uint64_t total = 0;
+    for (auto count: acquisitions) {
+        total += count;
+    }
+    result.ops_per_us = static_cast<double>(total) / std::max<int64_t>(elapsed.count(), 1);
+    if (handoffs) {
+        result.handoff_ns = static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(handoff_time).count()) / handoffs;
+    }
+    auto [min_it, max_it] = std::minmax_element(acquisitions.begin(), acquisitions.end());
+    result.fairness = *max_it ? static_cast<double>(*min_it) / *max_it : 0;
+    return result;
+}
+
+TEST(SpinLockTest, DISABLED_Benchmark) {
+    const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> thread_nums;
+    for (size_t n = 1; n < max_threads; n *= 2) {
+        thread_nums.push_back(n);
+    }
+    thread_nums.push_back(max_threads);
+
+    auto run = [&](const std::string &name, auto make_lock) {
+        for (auto n: thread_nums) {
+            auto lock = make_lock();
+            auto result = SpinLockBenchmark(*lock, n);
+            printf("%-16s threads=%-3zu throughput=%8.2f ops/us handoff=%10.1f ns fairness=%.2f\n",
+                   name.c_str(), n, result.ops_per_us, result.handoff_ns, result.fairness);
+            ASSERT_GT(result.ops_per_us, 0);
+        }
+    };
+    run("SimpleSpinLock", [] { return std::make_unique<SimpleSpinLock>(); });
+    run("AtomicSpinLock", [] { return std::make_unique<AtomicSpinLock>(); });
+    run("PosixSpinLock", [] { return std::make_unique<PosixSpinLock>(); });
+    run("TicketSpinLock", [] { return std::make_unique<TicketSpinLock>(); });
+    run("MCSSpinLock", [] { return std::make_unique<MCSSpinLock>(); });
+    run("CLHSpinLock", [] { return std::make_unique<CLHSpinLock>(); });
+}
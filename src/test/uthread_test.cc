@@ -1,3 +1,7 @@
+#include <string>
+#include <utility>
+#include <vector>
+#include <ucontext.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include "coroutine/uthread.h"
@@ -70,4 +74,102 @@ TEST_F(UThreadTest, ContextTest) {
 
 TEST_F(UThreadTest, ScheduleTest) {
     schedule_test();
-}
\ No newline at end of file
+}
+
+TEST_F(UThreadTest, RoundRobin) {
+    constexpr int uthread_nums = 10000, round_nums = 3;
+    schedule_t s;
+    std::vector<int> order;
+    struct Arg {
+        schedule_t *s;
+        std::vector<int> *order;
+        int index;
+    };
+    std::vector<Arg> args(uthread_nums);
+    for (int i = 0; i < uthread_nums; ++i) {
+        args[i] = {&s, &order, i};
+        uthread_create(s, [](void *p) {
+            Arg *arg = static_cast<Arg *>(p);
+            for (int r = 0; r < round_nums; ++r) {
+                arg->order->push_back(arg->index);
+                uthread_yield(*arg->s);
+            }
+        }, &args[i]);
+    }
+    // every uthread ran up to its first yield when created
+    ASSERT_EQ(order.size(), static_cast<size_t>(uthread_nums));
+    ASSERT_FALSE(schedule_finished(s));
+    uthread_run_until_finished(s);
+    ASSERT_TRUE(schedule_finished(s));
+    ASSERT_EQ(order.size(), static_cast<size_t>(uthread_nums * round_nums));
+    for (size_t i = 0; i < order.size(); ++i) {
+        ASSERT_EQ(order[i], static_cast<int>(i % uthread_nums));
+    }
+}
+
+TEST_F(UThreadTest, ReuseSlots) {
+    schedule_t s;
+    int runs = 0;
+    // finished uthreads give their slot and stack back
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(uthread_create(s, [](void *p) { ++*static_cast<int *>(p); }, &runs), 0);
+    }
+    ASSERT_EQ(runs, 100);
+    ASSERT_EQ(s.threads.size(), 1u);
+    ASSERT_TRUE(schedule_finished(s));
+}
+
+TEST_F(UThreadTest, ResumeAfterYield) {
+    schedule_t s;
+    int step = 0;
+    std::pair<schedule_t *, int *> arg{&s, &step};
+    int id = uthread_create(s, [](void *p) {
+        auto *arg = static_cast<std::pair<schedule_t *, int *> *>(p);
+        for (int i = 0; i < 3; ++i) {
+            ++*arg->second;
+            uthread_yield(*arg->first);
+        }
+    }, &arg);
+    ASSERT_EQ(step, 1);
+    // every resume runs up to the next yield
+    uthread_resume(s, id);
+    ASSERT_EQ(step, 2);
+    uthread_resume(s, id);
+    ASSERT_EQ(step, 3);
+    ASSERT_FALSE(schedule_finished(s));
+    uthread_resume(s, id);
+    ASSERT_TRUE(schedule_finished(s));
+}
+
+TEST_F(UThreadTest, CreateFromUThread) {
+    schedule_t s;
+    std::vector<int> order;
+    std::pair<schedule_t *, std::vector<int> *> arg{&s, &order};
+    uthread_create(s, [](void *p) {
+        auto *arg = static_cast<std::pair<schedule_t *, std::vector<int> *> *>(p);
+        // only queued, the parent keeps running
+        uthread_create(*arg->first, [](void *q) {
+            static_cast<std::vector<int> *>(q)->push_back(2);
+        }, arg->second);
+        arg->second->push_back(1);
+    }, &arg);
+    ASSERT_EQ(order, std::vector<int>({1}));
+    uthread_run_until_finished(s);
+    ASSERT_EQ(order, std::vector<int>({1, 2}));
+}
+
+static int Recurse(int depth) {
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    return depth > 0 ? Recurse(depth - 1) + frame[0] : 0;
+}
+
+TEST_F(UThreadTest, StackOverflowIsReported) {
+    const std::string style = GTEST_FLAG_GET(death_test_style);
+    GTEST_FLAG_SET(death_test_style, "threadsafe");
+    EXPECT_DEATH({
+        schedule_t s;
+        uthread_create(s, [](void *) { Recurse(1 << 20); }, nullptr, 64 * 1024);
+    }, "uthread stack overflow");
+    GTEST_FLAG_SET(death_test_style, style);
+}
@@ -0,0 +1,900 @@
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <glog/logging.h>
+
+#include "memory_pool_cached.h"
+
+namespace memory_pool_internal {
+
+static constexpr size_t kPageShift = 13;
+static constexpr size_t kPageSize = size_t(1) << kPageShift;
+/// free spans up to 1MB are kept in a list per length, longer ones in a single list
+static constexpr size_t kMaxPages = 128;
+/// the page heap grows by at least 2MB at a time
+static constexpr size_t kMinGrowPages = 256;
+/// user space addresses have 47 bits, the page heap never hands out a longer span
+static constexpr size_t kMaxLargeSize = size_t(1) << 47;
+static constexpr size_t kMaxSmallSize = MemoryPoolCachedImpl::kMaxSmallSize;
+static constexpr size_t kMaxClasses = 96;
+/// full batches a transfer cache holds per class
+static constexpr size_t kTransferSlots = 64;
+/// objects a thread cache list may grow to before it gives some back
+static constexpr uint32_t kMaxFreeListLength = 8192;
+/// a thread cache over this gives half of every list back
+static constexpr size_t kMaxThreadCacheBytes = 4 * 1024 * 1024;
+
+static inline void *&NextOf(void *object) {
+    return *static_cast<void **>(object);
+}
+
+static size_t FloorPow2(size_t n) {
+    return size_t(1) << (63 - __builtin_clzll(n));
+}
+
+/// the size classes, computed once
+struct SizeMap {
+    /// class 0 stands for the objects above kMaxSmallSize
+    size_t num_classes{1};
+    size_t class_size[kMaxClasses]{};
+    size_t class_pages[kMaxClasses]{};
+    size_t class_objects[kMaxClasses]{};
+    /// objects moved between a thread cache and the central list at once
+    size_t batch[kMaxClasses]{};
+    /// class by (size + 7) / 8
+    uint8_t class_of[kMaxSmallSize / 8 + 1]{};
+
+    SizeMap() {
+        for (size_t size = 8; size <= kMaxSmallSize;
+             size += size < 16 ? 8 : std::max<size_t>(16, FloorPow2(size) / 8)) {
+            size_t pages = 1;
+            // at most 1/8 of a span is lost at its end
+            while ((pages << kPageShift) < size || (pages << kPageShift) % size > (pages << kPageShift) / 8) {
+                ++pages;
+            }
+            const size_t cls = num_classes++;
+            class_size[cls] = size;
+            class_pages[cls] = pages;
+            class_objects[cls] = (pages << kPageShift) / size;
+            batch[cls] = std::clamp<size_t>(64 * 1024 / size, 2, 32);
+        }
+        CHECK_LE(num_classes, kMaxClasses);
+        size_t cls = 1;
+        for (size_t i = 0; i <= kMaxSmallSize / 8; ++i) {
+            while (class_size[cls] < i * 8) {
+                ++cls;
+            }
+            class_of[i] = static_cast<uint8_t>(cls);
+        }
+    }
+
+    uint32_t ClassIndex(size_t size) const { return class_of[(size + 7) >> 3]; }
+};
+
+static const SizeMap &Sizes() {
+    static const SizeMap s_sizes;
+    return s_sizes;
+}
+
+/// a run of pages, free in the page heap or handed out whole or as objects of a class
+struct Span {
+    /// first page number
+    uintptr_t start{0};
+    size_t npages{0};
+    Span *prev{nullptr};
+    Span *next{nullptr};
+    /// free objects of a span of a size class
+    void *objects{nullptr};
+    /// objects of the span out of the central list
+    uint32_t allocated{0};
+    /// 0 for a large object or a free span
+    uint16_t size_class{0};
+    bool in_use{false};
+    /// a free span whose pages were given back to the system
+    bool released{false};
+};
+
+static void ListInit(Span *list) {
+    list->prev = list->next = list;
+}
+
+static bool ListEmpty(const Span *list) {
+    return list->next == list;
+}
+
+static void ListInsert(Span *list, Span *span) {
+    span->next = list->next;
+    span->prev = list;
+    list->next->prev = span;
+    list->next = span;
+}
+
+static void ListRemove(Span *span) {
+    span->prev->next = span->next;
+    span->next->prev = span->prev;
+    span->prev = span->next = nullptr;
+}
+
+static void *MapMemory(size_t size) {
+    void *vp = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return vp == MAP_FAILED ? nullptr : vp;
+}
+
+/// Span objects, carved from mapped slabs so the pool never calls malloc for them
+class SpanAllocator {
+public:
+    SpanAllocator() = default;
+
+    ~SpanAllocator() {
+        for (void *slab: m_slabs) {
+            munmap(slab, kSlabSize);
+        }
+    }
+
+    Span *New() {
+        if (m_free) {
+            Span *span = m_free;
+            m_free = span->next;
+            return new(span) Span();
+        }
+        if (m_left == 0) {
+            void *slab = MapMemory(kSlabSize);
+            if (slab == nullptr) {
+                PLOG(FATAL) << "mmap memory pool span slab failed";
+            }
+            m_slabs.push_back(slab);
+            m_next = static_cast<Span *>(slab);
+            m_left = kSlabSize / sizeof(Span);
+        }
+        --m_left;
+        return new(m_next++) Span();
+    }
+
+    void Delete(Span *span) {
+        span->next = m_free;
+        m_free = span;
+    }
+
+    size_t bytes() const { return m_slabs.size() * kSlabSize; }
+
+private:
+    static constexpr size_t kSlabSize = 64 * 1024;
+
+    std::vector<void *> m_slabs;
+    Span *m_next{nullptr};
+    size_t m_left{0};
+    Span *m_free{nullptr};
+};
+
+/**
+ * @brief span of every page, a two level radix tree over 48 bit addresses
+ * @details the root is mapped whole but only touched where leaves exist. Readers do not
+ * lock: a leaf is published once and never freed before the pool, and the entries a
+ * reader looks up belong to spans it holds objects of.
+ */
+class PageMap {
+public:
+    PageMap() {
+        m_root = static_cast<std::atomic<Span **> *>(MapMemory(kRootBytes));
+        if (m_root == nullptr) {
+            PLOG(FATAL) << "mmap memory pool page map failed";
+        }
+    }
+
+    ~PageMap() {
+        constexpr size_t kEntriesPerPage = kRootPageSize / sizeof(std::atomic<Span **>);
+        for (size_t page = 0; page < m_root_pages_touched.size(); ++page) {
+            if (!m_root_pages_touched.test(page)) {
+                continue;
+            }
+            for (size_t i = page * kEntriesPerPage; i < (page + 1) * kEntriesPerPage; ++i) {
+                if (Span **leaf = m_root[i].load(std::memory_order_relaxed)) {
+                    munmap(leaf, kLeafBytes);
+                }
+            }
+        }
+        munmap(m_root, kRootBytes);
+    }
+
+    Span *get(uintptr_t page) const {
+        if (page >> (kRootBits + kLeafBits)) {
+            return nullptr;
+        }
+        Span **leaf = m_root[page >> kLeafBits].load(std::memory_order_acquire);
+        return leaf ? leaf[page & (kLeafSize - 1)] : nullptr;
+    }
+
+    /// only for pages ensure() was called for
+    void set(uintptr_t page, Span *span) {
+        m_root[page >> kLeafBits].load(std::memory_order_relaxed)[page & (kLeafSize - 1)] = span;
+    }
+
+    /// leaves for the pages [start, start + n)
+    bool ensure(uintptr_t start, size_t n) {
+        if ((start + n) >> (kRootBits + kLeafBits)) {
+            LOG(ERROR) << "memory pool page out of the page map, page: " << start;
+            return false;
+        }
+        for (uintptr_t i = start >> kLeafBits; i <= (start + n - 1) >> kLeafBits; ++i) {
+            if (m_root[i].load(std::memory_order_relaxed) == nullptr) {
+                void *leaf = MapMemory(kLeafBytes);
+                if (leaf == nullptr) {
+                    PLOG(ERROR) << "mmap memory pool page map leaf failed";
+                    return false;
+                }
+                m_root[i].store(static_cast<Span **>(leaf), std::memory_order_release);
+                ++m_leaves;
+                m_root_pages_touched.set(i * sizeof(std::atomic<Span **>) / kRootPageSize);
+            }
+        }
+        return true;
+    }
+
+    /// the root is reserved address space, only its pages holding leaves are resident
+    size_t bytes() const { return m_root_pages_touched.count() * kRootPageSize + m_leaves * kLeafBytes; }
+
+private:
+    static constexpr size_t kLeafBits = 15;
+    static constexpr size_t kRootBits = 48 - kPageShift - kLeafBits;
+    static constexpr size_t kLeafSize = size_t(1) << kLeafBits;
+    static constexpr size_t kRootSize = size_t(1) << kRootBits;
+    static constexpr size_t kLeafBytes = kLeafSize * sizeof(Span *);
+    static constexpr size_t kRootBytes = kRootSize * sizeof(std::atomic<Span **>);
+    static constexpr size_t kRootPageSize = 4096;
+
+    std::atomic<Span **> *m_root{nullptr};
+    size_t m_leaves{0};
+    std::bitset<kRootBytes / kRootPageSize> m_root_pages_touched;
+};
+
+class PageHeap {
+public:
+    PageHeap() {
+        for (auto &list: m_free) {
+            ListInit(&list);
+        }
+        ListInit(&m_large);
+    }
+
+    ~PageHeap() {
+        for (auto &[vp, size]: m_chunks) {
+            munmap(vp, size);
+        }
+    }
+
+    /**
+     * @brief a span of npages, all its pages map to it
+     * @return nullptr when the system is out of memory
+     */
+    Span *New(size_t npages) {
+        std::lock_guard guard(m_mutex);
+        Span *span = findFree(npages);
+        if (span == nullptr) {
+            if (!grow(npages)) {
+                return nullptr;
+            }
+            span = findFree(npages);
+        }
+        removeFree(span);
+        if (span->npages > npages) {
+            Span *rest = m_spans.New();
+            rest->start = span->start + npages;
+            rest->npages = span->npages - npages;
+            rest->released = span->released;
+            span->npages = npages;
+            insertFree(rest);
+        }
+        span->in_use = true;
+        span->released = false;
+        m_in_use_bytes += npages << kPageShift;
+        for (size_t i = 0; i < npages; ++i) {
+            m_pagemap.set(span->start + i, span);
+        }
+        return span;
+    }
+
+    void Delete(Span *span) {
+        std::lock_guard guard(m_mutex);
+        m_in_use_bytes -= span->npages << kPageShift;
+        span->in_use = false;
+        span->size_class = 0;
+        span->objects = nullptr;
+        span->allocated = 0;
+        mergeAndInsert(span);
+    }
+
+    Span *spanOf(const void *vp) const {
+        return m_pagemap.get(reinterpret_cast<uintptr_t>(vp) >> kPageShift);
+    }
+
+    void releaseFreeMemory() {
+        std::lock_guard guard(m_mutex);
+        auto release = [this](Span *list) {
+            for (Span *span = list->next; span != list; span = span->next) {
+                if (span->released) {
+                    continue;
+                }
+                const size_t bytes = span->npages << kPageShift;
+                if (madvise(reinterpret_cast<void *>(span->start << kPageShift), bytes, MADV_DONTNEED) != 0) {
+                    PLOG(ERROR) << "madvise memory pool span failed";
+                    continue;
+                }
+                span->released = true;
+                m_free_bytes -= bytes;
+                m_released_bytes += bytes;
+            }
+        };
+        for (auto &list: m_free) {
+            release(&list);
+        }
+        release(&m_large);
+    }
+
+    void getStats(MemoryPoolStats &stats, size_t &in_use_bytes) {
+        std::lock_guard guard(m_mutex);
+        stats.system_bytes = m_system_bytes;
+        stats.released_bytes = m_released_bytes;
+        stats.page_heap_free_bytes = m_free_bytes;
+        stats.metadata_bytes = m_spans.bytes() + m_pagemap.bytes();
+        in_use_bytes = m_in_use_bytes;
+    }
+
+private:
+    Span *findFree(size_t npages) {
+        for (size_t n = npages; n <= kMaxPages; ++n) {
+            if (!ListEmpty(&m_free[n])) {
+                return m_free[n].next;
+            }
+        }
+        // best fit, then lowest address, among the long spans
+        Span *best = nullptr;
+        for (Span *span = m_large.next; span != &m_large; span = span->next) {
+            if (span->npages >= npages &&
+                (best == nullptr || span->npages < best->npages ||
+                 (span->npages == best->npages && span->start < best->start))) {
+                best = span;
+            }
+        }
+        return best;
+    }
+
+    bool grow(size_t npages) {
+        const size_t n = std::max(npages, kMinGrowPages);
+        const size_t bytes = n << kPageShift;
+        // one page more to align the chunk to our pages, which are larger than the system's
+        char *vp = static_cast<char *>(MapMemory(bytes + kPageSize));
+        if (vp == nullptr) {
+            PLOG(ERROR) << "mmap memory pool chunk failed, size: " << bytes;
+            return false;
+        }
+        const uintptr_t base = reinterpret_cast<uintptr_t>(vp);
+        const uintptr_t aligned = (base + kPageSize - 1) & ~(kPageSize - 1);
+        if (aligned > base) {
+            munmap(vp, aligned - base);
+        }
+        if (aligned - base < kPageSize) {
+            munmap(reinterpret_cast<void *>(aligned + bytes), kPageSize - (aligned - base));
+        }
+        if (!m_pagemap.ensure(aligned >> kPageShift, n)) {
+            munmap(reinterpret_cast<void *>(aligned), bytes);
+            return false;
+        }
+        m_chunks.emplace_back(reinterpret_cast<void *>(aligned), bytes);
+        m_system_bytes += bytes;
+        Span *span = m_spans.New();
+        span->start = aligned >> kPageShift;
+        span->npages = n;
+        mergeAndInsert(span);
+        return true;
+    }
+
+    /// a free span joins the free spans right before and after it
+    void mergeAndInsert(Span *span) {
+        // only the first and the last page of a free span map to it, which are the
+        // pages next to the neighbours
+        Span *prev = m_pagemap.get(span->start - 1);
+        if (prev && !prev->in_use) {
+            removeFree(prev);
+            span->start = prev->start;
+            span->npages += prev->npages;
+            // partly released spans count as resident, their pages come back on first touch
+            span->released = span->released && prev->released;
+            m_spans.Delete(prev);
+        }
+        Span *next = m_pagemap.get(span->start + span->npages);
+        if (next && !next->in_use) {
+            removeFree(next);
+            span->npages += next->npages;
+            span->released = span->released && next->released;
+            m_spans.Delete(next);
+        }
+        insertFree(span);
+    }
+
+    void insertFree(Span *span) {
+        m_pagemap.set(span->start, span);
+        m_pagemap.set(span->start + span->npages - 1, span);
+        ListInsert(span->npages <= kMaxPages ? &m_free[span->npages] : &m_large, span);
+        (span->released ? m_released_bytes : m_free_bytes) += span->npages << kPageShift;
+    }
+
+    void removeFree(Span *span) {
+        ListRemove(span);
+        (span->released ? m_released_bytes : m_free_bytes) -= span->npages << kPageShift;
+    }
+
+private:
+    std::mutex m_mutex;
+    Span m_free[kMaxPages + 1];
+    Span m_large;
+    PageMap m_pagemap;
+    SpanAllocator m_spans;
+    std::vector<std::pair<void *, size_t>> m_chunks;
+    size_t m_system_bytes{0};
+    size_t m_free_bytes{0};
+    size_t m_released_bytes{0};
+    size_t m_in_use_bytes{0};
+};
+
+/**
+ * @brief the objects of a size class not in any thread cache
+ * @details free objects live in the free lists of their spans, or in the transfer cache
+ * as whole batches linked the way a thread cache gave them back
+ */
+class CentralFreeList {
+public:
+    CentralFreeList() { ListInit(&m_nonempty); }
+
+    void init(PageHeap *heap, uint32_t size_class) {
+        const SizeMap &sizes = Sizes();
+        m_heap = heap;
+        m_size_class = static_cast<uint16_t>(size_class);
+        m_size = sizes.class_size[size_class];
+        m_pages = sizes.class_pages[size_class];
+        m_objects_per_span = sizes.class_objects[size_class];
+        m_batch = sizes.batch[size_class];
+    }
+
+    /**
+     * @brief up to n objects linked from *head to *tail
+     * @return fewer than n when the system is out of memory
+     */
+    size_t removeRange(void **head, void **tail, size_t n) {
+        std::lock_guard guard(m_mutex);
+        if (n == m_batch && m_transfer_used > 0) {
+            const Batch &batch = m_transfer[--m_transfer_used];
+            *head = batch.head;
+            *tail = batch.tail;
+            m_free_objects -= n;
+            return n;
+        }
+        void *first = nullptr;
+        void *last = nullptr;
+        size_t count = 0;
+        for (; count < n; ++count) {
+            void *object = fetchFromSpans();
+            if (object == nullptr) {
+                break;
+            }
+            if (first == nullptr) {
+                last = object;
+            }
+            NextOf(object) = first;
+            first = object;
+        }
+        m_free_objects -= count;
+        *head = first;
+        *tail = last;
+        return count;
+    }
+
+    /// n objects linked from head to tail, the tail linked to nullptr
+    void insertRange(void *head, void *tail, size_t n) {
+        std::lock_guard guard(m_mutex);
+        m_free_objects += n;
+        if (n == m_batch && m_transfer_used < kTransferSlots) {
+            m_transfer[m_transfer_used++] = Batch{head, tail};
+            return;
+        }
+        releaseToSpans(head, n);
+    }
+
+    /// the batches of the transfer cache back to their spans, so empty spans free
+    void drain() {
+        std::lock_guard guard(m_mutex);
+        while (m_transfer_used > 0) {
+            const Batch batch = m_transfer[--m_transfer_used];
+            releaseToSpans(batch.head, m_batch);
+        }
+    }
+
+    void getStats(size_t &free_objects, size_t &spans) {
+        std::lock_guard guard(m_mutex);
+        free_objects = m_free_objects;
+        spans = m_spans;
+    }
+
+private:
+    void *fetchFromSpans() {
+        if (ListEmpty(&m_nonempty) && !populate()) {
+            return nullptr;
+        }
+        Span *span = m_nonempty.next;
+        void *object = span->objects;
+        span->objects = NextOf(object);
+        ++span->allocated;
+        if (span->objects == nullptr) {
+            ListRemove(span);
+        }
+        return object;
+    }
+
+    bool populate() {
+        Span *span = m_heap->New(m_pages);
+        if (span == nullptr) {
+            return false;
+        }
+        // written before any object of the span is out, Dispose() reads it without lock
+        span->size_class = m_size_class;
+        char *base = reinterpret_cast<char *>(span->start << kPageShift);
+        for (size_t i = 0; i < m_objects_per_span; ++i) {
+            NextOf(base + i * m_size) = i + 1 < m_objects_per_span ? base + (i + 1) * m_size : nullptr;
+        }
+        span->objects = base;
+        ListInsert(&m_nonempty, span);
+        m_free_objects += m_objects_per_span;
+        ++m_spans;
+        return true;
+    }
+
+    void releaseToSpans(void *object, size_t n) {
+        for (; n > 0; --n) {
+            void *next = NextOf(object);
+            Span *span = m_heap->spanOf(object);
+            if (span->objects == nullptr) {
+                ListInsert(&m_nonempty, span);
+            }
+            NextOf(object) = span->objects;
+            span->objects = object;
+            if (--span->allocated == 0) {
+                ListRemove(span);
+                m_free_objects -= m_objects_per_span;
+                --m_spans;
+                m_heap->Delete(span);
+            }
+            object = next;
+        }
+    }
+
+private:
+    struct Batch {
+        void *head;
+        void *tail;
+    };
+
+    std::mutex m_mutex;
+    PageHeap *m_heap{nullptr};
+    uint16_t m_size_class{0};
+    size_t m_size{0};
+    size_t m_pages{0};
+    size_t m_objects_per_span{0};
+    size_t m_batch{0};
+    /// spans with free objects
+    Span m_nonempty;
+    Batch m_transfer[kTransferSlots]{};
+    size_t m_transfer_used{0};
+    /// in the spans and the transfer cache
+    size_t m_free_objects{0};
+    size_t m_spans{0};
+};
+
+/**
+ * @brief free objects of one thread for one pool
+ * @details a list grows slowly: by one object per refill up to a batch, then by a batch
+ * per refill, and gives a batch back when it gets longer than that
+ */
+class ThreadCache {
+public:
+    explicit ThreadCache(CentralFreeList *central) : m_central(central), m_sizes(Sizes()) {}
+
+    void *allocate(uint32_t cls) {
+        FreeList &list = m_lists[cls];
+        if (LIKELY(list.head != nullptr)) {
+            void *object = list.head;
+            list.head = NextOf(object);
+            --list.length;
+            addSize(-static_cast<ptrdiff_t>(m_sizes.class_size[cls]));
+            return object;
+        }
+        return fetchFromCentral(cls);
+    }
+
+    void deallocate(void *object, uint32_t cls) {
+        FreeList &list = m_lists[cls];
+        NextOf(object) = list.head;
+        list.head = object;
+        ++list.length;
+        addSize(static_cast<ptrdiff_t>(m_sizes.class_size[cls]));
+        if (UNLIKELY(list.length > list.max_length)) {
+            listTooLong(cls);
+        } else if (UNLIKELY(m_size.load(std::memory_order_relaxed) > kMaxThreadCacheBytes)) {
+            scavenge();
+        }
+    }
+
+    void releaseAll() {
+        for (uint32_t cls = 1; cls < m_sizes.num_classes; ++cls) {
+            releaseToCentral(cls, m_lists[cls].length);
+        }
+    }
+
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+private:
+    struct FreeList {
+        void *head{nullptr};
+        uint32_t length{0};
+        uint32_t max_length{1};
+    };
+
+    void addSize(ptrdiff_t delta) {
+        // only the owner writes, the stats read it from other threads
+        m_size.store(m_size.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    void *fetchFromCentral(uint32_t cls) {
+        FreeList &list = m_lists[cls];
+        const size_t batch = m_sizes.batch[cls];
+        void *head;
+        void *tail;
+        const size_t n = m_central[cls].removeRange(&head, &tail, batch);
+        if (n == 0) {
+            return nullptr;
+        }
+        list.head = NextOf(head);
+        list.length = static_cast<uint32_t>(n - 1);
+        addSize(static_cast<ptrdiff_t>((n - 1) * m_sizes.class_size[cls]));
+        if (list.max_length < batch) {
+            ++list.max_length;
+        } else {
+            const size_t grown = std::min<size_t>(list.max_length + batch, kMaxFreeListLength);
+            list.max_length = static_cast<uint32_t>(grown - grown % batch);
+        }
+        return head;
+    }
+
+    void listTooLong(uint32_t cls) {
+        FreeList &list = m_lists[cls];
+        const size_t batch = m_sizes.batch[cls];
+        releaseToCentral(cls, std::min<size_t>(list.length, batch));
+        if (list.max_length < batch) {
+            ++list.max_length;
+        }
+    }
+
+    /// half of every list back to the central lists
+    void scavenge() {
+        for (uint32_t cls = 1; cls < m_sizes.num_classes; ++cls) {
+            releaseToCentral(cls, (m_lists[cls].length + 1) / 2);
+        }
+    }
+
+    /// in batches, the transfer cache takes those whole
+    void releaseToCentral(uint32_t cls, size_t n) {
+        FreeList &list = m_lists[cls];
+        const size_t batch = m_sizes.batch[cls];
+        addSize(-static_cast<ptrdiff_t>(n * m_sizes.class_size[cls]));
+        while (n > 0) {
+            const size_t k = std::min(n, batch);
+            void *head = list.head;
+            void *tail = head;
+            for (size_t i = 1; i < k; ++i) {
+                tail = NextOf(tail);
+            }
+            list.head = NextOf(tail);
+            NextOf(tail) = nullptr;
+            list.length -= static_cast<uint32_t>(k);
+            m_central[cls].insertRange(head, tail, k);
+            n -= k;
+        }
+    }
+
+private:
+    CentralFreeList *m_central;
+    const SizeMap &m_sizes;
+    FreeList m_lists[kMaxClasses];
+    std::atomic<size_t> m_size{0};
+};
+
+}  // namespace memory_pool_internal
+
+using namespace memory_pool_internal;
+
+/// pools alive by id, thread caches of a destroyed pool are never looked up again
+static std::mutex s_registry_mutex;
+/// leaked on purpose, threads may exit after the static destructors ran
+static auto *s_live_pools = new std::unordered_map<uint64_t, MemoryPoolCachedImpl *>;
+static std::atomic<uint64_t> s_next_pool_id{1};
+
+struct ThreadCacheSlot {
+    uint64_t pool_id;
+    ThreadCache *cache;
+};
+
+/// the cache of the pool this thread used last, checked before the list
+static thread_local ThreadCacheSlot t_last_cache{0, nullptr};
+/// objects disposed by thread_local destructors after the caches are gone go to the central lists
+static thread_local bool t_caches_destroyed = false;
+
+/// the caches of the current thread, given back to their pools when it exits
+class ThreadCacheList {
+public:
+    ThreadCacheList() = default;
+
+    ~ThreadCacheList() {
+        t_caches_destroyed = true;
+        t_last_cache = ThreadCacheSlot{0, nullptr};
+        std::lock_guard guard(s_registry_mutex);
+        for (const ThreadCacheSlot &slot: m_slots) {
+            auto it = s_live_pools->find(slot.pool_id);
+            if (it != s_live_pools->end()) {
+                it->second->ReleaseThreadCache(slot.cache);
+            }
+        }
+    }
+
+    ThreadCache *find(uint64_t pool_id) const {
+        for (const ThreadCacheSlot &slot: m_slots) {
+            if (slot.pool_id == pool_id) {
+                return slot.cache;
+            }
+        }
+        return nullptr;
+    }
+
+    /// under the registry lock
+    void add(uint64_t pool_id, ThreadCache *cache) {
+        // drop the slots of destroyed pools, their caches went with them
+        m_slots.erase(std::remove_if(m_slots.begin(), m_slots.end(), [](const ThreadCacheSlot &slot) {
+            return s_live_pools->count(slot.pool_id) == 0;
+        }), m_slots.end());
+        m_slots.push_back(ThreadCacheSlot{pool_id, cache});
+    }
+
+private:
+    std::vector<ThreadCacheSlot> m_slots;
+};
+
+MemoryPoolCachedImpl::MemoryPoolCachedImpl()
+        : m_id(s_next_pool_id.fetch_add(1, std::memory_order_relaxed)),
+          m_heap(std::make_unique<PageHeap>()),
+          m_central(std::make_unique<CentralFreeList[]>(kMaxClasses)) {
+    for (uint32_t cls = 1; cls < Sizes().num_classes; ++cls) {
+        m_central[cls].init(m_heap.get(), cls);
+    }
+    std::lock_guard guard(s_registry_mutex);
+    s_live_pools->emplace(m_id, this);
+}
+
+MemoryPoolCachedImpl::~MemoryPoolCachedImpl() {
+    std::lock_guard guard(s_registry_mutex);
+    s_live_pools->erase(m_id);
+    // the objects cached go with the spans
+    for (ThreadCache *cache: m_caches) {
+        delete cache;
+    }
+    m_caches.clear();
+}
+
+char *MemoryPoolCachedImpl::New(size_t size) {
+    if (LIKELY(size <= kMaxSmallSize)) {
+        const uint32_t cls = Sizes().ClassIndex(size);
+        if (ThreadCache *cache = GetThreadCache()) {
+            return static_cast<char *>(cache->allocate(cls));
+        }
+        void *head;
+        void *tail;
+        return m_central[cls].removeRange(&head, &tail, 1) ? static_cast<char *>(head) : nullptr;
+    }
+    // rounding a larger size up to pages could wrap around
+    if (UNLIKELY(size > kMaxLargeSize)) {
+        return nullptr;
+    }
+    Span *span = m_heap->New((size + kPageSize - 1) >> kPageShift);
+    return span ? reinterpret_cast<char *>(span->start << kPageShift) : nullptr;
+}
+
+void MemoryPoolCachedImpl::Dispose(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    Span *span = m_heap->spanOf(ptr);
+    if (UNLIKELY(span == nullptr || !span->in_use)) {
+        LOG(FATAL) << "dispose of " << ptr << " not allocated by the memory pool";
+    }
+    const uint32_t cls = span->size_class;
+    if (cls == 0) {
+        m_heap->Delete(span);
+    } else if (ThreadCache *cache = GetThreadCache()) {
+        cache->deallocate(ptr, cls);
+    } else {
+        NextOf(ptr) = nullptr;
+        m_central[cls].insertRange(ptr, ptr, 1);
+    }
+}
+
+size_t MemoryPoolCachedImpl::PoolUsage() const {
+    MemoryPoolStats stats;
+    size_t in_use_bytes;
+    m_heap->getStats(stats, in_use_bytes);
+    return stats.system_bytes - stats.released_bytes + stats.metadata_bytes;
+}
+
+MemoryPoolStats MemoryPoolCachedImpl::GetStats() const {
+    const SizeMap &sizes = Sizes();
+    MemoryPoolStats stats;
+    size_t span_bytes;
+    m_heap->getStats(stats, span_bytes);
+    size_t small_span_bytes = 0;
+    size_t small_bytes = 0;
+    for (uint32_t cls = 1; cls < sizes.num_classes; ++cls) {
+        size_t free_objects, spans;
+        m_central[cls].getStats(free_objects, spans);
+        stats.central_cache_bytes += free_objects * sizes.class_size[cls];
+        small_span_bytes += spans * (sizes.class_pages[cls] << kPageShift);
+        small_bytes += (spans * sizes.class_objects[cls] - free_objects) * sizes.class_size[cls];
+    }
+    {
+        std::lock_guard guard(s_registry_mutex);
+        for (const ThreadCache *cache: m_caches) {
+            stats.thread_cache_bytes += cache->size();
+        }
+    }
+    // the parts are read one after the other, clamp what a concurrent change skewed
+    const size_t large_bytes = span_bytes - std::min(span_bytes, small_span_bytes);
+    small_bytes -= std::min(small_bytes, stats.thread_cache_bytes);
+    stats.in_use_bytes = large_bytes + small_bytes;
+    return stats;
+}
+
+void MemoryPoolCachedImpl::ReleaseFreeMemory() {
+    for (uint32_t cls = 1; cls < Sizes().num_classes; ++cls) {
+        m_central[cls].drain();
+    }
+    m_heap->releaseFreeMemory();
+}
+
+ThreadCache *MemoryPoolCachedImpl::GetThreadCache() {
+    if (LIKELY(t_last_cache.pool_id == m_id)) {
+        return t_last_cache.cache;
+    }
+    return GetThreadCacheSlow();
+}
+
+ThreadCache *MemoryPoolCachedImpl::GetThreadCacheSlow() {
+    if (t_caches_destroyed) {
+        return nullptr;
+    }
+    static thread_local ThreadCacheList t_caches;
+    ThreadCache *cache = t_caches.find(m_id);
+    if (cache == nullptr) {
+        cache = new ThreadCache(m_central.get());
+        std::lock_guard guard(s_registry_mutex);
+        m_caches.push_back(cache);
+        t_caches.add(m_id, cache);
+    }
+    t_last_cache = ThreadCacheSlot{m_id, cache};
+    return cache;
+}
+
+void MemoryPoolCachedImpl::ReleaseThreadCache(ThreadCache *cache) {
+    cache->releaseAll();
+    m_caches.erase(std::remove(m_caches.begin(), m_caches.end(), cache), m_caches.end());
+    delete cache;
+}
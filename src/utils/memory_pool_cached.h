@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "memory_pool_lite.h"
+
+/**
+ * @file memory_pool_cached.h
+ * @brief a general purpose MemoryPool caching freed objects per thread
+ * @details organized like tcmalloc:
+ *  - sizes up to kMaxSmallSize are rounded up to one of ~70 size classes, 8 bytes
+ *    apart at first and then about 1/8 of the size apart;
+ *  - every thread has a cache of free objects per class, New() and Dispose() of a
+ *    small object touch only that list when it is neither empty nor too long;
+ *  - the caches exchange objects with a central free list per class in batches, and
+ *    a full batch is parked as a whole in the transfer cache of the class, so a batch
+ *    released by one thread is handed to the next that runs dry without walking it;
+ *  - the central lists carve spans of 8KB pages taken from a page heap, which maps
+ *    memory in chunks of at least 2MB, coalesces the spans given back and finds the
+ *    span of any pointer through a radix tree of the pages;
+ *  - objects above kMaxSmallSize get a span of their own.
+ * Small objects of 16 bytes or more are 16 byte aligned, large ones page aligned.
+ * Dispose() may run on any thread, the object goes to the cache of that thread.
+ */
+
+struct MemoryPoolStats {
+    /// mapped from the system for spans
+    size_t system_bytes{0};
+    /// of system_bytes, free pages given back with madvise
+    size_t released_bytes{0};
+    /// of system_bytes, free pages kept by the page heap
+    size_t page_heap_free_bytes{0};
+    /// free objects of the central lists, transfer caches included
+    size_t central_cache_bytes{0};
+    /// free objects of the thread caches
+    size_t thread_cache_bytes{0};
+    /// returned by New() and not disposed yet, rounded up to their size class or pages
+    size_t in_use_bytes{0};
+    /// spans and page map
+    size_t metadata_bytes{0};
+};
+
+namespace memory_pool_internal {
+
+class PageHeap;
+
+class CentralFreeList;
+
+class ThreadCache;
+
+}  // namespace memory_pool_internal
+
+class MemoryPoolCachedImpl : public MemoryPool {
+public:
+    /// bigger objects get spans of their own instead of a size class
+    static constexpr size_t kMaxSmallSize = 32 * 1024;
+
+    MemoryPoolCachedImpl();
+
+    /**
+     * @brief unmaps all memory of the pool, objects not disposed included
+     * @details threads that used the pool drop their caches of it, they must not use it
+     * any more
+     */
+    ~MemoryPoolCachedImpl() override;
+
+    MemoryPoolCachedImpl(const MemoryPoolCachedImpl &) = delete;
+
+    MemoryPoolCachedImpl &operator=(const MemoryPoolCachedImpl &) = delete;
+
+    /**
+     * @return nullptr when the system is out of memory or size exceeds the address space
+     */
+    char *New(size_t size) override;
+
+    /**
+     * @brief bytes taken from the system and not released, metadata included
+     */
+    size_t PoolUsage() const override;
+
+    /**
+     * @brief give back an object of New(), from any thread
+     */
+    void Dispose(void *ptr) override;
+
+    MemoryPoolStats GetStats() const;
+
+    /**
+     * @brief move the free objects of the transfer caches back to their spans and give the
+     * free pages of the page heap back to the system
+     * @details the thread caches are left alone
+     */
+    void ReleaseFreeMemory();
+
+private:
+    friend class ThreadCacheList;
+
+    memory_pool_internal::ThreadCache *GetThreadCache();
+
+    memory_pool_internal::ThreadCache *GetThreadCacheSlow();
+
+    /// from the exit of a thread, under the registry lock
+    void ReleaseThreadCache(memory_pool_internal::ThreadCache *cache);
+
+private:
+    const uint64_t m_id;
+    std::unique_ptr<memory_pool_internal::PageHeap> m_heap;
+    std::unique_ptr<memory_pool_internal::CentralFreeList[]> m_central;
+    /// caches of the threads that used the pool, guarded by the registry lock
+    std::vector<memory_pool_internal::ThreadCache *> m_caches;
+};
@@ -1,133 +1,131 @@
 #include <cstdint>
+#include <sys/mman.h>
+#include <glog/logging.h>
 #include "memory_pool_lite.h"
 
-template<typename T, size_t BlockSize>
-inline typename MemoryPoolLiteAllocator<T, BlockSize>::size_type
-MemoryPoolLiteAllocator<T, BlockSize>::padPointer(data_pointer_ p, size_type align)
-const noexcept {
-    uintptr_t result = reinterpret_cast<uintptr_t>(p);
-    return ((align - result) % align);
-}
-
-template<typename T, size_t BlockSize>
-MemoryPoolLiteAllocator<T, BlockSize>::MemoryPoolLiteAllocator() noexcept:
-        currentBlock_{nullptr},
-        currentSlot_{nullptr},
-        lastSlot_{nullptr},
-        freeSlots_{nullptr} {}
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
 
-template<typename T, size_t BlockSize>
-MemoryPoolLiteAllocator<T, BlockSize>::MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator &) noexcept
-        :MemoryPoolLiteAllocator() {}
+/// the header of a block, rounded so that the memory after it is aligned like malloc's
+static constexpr size_t kBlockHeaderSize = 32;
 
-template<typename T, size_t BlockSize>
-MemoryPoolLiteAllocator<T, BlockSize>::MemoryPoolLiteAllocator(MemoryPoolLiteAllocator &&other) noexcept
-        :MemoryPoolLiteAllocator() {
-    currentBlock_ = other.currentBlock_;
-    other.currentBlock_ = nullptr;
-    currentSlot_ = other.currentSlot_;
-    lastSlot_ = other.lastSlot_;
-    freeSlots_ = other.freeSlots_;
+MemoryPoolLiteImpl::MemoryPoolLiteImpl(size_t initial_block_size, size_t max_block_size, HugePages huge_pages)
+        : next_block_size_(std::max(initial_block_size, kBlockHeaderSize * 2)),
+          max_block_size_(std::max(max_block_size, next_block_size_)),
+          huge_pages_(huge_pages) {
+    static_assert(sizeof(Block) <= kBlockHeaderSize && kBlockHeaderSize % alignof(std::max_align_t) == 0);
 }
 
-template<typename T, size_t BlockSize>
-template<class U>
-MemoryPoolLiteAllocator<T, BlockSize>::MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator<U> &memoryPool) noexcept
-        : MemoryPoolLiteAllocator() {}
-
-template<typename T, size_t BlockSize>
-MemoryPoolLiteAllocator<T, BlockSize> &
-MemoryPoolLiteAllocator<T, BlockSize>::operator=(MemoryPoolLiteAllocator<T, BlockSize> &&other) noexcept {
-    if (this != &other) {
-        std::swap(currentBlock_, other.currentBlock_);
-        currentSlot_ = other.currentSlot_;
-        lastSlot_ = other.lastSlot_;
-        freeSlots_ = other.freeSlots_;
+MemoryPoolLiteImpl::~MemoryPoolLiteImpl() {
+    RunDestructors(nullptr);
+    while (first_ != nullptr) {
+        Block *next = first_->next;
+        FreeBlock(first_);
+        first_ = next;
     }
-    return *this;
 }
 
-template<typename T, size_t BlockSize>
-MemoryPoolLiteAllocator<T, BlockSize>::~MemoryPoolLiteAllocator() noexcept {
-    slot_pointer_ curr = currentBlock_;
-    while (curr != nullptr) {
-        slot_pointer_ next = curr->next;
-        operator delete(reinterpret_cast<void *>(curr));
-        curr = next;
+void MemoryPoolLiteImpl::Rewind(const Marker &marker) {
+    RunDestructors(marker.dtors_);
+    current_ = marker.block_;
+    if (current_ != nullptr) {
+        ptr_ = marker.ptr_;
+        end_ = reinterpret_cast<uintptr_t>(current_) + current_->size;
+    } else {
+        ptr_ = end_ = 0;
     }
 }
 
-template<typename T, size_t BlockSize>
-void
-MemoryPoolLiteAllocator<T, BlockSize>::allocateBlock() {
-    // Allocate space for the new block and store a pointer to the previous one
-    data_pointer_ newBlock = reinterpret_cast<data_pointer_>
-    (operator new(BlockSize));
-    reinterpret_cast<slot_pointer_>(newBlock)->next = currentBlock_;
-    currentBlock_ = reinterpret_cast<slot_pointer_>(newBlock);
-    // Pad block body to staisfy the alignment requirements for elements
-    data_pointer_ body = newBlock + sizeof(slot_pointer_);
-    size_type bodyPadding = padPointer(body, alignof(slot_type_));
-    currentSlot_ = reinterpret_cast<slot_pointer_>(body + bodyPadding);
-    lastSlot_ = reinterpret_cast<slot_pointer_>
-    (newBlock + BlockSize - sizeof(slot_type_) + 1);
+void MemoryPoolLiteImpl::Reset() {
+    RunDestructors(nullptr);
+    if (first_ != nullptr) {
+        UseBlock(first_);
+    }
 }
 
-template<typename T, size_t BlockSize>
-inline typename MemoryPoolLiteAllocator<T, BlockSize>::pointer
-MemoryPoolLiteAllocator<T, BlockSize>::allocate(size_type n, const_pointer hint) {
-    if (freeSlots_ != nullptr) {
-        pointer result = reinterpret_cast<pointer>(freeSlots_);
-        freeSlots_ = freeSlots_->next;
-        return result;
+void *MemoryPoolLiteImpl::AllocateSlow(size_t size, size_t align) {
+    // the blocks after the current one are free, kept by Rewind() and Reset()
+    for (Block *block = current_ ? current_->next : first_; block != nullptr; block = block->next) {
+        UseBlock(block);
+        const uintptr_t ptr = (ptr_ + align - 1) & ~(align - 1);
+        if (ptr < end_ && size <= end_ - ptr) {
+            ptr_ = ptr + size;
+            return reinterpret_cast<void *>(ptr);
+        }
+    }
+    // too small blocks on the way stay empty until the next rewind
+    Block *block = NewBlock(size + align);
+    if (current_ != nullptr) {
+        current_->next = block;
     } else {
-        if (currentSlot_ >= lastSlot_)
-            allocateBlock();
-        return reinterpret_cast<pointer>(currentSlot_++);
+        first_ = block;
     }
+    UseBlock(block);
+    const uintptr_t ptr = (ptr_ + align - 1) & ~(align - 1);
+    ptr_ = ptr + size;
+    return reinterpret_cast<void *>(ptr);
 }
 
-template<typename T, size_t BlockSize>
-inline void
-MemoryPoolLiteAllocator<T, BlockSize>::deallocate(pointer p, size_type n) {
-    if (p != nullptr) {
-        reinterpret_cast<slot_pointer_>(p)->next = freeSlots_;
-        freeSlots_ = reinterpret_cast<slot_pointer_>(p);
+MemoryPoolLiteImpl::Block *MemoryPoolLiteImpl::NewBlock(size_t min_size) {
+    size_t size = kBlockHeaderSize + min_size;
+    if (size <= next_block_size_) {
+        size = next_block_size_;
+        next_block_size_ = std::min(next_block_size_ * 2, max_block_size_);
     }
+    void *vp = nullptr;
+    bool mapped = false;
+    if (huge_pages_ != HugePages::kNone) {
+        size = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        if (huge_pages_ == HugePages::kHugeTlb) {
+            vp = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (vp == MAP_FAILED) {
+                PLOG(WARNING) << "mmap arena block with MAP_HUGETLB failed, falling back to madvise";
+                huge_pages_ = HugePages::kAdvise;
+                vp = nullptr;
+            }
+        }
+        if (vp == nullptr) {
+            vp = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (vp == MAP_FAILED) {
+                PLOG(ERROR) << "mmap arena block failed, size: " << size;
+                throw std::bad_alloc();
+            }
+            // transparent huge pages may be disabled, the block works without
+            madvise(vp, size, MADV_HUGEPAGE);
+        }
+        mapped = true;
+    } else {
+        vp = std::malloc(size);
+        if (vp == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+    Block *block = static_cast<Block *>(vp);
+    block->next = nullptr;
+    block->size = size;
+    block->mapped = mapped;
+    block_bytes_ += size;
+    return block;
 }
 
-template<typename T, size_t BlockSize>
-template<class U, class... Args>
-inline void
-MemoryPoolLiteAllocator<T, BlockSize>::construct(U *p, Args &&... args) {
-    new(p) U(std::forward<Args>(args)...);
-}
-
-
-template<typename T, size_t BlockSize>
-template<class U>
-inline void
-MemoryPoolLiteAllocator<T, BlockSize>::destroy(U *p) {
-    p->~U();
-}
-
-
-template<typename T, size_t BlockSize>
-template<class... Args>
-inline typename MemoryPoolLiteAllocator<T, BlockSize>::pointer
-MemoryPoolLiteAllocator<T, BlockSize>::newElement(Args &&... args) {
-    pointer result = allocate();
-    construct<value_type>(result, std::forward<Args>(args)...);
-    return result;
+void MemoryPoolLiteImpl::FreeBlock(Block *block) {
+    block_bytes_ -= block->size;
+    if (block->mapped) {
+        munmap(block, block->size);
+    } else {
+        std::free(block);
+    }
 }
 
-
-template<typename T, size_t BlockSize>
-inline void
-MemoryPoolLiteAllocator<T, BlockSize>::deleteElement(pointer p) {
-    if (p != nullptr) {
-        p->~value_type();
-        deallocate(p);
+void MemoryPoolLiteImpl::RunDestructors(DtorNode *until) {
+    while (dtors_ != until) {
+        DtorNode *node = dtors_;
+        dtors_ = node->prev;
+        node->destroy(node->object);
     }
 }
 
+void MemoryPoolLiteImpl::UseBlock(Block *block) {
+    current_ = block;
+    ptr_ = reinterpret_cast<uintptr_t>(block) + kBlockHeaderSize;
+    end_ = reinterpret_cast<uintptr_t>(block) + block->size;
+}
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <algorithm>
-#include <deque>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <numeric>
 #include <functional>
+#include <new>
+#include <type_traits>
 #include <utility>
 #include <memory>
+#include <vector>
 #include <cstdlib>
 #include "macro.h"
 
@@ -40,58 +45,274 @@ public:
     void Dispose(void *ptr) { std::free(ptr); };
 };
 
+/**
+ * @brief arena: bump allocation out of blocks, all freed at once
+ * @details blocks grow geometrically from initial_block_size up to max_block_size, a
+ * request bigger than the next block gets a block of its own. Rewind() and Reset() keep
+ * the blocks, so an arena reset after every request stops allocating once it grew to
+ * the size of a request. Objects of Create() are destroyed by Rewind(), Reset() and the
+ * destructor, in reverse order of creation.
+ *
+ *     MemoryPoolLiteImpl arena;
+ *     for (;;) {
+ *         Request *request = arena.Create<Request>(...);
+ *         ...
+ *         arena.Reset();
+ *     }
+ */
 class MemoryPoolLiteImpl : public MemoryPool {
+private:
+    struct Block;
+    struct DtorNode;
+
 public:
-    MemoryPoolLiteImpl() : ptr_{0}, left_{0}, memory_{sizeof(*this)} {};
+    /// how blocks are backed
+    enum class HugePages {
+        kNone,     ///< malloc
+        kAdvise,   ///< mmap in multiples of 2MB, with madvise(MADV_HUGEPAGE)
+        kHugeTlb,  ///< mmap with MAP_HUGETLB, kAdvise once no huge page is left
+    };
 
-    virtual ~MemoryPoolLiteImpl() {
-        std::for_each(blocks_.begin(), blocks_.end(), [](auto *p) { delete[] p; });
+    /// a position of the arena, Rewind() goes back to it
+    class Marker {
+    private:
+        friend class MemoryPoolLiteImpl;
+
+        Block *block_{nullptr};
+        uintptr_t ptr_{0};
+        DtorNode *dtors_{nullptr};
     };
 
-    char *New(size_t size) override {
-        if (left_ >= size) {
-            left_ -= size;
-            if (UNLIKELY(ptr_ == 0)) {
-                return NewBlock(0);
-            }
-            char *ptr = reinterpret_cast<char *>(ptr_);
-            ptr_ += size;
-            return ptr;
+    /// rewinds the arena to where it was when the scope began
+    class Scope {
+    public:
+        explicit Scope(MemoryPoolLiteImpl &arena) : arena_(arena), marker_(arena.Mark()) {}
+
+        ~Scope() { arena_.Rewind(marker_); }
+
+        DISALLOW_COPY_AND_ASSIGN(Scope);
+
+    private:
+        MemoryPoolLiteImpl &arena_;
+        const Marker marker_;
+    };
+
+    explicit MemoryPoolLiteImpl(size_t initial_block_size = DefaultBlockSize,
+                                size_t max_block_size = MaxBlockSize,
+                                HugePages huge_pages = HugePages::kNone);
+
+    ~MemoryPoolLiteImpl() override;
+
+    DISALLOW_COPY_AND_ASSIGN(MemoryPoolLiteImpl);
+
+    /// aligned for any scalar type
+    char *New(size_t size) override { return static_cast<char *>(Allocate(size)); }
+
+    /**
+     * @param align a power of 2
+     * @throw std::bad_alloc when a block cannot be allocated
+     */
+    void *Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        const uintptr_t ptr = (ptr_ + align - 1) & ~(align - 1);
+        if (LIKELY(ptr < end_ && size <= end_ - ptr)) {
+            ptr_ = ptr + size;
+            return reinterpret_cast<void *>(ptr);
+        }
+        return AllocateSlow(size, align);
+    }
+
+    /**
+     * @brief construct a T in the arena, destroyed when the arena is rewound past it
+     */
+    template<typename T, typename... Args>
+    T *Create(Args &&... args) {
+        if constexpr (std::is_trivially_destructible_v<T>) {
+            return new(Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        } else {
+            // the node first, nothing can fail once the object exists
+            auto *node = static_cast<DtorNode *>(Allocate(sizeof(DtorNode), alignof(DtorNode)));
+            T *object = new(Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            node->destroy = [](void *vp) { static_cast<T *>(vp)->~T(); };
+            node->object = object;
+            node->prev = dtors_;
+            dtors_ = node;
+            return object;
         }
-        return NewBlock(size);
     }
 
-    size_t PoolUsage() const override {
-        return memory_ + blocks_.size() * sizeof(blocks_.front());
+    Marker Mark() const {
+        Marker marker;
+        marker.block_ = current_;
+        marker.ptr_ = ptr_;
+        marker.dtors_ = dtors_;
+        return marker;
     }
 
-    void Dispose(void *ptr) {}
+    /**
+     * @brief destroy the objects created since marker and reuse their memory
+     * @details markers taken after this one are invalid afterwards
+     */
+    void Rewind(const Marker &marker);
+
+    /// destroy every object created and reuse all blocks from the first one
+    void Reset();
+
+    size_t PoolUsage() const override { return sizeof(*this) + block_bytes_; }
+
+    void Dispose(void *ptr) override {}
 
 private:
+    struct Block {
+        Block *next;
+        size_t size;
+        bool mapped;
+    };
+
+    struct DtorNode {
+        void (*destroy)(void *);
+        void *object;
+        DtorNode *prev;
+    };
+
+    void *AllocateSlow(size_t size, size_t align);
+
+    Block *NewBlock(size_t min_size);
+
+    void FreeBlock(Block *block);
+
+    void RunDestructors(DtorNode *until);
+
+    /// makes block the current one, at its beginning
+    void UseBlock(Block *block);
+
+    Block *first_{nullptr};
+    Block *current_{nullptr};
+    uintptr_t ptr_{0};
+    uintptr_t end_{0};
+    DtorNode *dtors_{nullptr};
+    size_t block_bytes_{0};
+    size_t next_block_size_;
+    const size_t max_block_size_;
+    HugePages huge_pages_;
+
+    static constexpr size_t DefaultBlockSize = 64 * 1024;
+    static constexpr size_t MaxBlockSize = 8 * 1024 * 1024;
+};
+
+namespace memory_pool_lite_internal {
+
+/// what a pool allocator does with allocate(n) for n != 1, arrays are not pooled
+template<typename T>
+T *AllocateArray(size_t n) {
+    if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+    } else {
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+}
 
-    char *NewBlock(size_t block_size) {
-        const size_t allocate_size = std::max(block_size, DefaultBlockSize);
-        char *block = new char[allocate_size];
-        blocks_.emplace_back(block);
-        memory_ += allocate_size;
-        if (allocate_size > block_size) {
-            ptr_ = reinterpret_cast<uintptr_t>(block + block_size);
-            left_ = allocate_size - block_size;
+template<typename T>
+void DeallocateArray(T *p) {
+    if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        ::operator delete(p, std::align_val_t(alignof(T)));
+    } else {
+        ::operator delete(p);
+    }
+}
+
+/// free slots of one size, carved from blocks of block_size
+class SlotPool {
+public:
+    SlotPool(size_t slot_size, size_t slot_align, size_t block_size)
+            : slot_size_(slot_size), slot_align_(slot_align), block_size_(block_size) {}
+
+    ~SlotPool() {
+        while (blocks_ != nullptr) {
+            char *next = *reinterpret_cast<char **>(blocks_);
+            ::operator delete(blocks_);
+            blocks_ = next;
         }
+    }
 
-        return block;
+    SlotPool(const SlotPool &) = delete;
+
+    SlotPool &operator=(const SlotPool &) = delete;
+
+    void *Allocate() {
+        if (freeSlots_ != nullptr) {
+            void *slot = freeSlots_;
+            freeSlots_ = *static_cast<void **>(slot);
+            return slot;
+        }
+        if (currentSlot_ + slot_size_ > lastSlot_) {
+            AllocateBlock();
+        }
+        void *slot = currentSlot_;
+        currentSlot_ += slot_size_;
+        return slot;
     }
 
-    std::deque<char *> blocks_;
-    uintptr_t ptr_{};
-    size_t left_{};
-    size_t memory_{};
+    void Deallocate(void *slot) {
+        *static_cast<void **>(slot) = freeSlots_;
+        freeSlots_ = slot;
+    }
 
-    static constexpr size_t DefaultBlockSize = 64 * 1024;
+    bool Fits(size_t slot_size, size_t slot_align) const {
+        return slot_size_ == slot_size && slot_align_ == slot_align;
+    }
+
+private:
+    void AllocateBlock() {
+        // the blocks are linked through their first pointer
+        char *block = static_cast<char *>(::operator new(block_size_));
+        *reinterpret_cast<char **>(block) = blocks_;
+        blocks_ = block;
+        const uintptr_t body = reinterpret_cast<uintptr_t>(block + sizeof(char *));
+        currentSlot_ = reinterpret_cast<char *>((body + slot_align_ - 1) & ~(slot_align_ - 1));
+        lastSlot_ = block + block_size_;
+    }
+
+    const size_t slot_size_;
+    const size_t slot_align_;
+    const size_t block_size_;
+    char *blocks_{nullptr};
+    char *currentSlot_{nullptr};
+    char *lastSlot_{nullptr};
+    void *freeSlots_{nullptr};
+};
+
+/// the pools of an allocator and of everything copied or rebound from it, one per slot size
+class SlotPoolGroup {
+public:
+    explicit SlotPoolGroup(size_t block_size) : block_size_(block_size) {}
+
+    SlotPool *Get(size_t slot_size, size_t slot_align) {
+        for (auto &pool: pools_) {
+            if (pool->Fits(slot_size, slot_align)) {
+                return pool.get();
+            }
+        }
+        pools_.push_back(std::make_unique<SlotPool>(slot_size, slot_align, block_size_));
+        return pools_.back().get();
+    }
+
+private:
+    const size_t block_size_;
+    std::vector<std::unique_ptr<SlotPool>> pools_;
 };
 
+}  // namespace memory_pool_lite_internal
+
+/**
+ * @brief STL allocator of single objects from free lists and blocks of BlockSize
+ * @details not thread safe. A default constructed allocator starts a pool of its own,
+ * copies and rebound allocators share it and compare equal, so a node container can
+ * splice, sort and hand out get_allocator() like with std::allocator; the memory goes
+ * when the last of them is gone. allocate(n) for n != 1, like the buckets of an
+ * unordered_map or the storage of a vector, goes to operator new.
+ */
 template<typename T, size_t BlockSize = 4096>
-class MemoryPoolLiteAllocator : public std::allocator<T> {
+class MemoryPoolLiteAllocator {
 public:
     /* type traits */
     typedef T value_type;
@@ -104,69 +325,289 @@ public:
     typedef std::false_type propagate_on_container_copy_assignment;
     typedef std::true_type propagate_on_container_move_assignment;
     typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
 
     template<typename U>
     struct rebind {
-        typedef MemoryPoolLiteAllocator<T> other;
+        typedef MemoryPoolLiteAllocator<U, BlockSize> other;
     };
 
     /* member functions */
-    MemoryPoolLiteAllocator() noexcept;
-
-    MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator &) noexcept;
+    MemoryPoolLiteAllocator()
+            : group_(std::make_shared<memory_pool_lite_internal::SlotPoolGroup>(BlockSize)),
+              pool_(group_->Get(SlotSize, SlotAlign)) {}
 
-    MemoryPoolLiteAllocator(MemoryPoolLiteAllocator &&) noexcept;
+    MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator &) noexcept = default;
 
     template<class U>
-    MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator<U> &) noexcept;
+    MemoryPoolLiteAllocator(const MemoryPoolLiteAllocator<U, BlockSize> &other)
+            : group_(other.group_), pool_(group_->Get(SlotSize, SlotAlign)) {}
 
-    ~MemoryPoolLiteAllocator() noexcept;
-
-    MemoryPoolLiteAllocator &operator=(const MemoryPoolLiteAllocator &) = delete;
-
-    MemoryPoolLiteAllocator &operator=(MemoryPoolLiteAllocator &&) noexcept;
+    MemoryPoolLiteAllocator &operator=(const MemoryPoolLiteAllocator &) noexcept = default;
 
     inline pointer address(reference value) const noexcept { return &value; }
 
     inline const_pointer address(const_reference value) const noexcept { return &value; }
 
-    inline pointer allocate(size_type n = 1, const_pointer hint = 0);
+    inline pointer allocate(size_type n = 1, const_pointer hint = 0) {
+        if (LIKELY(n == 1)) {
+            return static_cast<pointer>(pool_->Allocate());
+        }
+        return memory_pool_lite_internal::AllocateArray<T>(n);
+    }
 
-    inline void deallocate(pointer p, size_type n = 1);
+    inline void deallocate(pointer p, size_type n = 1) {
+        if (LIKELY(n == 1)) {
+            if (p != nullptr) {
+                pool_->Deallocate(p);
+            }
+        } else {
+            memory_pool_lite_internal::DeallocateArray<T>(p);
+        }
+    }
 
     inline size_type max_size() const noexcept { return static_cast<size_type>(-1) / sizeof(T); }
 
     template<class U, class ... Args>
-    void construct(U *p, Args &&...args);
+    void construct(U *p, Args &&...args) { new(p) U(std::forward<Args>(args)...); }
 
     template<class U>
-    void destroy(U *p);
+    void destroy(U *p) { p->~U(); }
 
     template<class... Args>
-    pointer newElement(Args &&... args);
+    pointer newElement(Args &&... args) {
+        pointer result = allocate();
+        construct<value_type>(result, std::forward<Args>(args)...);
+        return result;
+    }
+
+    void deleteElement(pointer p) {
+        if (p != nullptr) {
+            p->~value_type();
+            deallocate(p);
+        }
+    }
+
+    template<class U>
+    bool operator==(const MemoryPoolLiteAllocator<U, BlockSize> &other) const noexcept {
+        return group_ == other.group_;
+    }
+
+    template<class U>
+    bool operator!=(const MemoryPoolLiteAllocator<U, BlockSize> &other) const noexcept {
+        return group_ != other.group_;
+    }
+
+private:
+    template<typename U, size_t>
+    friend class MemoryPoolLiteAllocator;
+
+    static constexpr size_t SlotAlign = std::max(alignof(T), alignof(void *));
+    static constexpr size_t SlotSize = (std::max(sizeof(T), sizeof(void *)) + SlotAlign - 1) & ~(SlotAlign - 1);
+
+    static_assert(BlockSize >= sizeof(void *) + SlotAlign + 2 * SlotSize, "BlockSize too small.");
+
+    std::shared_ptr<memory_pool_lite_internal::SlotPoolGroup> group_;
+    memory_pool_lite_internal::SlotPool *pool_;
+};
+
+namespace memory_pool_lite_internal {
+
+/**
+ * @brief free slots of one size for one thread
+ * @details blocks are aligned to BlockSize and start with their heap, so a slot finds
+ * its owner by masking its address. A slot freed by the owner goes to its free list, a
+ * slot freed by any other thread is pushed onto the lock free remote list, which the
+ * owner takes over whole once its free list ran dry.
+ *
+ * When the thread exits its heap is orphaned: m_balance, the remote frees counted down
+ * from 0, gets the objects the owner saw allocated and not freed added, and the free
+ * that brings it back to 0 deletes the heap and its blocks.
+ */
+template<size_t SlotSize, size_t SlotAlign, size_t BlockSize>
+class ThreadSlotHeap {
+public:
+    static void *Allocate() {
+        ThreadSlotHeap *heap = t_heap;
+        if (LIKELY(heap != nullptr)) {
+            return heap->allocate();
+        }
+        return AllocateWithoutHeap();
+    }
 
-    void deleteElement(pointer p);
+    static void Deallocate(void *vp) {
+        auto *block = reinterpret_cast<Block *>(reinterpret_cast<uintptr_t>(vp) & ~(BlockSize - 1));
+        ThreadSlotHeap *heap = block->heap;
+        if (LIKELY(heap == t_heap)) {
+            heap->freeLocal(vp);
+        } else {
+            heap->freeRemote(vp);
+        }
+    }
 
 private:
-    union Slot_ {
-        value_type element;
-        Slot_ *next;
+    struct Block {
+        ThreadSlotHeap *heap;
+        Block *next;
+    };
+
+    /// creates the heap of the thread and orphans it at exit
+    struct Owner {
+        Owner() { t_heap = new ThreadSlotHeap; }
+
+        ~Owner() {
+            t_owner_destroyed = true;
+            ThreadSlotHeap *heap = t_heap;
+            t_heap = nullptr;
+            heap->orphan();
+        }
+    };
+
+    static constexpr size_t kHeaderSize = (sizeof(Block) + SlotAlign - 1) & ~(SlotAlign - 1);
+    static constexpr size_t kSlotsPerBlock = (BlockSize - kHeaderSize) / SlotSize;
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "BlockSize must be a power of 2.");
+    static_assert(kHeaderSize < BlockSize && kSlotsPerBlock >= 2, "BlockSize too small.");
+
+    static void *&NextOf(void *vp) { return *static_cast<void **>(vp); }
+
+    static void *AllocateWithoutHeap() {
+        if (!t_owner_destroyed) {
+            static thread_local Owner t_owner;
+            return t_heap->allocate();
+        }
+        // a thread_local destructor running after ours: a heap for the object alone
+        auto *heap = new ThreadSlotHeap;
+        void *vp = heap->allocate();
+        heap->orphan();
+        return vp;
+    }
+
+    ~ThreadSlotHeap() {
+        while (m_blocks != nullptr) {
+            Block *next = m_blocks->next;
+            ::operator delete(m_blocks, std::align_val_t(BlockSize));
+            m_blocks = next;
+        }
+    }
+
+    void *allocate() {
+        ++m_live;
+        if (LIKELY(m_free != nullptr)) {
+            void *vp = m_free;
+            m_free = NextOf(vp);
+            return vp;
+        }
+        if (m_remote.load(std::memory_order_relaxed) != nullptr) {
+            void *vp = m_remote.exchange(nullptr, std::memory_order_acquire);
+            m_free = NextOf(vp);
+            return vp;
+        }
+        if (m_bump == m_bump_end) {
+            auto *block = static_cast<Block *>(::operator new(BlockSize, std::align_val_t(BlockSize)));
+            block->heap = this;
+            block->next = m_blocks;
+            m_blocks = block;
+            m_bump = reinterpret_cast<char *>(block) + kHeaderSize;
+            m_bump_end = m_bump + kSlotsPerBlock * SlotSize;
+        }
+        void *vp = m_bump;
+        m_bump += SlotSize;
+        return vp;
+    }
+
+    void freeLocal(void *vp) {
+        --m_live;
+        NextOf(vp) = m_free;
+        m_free = vp;
+    }
+
+    void freeRemote(void *vp) {
+        void *head = m_remote.load(std::memory_order_relaxed);
+        do {
+            NextOf(vp) = head;
+        } while (!m_remote.compare_exchange_weak(head, vp, std::memory_order_release, std::memory_order_relaxed));
+        // only an orphaned heap has a positive balance
+        if (m_balance.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    void orphan() {
+        if (m_balance.fetch_add(m_live, std::memory_order_acq_rel) + m_live == 0) {
+            delete this;
+        }
+    }
+
+    static inline thread_local ThreadSlotHeap *t_heap = nullptr;
+    static inline thread_local bool t_owner_destroyed = false;
+
+    void *m_free{nullptr};
+    char *m_bump{nullptr};
+    char *m_bump_end{nullptr};
+    Block *m_blocks{nullptr};
+    /// allocated by the owner less freed by the owner
+    int64_t m_live{0};
+    std::atomic<void *> m_remote{nullptr};
+    std::atomic<int64_t> m_balance{0};
+};
+
+}  // namespace memory_pool_lite_internal
+
+/**
+ * @brief thread safe STL allocator of single objects from free lists of the allocating thread
+ * @details stateless, all instances share the heaps of the threads and compare equal, so
+ * nodes can move between containers and threads. A node freed by another thread goes
+ * back to the thread that allocated it. Blocks of a thread are kept until it exited and
+ * all their objects were freed. allocate(n) for n != 1 goes to operator new.
+ */
+template<typename T, size_t BlockSize = 64 * 1024>
+class MemoryPoolLiteConcurrentAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type is_always_equal;
+
+    template<typename U>
+    struct rebind {
+        typedef MemoryPoolLiteConcurrentAllocator<U, BlockSize> other;
     };
 
-    typedef char *data_pointer_;
-    typedef Slot_ slot_type_;
-    typedef Slot_ *slot_pointer_;
+    MemoryPoolLiteConcurrentAllocator() noexcept = default;
 
-    slot_pointer_ currentBlock_;
-    slot_pointer_ currentSlot_;
-    slot_pointer_ lastSlot_;
-    slot_pointer_ freeSlots_;
+    template<class U>
+    MemoryPoolLiteConcurrentAllocator(const MemoryPoolLiteConcurrentAllocator<U, BlockSize> &) noexcept {}
 
-    size_type padPointer(data_pointer_ p, size_type align) const noexcept;
+    pointer allocate(size_type n) {
+        if (LIKELY(n == 1)) {
+            return static_cast<pointer>(Heap::Allocate());
+        }
+        return memory_pool_lite_internal::AllocateArray<T>(n);
+    }
 
-    void allocateBlock();
+    void deallocate(pointer p, size_type n) {
+        if (LIKELY(n == 1)) {
+            Heap::Deallocate(p);
+        } else {
+            memory_pool_lite_internal::DeallocateArray<T>(p);
+        }
+    }
+
+    template<class U>
+    bool operator==(const MemoryPoolLiteConcurrentAllocator<U, BlockSize> &) const noexcept { return true; }
+
+    template<class U>
+    bool operator!=(const MemoryPoolLiteConcurrentAllocator<U, BlockSize> &) const noexcept { return false; }
+
+private:
+    static constexpr size_t kSlotAlign = std::max(alignof(T), alignof(void *));
+    static constexpr size_t kSlotSize = (std::max(sizeof(T), sizeof(void *)) + kSlotAlign - 1) & ~(kSlotAlign - 1);
 
-    static_assert(BlockSize >= 2 * sizeof(slot_type_), "BlockSize too small.");
+    /// types of the same slot size share the heaps
+    using Heap = memory_pool_lite_internal::ThreadSlotHeap<kSlotSize, kSlotAlign, BlockSize>;
 };
 
 template<typename T>
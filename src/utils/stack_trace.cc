@@ -10,6 +10,11 @@ char (&ArraySizeHelper(const T (&array)[N]))[N];
 #define arraysize(array) (sizeof(ArraySizeHelper(array)))
 #define ARRAY_SIZE(array) arraysize(array)
 
+StackTrace::StackTrace() {
+    const int count = backtrace(trace_, arraysize(trace_));
+    count_ = count > 0 ? static_cast<size_t>(count) : 0;
+}
+
 StackTrace::StackTrace(const void *const *trace, size_t count) {
     count = std::min(count, arraysize(trace_));
     if (count)
@@ -29,7 +34,18 @@ const void *const *StackTrace::Addresses(size_t *count) const {
 
 std::string StackTrace::ToString() const {
     std::stringstream stream;
-    // OutputToStream(&stream);
+    if (count_ == 0) {
+        return stream.str();
+    }
+    char **symbols = backtrace_symbols(trace_, static_cast<int>(count_));
+    for (size_t i = 0; i < count_; ++i) {
+        if (symbols != nullptr) {
+            stream << symbols[i] << "\n";
+        } else {
+            stream << trace_[i] << "\n";
+        }
+    }
+    free(symbols);
     return stream.str();
 }
 
@@ -1,3 +1,6 @@
+#pragma once
+
+#include <cstdint>
 #include <iosfwd>
 #include <string>
 #include <unistd.h>